@@ -41,6 +41,18 @@ enum class ItemType
     LAST_ENTRY__  /*!< End of enumeration marker. */
 };
 
+/**
+\brief Indicates how an item has changed.
+*/
+
+enum class ChangeType
+{
+    created,      /*!< The item was created (or moved into its parent folder). */
+    changed,      /*!< The contents or metadata of the item changed. */
+    deleted,      /*!< The item was deleted (or moved out of its parent folder). */
+    LAST_ENTRY__  /*!< End of enumeration marker. */
+};
+
 /**
 \brief Determines the behavior in case of an ETag mismatch.
 */
@@ -75,8 +87,11 @@ static char constexpr FREE_SPACE_BYTES[] = "free_space_bytes";      // int64_t >
 static char constexpr USED_SPACE_BYTES[] = "used_space_bytes";      // int64_t >= 0
 static char constexpr CONTENT_TYPE[] = "content_type";              // string
 static char constexpr WRITABLE[] = "writable";                      // int64_t, 0 or 1
-static char constexpr MD5[] = "md5";                                // string
+static char constexpr MD5[] = "md5";                                // string, hex digest
+static char constexpr SHA256[] = "sha256";                          // string, hex digest
+static char constexpr CRC32C[] = "crc32c";                          // string, hex, 8 digits
 static char constexpr DOWNLOAD_URL[] = "download_url";              // string
+static char constexpr PATH[] = "path";                              // string, relative to walked folder
 
 // A single-element vector containing the key ALL indicates that the client would like all available
 // metadata to be returned by the provider.
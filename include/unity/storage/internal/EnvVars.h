@@ -35,6 +35,57 @@ constexpr int REGISTRY_IDLE_TIMEOUT_DFLT = 30;
 constexpr char PROVIDER_IDLE_TIMEOUT[] = "SF_PROVIDER_IDLE_TIMEOUT";
 constexpr int PROVIDER_IDLE_TIMEOUT_DFLT = 30;
 
+constexpr char PROVIDER_METADATA_THREADS[] = "SF_PROVIDER_METADATA_THREADS";  // 0 means "number of cores"
+constexpr int PROVIDER_METADATA_THREADS_DFLT = 0;
+
+constexpr char PROVIDER_BULK_THREADS[] = "SF_PROVIDER_BULK_THREADS";
+constexpr int PROVIDER_BULK_THREADS_DFLT = 2;
+
+constexpr char PROVIDER_MAX_QUEUE_DEPTH[] = "SF_PROVIDER_MAX_QUEUE_DEPTH";  // Per lane, 0 means "unlimited"
+constexpr int PROVIDER_MAX_QUEUE_DEPTH_DFLT = 10000;
+
+constexpr char PROVIDER_DISPATCH_THREADS[] = "SF_PROVIDER_DISPATCH_THREADS";  // 0 means "number of cores"
+constexpr int PROVIDER_DISPATCH_THREADS_DFLT = 0;
+
+constexpr char PROVIDER_PEER_CACHE_SIZE[] = "SF_PROVIDER_PEER_CACHE_SIZE";  // Peers, 0 disables the cache
+constexpr int PROVIDER_PEER_CACHE_SIZE_DFLT = 200;
+
+constexpr char PROVIDER_PEER_CACHE_TTL[] = "SF_PROVIDER_PEER_CACHE_TTL";  // Seconds, 0 means "no expiry"
+constexpr int PROVIDER_PEER_CACHE_TTL_DFLT = 300;
+
+constexpr char PROVIDER_UPLOAD_GRACE_PERIOD[] = "SF_PROVIDER_UPLOAD_GRACE_PERIOD";  // Seconds, 0 disables resuming
+constexpr int PROVIDER_UPLOAD_GRACE_PERIOD_DFLT = 600;
+
+constexpr char LOCAL_PROVIDER_PAGE_SIZE[] = "SF_LOCAL_PROVIDER_PAGE_SIZE";  // Items per page, 0 means "unlimited"
+constexpr int LOCAL_PROVIDER_PAGE_SIZE_DFLT = 500;
+
+constexpr char LOCAL_PROVIDER_LIST_THREADS[] = "SF_LOCAL_PROVIDER_LIST_THREADS";  // Per list() or walk() call
+constexpr int LOCAL_PROVIDER_LIST_THREADS_DFLT = 4;
+
+constexpr char LOCAL_PROVIDER_SNIFF_CONTENT[] = "SF_LOCAL_PROVIDER_SNIFF_CONTENT";  // 0 or 1
+constexpr int LOCAL_PROVIDER_SNIFF_CONTENT_DFLT = 0;
+
+constexpr char LOCAL_PROVIDER_ZERO_COPY[] = "SF_LOCAL_PROVIDER_ZERO_COPY";  // 0 or 1
+constexpr int LOCAL_PROVIDER_ZERO_COPY_DFLT = 1;
+
+constexpr char LOCAL_PROVIDER_COPY_THREADS[] = "SF_LOCAL_PROVIDER_COPY_THREADS";  // Per copy() of a folder
+constexpr int LOCAL_PROVIDER_COPY_THREADS_DFLT = 4;
+
+constexpr char LOCAL_PROVIDER_WATCH_CHANGES[] = "SF_LOCAL_PROVIDER_WATCH_CHANGES";  // 0 or 1
+constexpr int LOCAL_PROVIDER_WATCH_CHANGES_DFLT = 1;
+
+constexpr char LOCAL_PROVIDER_JOURNAL_SIZE[] = "SF_LOCAL_PROVIDER_JOURNAL_SIZE";  // MB, 0 disables the journal
+constexpr int LOCAL_PROVIDER_JOURNAL_SIZE_DFLT = 64;
+
+constexpr char LOCAL_PROVIDER_INDEX[] = "SF_LOCAL_PROVIDER_INDEX";  // 0 or 1
+constexpr int LOCAL_PROVIDER_INDEX_DFLT = 1;
+
+constexpr char LOCAL_PROVIDER_HASH_DOWNLOADS[] = "SF_LOCAL_PROVIDER_HASH_DOWNLOADS";  // 0 or 1
+constexpr int LOCAL_PROVIDER_HASH_DOWNLOADS_DFLT = 0;
+
+constexpr char LOCAL_PROVIDER_DURABILITY[] = "SF_LOCAL_PROVIDER_DURABILITY";  // none, data, or full
+constexpr char LOCAL_PROVIDER_DURABILITY_DFLT[] = "data";
+
 // Helper class to make retrieval of environment variables type-safe and
 // to sanity check the setting, if applicable. Also returns a default
 // setting, if applicable.
@@ -44,6 +95,23 @@ class EnvVars
 public:
     static int registry_timeout_ms();
     static int provider_timeout_ms();
+    static int provider_metadata_threads();
+    static int provider_bulk_threads();
+    static int provider_max_queue_depth();
+    static int provider_dispatch_threads();
+    static int provider_peer_cache_size();
+    static int provider_peer_cache_ttl_ms();
+    static int provider_upload_grace_period_ms();
+    static int local_provider_page_size();
+    static int local_provider_list_threads();
+    static bool local_provider_sniff_content();
+    static bool local_provider_zero_copy();
+    static int local_provider_copy_threads();
+    static bool local_provider_watch_changes();
+    static int local_provider_journal_size();
+    static bool local_provider_index();
+    static bool local_provider_hash_downloads();
+    static std::string local_provider_durability();
 
     // Returns value of var_name in the environment, if set, and an empty string otherwise.
     // Can be used for any environment variable, not just the ones defined above.
@@ -51,6 +119,7 @@ public:
 
 private:
     static int get_timeout_ms(char const* var_name, int dflt);
+    static int get_int(char const* var_name, int dflt);
 };
 
 }  // namespace internal
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/common.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wcast-align"
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#pragma GCC diagnostic ignored "-Wswitch-default"
+#include <QList>
+#include <QMetaType>
+#include <QString>
+#pragma GCC diagnostic pop
+
+namespace unity
+{
+namespace storage
+{
+namespace internal
+{
+
+struct ItemChange
+{
+    QString item_id;
+    QString parent_id;
+    ChangeType type;
+};
+
+}  // namespace internal
+}  // namespace storage
+}  // namespace unity
+
+Q_DECLARE_METATYPE(unity::storage::internal::ItemChange)
+Q_DECLARE_METATYPE(QList<unity::storage::internal::ItemChange>)
@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <unity/storage/internal/ItemChange.h>
 #include <unity/storage/internal/ItemMetadata.h>
 
 #include <QDBusArgument>
@@ -36,6 +37,12 @@ QDBusArgument const& operator>>(QDBusArgument const& argument, ItemMetadata& met
 QDBusArgument& operator<<(QDBusArgument& argument, QList<ItemMetadata> const& md_list);
 QDBusArgument const& operator>>(QDBusArgument const& argument, QList<ItemMetadata>& md_list);
 
+QDBusArgument& operator<<(QDBusArgument& argument, ItemChange const& change);
+QDBusArgument const& operator>>(QDBusArgument const& argument, ItemChange& change);
+
+QDBusArgument& operator<<(QDBusArgument& argument, QList<ItemChange> const& changes);
+QDBusArgument const& operator>>(QDBusArgument const& argument, QList<ItemChange>& changes);
+
 }  // namespace internal
 }  // storage
 }  // unity
@@ -44,7 +44,10 @@ static std::unordered_map<std::string, MetadataType> const known_metadata =
     { metadata::CONTENT_TYPE, MetadataType::string },
     { metadata::WRITABLE, MetadataType::boolean },
     { metadata::MD5, MetadataType::string },
-    { metadata::DOWNLOAD_URL, MetadataType::string }
+    { metadata::SHA256, MetadataType::string },
+    { metadata::CRC32C, MetadataType::string },
+    { metadata::DOWNLOAD_URL, MetadataType::string },
+    { metadata::PATH, MetadataType::string }
 };
 
 }  // namespace metadata
@@ -24,6 +24,7 @@
 #include <boost/variant.hpp>
 
 #include <map>
+#include <string>
 #include <vector>
 
 namespace unity
@@ -95,6 +96,34 @@ struct UNITY_STORAGE_EXPORT Item
 
 typedef std::vector<Item> ItemList;
 
+/**
+\brief Describes a change to a storage item.
+
+\see ProviderBase::notify_changes()
+*/
+
+struct UNITY_STORAGE_EXPORT ItemChange
+{
+    /**
+    \brief The identity of the item that changed.
+    */
+    std::string item_id;
+
+    /**
+    \brief The identity of the parent folder of the item.
+
+    Clients that display the contents of this folder should refresh the folder.
+    */
+    std::string parent_id;
+
+    /**
+    \brief The type of change.
+    */
+    unity::storage::ChangeType type;
+};
+
+typedef std::vector<ItemChange> ItemChangeList;
+
 }
 }
 }
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/visibility.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+
+/**
+\brief Determines which metadata a provider should return for an item.
+
+Provider methods that return items receive the metadata keys that were requested by the client.
+If metadata is expensive to compute, use this class to find out whether
+the client asked for it:
+
+\code{.cpp}
+MetadataKeys const keys(metadata_keys, {metadata::SIZE_IN_BYTES, metadata::LAST_MODIFIED_TIME});
+if (keys.contains(metadata::CONTENT_TYPE))
+{
+    // Compute the content type...
+}
+\endcode
+
+If the client did not request any keys, the provider's default keys apply. If the client
+requested metadata::ALL, contains() returns true for all keys.
+
+Note that the requested keys are hints only. In particular, the client API requires
+metadata::SIZE_IN_BYTES and metadata::LAST_MODIFIED_TIME for files, so a provider must return
+these even if the client did not request them.
+*/
+
+class UNITY_STORAGE_EXPORT MetadataKeys
+{
+public:
+    /**
+    \brief Constructs the set of keys to return.
+    \param keys The keys that were requested by the client.
+    \param default_keys The keys to return if <code>keys</code> is empty.
+    */
+    MetadataKeys(std::vector<std::string> const& keys, std::vector<std::string> const& default_keys);
+
+    /**
+    \brief Returns true if the metadata for <code>key</code> should be returned.
+    */
+    bool contains(std::string const& key) const;
+
+    /**
+    \brief Returns true if the client requested all available metadata.
+    */
+    bool all() const;
+
+private:
+    std::set<std::string> keys_;
+    bool all_;
+};
+
+}
+}
+}
@@ -30,6 +30,7 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <vector>
 
 namespace unity
@@ -42,8 +43,15 @@ namespace storage
 namespace provider
 {
 
+namespace internal
+{
+class ProviderBaseImpl;
+class ProviderInterface;
+}
+
 class DownloadJob;
 class UploadJob;
+class WorkerPool;
 
 /**
 \brief Security related information for an operation invocation.
@@ -226,6 +234,35 @@ public:
                                                                  std::string const& match_etag,
                                                                  Context const& context) = 0;
 
+    /**
+    \brief Download part of the contents of a file.
+
+    The DownloadJob writes the <code>length</code> bytes that start at <code>offset</code>, or fewer
+    if the file ends before that. If <code>length</code> is negative, the job writes everything from
+    <code>offset</code> to the end of the file.
+
+    The default implementation calls download() if the range covers the whole file and throws
+    LogicException otherwise. Providers that can download part of a file override this method.
+    \param item_id The identity of the file.
+    \param match_etag The ETag of the existing file (empty if the file should be downloaded unconditionally).
+    \param offset The offset of the first byte to download.
+    \param length The number of bytes to download, or -1 to download to the end of the file.
+    \param context The security context of the operation.
+    \return A DownloadJob that will write the requested range to the client socket.
+    \throws InvalidArgumentException <code>item_id</code> is invalid, <code>offset</code> is negative
+    or beyond the end of the file, or <code>length</code> is less than -1.
+    \throws NotExistsException <code>item_id</code> does not exist.
+    \throws LogicException The <code>item_id</code> denotes a folder, or the provider cannot download
+    part of a file.
+    \throws ConflictException The ETag for <code>item_id</code> does not match the given
+    (non-empty) <code>match_etag</code>.
+    */
+    virtual boost::future<std::unique_ptr<DownloadJob>> download_range(std::string const& item_id,
+                                                                       std::string const& match_etag,
+                                                                       int64_t offset,
+                                                                       int64_t length,
+                                                                       Context const& context);
+
     /**
     \brief Delete an item.
 
@@ -284,6 +321,123 @@ public:
                                      std::string const& new_name,
                                      std::vector<std::string> const& keys,
                                      Context const& context) = 0;
+
+    /**
+    \brief Return the changes to items since an earlier call.
+
+    Instead of re-listing all folders to find out what changed, a client can keep a cursor
+    and ask for the changes since the cursor was issued. A client starts by passing an empty cursor,
+    which returns no changes and a cursor for the current state. The client then lists
+    all items once and, from then on, calls changes() with the most recently returned cursor.
+
+    Each item appears at most once in the returned list of changes. If there are many changes,
+    the provider may return only some of them; the client calls the method again with the returned
+    cursor until the returned list of changes is empty.
+
+    The default implementation throws LogicException. Providers that can keep track of changes
+    override this method.
+    \param cursor The cursor that was returned by the previous call, or the empty string.
+    \param keys The keys of metadata items that the client wants to receive.
+    \param context The security context of the operation.
+    \return A tuple containing the list of changes, the items that were created or changed (if they
+    still exist), and the cursor to pass to the next call.
+    \throws InvalidArgumentException <code>cursor</code> is malformed or has expired. The client must
+    list all items again and start over with an empty cursor.
+    \throws LogicException The provider does not keep track of changes.
+    */
+    virtual boost::future<std::tuple<ItemChangeList, ItemList, std::string>> changes(
+        std::string const& cursor,
+        std::vector<std::string> const& keys,
+        Context const& context);
+
+    /**
+    \brief Find the items below a folder (at any depth) that match a query.
+
+    The query is a list of terms separated by white space. A term of the form <code>type:</code><i>prefix</i>
+    matches items whose content type starts with <i>prefix</i> (such as <code>type:image/</code>); any other
+    term matches items whose name contains the term, ignoring case. An item must match all terms; an empty
+    query matches all items. Results are paged in the same way as for list().
+
+    The default implementation throws LogicException. Providers that can search efficiently
+    override this method.
+    \param parent_id The identity of the folder to search.
+    \param query The search terms.
+    \param page_token A token identifying the next page of results (empty for the initial request).
+    \param keys The keys of metadata items that the client wants to receive.
+    \param context The security context of the operation.
+    \return A tuple containing a number of matching items, plus a new page token, which is empty
+    if there are no more results.
+    \throws InvalidArgumentException <code>parent_id</code> or <code>page_token</code> are invalid.
+    \throws NotExistsException <code>parent_id</code> does not exist.
+    \throws LogicException <code>parent_id</code> denotes a file, or the provider does not support searches.
+    */
+    virtual boost::future<std::tuple<ItemList, std::string>> search(std::string const& parent_id,
+                                                                    std::string const& query,
+                                                                    std::string const& page_token,
+                                                                    std::vector<std::string> const& keys,
+                                                                    Context const& context);
+
+    /**
+    \brief Return the items below a folder, down to a given depth.
+
+    This allows a client to enumerate a whole tree without calling list() for each folder.
+    The metadata of each returned item contains the key metadata::PATH, whose value is the path
+    of the item relative to <code>parent_id</code> (such as <code>Photos/beach.jpg</code>).
+    Items are returned in depth-first order: each folder is followed by its contents before
+    the items that follow it in the parent. Results are paged in the same way as for list().
+
+    The default implementation throws LogicException. Providers that can walk a tree efficiently
+    override this method.
+    \param parent_id The identity of the folder to walk.
+    \param max_depth The number of levels to descend. A value of 1 returns the contents of
+    <code>parent_id</code> only; a value of 0 returns the entire tree.
+    \param page_token A token identifying the next page of results (empty for the initial request).
+    \param keys The keys of metadata items that the client wants to receive.
+    \param context The security context of the operation.
+    \return A tuple containing a number of items, plus a new page token, which is empty
+    if there are no more results.
+    \throws InvalidArgumentException <code>parent_id</code>, <code>max_depth</code>,
+    or <code>page_token</code> are invalid.
+    \throws NotExistsException <code>parent_id</code> does not exist.
+    \throws LogicException <code>parent_id</code> denotes a file, or the provider does not support walks.
+    */
+    virtual boost::future<std::tuple<ItemList, std::string>> walk(std::string const& parent_id,
+                                                                  int32_t max_depth,
+                                                                  std::string const& page_token,
+                                                                  std::vector<std::string> const& keys,
+                                                                  Context const& context);
+
+    /**
+    \brief Returns the worker pool of the runtime.
+
+    Provider methods must not block. Use the pool to run operations that make blocking calls,
+    instead of creating a thread for each operation. The pool is shared by all providers in the process.
+    \return The worker pool.
+    \see WorkerPool
+    */
+    static WorkerPool& worker_pool();
+
+protected:
+    /**
+    \brief Notifies clients that items have changed.
+
+    Providers that can detect changes to the storage backend (whether made through the
+    provider or by some other means) call this method, so clients do not have to poll for
+    changes. The runtime tells clients that items changed with the <code>ItemsChanged</code>
+    signal. The signal does not contain the changes because any process on the bus can
+    receive it; clients retrieve the changes by calling changes(), so a provider that calls
+    notify_changes() must also implement changes().
+
+    The method does not block and can be called from any thread. To keep the number of
+    signals low, providers should batch changes that occur in quick succession.
+    \param changes The list of changes.
+    */
+    void notify_changes(ItemChangeList const& changes);
+
+private:
+    std::unique_ptr<internal::ProviderBaseImpl> const p_;
+
+    friend class internal::ProviderInterface;
 };
 
 }
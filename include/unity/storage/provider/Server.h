@@ -37,6 +37,16 @@ class ServerImpl;
 
 class ProviderBase;
 
+/**
+\brief Determines which threads handle the requests that clients send to a provider.
+*/
+
+enum class DispatchMode
+{
+    main_thread,  /*!< All requests are handled by the main thread (the default). */
+    thread_pool,  /*!< Requests are handled by a pool of threads, each with its own event loop. */
+};
+
 /**
 \brief Base class to register a storage provider with the runtime.
 
@@ -115,6 +125,32 @@ public:
     <a href="https://help.ubuntu.com/stable/ubuntu-help/accounts.html">Online Accounts</a>.
     */
     ServerBase(std::string const& bus_name, std::string const& account_service_id);
+
+    /**
+    \brief Constructs a server instance that handles requests as determined by <code>mode</code>.
+
+    With DispatchMode::main_thread, the runtime calls all provider methods from the main thread,
+    and it marshals all replies in the main thread. A slow provider method, or a large reply, therefore
+    delays every other request.
+
+    With DispatchMode::thread_pool, the runtime calls the provider methods that deal with metadata
+    from a pool of threads, and marshals their replies in the same thread. The provider <i>must</i>
+    be thread-safe in this mode.
+    Methods that only read (such as ProviderBase::list() and ProviderBase::metadata()) are spread
+    over all threads. Methods that change items (such as ProviderBase::create_folder() and
+    ProviderBase::move()) are called from a single thread per account, in the order in which the
+    requests arrive. This orders the calls only: if the provider completes operations asynchronously,
+    they can complete (and the clients receive their replies) in a different order. A provider that must
+    apply changes in order has to sequence them itself.
+    Methods that deal with uploads and downloads are still called from the main thread.
+    The size of the pool is set by the environment variable <code>SF_PROVIDER_DISPATCH_THREADS</code>
+    (0, the default, means one thread per CPU core).
+    \param bus_name The DBus name of the provider service on the session bus.
+    \param account_service_id The service ID with which the provider is known to
+    <a href="https://help.ubuntu.com/stable/ubuntu-help/accounts.html">Online Accounts</a>.
+    \param mode Determines which threads handle requests.
+    */
+    ServerBase(std::string const& bus_name, std::string const& account_service_id, DispatchMode mode);
     virtual ~ServerBase();
 
     /**
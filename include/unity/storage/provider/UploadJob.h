@@ -106,7 +106,8 @@ public:
     /**
     \brief Cancel this upload.
 
-    The runtime calls this method when a client explicitly cancels an upload or crashes.
+    The runtime calls this method when a client explicitly cancels an upload, or when a client crashes
+    and the upload cannot be suspended or is not resumed within the grace period (see suspend()).
     Your implementation should reclaim all resources that are used by the upload. In particular,
     you should stop reading any more data and close the upload socket. In addition,
     you should reclaim any resources (such as open connections) that are associated
@@ -152,6 +153,41 @@ public:
     */
     virtual boost::future<Item> finish() = 0;
 
+    /**
+    \brief Suspend this upload so the client can resume it later.
+
+    The runtime calls this method instead of cancel() when the client disconnects from the bus while
+    the upload is in progress. Your implementation should drain the upload socket, store the data received
+    so far, and stop reading. If the client resumes the upload within the grace period, the runtime calls
+    resume(); otherwise, it calls cancel(). The grace period is set by the environment variable
+    <code>SF_PROVIDER_UPLOAD_GRACE_PERIOD</code> (in seconds, 600 by default); a value of 0 disables
+    resuming uploads.
+
+    The default implementation returns a future that stores a LogicException, which causes the runtime
+    to cancel the upload immediately.
+
+    \return A future that becomes ready and contains the number of bytes that were received and stored
+    (or contains a StorageException) once the upload is suspended.
+    \see resume()
+    */
+    virtual boost::future<int64_t> suspend();
+
+    /**
+    \brief Resume a suspended upload.
+
+    The runtime calls this method when a client resumes an upload that was suspended by suspend().
+    By the time it does, read_socket() returns a new socket that is connected to the client. Your
+    implementation must read the remainder of the file contents from that socket, that is, the bytes
+    that follow the offset that was returned by suspend().
+
+    The default implementation returns a future that stores a LogicException.
+
+    \return A future that becomes ready (or contains a StorageException) once the upload is ready
+    to receive more data.
+    \see suspend()
+    */
+    virtual boost::future<void> resume();
+
 private:
     UploadJob(internal::UploadJobImpl *p) UNITY_STORAGE_HIDDEN;
     internal::UploadJobImpl *p_ = nullptr;
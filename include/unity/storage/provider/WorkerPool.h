@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/visibility.h>
+
+#include <boost/thread/future.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+
+namespace internal
+{
+class WorkerPoolImpl;
+}
+
+/**
+\brief Bounded pool of worker threads for blocking provider operations.
+
+Provider methods are called from the main thread and must not block. If an operation
+has to make blocking calls (such as file system calls, or synchronous calls to a cloud
+service), you can use submit() to run it on one of the pool's threads instead of creating
+a new thread for each request.
+
+The pool has two lanes with separate threads and queues. Use the
+\link unity::storage::provider::WorkerPool::Lane::metadata metadata\endlink lane for cheap operations
+(such as retrieving metadata or listing a folder), and the
+\link unity::storage::provider::WorkerPool::Lane::bulk bulk\endlink lane for operations that can take a long time
+(such as copying or deleting large trees). This ensures that a few expensive operations cannot
+delay a large number of cheap ones. Within a lane, idle threads steal queued work from busy ones.
+
+The runtime creates a single pool per process; use ProviderBase::worker_pool() to access it.
+The size of the pool can be configured with the following environment variables:
+
+- <code>SF_PROVIDER_METADATA_THREADS</code>: number of threads for the metadata lane
+  (default: number of cores).
+- <code>SF_PROVIDER_BULK_THREADS</code>: number of threads for the bulk lane (default: 2).
+- <code>SF_PROVIDER_MAX_QUEUE_DEPTH</code>: maximum number of queued operations per lane
+  (default: 10000, 0 means unlimited).
+*/
+
+class UNITY_STORAGE_EXPORT WorkerPool
+{
+public:
+    /**
+    \brief Selects the set of threads that runs an operation.
+    */
+    enum class Lane
+    {
+        metadata,  /*!< Cheap operations that complete quickly. */
+        bulk       /*!< Expensive operations, such as copying or deleting data. */
+    };
+
+    /**
+    \brief Configuration of a pool.
+    */
+    struct Options
+    {
+        int metadata_threads;  /*!< Number of threads in the metadata lane. */
+        int bulk_threads;      /*!< Number of threads in the bulk lane. */
+        int max_queue_depth;   /*!< Maximum number of queued operations per lane (0 means unlimited). */
+    };
+
+    /**
+    \brief Counters for a lane.
+    */
+    struct LaneStats
+    {
+        int64_t queued = 0;            /*!< Number of operations that are currently queued. */
+        int64_t max_queued = 0;        /*!< Largest number of operations that were queued at the same time. */
+        int64_t executed = 0;          /*!< Number of operations that were run. */
+        int64_t stolen = 0;            /*!< Number of operations that were stolen by an idle thread. */
+        int64_t rejected = 0;          /*!< Number of operations that were rejected because the queue was full. */
+        int64_t total_wait_nsecs = 0;  /*!< Sum of the time that operations spent waiting in the queue. */
+        int64_t max_wait_nsecs = 0;    /*!< Longest time that an operation spent waiting in the queue. */
+    };
+
+    /**
+    \brief Constructs a pool and starts its threads.
+    \param options The pool configuration.
+    */
+    explicit WorkerPool(Options const& options);
+
+    /**
+    \brief Destroys the pool.
+
+    Operations that are still queued are abandoned (their futures contain a
+    <code>broken_promise</code> exception). The destructor waits for operations that are running to complete.
+    */
+    ~WorkerPool();
+
+    WorkerPool(WorkerPool const&) = delete;
+    WorkerPool& operator=(WorkerPool const&) = delete;
+
+    /**
+    \brief Runs a functor on one of the pool's threads.
+    \param lane The lane on which to run the functor.
+    \param f The functor to run. Exceptions thrown by the functor are stored in the returned future.
+    \return A future that becomes ready once the functor has completed and that contains its result.
+    \throws ResourceException The queue for <code>lane</code> is full.
+    */
+    template<typename F>
+    auto submit(Lane lane, F&& f) -> boost::future<decltype(f())>
+    {
+        using R = decltype(f());
+        auto task = std::make_shared<boost::packaged_task<R()>>(std::forward<F>(f));
+        auto future = task->get_future();
+        post(lane, [task]{ (*task)(); });
+        return future;
+    }
+
+    /**
+    \brief Returns the counters for a lane.
+    */
+    LaneStats stats(Lane lane) const;
+
+    /**
+    \brief Returns the configuration of the pool.
+    */
+    Options const& options() const;
+
+    /**
+    \brief Returns the configuration that is set by the environment.
+    */
+    static Options default_options();
+
+private:
+    void post(Lane lane, std::function<void()> closure);
+
+    std::unique_ptr<internal::WorkerPoolImpl> p_;
+};
+
+}
+}
+}
@@ -29,13 +29,17 @@
 #pragma GCC diagnostic pop
 #include <QString>
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <list>
 #include <map>
 #include <memory>
 #include <string>
 #include <sys/types.h>
 
 class BusInterface;
+class QDBusServiceWatcher;
 
 namespace unity
 {
@@ -46,6 +50,13 @@ namespace provider
 namespace internal
 {
 
+// Caches the credentials of D-Bus peers. The cache holds up to capacity peers, evicting
+// the least recently used one when it is full. Entries expire after ttl (unless ttl is zero),
+// and are dropped as soon as the bus reports that the peer has disconnected. The cache
+// watches only the peers it holds or is asking about, so the bus daemon does not send
+// us a signal for every other connection on the bus.
+// The cache must be used from the main thread only.
+
 class DBusPeerCache final {
 public:
     struct Credentials
@@ -57,7 +68,20 @@ public:
         std::string label;
     };
 
+    struct Stats
+    {
+        int64_t hits = 0;         // Lookups that were answered from the cache.
+        int64_t misses = 0;       // Lookups and prefetches that sent a request to the bus daemon.
+        int64_t joined = 0;       // Lookups that waited for a request that was already in flight.
+        int64_t in_flight = 0;    // Requests to the bus daemon that are outstanding.
+        int64_t expired = 0;      // Entries that were dropped because they were older than the TTL.
+        int64_t evicted = 0;      // Entries that were dropped to make room for another peer.
+        int64_t invalidated = 0;  // Entries that were dropped because the peer disconnected.
+    };
+
+    // Uses SF_PROVIDER_PEER_CACHE_SIZE and SF_PROVIDER_PEER_CACHE_TTL.
     DBusPeerCache(QDBusConnection const& bus);
+    DBusPeerCache(QDBusConnection const& bus, int capacity, std::chrono::milliseconds ttl);
     ~DBusPeerCache();
 
     DBusPeerCache(DBusPeerCache const&) = delete;
@@ -66,17 +90,39 @@ public:
     // Retrieve the security credentials for the given D-Bus peer.
     boost::future<Credentials> get(QString const& peer);
 
+    // Start retrieving the credentials for the given D-Bus peer, unless
+    // they are cached or are being retrieved already.
+    void prefetch(QString const& peer);
+
+    Stats stats() const;
+    int size() const;
+
 private:
+    struct Entry
+    {
+        QString peer;
+        Credentials credentials;
+        std::chrono::steady_clock::time_point expiry;
+    };
     struct Request;
 
     std::unique_ptr<BusInterface> bus_daemon_;
+    std::unique_ptr<QDBusServiceWatcher> watcher_;
     bool apparmor_enabled_;
+    int const capacity_;
+    std::chrono::milliseconds const ttl_;
 
-    std::map<QString,Credentials> cache_;
-    std::map<QString,Credentials> old_cache_;
+    std::list<Entry> lru_;  // Most recently used first.
+    std::map<QString,std::list<Entry>::iterator> cache_;
     std::map<QString,std::unique_ptr<Request>> pending_;
+    Stats stats_;
 
+    Credentials const* lookup(QString const& peer);
+    Request& start_request(QString const& peer);
+    void insert(QString const& peer, Credentials const& credentials);
+    void erase(QString const& peer);
     void received_credentials(QString const& peer, QDBusPendingReply<QVariantMap> const& reply);
+    void peer_disconnected(QString const& peer);
 };
 
 }  // namespace internal
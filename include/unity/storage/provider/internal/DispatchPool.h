@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class QThread;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+class MainLoopExecutor;
+
+// Threads that handle requests in the DispatchMode::thread_pool mode. Each thread runs
+// its own event loop with its own MainLoopExecutor, so a closure that is submitted to
+// the executor, and any EXEC_IN_DISPATCH continuation that it creates, run on that thread.
+
+class DispatchPool final
+{
+public:
+    DispatchPool(int num_threads);
+    ~DispatchPool();
+
+    DispatchPool(DispatchPool const&) = delete;
+    DispatchPool& operator=(DispatchPool const&) = delete;
+
+    int size() const;
+
+    // Returns the executor of the next thread, in round-robin order. Closures that are
+    // submitted to the same executor run in the order in which they were submitted.
+    MainLoopExecutor& next_executor();
+
+private:
+    class Thread;
+
+    std::vector<std::unique_ptr<MainLoopExecutor>> executors_;
+    std::vector<std::unique_ptr<Thread>> threads_;
+    std::atomic<unsigned> next_;
+};
+
+}  // namespace internal
+}  // namespace provider
+}  // namespace storage
+}  // namespace unity
@@ -28,6 +28,7 @@
 #include <QDBusConnection>
 #include <QDBusMessage>
 
+#include <chrono>
 #include <functional>
 #include <memory>
 
@@ -41,6 +42,7 @@ namespace internal
 {
 
 class AccountData;
+class MainLoopExecutor;
 class PendingJobs;
 
 class Handler : public QObject
@@ -49,28 +51,40 @@ class Handler : public QObject
 public:
     typedef std::function<boost::future<QDBusMessage>(std::shared_ptr<AccountData> const&, Context const&, QDBusMessage const&)> Callback;
 
+    // If dispatcher is non-null, the callback and its reply continuation run on the dispatcher's
+    // thread, and the reply is sent from there. Otherwise, everything runs on the main thread.
     Handler(std::shared_ptr<AccountData> const& account,
             Callback const& callback,
-            QDBusConnection const& bus, QDBusMessage const& message);
+            QDBusConnection const& bus, QDBusMessage const& message,
+            MainLoopExecutor* dispatcher = nullptr);
 
+    // If the account and peer credentials are cached and the provider returns a ready
+    // future, the reply is sent (and finished() is emitted) before begin() returns.
     void begin();
 
 private Q_SLOTS:
     void on_authenticated();
-    void credentials_received();
     void handle_unauthorized(std::exception_ptr ep);
     void send_reply();
+    void done();
 
 Q_SIGNALS:
     void finished();
 
 private:
+    void peer_credentials_received(DBusPeerCache::Credentials info);
+    void credentials_received();
+    void call_provider();
+    void provider_done(boost::future<QDBusMessage> f);
+    void reply_ready();
+    void record_stats();
     void marshal_exception(std::exception_ptr ep);
 
     std::shared_ptr<AccountData> const account_;
     Callback const callback_;
     QDBusConnection const bus_;
     QDBusMessage const message_;
+    MainLoopExecutor* const dispatcher_;
     unity::storage::internal::ActivityNotifier activity_;
 
     boost::future<void> creds_future_;
@@ -79,6 +93,17 @@ private:
     QDBusMessage reply_;
     bool retry_ = false;
 
+    // Per-stage timestamps for RequestStats. fast_path_ is cleared as soon as the request
+    // has to wait for the event loop.
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    TimePoint start_time_;
+    TimePoint authenticated_time_;
+    TimePoint credentials_time_;
+    TimePoint called_time_;
+    TimePoint ready_time_;
+    TimePoint sent_time_;
+    bool fast_path_ = true;
+
     Q_DISABLE_COPY(Handler)
 };
 
@@ -22,6 +22,9 @@
 #include <boost/thread/executor.hpp>
 #include <QObject>
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 
 namespace unity
@@ -41,14 +44,33 @@ namespace internal
  * On Boost >= 1.56, this will use a custom executor to run the
  * continuation as an event in the main thread.  On older versions,
  * the continuation will be executed in a new thread.
+ *
+ * Continuations that only build a reply can instead use
+ *
+ *   auto f2 = f.then(EXEC_IN_DISPATCH [](decltype(f) f) { ... });
+ *
+ * to run in the event loop of the thread that creates the continuation.
+ * That is the main thread, unless the request is handled by a thread of
+ * the DispatchPool.
  */
 
 #define EXEC_IN_MAIN MainLoopExecutor::instance(),
+#define EXEC_IN_DISPATCH MainLoopExecutor::current(),
+
+class DispatchPool;
+
+// Closures are pushed onto a lock-free multi-producer/single-consumer queue.
+// Only the first submit() after the queue was drained posts an event to wake
+// up the event loop, which then runs up to MAX_BATCH closures before yielding
+// to other events.
 
 class MainLoopExecutor : public QObject, public boost::executors::executor {
     Q_OBJECT
 public:
+    ~MainLoopExecutor();
+
     static MainLoopExecutor& instance();
+    static MainLoopExecutor& current();
 
     void submit(work&& closure) override;
     void close() override;
@@ -57,10 +79,49 @@ public:
 
     bool event(QEvent *event) override;
 
+    struct Stats
+    {
+        int64_t wakeups = 0;             // Number of wake-up events that were delivered.
+        int64_t executed = 0;            // Number of closures that were run.
+        int64_t max_batch = 0;           // Largest number of closures run by a single wake-up.
+        int64_t total_latency_nsecs = 0; // Sum of the time between submit() and running each closure.
+        int64_t max_latency_nsecs = 0;   // Longest time between submit() and running a closure.
+    };
+    Stats stats() const;
+
+    static constexpr int MAX_BATCH = 256;
+
 private:
+    struct Node
+    {
+        std::atomic<Node*> next{nullptr};
+        work closure;
+        std::chrono::steady_clock::time_point enqueue_time;
+    };
+
     MainLoopExecutor();
+    void make_current();
+    void push(Node* node) noexcept;
+    Node* pop() noexcept;
+    void post_wakeup();
+    void drain();
     void execute(work& closure) noexcept;
 
+    // Producers exchange head_; only the thread of the event loop touches tail_.
+    // stub_ keeps the queue non-empty, so neither end is ever null.
+    Node stub_;
+    std::atomic<Node*> head_;
+    Node* tail_;
+    std::atomic<bool> wakeup_pending_{false};
+
+    std::atomic<int64_t> wakeups_{0};
+    std::atomic<int64_t> executed_{0};
+    std::atomic<int64_t> max_batch_{0};
+    std::atomic<int64_t> total_latency_nsecs_{0};
+    std::atomic<int64_t> max_latency_nsecs_{0};
+
+    friend class DispatchPool;
+
     Q_DISABLE_COPY(MainLoopExecutor)
 };
 
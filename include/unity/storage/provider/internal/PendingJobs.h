@@ -28,6 +28,8 @@
 #include <QString>
 #pragma GCC diagnostic pop
 
+#include <unity/storage/provider/ProviderBase.h>
+
 #include <map>
 #include <memory>
 #include <mutex>
@@ -59,9 +61,17 @@ public:
     void add_download(QString const& client_bus_name, std::unique_ptr<DownloadJob> &&job);
     std::shared_ptr<DownloadJob> remove_download(QString const& client_bus_name, std::string const& download_id);
 
-    void add_upload(QString const& client_bus_name, std::unique_ptr<UploadJob> &&job);
+    void add_upload(QString const& client_bus_name, std::shared_ptr<UploadJob> const& job);
     std::shared_ptr<UploadJob> remove_upload(QString const& client_bus_name, std::string const& upload_id);
 
+    // Uploads whose client disconnected are suspended for a grace period,
+    // during which a client with the same credentials can resume them.
+    int64_t suspended_upload_offset(Context const& ctx, std::string const& upload_id);
+    std::shared_ptr<UploadJob> remove_suspended_upload(Context const& ctx,
+                                                       std::string const& upload_id,
+                                                       int64_t& offset);
+    void abandon_upload(std::shared_ptr<UploadJob> const& job);
+
 private Q_SLOTS:
     void service_disconnected(QString const& service_name);
 
@@ -72,11 +82,27 @@ private:
     template <typename Job>
     void cancel_job(std::shared_ptr<Job> const& job,
                     std::string const& identifier);
+    void suspend_upload(std::shared_ptr<UploadJob> const& job);
+    void expire_upload(std::string const& upload_id, int64_t serial);
+    void keep_until_ready(std::shared_ptr<void> const& job,
+                          boost::future<void> f,
+                          std::string const& action);
+
+    struct SuspendedUpload
+    {
+        std::shared_ptr<UploadJob> job;
+        int64_t offset;
+        int64_t serial;  // Distinguishes successive suspensions of the same upload.
+    };
 
     std::mutex lock_;
     // Key is client_bus_name and upload or download ID.
     std::map<std::pair<QString,std::string>,std::shared_ptr<UploadJob>> uploads_;
     std::map<std::pair<QString,std::string>,std::shared_ptr<DownloadJob>> downloads_;
+    // Key is upload ID.
+    std::map<std::string,SuspendedUpload> suspended_uploads_;
+    int64_t next_serial_ = 0;
+    int const grace_period_ms_;
 
     QDBusServiceWatcher watcher_;
     std::map<QString,int> services_;
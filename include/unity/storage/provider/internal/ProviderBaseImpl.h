@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/Item.h>
+
+#include <functional>
+#include <mutex>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+class ProviderBaseImpl
+{
+public:
+    typedef std::function<void(ItemChangeList const&)> ChangeListener;
+
+    ProviderBaseImpl() = default;
+    ~ProviderBaseImpl() = default;
+
+    ProviderBaseImpl(ProviderBaseImpl const&) = delete;
+    ProviderBaseImpl& operator=(ProviderBaseImpl const&) = delete;
+
+    // The listener is called on the thread that calls notify_changes(). Once
+    // set_change_listener() returns, the previous listener is no longer called.
+    void set_change_listener(ChangeListener const& listener);
+    void notify_changes(ItemChangeList const& changes);
+
+private:
+    std::mutex mutex_;
+    ChangeListener listener_;
+};
+
+}
+}
+}
+}
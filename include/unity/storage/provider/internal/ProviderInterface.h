@@ -18,8 +18,11 @@
 
 #pragma once
 
+#include <unity/storage/internal/ItemChange.h>
 #include <unity/storage/internal/ItemMetadata.h>
+#include <unity/storage/provider/Item.h>
 #include <unity/storage/provider/internal/Handler.h>
+#include <unity/storage/provider/internal/RequestCoalescer.h>
 
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wcast-align"
@@ -34,6 +37,9 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
 
 namespace unity
 {
@@ -41,17 +47,25 @@ namespace storage
 {
 namespace provider
 {
+
+class DownloadJob;
+
 namespace internal
 {
 
 class AccountData;
+class DispatchPool;
+class MainLoopExecutor;
 
 class ProviderInterface : public QObject, protected QDBusContext
 {
     Q_OBJECT
 
 public:
+    // If dispatch_pool is non-null, requests other than uploads and downloads are
+    // handled by the threads of the pool. The pool must outlive the interface.
     ProviderInterface(std::shared_ptr<AccountData> const& account_data,
+                      DispatchPool* dispatch_pool = nullptr,
                       QObject *parent=nullptr);
     ~ProviderInterface();
 
@@ -78,7 +92,14 @@ public Q_SLOTS:
                    QDBusUnixFileDescriptor& file_descriptor);
     IMD FinishUpload(QString const& upload_id);
     void CancelUpload(QString const& upload_id);
+    qlonglong UploadOffset(QString const& upload_id);
+    qlonglong ResumeUpload(QString const& upload_id, QDBusUnixFileDescriptor& file_descriptor);
     QString Download(QString const& item_id, QString const& match_etag, QDBusUnixFileDescriptor& file_descriptor);
+    QString DownloadRange(QString const& item_id,
+                          QString const& match_etag,
+                          int64_t offset,
+                          int64_t length,
+                          QDBusUnixFileDescriptor& file_descriptor);
     void FinishDownload(QString const& download_id);
     void Delete(QString const& item_id);
     IMD Move(QString const& item_id,
@@ -89,16 +110,61 @@ public Q_SLOTS:
              QString const& new_parent_id,
              QString const& new_name,
              QList<QString> const& metadata_keys);
+    QList<unity::storage::internal::ItemChange> Changes(QString const& cursor,
+                                                        QList<QString> const& keys,
+                                                        QList<IMD>& items,
+                                                        QString& next_cursor);
+    QList<IMD> Search(QString const& parent_id,
+                      QString const& query,
+                      QString const& page_token,
+                      QList<QString> const& keys,
+                      QString& next_token);
+    QList<IMD> Walk(QString const& parent_id,
+                    int max_depth,
+                    QString const& page_token,
+                    QList<QString> const& keys,
+                    QString& next_token);
+
+Q_SIGNALS:
+    void ItemsChanged();
 
 private Q_SLOTS:
     void request_finished();
+    void flush_changes();
 
 private:
-    void queue_request(Handler::Callback callback);
+    // Determines which thread handles a request if there is a dispatch pool.
+    enum class Affinity
+    {
+        main_thread,     // Uploads and downloads, which use PendingJobs and the inactivity timer.
+        account_thread,  // Mutating requests, which are dispatched in order per account.
+        any_thread       // Read-only requests.
+    };
+
+    void queue_request(Handler::Callback callback, Affinity affinity = Affinity::main_thread);
+    void queue_changes();
+    static QDBusMessage start_download(std::shared_ptr<AccountData> const& account,
+                                       QDBusMessage const& message,
+                                       std::unique_ptr<DownloadJob> job);
 
     std::shared_ptr<AccountData> const account_;
+    DispatchPool* const dispatch_pool_;
+    MainLoopExecutor* const account_executor_;
     std::map<Handler*, std::unique_ptr<Handler>> requests_;
 
+    // Identical read-only requests for this account that are in flight at the same time
+    // share a single provider call.
+    RequestCoalescer<ItemList> roots_calls_;
+    RequestCoalescer<std::tuple<ItemList, std::string>> list_calls_;
+    RequestCoalescer<ItemList> lookup_calls_;
+    RequestCoalescer<Item> metadata_calls_;
+
+    // Set when the provider reports changes, which it can do from any thread. The changes
+    // themselves are not sent with the signal, because signals are broadcast to anyone on
+    // the bus; clients fetch them with Changes(), which checks the caller's credentials.
+    std::mutex changes_mutex_;
+    bool changes_pending_ = false;
+
     Q_DISABLE_COPY(ProviderInterface)
 };
 
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <boost/thread/future.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+// Lets identical read-only requests that are in flight at the same time share a single provider call.
+// Each request passes a key that identifies its method and arguments. If a call for the same key has
+// not completed yet, the request waits for the result of that call instead of calling the provider again.
+//
+// Copies share the same set of in-flight calls, so request callbacks can capture the coalescer by value.
+// All methods are thread-safe. Calls are forgotten as soon as they complete, so nothing is cached.
+
+template<typename T>
+class RequestCoalescer final
+{
+public:
+    RequestCoalescer();
+
+    // Returns a future for the result of start(), which is called only if no call for key is in flight.
+    // Sets coalesced to true if the request joined a call that was in flight already.
+    // If start() returns a ready future, the returned future is ready as well.
+    template<typename F>
+    boost::future<T> call(std::string const& key, F&& start, bool& coalesced) const;
+
+    // Number of distinct calls that are in flight.
+    int in_flight() const;
+
+private:
+    struct State
+    {
+        std::mutex mutex;
+        std::map<std::string, boost::shared_future<T>> calls;
+    };
+
+    std::shared_ptr<State> state_;
+};
+
+template<typename T>
+RequestCoalescer<T>::RequestCoalescer()
+    : state_(std::make_shared<State>())
+{
+}
+
+template<typename T>
+template<typename F>
+boost::future<T> RequestCoalescer<T>::call(std::string const& key, F&& start, bool& coalesced) const
+{
+    auto promise = std::make_shared<boost::promise<T>>();
+    boost::shared_future<T> result;
+    {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        auto it = state_->calls.find(key);
+        coalesced = it != state_->calls.end();
+        if (coalesced)
+        {
+            result = it->second;
+        }
+        else
+        {
+            result = promise->get_future().share();
+            state_->calls.emplace(key, result);
+        }
+    }
+
+    if (!coalesced)
+    {
+        boost::future<T> f;
+        try
+        {
+            f = start();
+        }
+        catch (...)
+        {
+            f = boost::make_exceptional_future<T>(boost::current_exception());
+        }
+
+        // The call is removed before its result is published, so a request that
+        // arrives after that starts a new call instead of getting a stale result.
+        auto state = state_;
+        auto done = [state, key, promise](boost::future<T> f)
+        {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->calls.erase(key);
+            }
+            try
+            {
+                promise->set_value(f.get());
+            }
+            catch (...)
+            {
+                promise->set_exception(boost::current_exception());
+            }
+        };
+        if (f.is_ready())
+        {
+            done(std::move(f));
+        }
+        else
+        {
+            // Runs in the thread that makes f ready.
+            f.then(boost::launch::sync, std::move(done));
+        }
+    }
+
+    // Each request gets its own copy of the result.
+    return result.then(boost::launch::sync, [](boost::shared_future<T> f) { return f.get(); });
+}
+
+template<typename T>
+int RequestCoalescer<T>::in_flight() const
+{
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    return int(state_->calls.size());
+}
+
+}  // namespace internal
+}  // namespace provider
+}  // namespace storage
+}  // namespace unity
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+// Per-method counters for the requests that are handled by the runtime.
+// Handlers record their timings once they have sent their reply.
+
+class RequestStats final
+{
+public:
+    // Time spent in each stage of a request, in nanoseconds.
+    struct Timings
+    {
+        int64_t authenticate_nsecs = 0;  // Until the account credentials are available.
+        int64_t peer_nsecs = 0;          // Until the D-Bus peer credentials are available.
+        int64_t dispatch_nsecs = 0;      // Until the provider method is called.
+        int64_t provider_nsecs = 0;      // Until the future returned by the provider is ready.
+        int64_t reply_nsecs = 0;         // Until the reply is sent.
+    };
+
+    struct Totals
+    {
+        int64_t requests = 0;
+        int64_t fast_path = 0;  // Requests that were handled without a trip through the event loop.
+        int64_t coalesced = 0;  // Requests that shared the provider call of an identical request.
+        Timings timings;        // Sum over all requests.
+    };
+
+    static RequestStats& instance();
+
+    void record(std::string const& method, Timings const& timings, bool fast_path);
+    void record_coalesced(std::string const& method);
+    Totals totals(std::string const& method) const;
+    void reset();
+
+private:
+    RequestStats() = default;
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Totals> totals_;
+};
+
+}  // namespace internal
+}  // namespace provider
+}  // namespace storage
+}  // namespace unity
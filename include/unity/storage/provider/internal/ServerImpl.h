@@ -22,6 +22,7 @@
 #include <unity/storage/internal/InactivityTimer.h>
 #include <unity/storage/internal/TraceMessageHandler.h>
 #include <unity/storage/provider/internal/DBusPeerCache.h>
+#include <unity/storage/provider/internal/DispatchPool.h>
 #include <unity/storage/provider/internal/ProviderInterface.h>
 
 #include <OnlineAccounts/Manager>
@@ -47,7 +48,10 @@ namespace internal
 class ServerImpl : public QObject {
     Q_OBJECT
 public:
-    ServerImpl(ServerBase* server, std::string const& bus_name, std::string const& account_service_id);
+    ServerImpl(ServerBase* server,
+               std::string const& bus_name,
+               std::string const& account_service_id,
+               DispatchMode dispatch_mode = DispatchMode::main_thread);
     ~ServerImpl();
 
     void init(int& argc, char **argv, QDBusConnection *bus = nullptr);
@@ -71,6 +75,7 @@ private:
     ServerBase* const server_;
     std::string const bus_name_;
     std::string const service_id_;
+    DispatchMode const dispatch_mode_;
     unity::storage::internal::TraceMessageHandler trace_message_handler_;
 
     std::unique_ptr<QCoreApplication> app_;
@@ -79,6 +84,9 @@ private:
     std::unique_ptr<OnlineAccounts::Manager> manager_;
     std::shared_ptr<DBusPeerCache> dbus_peer_;
     std::map<OnlineAccounts::AccountId,std::unique_ptr<ProviderInterface>> interfaces_;
+    // Null unless dispatch_mode_ is thread_pool. Declared last so the dispatch threads
+    // are joined before the interfaces (and their handlers) are destroyed.
+    std::unique_ptr<DispatchPool> dispatch_pool_;
 
     Q_DISABLE_COPY(ServerImpl)
 };
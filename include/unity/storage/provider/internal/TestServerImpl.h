@@ -44,6 +44,7 @@ namespace provider
 namespace internal
 {
 
+class DispatchPool;
 class ProviderInterface;
 
 class TestServerImpl
@@ -52,7 +53,8 @@ public:
     TestServerImpl(std::shared_ptr<ProviderBase> const& provider,
                    OnlineAccounts::Account* account,
                    QDBusConnection const& connection,
-                   std::string const& object_path);
+                   std::string const& object_path,
+                   DispatchMode mode);
     ~TestServerImpl();
 
     QDBusConnection const& connection() const;
@@ -64,6 +66,7 @@ private:
 
     std::shared_ptr<unity::storage::internal::InactivityTimer> inactivity_timer_;
     std::unique_ptr<ProviderInterface> interface_;
+    std::unique_ptr<DispatchPool> dispatch_pool_;  // Joined before interface_ is destroyed.
 };
 
 }
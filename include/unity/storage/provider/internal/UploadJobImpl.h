@@ -55,15 +55,21 @@ public:
     int read_socket() const;
     int take_write_socket();
     void set_activity(std::shared_ptr<unity::storage::internal::InactivityTimer> const& inactivity_timer);
+    void set_owner(Context const& ctx);
+    bool is_owner(Context const& ctx) const;
 
     void report_error(std::exception_ptr p);
     boost::future<Item> finish(UploadJob& job);
     boost::future<void> cancel(UploadJob& job);
+    boost::future<int64_t> suspend(UploadJob& job);
+    boost::future<void> resume(UploadJob& job);
 
 public Q_SLOTS:
     virtual void complete_init();
 
 protected:
+    void create_sockets();
+
     std::string const upload_id_;
     int read_socket_ = -1;
     int write_socket_ = -1;
@@ -74,6 +80,11 @@ protected:
 
     unity::storage::internal::ActivityNotifier activity_;
 
+    // The client that started the upload. Only a client with the same
+    // credentials can resume the upload after a disconnect.
+    uid_t owner_uid_ = 0;
+    std::string owner_label_;
+
     Q_DISABLE_COPY(UploadJobImpl)
 };
 
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/WorkerPool.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+class WorkerPoolImpl
+{
+public:
+    WorkerPoolImpl(WorkerPool::Options const& options);
+    ~WorkerPoolImpl();
+
+    WorkerPoolImpl(WorkerPoolImpl const&) = delete;
+    WorkerPoolImpl& operator=(WorkerPoolImpl const&) = delete;
+
+    void post(WorkerPool::Lane lane, std::function<void()> closure);
+    WorkerPool::LaneStats stats(WorkerPool::Lane lane) const;
+    WorkerPool::Options const& options() const;
+
+private:
+    struct Task
+    {
+        std::function<void()> closure;
+        std::chrono::steady_clock::time_point enqueue_time;
+    };
+
+    // Each worker owns a queue. Work is distributed round-robin over the queues,
+    // and a worker whose queue is empty steals from the other queues in the same lane.
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    struct Lane
+    {
+        std::string name;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<unsigned> next_worker{0};
+
+        // Idle workers wait on wakeup_; queued_ is the number of tasks across all queues of the lane.
+        std::mutex wakeup_mutex;
+        std::condition_variable wakeup;
+        std::atomic<int64_t> queued{0};
+
+        std::atomic<int64_t> max_queued{0};
+        std::atomic<int64_t> executed{0};
+        std::atomic<int64_t> stolen{0};
+        std::atomic<int64_t> rejected{0};
+        std::atomic<int64_t> total_wait_nsecs{0};
+        std::atomic<int64_t> max_wait_nsecs{0};
+    };
+
+    Lane& lane(WorkerPool::Lane l);
+    Lane const& lane(WorkerPool::Lane l) const;
+    void start(Lane& lane, std::string const& name, int num_threads);
+    void stop(Lane& lane);
+    void run(Lane& lane, size_t index);
+    bool try_pop(Lane& lane, size_t index, Task& task);
+
+    WorkerPool::Options const options_;
+    Lane metadata_lane_;
+    Lane bulk_lane_;
+    std::atomic<bool> stopped_{false};
+};
+
+}
+}
+}
+}
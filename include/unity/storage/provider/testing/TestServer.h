@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include <unity/storage/provider/Server.h>
 #include <unity/storage/visibility.h>
 
 #include <memory>
@@ -74,6 +75,22 @@ public:
                OnlineAccounts::Account* account,
                QDBusConnection const& connection,
                std::string const& object_path);
+
+    /**
+    \brief Constructs a TestServer instance that handles requests as determined by <code>mode</code>.
+
+    See ServerBase::ServerBase() for details of the dispatch modes.
+    \param provider The provider implementation to be tested.
+    \param account The account for the provider (or <code>nullptr</code>).
+    \param connection The DBus connection to connect the provider to.
+    \param object_path The DBus object path for the provider interface.
+    \param mode Determines which threads handle requests.
+    */
+    TestServer(std::shared_ptr<ProviderBase> const& provider,
+               OnlineAccounts::Account* account,
+               QDBusConnection const& connection,
+               std::string const& object_path,
+               DispatchMode mode);
     ~TestServer();
 
     /**
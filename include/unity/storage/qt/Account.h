@@ -33,10 +33,12 @@ namespace internal
 {
 
 class AccountImpl;
+class ChangeWatcherImpl;
 class ItemImpl;
 
 }
 
+class ChangeWatcher;
 class ItemJob;
 class ItemListJob;
 
@@ -161,6 +163,14 @@ public:
     */
     Q_INVOKABLE unity::storage::qt::ItemJob* get(QString const& itemId, QStringList const& keys = QStringList()) const;
 
+    /**
+    \brief Watches the account for changes to its items.
+    \return A ChangeWatcher that emits a signal whenever the provider reports changes.
+    \note You <i>must</i> deallocate the returned watcher by calling <code>delete</code>.
+    \see ChangeWatcher
+    */
+    Q_INVOKABLE unity::storage::qt::ChangeWatcher* watchChanges() const;
+
     /** @name Comparison operators and hashing
     */
     //{@
@@ -196,6 +206,7 @@ private:
     std::shared_ptr<internal::AccountImpl> p_;
 
     friend class internal::AccountImpl;
+    friend class internal::ChangeWatcherImpl;
     friend class internal::ItemImpl;
     ///@endcond
 };
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <QList>
+#include <QMetaType>
+#include <QObject>
+#include <QString>
+
+#include <memory>
+
+namespace unity
+{
+namespace storage
+{
+namespace qt
+{
+namespace internal
+{
+
+class ChangeWatcherImpl;
+
+}  // namespace internal
+
+class Account;
+class StorageError;
+
+/**
+\brief Describes a change to a file or folder.
+*/
+
+struct Q_DECL_EXPORT ItemChange
+{
+    Q_GADGET
+
+    /**
+    \see \link itemId\endlink
+    */
+    Q_PROPERTY(QString itemId MEMBER itemId FINAL)
+
+    /**
+    \see \link parentId\endlink
+    */
+    Q_PROPERTY(QString parentId MEMBER parentId FINAL)
+
+    /**
+    \see \link type\endlink
+    */
+    Q_PROPERTY(unity::storage::qt::ItemChange::Type type MEMBER type FINAL)
+
+public:
+    /**
+    \brief Indicates how an item has changed.
+    */
+    enum Type {
+        Created,  /*!< The item was created (or moved into its parent folder). */
+        Changed,  /*!< The contents or metadata of the item changed. */
+        Deleted   /*!< The item was deleted (or moved out of its parent folder). */
+    };
+    Q_ENUMS(Type)
+
+    QString itemId;    /*!< The identity of the item that changed. */
+    QString parentId;  /*!< The identity of the item's parent folder. */
+    Type type;         /*!< How the item changed. */
+};
+
+/**
+\brief Notifies the application of changes to the items of an account.
+
+Instead of polling for changes by listing folders and comparing ETags, an application
+can create a ChangeWatcher by calling Account::watchChanges(). Whenever the provider detects that
+items have changed, the watcher emits itemsChanged(), so the application only needs to
+re-fetch the items that changed (or list their parent folders).
+
+The provider's notification only says that something changed; the watcher then asks the provider
+for the changes since it last asked, so no other process can find out which items changed.
+If the provider cannot say which items changed (for example, because it lost track of changes),
+the watcher emits changesLost() instead, and the application must list its folders again.
+
+Not all providers can detect changes. For such providers, the watcher never emits a signal.
+*/
+
+class Q_DECL_EXPORT ChangeWatcher final : public QObject
+{
+    Q_OBJECT
+
+    /**
+    \see \link isValid() const isValid()\endlink
+    */
+    Q_PROPERTY(bool isValid READ isValid FINAL)
+
+    /**
+    \see \link error() const error()\endlink
+    */
+    Q_PROPERTY(unity::storage::qt::StorageError error READ error FINAL)
+
+public:
+    /**
+    \brief Destroys the watcher.
+
+    Once the watcher is destroyed, the application no longer receives notifications.
+    */
+    virtual ~ChangeWatcher();
+
+    /**
+    \brief Returns whether this watcher was successfully created.
+    \return If the watcher was created for an invalid account or after the runtime was
+    destroyed, the return value is <code>false</code>; <code>true</code> otherwise.
+    */
+    bool isValid() const;
+
+    /**
+    \brief Returns the error that occured when creating the watcher.
+    \return A StorageError that indicates the cause of the error if isValid() returns <code>false</code>.
+    If isValid() returns <code>true</code>, the returned StorageError has type StorageError::NoError.
+    */
+    StorageError error() const;
+
+    /**
+    \brief Returns the account that is watched.
+    \return The account, or an invalid account if isValid() returns <code>false</code>.
+    */
+    Account account() const;
+
+Q_SIGNALS:
+    /** @name Signals
+    */
+    //{@
+    /**
+    \brief This signal is emitted whenever the provider reports changes to items.
+
+    Changes that occur in quick succession are reported with a single signal.
+    \param changes The list of changes.
+    */
+    void itemsChanged(QList<unity::storage::qt::ItemChange> const& changes) const;
+
+    /**
+    \brief This signal is emitted if items have changed, but the provider cannot say which ones.
+
+    The application must list the folders it is interested in again.
+    */
+    void changesLost() const;
+    //@}
+
+private:
+    ///@cond
+    ChangeWatcher(std::unique_ptr<internal::ChangeWatcherImpl> p);
+
+    std::unique_ptr<internal::ChangeWatcherImpl> const p_;
+
+    friend class internal::ChangeWatcherImpl;
+    ///@endcond
+};
+
+}  // namespace qt
+}  // namespace storage
+}  // namespace unity
+
+Q_DECLARE_METATYPE(unity::storage::qt::ItemChange)
+Q_DECLARE_METATYPE(QList<unity::storage::qt::ItemChange>)
+Q_DECLARE_METATYPE(unity::storage::qt::ItemChange::Type)
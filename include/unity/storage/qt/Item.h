@@ -312,6 +312,25 @@ public:
                                                              qint64 sizeInBytes,
                                                              QStringList const& keys = QStringList()) const;
 
+    /**
+    \brief Resumes an upload that was interrupted because the client disconnected.
+
+    If a client disconnects from the provider during an upload (for example, because it crashed),
+    the provider keeps the data it has received for a grace period. Within that period, the client
+    can call resumeUpload() on the item that the upload was started from, passing the Uploader::uploadId()
+    of the interrupted upload. Once the returned uploader is ready, Uploader::offset() indicates
+    how many bytes the provider has stored already; you must write the remaining
+    <code>sizeInBytes - offset()</code> bytes before finalizing the upload.
+
+    Attempts to resume an upload that does not exist (or no longer exists), or to resume an upload
+    with a provider that does not support resumable uploads, return an uploader that indicates an error.
+    \param uploadId The identifier of the interrupted upload.
+    \param sizeInBytes The size of the upload that was passed when the upload was started.
+    \return An uploader that, once ready, can be used to upload the remainder of the data.
+    \see \link uploads-downloads Uploads and Downloads\endlink
+    */
+    Q_INVOKABLE unity::storage::qt::Uploader* resumeUpload(QString const& uploadId, qint64 sizeInBytes) const;
+
     /**
     \brief Creates a downloader for this file.
 
@@ -324,6 +343,25 @@ public:
     */
     Q_INVOKABLE unity::storage::qt::Downloader* createDownloader(ConflictPolicy policy) const;
 
+    /**
+    \brief Creates a downloader for part of this file.
+
+    The downloader provides the <code>length</code> bytes that start at <code>offset</code>, or fewer if
+    the file ends before that. This allows a client to resume an interrupted download, or to read only
+    the part of a file that it needs. Attempts to download a folder, or to download part of a file from
+    a provider that can only download whole files, return a downloader that indicates an error.
+    \param policy If set to <code>ErrorIfConflict</code>, the download job indicates an error if this file's
+    ETag no longer matches the ETag maintained by the provider. If set to <code>IgnoreConflict</code>, the
+    download will proceed regardless of any ETag mismatch.
+    \param offset The offset of the first byte to download.
+    \param length The number of bytes to download, or -1 to download to the end of the file.
+    \return A downloader that, once ready, can be used to download the data for the range.
+    \see \link uploads-downloads Uploads and Downloads\endlink
+    */
+    Q_INVOKABLE unity::storage::qt::Downloader* createDownloader(ConflictPolicy policy,
+                                                                 qint64 offset,
+                                                                 qint64 length = -1) const;
+
     /**
     \brief Lists the contents of this folder.
 
@@ -346,6 +384,40 @@ public:
     Q_INVOKABLE unity::storage::qt::ItemListJob* lookup(QString const& name,
                                                         QStringList const& keys = QStringList()) const;
 
+    /**
+    \brief Finds the items within this folder and its sub-folders that match a query.
+
+    A query term of the form <code>type:</code><i>prefix</i> matches items whose content type starts
+    with <i>prefix</i> (such as <code>type:image/</code>); any other term matches items whose name
+    contains the term, ignoring case. An item must match all terms.
+    Attempts to search a file, or to search with a provider that does not support searches,
+    return a job that indicates an error.
+    \param query The search terms, separated by white space.
+    \param keys A list of metadata keys for metadata items that should be returned by the provider.
+    If the list is empty, the provider returns a default set of metadata items.
+    \return A job that, once complete, provides access to the matching items.
+    */
+    Q_INVOKABLE unity::storage::qt::ItemListJob* search(QString const& query,
+                                                        QStringList const& keys = QStringList()) const;
+
+    /**
+    \brief Returns the items within this folder and its sub-folders, down to a given depth.
+
+    This is more efficient than calling list() for each folder of a tree.
+    Items are returned in depth-first order: each folder is followed by its contents.
+    The metadata of each item contains the key <code>path</code>, whose value is the path of the
+    item relative to this folder.
+    Attempts to walk a file, or to walk with a provider that does not support walks,
+    return a job that indicates an error.
+    \param maxDepth The number of levels to descend. A value of 1 returns the contents of this folder
+    only; a value of 0 returns the entire tree.
+    \param keys A list of metadata keys for metadata items that should be returned by the provider.
+    If the list is empty, the provider returns a default set of metadata items.
+    \return A job that, once complete, provides access to the items.
+    */
+    Q_INVOKABLE unity::storage::qt::ItemListJob* walk(int maxDepth = 0,
+                                                      QStringList const& keys = QStringList()) const;
+
     /**
     \brief Creates a child folder within this folder.
 
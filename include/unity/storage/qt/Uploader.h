@@ -48,6 +48,8 @@ class Q_DECL_EXPORT Uploader final : public QIODevice
     Q_PROPERTY(unity::storage::qt::Item::ConflictPolicy policy READ policy NOTIFY statusChanged FINAL)
     Q_PROPERTY(qint64 sizeInBytes READ sizeInBytes NOTIFY statusChanged FINAL)
     Q_PROPERTY(unity::storage::qt::Item item READ item NOTIFY statusChanged FINAL)
+    Q_PROPERTY(QString uploadId READ uploadId NOTIFY statusChanged FINAL)
+    Q_PROPERTY(qint64 offset READ offset NOTIFY statusChanged FINAL)
 
 public:
     enum Status { Loading, Ready, Cancelled, Finished, Error };
@@ -61,6 +63,8 @@ public:
     Item::ConflictPolicy policy() const;
     qint64 sizeInBytes() const;
     Item item() const;
+    QString uploadId() const;
+    qint64 offset() const;
 
     Q_INVOKABLE void cancel();
 
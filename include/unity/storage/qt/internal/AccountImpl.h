@@ -52,6 +52,7 @@ public:
 
     ItemListJob* roots(QStringList const& keys) const;
     ItemJob* get(QString const& itemId, QStringList const& keys) const;
+    ChangeWatcher* watchChanges() const;
 
     bool operator==(AccountImpl const&) const;
     bool operator!=(AccountImpl const&) const;
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/qt/ChangeWatcher.h>
+
+#include <unity/storage/internal/ItemChange.h>
+#include <unity/storage/qt/StorageError.h>
+
+namespace unity
+{
+namespace storage
+{
+namespace qt
+{
+namespace internal
+{
+
+class AccountImpl;
+
+class ChangeWatcherImpl : public QObject
+{
+    Q_OBJECT
+public:
+    virtual ~ChangeWatcherImpl() = default;
+
+    bool isValid() const;
+    StorageError error() const;
+    Account account() const;
+
+    static ChangeWatcher* make_watcher(std::shared_ptr<AccountImpl> const& account_impl);
+    static ChangeWatcher* make_watcher(StorageError const& e);
+
+private Q_SLOTS:
+    void items_changed();
+
+private:
+    ChangeWatcherImpl(std::shared_ptr<AccountImpl> const& account_impl);
+    ChangeWatcherImpl(StorageError const& e);
+
+    void fetch_changes(bool notified);
+
+    ChangeWatcher* public_instance_;
+    StorageError error_;
+    std::shared_ptr<AccountImpl> account_impl_;
+    QString cursor_;          // Empty until the first call to Changes() returns, or after an error.
+    bool fetching_ = false;   // Set while a call to Changes() is in progress.
+    bool pending_ = false;    // Set if the provider reported changes while we were fetching.
+};
+
+}  // namespace internal
+}  // namespace qt
+}  // namespace storage
+}  // namespace unity
@@ -102,12 +102,6 @@ public:
                           })
     {
     }
-
-    void wait_and_process_now()
-    {
-        watcher_.waitForFinished();
-        finished(&watcher_);
-    }
 };
 
 }  // namespace internal
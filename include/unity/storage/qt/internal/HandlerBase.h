@@ -48,6 +48,8 @@ public:
                 QDBusPendingCall const& call,
                 std::function<void(QDBusPendingCallWatcher&)> const& closure);
 
+    void wait_and_process_now();
+
 public Q_SLOTS:
     void finished(QDBusPendingCallWatcher* call);
 
@@ -64,9 +64,13 @@ public:
     ItemJob* move(Item const& newParent, QString const& newName, QStringList const& keys) const;
     VoidJob* deleteItem() const;
     Uploader* createUploader(Item::ConflictPolicy policy, qint64 sizeInBytes, QStringList const& keys) const;
+    Uploader* resumeUpload(QString const& uploadId, qint64 sizeInBytes) const;
     Downloader* createDownloader(Item::ConflictPolicy policy) const;
+    Downloader* createDownloader(Item::ConflictPolicy policy, qint64 offset, qint64 length) const;
     ItemListJob* list(QStringList const& keys) const;
     ItemListJob* lookup(QString const& name, QStringList const& keys) const;
+    ItemListJob* search(QString const& query, QStringList const& keys) const;
+    ItemListJob* walk(int maxDepth, QStringList const& keys) const;
     ItemJob* createFolder(QString const& name, QStringList const& keys) const;
     Uploader* createFile(QString const& name) const;
     Uploader* createFile(QString const& name,
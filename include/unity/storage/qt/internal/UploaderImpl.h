@@ -51,6 +51,12 @@ public:
                  std::function<void(storage::internal::ItemMetadata const&)> const& validate,
                  Item::ConflictPolicy policy,
                  qint64 size_in_bytes);
+    UploaderImpl(std::shared_ptr<ItemImpl> const& item_impl,
+                 QString const& method,
+                 QDBusPendingReply<qlonglong, QDBusUnixFileDescriptor>& reply,
+                 std::function<void(storage::internal::ItemMetadata const&)> const& validate,
+                 QString const& upload_id,
+                 qint64 size_in_bytes);
     UploaderImpl(StorageError const& e);
     virtual ~UploaderImpl();
 
@@ -60,6 +66,8 @@ public:
     Item::ConflictPolicy policy() const;
     qint64 sizeInBytes() const;
     Item item() const;
+    QString uploadId() const;
+    qint64 offset() const;
 
     void cancel();
 
@@ -80,11 +88,20 @@ public:
                               std::function<void(storage::internal::ItemMetadata const&)> const& validate,
                               Item::ConflictPolicy policy,
                               qint64 size_in_bytes);
+    static Uploader* make_job(std::shared_ptr<ItemImpl> const& item_impl,
+                              QString const& method,
+                              QDBusPendingReply<qlonglong, QDBusUnixFileDescriptor>& reply,
+                              std::function<void(storage::internal::ItemMetadata const&)> const& validate,
+                              QString const& upload_id,
+                              qint64 size_in_bytes);
     static Uploader* make_job(StorageError const& e);
 
     qint64 flush_buffer();
 
 private:
+    void connect_socket(QString const& upload_id, QDBusUnixFileDescriptor const& fd);
+    void set_error(StorageError const& error);
+
     Uploader* public_instance_;
     Uploader::Status status_;
     StorageError error_;
@@ -93,8 +110,9 @@ private:
     std::function<void(storage::internal::ItemMetadata const&)> validate_;
     Item::ConflictPolicy policy_ = Item::ConflictPolicy::IgnoreConflict;
     qint64 size_in_bytes_ = 0;
-    QPointer<Handler<QDBusPendingReply<QString, QDBusUnixFileDescriptor>>> handler_;
+    QPointer<HandlerBase> handler_;  // Replies differ for new and resumed uploads.
     QString upload_id_;
+    qint64 offset_ = 0;  // Non-zero only for a resumed upload.
     QDBusUnixFileDescriptor fd_;
     QLocalSocket socket_;
     QByteArray buffer_;
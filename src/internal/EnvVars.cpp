@@ -42,9 +42,115 @@ int EnvVars::provider_timeout_ms()
     return get_timeout_ms(PROVIDER_IDLE_TIMEOUT, PROVIDER_IDLE_TIMEOUT_DFLT);
 }
 
+int EnvVars::provider_metadata_threads()
+{
+    return get_int(PROVIDER_METADATA_THREADS, PROVIDER_METADATA_THREADS_DFLT);
+}
+
+int EnvVars::provider_bulk_threads()
+{
+    return get_int(PROVIDER_BULK_THREADS, PROVIDER_BULK_THREADS_DFLT);
+}
+
+int EnvVars::provider_max_queue_depth()
+{
+    return get_int(PROVIDER_MAX_QUEUE_DEPTH, PROVIDER_MAX_QUEUE_DEPTH_DFLT);
+}
+
+int EnvVars::provider_dispatch_threads()
+{
+    return get_int(PROVIDER_DISPATCH_THREADS, PROVIDER_DISPATCH_THREADS_DFLT);
+}
+
+int EnvVars::provider_peer_cache_size()
+{
+    return get_int(PROVIDER_PEER_CACHE_SIZE, PROVIDER_PEER_CACHE_SIZE_DFLT);
+}
+
+int EnvVars::provider_peer_cache_ttl_ms()
+{
+    return get_timeout_ms(PROVIDER_PEER_CACHE_TTL, PROVIDER_PEER_CACHE_TTL_DFLT);
+}
+
+int EnvVars::provider_upload_grace_period_ms()
+{
+    return get_timeout_ms(PROVIDER_UPLOAD_GRACE_PERIOD, PROVIDER_UPLOAD_GRACE_PERIOD_DFLT);
+}
+
+int EnvVars::local_provider_page_size()
+{
+    return get_int(LOCAL_PROVIDER_PAGE_SIZE, LOCAL_PROVIDER_PAGE_SIZE_DFLT);
+}
+
+int EnvVars::local_provider_list_threads()
+{
+    return get_int(LOCAL_PROVIDER_LIST_THREADS, LOCAL_PROVIDER_LIST_THREADS_DFLT);
+}
+
+bool EnvVars::local_provider_sniff_content()
+{
+    return get_int(LOCAL_PROVIDER_SNIFF_CONTENT, LOCAL_PROVIDER_SNIFF_CONTENT_DFLT) != 0;
+}
+
+bool EnvVars::local_provider_zero_copy()
+{
+    return get_int(LOCAL_PROVIDER_ZERO_COPY, LOCAL_PROVIDER_ZERO_COPY_DFLT) != 0;
+}
+
+int EnvVars::local_provider_copy_threads()
+{
+    return get_int(LOCAL_PROVIDER_COPY_THREADS, LOCAL_PROVIDER_COPY_THREADS_DFLT);
+}
+
+bool EnvVars::local_provider_watch_changes()
+{
+    return get_int(LOCAL_PROVIDER_WATCH_CHANGES, LOCAL_PROVIDER_WATCH_CHANGES_DFLT) != 0;
+}
+
+int EnvVars::local_provider_journal_size()
+{
+    return get_int(LOCAL_PROVIDER_JOURNAL_SIZE, LOCAL_PROVIDER_JOURNAL_SIZE_DFLT);
+}
+
+bool EnvVars::local_provider_index()
+{
+    return get_int(LOCAL_PROVIDER_INDEX, LOCAL_PROVIDER_INDEX_DFLT) != 0;
+}
+
+bool EnvVars::local_provider_hash_downloads()
+{
+    return get_int(LOCAL_PROVIDER_HASH_DOWNLOADS, LOCAL_PROVIDER_HASH_DOWNLOADS_DFLT) != 0;
+}
+
+string EnvVars::local_provider_durability()
+{
+    auto const val = get(LOCAL_PROVIDER_DURABILITY);
+    if (val.empty())
+    {
+        return LOCAL_PROVIDER_DURABILITY_DFLT;
+    }
+    if (val != "none" && val != "data" && val != "full")
+    {
+        qWarning().noquote().nospace()
+            << "Invalid setting of env var " << LOCAL_PROVIDER_DURABILITY
+            << " (\"" << QString::fromStdString(val) << "\"): must be none, data, or full";
+        qWarning().nospace() << "Using default value of " << LOCAL_PROVIDER_DURABILITY_DFLT;
+        return LOCAL_PROVIDER_DURABILITY_DFLT;
+    }
+    return val;
+}
+
 int EnvVars::get_timeout_ms(char const* var_name, int dflt)
 {
-    int timeout = dflt;
+    return get_int(var_name, dflt) * 1000;
+}
+
+// Returns the non-negative integer value of var_name, or dflt if the
+// variable is not set or does not contain a valid setting.
+
+int EnvVars::get_int(char const* var_name, int dflt)
+{
+    int result = dflt;
 
     auto const val = get(var_name);
     if (!val.empty())
@@ -61,7 +167,7 @@ int EnvVars::get_timeout_ms(char const* var_name, int dflt)
             {
                 throw invalid_argument("value must be >= 0");
             }
-            timeout = int_val;
+            result = int_val;
         }
         catch (std::exception const& e)
         {
@@ -71,7 +177,7 @@ int EnvVars::get_timeout_ms(char const* var_name, int dflt)
             qWarning().nospace() << "Using default value of " << dflt;
         }
     }
-    return timeout * 1000;
+    return result;
 }
 
 string EnvVars::get(char const* var_name)
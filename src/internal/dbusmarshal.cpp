@@ -108,6 +108,58 @@ QDBusArgument const& operator>>(QDBusArgument const& argument, QList<storage::in
     return argument;
 }
 
+QDBusArgument& operator<<(QDBusArgument& argument, storage::internal::ItemChange const& change)
+{
+    argument.beginStructure();
+    argument << change.item_id;
+    argument << change.parent_id;
+    argument << static_cast<int32_t>(change.type);
+    argument.endStructure();
+    return argument;
+}
+
+QDBusArgument const& operator>>(QDBusArgument const& argument, storage::internal::ItemChange& change)
+{
+    argument.beginStructure();
+    argument >> change.item_id;
+    argument >> change.parent_id;
+    int32_t enum_val;
+    argument >> enum_val;
+    if (enum_val < 0 || enum_val >= int(ChangeType::LAST_ENTRY__))
+    {
+        qCritical() << "unmarshaling error: impossible ChangeType value: " + QString::number(enum_val);
+        return argument;  // Forces error
+    }
+    change.type = static_cast<ChangeType>(enum_val);
+    argument.endStructure();
+    return argument;
+}
+
+QDBusArgument& operator<<(QDBusArgument& argument, QList<storage::internal::ItemChange> const& changes)
+{
+    argument.beginArray(qMetaTypeId<storage::internal::ItemChange>());
+    for (auto const& c : changes)
+    {
+        argument << c;
+    }
+    argument.endArray();
+    return argument;
+}
+
+QDBusArgument const& operator>>(QDBusArgument const& argument, QList<storage::internal::ItemChange>& changes)
+{
+    changes.clear();
+    argument.beginArray();
+    while (!argument.atEnd())
+    {
+        ItemChange c;
+        argument >> c;
+        changes.append(c);
+    }
+    argument.endArray();
+    return argument;
+}
+
 }  // namespace internal
 }  // namespace storage
 }  // namespace unity
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "ChangeJournal.h"
+
+#include "utils.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace unity::storage;
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+struct Header
+{
+    char magic[8];
+    uint64_t id;        // Changes whenever the journal starts over.
+    uint64_t end;       // Offset of the first byte after the last record.
+    uint64_t reserved[5];
+};
+
+struct Record
+{
+    uint32_t magic;
+    uint16_t type;
+    uint16_t reserved;
+    uint32_t id_len;
+    uint32_t parent_len;
+    // Followed by item_id and parent_id (not NUL-terminated), padded to a multiple of 8 bytes.
+};
+
+char const JOURNAL_MAGIC[8] = { 'S', 'F', 'J', 'R', 'N', 'L', '0', '1' };
+uint32_t const RECORD_MAGIC = 0x5346434a;
+
+// We grow the file in steps of this size. The space is allocated (not sparse), so
+// writing to the mapping cannot fail with SIGBUS if the disk fills up.
+uint64_t const GROWTH_INCREMENT = 1024 * 1024;
+
+void close_fd(int fd)
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+}
+
+Header& header_of(char* map)
+{
+    assert(map);
+    return *reinterpret_cast<Header*>(map);
+}
+
+uint64_t record_size(size_t id_len, size_t parent_len)
+{
+    return (sizeof(Record) + id_len + parent_len + 7) & ~uint64_t(7);
+}
+
+[[ noreturn ]]
+void throw_error(string const& msg, string const& path, int error)
+{
+    throw boost::filesystem::filesystem_error(msg, path,
+                                              boost::system::error_code(error, boost::system::system_category()));
+}
+
+}  // namespace
+
+ChangeJournal::ChangeJournal(string const& root, string const& path, int64_t max_size)
+    : root_(root)
+    , path_(path)
+    , max_size_(max(uint64_t(max_size), GROWTH_INCREMENT))
+    , fd_(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600), close_fd)
+    , map_(nullptr)
+    , map_size_(0)
+{
+    if (fd_.get() == -1)
+    {
+        throw_error("ChangeJournal(): cannot open journal", path_, errno);
+    }
+    struct stat st;
+    if (fstat(fd_.get(), &st) == -1)
+    {
+        throw_error("ChangeJournal(): cannot stat journal", path_, errno);  // LCOV_EXCL_LINE
+    }
+
+    if (uint64_t(st.st_size) >= sizeof(Header))
+    {
+        map(st.st_size);
+    }
+    if (map_size_ < GROWTH_INCREMENT && !reserve(GROWTH_INCREMENT))
+    {
+        throw_error("ChangeJournal(): cannot allocate journal", path_, errno);
+    }
+    // We don't know what changed while no provider was running, so existing cursors are no good.
+    // This also takes care of a journal that we crashed while writing.
+    reset();
+}
+
+ChangeJournal::~ChangeJournal()
+{
+    if (map_)
+    {
+        munmap(map_, map_size_);
+    }
+}
+
+void ChangeJournal::append(ItemChangeList const& changes)
+{
+    lock_guard<mutex> lock(mutex_);
+
+    for (auto const& c : changes)
+    {
+        string id;
+        string parent;
+        if (!to_relative(c.item_id, id) || !to_relative(c.parent_id, parent))
+        {
+            continue;
+        }
+        auto const size = record_size(id.size(), parent.size());
+        if (header_of(map_).end + size > max_size_ || !reserve(header_of(map_).end + size))
+        {
+            // Start over, re-using the space we have, so the clients get to see that they missed changes.
+            reset();
+            if (header_of(map_).end + size > map_size_)
+            {
+                continue;  // LCOV_EXCL_LINE  // Impossible, unless a path is longer than the growth increment.
+            }
+        }
+
+        auto const offset = header_of(map_).end;
+        auto r = reinterpret_cast<Record*>(map_ + offset);
+        r->magic = RECORD_MAGIC;
+        r->type = uint16_t(c.type);
+        r->reserved = 0;
+        r->id_len = id.size();
+        r->parent_len = parent.size();
+        char* p = map_ + offset + sizeof(Record);
+        memcpy(p, id.data(), id.size());
+        memcpy(p + id.size(), parent.data(), parent.size());
+        header_of(map_).end = offset + size;  // Only now is the record part of the journal.
+    }
+}
+
+void ChangeJournal::invalidate_cursors()
+{
+    lock_guard<mutex> lock(mutex_);
+    reset();
+}
+
+string ChangeJournal::cursor() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return make_cursor(header_of(map_).end);
+}
+
+bool ChangeJournal::read(string const& cursor,
+                         size_t max_changes,
+                         ItemChangeList& changes,
+                         string& next_cursor) const
+{
+    lock_guard<mutex> lock(mutex_);
+
+    // Cursor format is <id in hex>:<offset>. The offset has at most 19 digits, so stoull() cannot overflow.
+    auto const colon = cursor.find(':');
+    if (colon != 16 || cursor.find_first_not_of("0123456789abcdef") != colon
+        || colon + 1 == cursor.size() || cursor.find_first_not_of("0123456789", colon + 1) != string::npos
+        || cursor.size() - colon - 1 > 19)
+    {
+        return false;
+    }
+    auto const id = stoull(cursor.substr(0, colon), nullptr, 16);
+    auto offset = stoull(cursor.substr(colon + 1));
+    if (id != header_of(map_).id || offset < sizeof(Header) || offset > header_of(map_).end)
+    {
+        return false;
+    }
+
+    // Each item is reported once, in the order of its first change. Items that were
+    // created and deleted again are not reported, so we keep going until we have found
+    // something to report or reached the end. An empty result means that the client is up to date.
+    changes.clear();
+    while (changes.empty() && offset < header_of(map_).end)
+    {
+        unordered_map<string, size_t> index;
+        while (offset < header_of(map_).end)
+        {
+            ItemChange c;
+            uint64_t next_offset;
+            if (!read_record(offset, c, next_offset))
+            {
+                return false;  // Cursor does not point at a record.
+            }
+            auto it = index.find(c.item_id);
+            if (it == index.end())
+            {
+                if (index.size() == max_changes)
+                {
+                    break;
+                }
+                index.emplace(c.item_id, changes.size());
+                changes.push_back(move(c));
+            }
+            else
+            {
+                auto& existing = changes[it->second];
+                existing.type = existing.type == ChangeType::LAST_ENTRY__ ? c.type
+                                                                           : merge_changes(existing.type, c.type);
+                existing.parent_id = move(c.parent_id);
+            }
+            offset = next_offset;
+        }
+        changes.erase(remove_if(changes.begin(), changes.end(),
+                                [](ItemChange const& c) { return c.type == ChangeType::LAST_ENTRY__; }),
+                      changes.end());
+    }
+    next_cursor = make_cursor(offset);
+    return true;
+}
+
+bool ChangeJournal::read_record(uint64_t offset, ItemChange& change, uint64_t& next_offset) const
+{
+    auto const end = header_of(map_).end;
+    if (offset % 8 != 0 || end - offset < sizeof(Record))
+    {
+        return false;
+    }
+    auto r = reinterpret_cast<Record const*>(map_ + offset);
+    if (r->magic != RECORD_MAGIC || r->type >= uint16_t(ChangeType::LAST_ENTRY__))
+    {
+        return false;
+    }
+    auto const size = record_size(r->id_len, r->parent_len);
+    if (end - offset < size)
+    {
+        return false;
+    }
+    char const* p = map_ + offset + sizeof(Record);
+    change.item_id = from_relative(p, r->id_len);
+    change.parent_id = from_relative(p + r->id_len, r->parent_len);
+    change.type = ChangeType(r->type);
+    next_offset = offset + size;
+    return true;
+}
+
+// Make sure that the file has space for at least bytes. Returns false if we cannot allocate the space.
+
+bool ChangeJournal::reserve(uint64_t bytes)
+{
+    if (bytes <= map_size_)
+    {
+        return true;
+    }
+    auto const new_size = min(max_size_, (bytes + GROWTH_INCREMENT - 1) / GROWTH_INCREMENT * GROWTH_INCREMENT);
+    if (new_size < bytes)
+    {
+        return false;  // LCOV_EXCL_LINE
+    }
+    int rc = posix_fallocate(fd_.get(), 0, new_size);
+    if (rc != 0)
+    {
+        errno = rc;
+        return false;
+    }
+    map(new_size);
+    return true;
+}
+
+void ChangeJournal::map(uint64_t size)
+{
+    void* addr = map_ ? mremap(map_, map_size_, size, MREMAP_MAYMOVE)
+                      : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.get(), 0);
+    if (addr == MAP_FAILED)
+    {
+        throw_error("ChangeJournal: cannot map journal", path_, errno);  // LCOV_EXCL_LINE
+    }
+    map_ = static_cast<char*>(addr);
+    map_size_ = size;
+}
+
+// Start a new journal with a different id, so all existing cursors become invalid.
+
+void ChangeJournal::reset()
+{
+    static mt19937_64 generator(random_device{}());
+
+    auto& h = header_of(map_);
+    auto const old_id = memcmp(h.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0 ? h.id : 0;
+    uint64_t id;
+    do
+    {
+        id = generator();
+    }
+    while (id == old_id);
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    h.id = id;
+    h.end = sizeof(Header);
+}
+
+string ChangeJournal::make_cursor(uint64_t offset) const
+{
+    char buf[40];
+    snprintf(buf, sizeof(buf), "%016llx:%llu",
+             static_cast<unsigned long long>(header_of(map_).id), static_cast<unsigned long long>(offset));
+    return buf;
+}
+
+bool ChangeJournal::to_relative(string const& id, string& rel) const
+{
+    if (id.empty() || id == root_)
+    {
+        rel.clear();  // Root, or no parent (for the root itself).
+        return true;
+    }
+    if (id.size() <= root_.size() + 1 || id.compare(0, root_.size(), root_) != 0 || id[root_.size()] != '/')
+    {
+        return false;
+    }
+    rel = id.substr(root_.size() + 1);
+    return true;
+}
+
+string ChangeJournal::from_relative(char const* rel, size_t len) const
+{
+    return len == 0 ? root_ : root_ + "/" + string(rel, len);
+}
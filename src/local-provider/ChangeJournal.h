@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/Item.h>
+#include <unity/util/ResourcePtr.h>
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+// Persistent record of the changes to the items below the root, so clients can ask for
+// the changes since they last looked instead of re-listing the whole tree. The journal is
+// an append-only file that we map into memory. Each record holds one change, with paths
+// stored relative to the root. A cursor identifies a journal and an offset into it.
+// If the journal reaches its maximum size or runs out of disk space, we start over with a new
+// journal id. This invalidates all cursors, so clients have to re-list the tree once. Changes
+// that are made while no provider is running are not recorded, so we also start over each time
+// the journal is opened; only the file's space is re-used.
+// This class is thread-safe.
+
+class ChangeJournal
+{
+public:
+    // Throws boost::filesystem::filesystem_error if the journal cannot be opened or created.
+    ChangeJournal(std::string const& root, std::string const& path, int64_t max_size);
+    ~ChangeJournal();
+
+    ChangeJournal(ChangeJournal const&) = delete;
+    ChangeJournal& operator=(ChangeJournal const&) = delete;
+
+    void append(unity::storage::provider::ItemChangeList const& changes);
+
+    // Starts over with a new journal id. Call this if changes may have been missed.
+    void invalidate_cursors();
+
+    // Returns the cursor for the current end of the journal.
+    std::string cursor() const;
+
+    // Returns the changes after cursor, with at most one change per item, and the cursor
+    // that follows the returned changes. At most max_changes are returned; if there are
+    // more changes, they are returned by the next call with next_cursor.
+    // Returns false if the cursor is malformed or has expired.
+    bool read(std::string const& cursor,
+              size_t max_changes,
+              unity::storage::provider::ItemChangeList& changes,
+              std::string& next_cursor) const;
+
+private:
+    typedef unity::util::ResourcePtr<int, std::function<void(int)>> FdPtr;
+
+    bool read_record(uint64_t offset, unity::storage::provider::ItemChange& change, uint64_t& next_offset) const;
+    bool reserve(uint64_t bytes);
+    void map(uint64_t size);
+    void reset();
+    std::string make_cursor(uint64_t offset) const;
+    bool to_relative(std::string const& id, std::string& rel) const;
+    std::string from_relative(char const* rel, size_t len) const;
+
+    std::string const root_;
+    std::string const path_;
+    uint64_t const max_size_;
+
+    mutable std::mutex mutex_;
+    FdPtr fd_;
+    char* map_;
+    uint64_t map_size_;
+};
@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "ContentHasher.h"
+
+#include "utils.h"
+
+#include <unity/storage/common.h>
+
+#include <boost/filesystem.hpp>
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#include <QCryptographicHash>
+#pragma GCC diagnostic pop
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#endif
+
+using namespace unity::storage;
+using namespace std;
+
+namespace
+{
+
+char const XATTR_NAME[] = "user.storage-framework.checksums";
+
+size_t const BUF_SIZE = 64 * 1024;
+
+struct AlgorithmInfo
+{
+    ContentHasher::Algorithm algorithm;
+    char const* key;
+};
+
+AlgorithmInfo const algorithm_info[] =
+{
+    { ContentHasher::md5, metadata::MD5 },
+    { ContentHasher::sha256, metadata::SHA256 },
+    { ContentHasher::crc32c, metadata::CRC32C },
+};
+
+// Slicing-by-8 tables for the CRC-32C polynomial (reversed 0x82F63B78).
+// Used if the CPU does not have CRC instructions.
+
+struct Crc32cTables
+{
+    uint32_t t[8][256];
+
+    Crc32cTables()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; ++j)
+            {
+                crc = (crc >> 1) ^ (0x82F63B78 & (0 - (crc & 1)));
+            }
+            t[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            for (int k = 1; k < 8; ++k)
+            {
+                t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+uint32_t crc32c_sw(uint32_t crc, unsigned char const* p, size_t size)
+{
+    static Crc32cTables const tables;
+    auto const& t = tables.t;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (size >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+            ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+#endif
+    while (size-- > 0)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hw(uint32_t crc, unsigned char const* p, size_t size)
+{
+    uint64_t crc64 = crc;
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        size -= 8;
+    }
+    crc = uint32_t(crc64);
+    while (size-- > 0)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+bool have_crc_instructions()
+{
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(__aarch64__)
+
+__attribute__((target("+crc")))
+uint32_t crc32c_hw(uint32_t crc, unsigned char const* p, size_t size)
+{
+    while (size >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0)
+    {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+bool have_crc_instructions()
+{
+    return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+
+#else
+
+uint32_t crc32c_hw(uint32_t crc, unsigned char const* p, size_t size)
+{
+    return crc32c_sw(crc, p, size);
+}
+
+bool have_crc_instructions()
+{
+    return false;
+}
+
+#endif
+
+// The part of the xattr value that identifies the version of the file.
+
+string version_of(struct stat const& st)
+{
+    return to_string(st.st_ino) + " " + to_string(st.st_size) + " " + to_string(get_mtime_nsecs(st));
+}
+
+// Parses the xattr value "<inode> <size> <mtime_nsecs> <key>=<value> ...". Values written
+// by earlier versions, which start with just the mtime, do not match any version.
+
+ContentHasher::Checksums parse_cached(string const& value, struct stat const& st)
+{
+    ContentHasher::Checksums checksums;
+    auto const version = version_of(st);
+    if (value.compare(0, version.size(), version) != 0
+        || (value.size() > version.size() && value[version.size()] != ' '))
+    {
+        return checksums;
+    }
+    istringstream s(value.substr(version.size()));
+    string field;
+    while (s >> field)
+    {
+        auto pos = field.find('=');
+        if (pos != string::npos)
+        {
+            checksums[field.substr(0, pos)] = field.substr(pos + 1);
+        }
+    }
+    return checksums;
+}
+
+}  // namespace
+
+ContentHasher::ContentHasher(int algorithms)
+    : algorithms_(algorithms)
+    , crc32c_(0)
+{
+    if (algorithms_ & md5)
+    {
+        md5_.reset(new QCryptographicHash(QCryptographicHash::Md5));
+    }
+    if (algorithms_ & sha256)
+    {
+        sha256_.reset(new QCryptographicHash(QCryptographicHash::Sha256));
+    }
+}
+
+ContentHasher::~ContentHasher() = default;
+
+int ContentHasher::algorithms() const
+{
+    return algorithms_;
+}
+
+void ContentHasher::update(void const* data, size_t size)
+{
+    auto p = static_cast<char const*>(data);
+    if (md5_)
+    {
+        md5_->addData(p, int(size));
+    }
+    if (sha256_)
+    {
+        sha256_->addData(p, int(size));
+    }
+    if (algorithms_ & crc32c)
+    {
+        crc32c_ = crc32c_update(crc32c_, p, size);
+    }
+}
+
+ContentHasher::Checksums ContentHasher::result() const
+{
+    Checksums checksums;
+    if (md5_)
+    {
+        checksums[metadata::MD5] = md5_->result().toHex().toStdString();
+    }
+    if (sha256_)
+    {
+        checksums[metadata::SHA256] = sha256_->result().toHex().toStdString();
+    }
+    if (algorithms_ & crc32c)
+    {
+        char buf[9];
+        snprintf(buf, sizeof(buf), "%08x", crc32c_);
+        checksums[metadata::CRC32C] = buf;
+    }
+    return checksums;
+}
+
+int ContentHasher::algorithms_for(unity::storage::provider::MetadataKeys const& keys)
+{
+    int algorithms = 0;
+    for (auto const& info : algorithm_info)
+    {
+        if (keys.contains(info.key))
+        {
+            algorithms |= info.algorithm;
+        }
+    }
+    return algorithms;
+}
+
+int ContentHasher::algorithms_in(Checksums const& checksums)
+{
+    int algorithms = 0;
+    for (auto const& info : algorithm_info)
+    {
+        if (checksums.find(info.key) != checksums.end())
+        {
+            algorithms |= info.algorithm;
+        }
+    }
+    return algorithms;
+}
+
+ContentHasher::Checksums ContentHasher::hash_file(string const& path, int fd, int algorithms)
+{
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    ContentHasher hasher(algorithms);
+    vector<char> buf(BUF_SIZE);
+    off_t offset = 0;
+    for (;;)
+    {
+        auto bytes_read = pread(fd, buf.data(), buf.size(), offset);
+        if (bytes_read == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;  // LCOV_EXCL_LINE
+            }
+            // LCOV_EXCL_START
+            boost::system::error_code ec(errno, boost::system::system_category());
+            throw boost::filesystem::filesystem_error("pread", path, ec);
+            // LCOV_EXCL_STOP
+        }
+        if (bytes_read == 0)
+        {
+            break;
+        }
+        hasher.update(buf.data(), size_t(bytes_read));
+        offset += bytes_read;
+    }
+    return hasher.result();
+}
+
+ContentHasher::Checksums ContentHasher::load_cached(string const& path, struct stat const& st)
+{
+    char buf[512];
+    auto size = getxattr(path.c_str(), XATTR_NAME, buf, sizeof(buf));
+    if (size <= 0)
+    {
+        return Checksums();
+    }
+    return parse_cached(string(buf, size_t(size)), st);
+}
+
+void ContentHasher::store_cached(int fd, struct stat const& st, Checksums const& checksums)
+{
+    Checksums merged;
+    char buf[512];
+    auto size = fgetxattr(fd, XATTR_NAME, buf, sizeof(buf));
+    if (size > 0)
+    {
+        merged = parse_cached(string(buf, size_t(size)), st);
+    }
+    for (auto const& c : checksums)
+    {
+        merged[c.first] = c.second;
+    }
+
+    string value = version_of(st);
+    for (auto const& c : merged)
+    {
+        value += " " + c.first + "=" + c.second;
+    }
+    fsetxattr(fd, XATTR_NAME, value.data(), value.size(), 0);
+}
+
+bool ContentHasher::same_version(struct stat const& a, struct stat const& b)
+{
+    return a.st_ino == b.st_ino && a.st_size == b.st_size && get_mtime_nsecs(a) == get_mtime_nsecs(b);
+}
+
+uint32_t ContentHasher::crc32c_update(uint32_t crc, void const* data, size_t size)
+{
+    static bool const use_hw = have_crc_instructions();
+
+    auto p = static_cast<unsigned char const*>(data);
+    crc = ~crc;
+    crc = use_hw ? crc32c_hw(crc, p, size) : crc32c_sw(crc, p, size);
+    return ~crc;
+}
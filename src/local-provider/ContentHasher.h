@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/MetadataKeys.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+
+class QCryptographicHash;
+
+// Computes checksums of file contents while the data streams through an upload
+// or download, so we don't have to read the file a second time. The results are
+// hex strings, keyed by the metadata key for the checksum.
+//
+// Checksums are cached in a user xattr of the file, together with the inode number, size,
+// and mtime of the file at the time the checksums were computed, so we can tell when they
+// are stale. (The ctime cannot be part of this, because writing the xattr changes it.)
+
+class ContentHasher
+{
+public:
+    enum Algorithm
+    {
+        md5 = 1 << 0,
+        sha256 = 1 << 1,
+        crc32c = 1 << 2
+    };
+
+    typedef std::map<std::string, std::string> Checksums;
+
+    ContentHasher(int algorithms);  // Bitwise or of Algorithm values.
+    ~ContentHasher();
+
+    ContentHasher(ContentHasher const&) = delete;
+    ContentHasher& operator=(ContentHasher const&) = delete;
+
+    int algorithms() const;
+    void update(void const* data, size_t size);
+    Checksums result() const;
+
+    // Returns the algorithms for the checksum keys that are in keys.
+    static int algorithms_for(unity::storage::provider::MetadataKeys const& keys);
+
+    // Returns the algorithms for which checksums contains a value.
+    static int algorithms_in(Checksums const& checksums);
+
+    // Hashes the contents of the open file. Throws boost::filesystem::filesystem_error if it cannot be read.
+    static Checksums hash_file(std::string const& path, int fd, int algorithms);
+
+    // Returns the cached checksums for the file, or an empty map if there are none
+    // or they were computed for a different version of the file than st describes.
+    static Checksums load_cached(std::string const& path, struct stat const& st);
+
+    // Adds checksums to the cache of the file, which st describes. Errors are ignored
+    // because not all file systems support user xattrs.
+    static void store_cached(int fd, struct stat const& st, Checksums const& checksums);
+
+    // Returns true if a and b describe the same version of a file, as far as the cache is concerned.
+    static bool same_version(struct stat const& a, struct stat const& b);
+
+    // Extends a CRC-32C (Castagnoli) over data. Uses the CPU's CRC instructions if available.
+    static uint32_t crc32c_update(uint32_t crc, void const* data, size_t size);
+
+private:
+    int const algorithms_;
+    std::unique_ptr<QCryptographicHash> md5_;
+    std::unique_ptr<QCryptographicHash> sha256_;
+    uint32_t crc32c_;
+};
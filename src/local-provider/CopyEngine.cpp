@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#include "CopyEngine.h"
+
+#include "utils.h"
+#include <unity/util/ResourcePtr.h>
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+typedef unity::util::ResourcePtr<int, function<void(int)>> FdPtr;
+
+auto const close_fd = [](int fd){ if (fd != -1) ::close(fd); };
+
+[[ noreturn ]]
+void throw_copy_error(string const& what,
+                      boost::filesystem::path const& source,
+                      boost::filesystem::path const& target,
+                      int error)
+{
+    boost::system::error_code ec(error, boost::system::system_category());
+    throw boost::filesystem::filesystem_error(what, source, target, ec);
+}
+
+// Errors that mean "this way of copying is not supported here", as opposed to a real error.
+
+bool is_unsupported(int error)
+{
+    return error == EOPNOTSUPP || error == ENOTTY || error == ENOSYS || error == EXDEV
+           || error == EINVAL || error == EBADF;
+}
+
+}  // namespace
+
+// Copies the files of a directory tree. The calling thread walks the tree, creates
+// the directories, and queues the files. Helpers (borrowed from the bulk lane of the
+// pool as needed, up to max_threads - 1 of them) copy the files. Once the walk is
+// complete, the calling thread helps to copy the remaining files, so the copy completes
+// even if no helper gets to run. The first error stops the copy.
+
+class CopyEngine::TreeCopy
+{
+public:
+    TreeCopy(CopyEngine& engine)
+        : engine_(engine)
+        , helpers_(make_shared<Helpers>())
+    {
+    }
+
+    ~TreeCopy()
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            done_ = true;
+        }
+        cond_.notify_all();
+        wait_for_helpers();
+    }
+
+    void run(boost::filesystem::path const& source, boost::filesystem::path const& target)
+    {
+        try
+        {
+            walk(source, target);
+        }
+        catch (std::exception const&)
+        {
+            set_error(current_exception());
+        }
+        {
+            lock_guard<mutex> lock(mutex_);
+            done_ = true;
+        }
+        cond_.notify_all();
+        copy_files();
+        wait_for_helpers();
+        if (error_)
+        {
+            rethrow_exception(error_);
+        }
+    }
+
+private:
+    struct Job
+    {
+        boost::filesystem::path source;
+        boost::filesystem::path target;
+    };
+
+    // Shared with the helpers we submit to the pool, which may start after we are gone.
+    struct Helpers
+    {
+        mutex m;
+        condition_variable idle;
+        int active = 0;
+        bool closed = false;
+    };
+
+    void walk(boost::filesystem::path const& source, boost::filesystem::path const& target)
+    {
+        using namespace boost::filesystem;
+
+        for (directory_iterator it(source); it != directory_iterator(); ++it)
+        {
+            if (failed())
+            {
+                return;
+            }
+            path const& source_entry = it->path();
+            if (is_reserved_path(source_entry))
+            {
+                continue;  // Don't copy temporary files and directories.
+            }
+            path target_entry = target / source_entry.filename();
+            auto s = it->status();
+            if (is_regular_file(s))
+            {
+                add_job(Job{source_entry, target_entry});
+            }
+            else if (is_directory(s))
+            {
+                copy_directory(source_entry, target_entry);  // Creates the target dir without recursion.
+                walk(source_entry, target_entry);
+            }
+            else
+            {
+                // Ignore everything that's not a directory or file.
+            }
+        }
+    }
+
+    void add_job(Job job)
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            jobs_.push_back(move(job));
+            if (jobs_.size() > size_t(started_) && started_ < engine_.max_threads_ - 1)
+            {
+                add_helper();
+            }
+        }
+        cond_.notify_one();
+    }
+
+    // Called with mutex_ locked.
+
+    void add_helper()
+    {
+        auto helpers = helpers_;
+        try
+        {
+            engine_.pool_.submit(WorkerPool::Lane::bulk, [this, helpers]
+            {
+                {
+                    lock_guard<mutex> lock(helpers->m);
+                    if (helpers->closed)
+                    {
+                        return;
+                    }
+                    ++helpers->active;
+                }
+                copy_files();
+                lock_guard<mutex> lock(helpers->m);
+                if (--helpers->active == 0)
+                {
+                    helpers->idle.notify_one();
+                }
+            });
+            ++started_;
+        }
+        // LCOV_EXCL_START
+        catch (std::exception const&)
+        {
+            started_ = engine_.max_threads_;  // The lane is saturated; we copy with the threads we have.
+        }
+        // LCOV_EXCL_STOP
+    }
+
+    // Helpers that have not started yet must not touch this copy once we return.
+
+    void wait_for_helpers()
+    {
+        unique_lock<mutex> lock(helpers_->m);
+        helpers_->closed = true;
+        helpers_->idle.wait(lock, [this]{ return helpers_->active == 0; });
+    }
+
+    // Copies queued files until the queue is empty and the walk is complete, or until an error occurs.
+
+    void copy_files()
+    {
+        unique_lock<mutex> lock(mutex_);
+        for (;;)
+        {
+            cond_.wait(lock, [this]{ return !jobs_.empty() || done_ || error_; });
+            if (error_ || jobs_.empty())
+            {
+                return;
+            }
+            auto job = move(jobs_.front());
+            jobs_.pop_front();
+            lock.unlock();
+            try
+            {
+                engine_.copy_file(job.source, job.target);
+            }
+            catch (std::exception const&)
+            {
+                set_error(current_exception());
+            }
+            lock.lock();
+        }
+    }
+
+    bool failed()
+    {
+        lock_guard<mutex> lock(mutex_);
+        return bool(error_);
+    }
+
+    void set_error(exception_ptr e)
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (!error_)
+            {
+                error_ = e;
+            }
+        }
+        cond_.notify_all();
+    }
+
+    CopyEngine& engine_;
+    mutex mutex_;
+    condition_variable cond_;
+    deque<Job> jobs_;
+    bool done_ = false;
+    exception_ptr error_;
+    int started_ = 0;
+    shared_ptr<Helpers> const helpers_;
+};
+
+CopyEngine::CopyEngine(WorkerPool& pool, int max_threads)
+    : pool_(pool)
+    , max_threads_(max(1, max_threads))
+    , cloned_(0)
+    , kernel_copied_(0)
+    , buffer_copied_(0)
+{
+}
+
+void CopyEngine::copy_file(boost::filesystem::path const& source, boost::filesystem::path const& target)
+{
+    FdPtr source_fd(open(source.native().c_str(), O_RDONLY | O_CLOEXEC), close_fd);
+    if (source_fd.get() == -1)
+    {
+        throw_copy_error("copy_file", source, target, errno);
+    }
+    struct stat st;
+    if (fstat(source_fd.get(), &st) == -1)
+    {
+        throw_copy_error("copy_file", source, target, errno);  // LCOV_EXCL_LINE
+    }
+    FdPtr target_fd(open(target.native().c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777),
+                    close_fd);
+    if (target_fd.get() == -1)
+    {
+        throw_copy_error("copy_file", source, target, errno);
+    }
+
+    try
+    {
+        if (clone(source_fd.get(), target_fd.get()))
+        {
+            ++cloned_;
+        }
+        else if (kernel_copy(source_fd.get(), target_fd.get(), source, target))
+        {
+            ++kernel_copied_;
+        }
+        else
+        {
+            buffer_copy(source_fd.get(), target_fd.get(), source, target);
+            ++buffer_copied_;
+        }
+    }
+    // LCOV_EXCL_START
+    catch (boost::filesystem::filesystem_error const&)
+    {
+        ::unlink(target.native().c_str());  // Don't leave a partial copy behind.
+        throw;
+    }
+    // LCOV_EXCL_STOP
+}
+
+void CopyEngine::copy_contents(boost::filesystem::path const& source, boost::filesystem::path const& target)
+{
+    TreeCopy(*this).run(source, target);
+}
+
+CopyEngine::Stats CopyEngine::stats() const
+{
+    Stats s;
+    s.cloned = cloned_;
+    s.kernel_copied = kernel_copied_;
+    s.buffer_copied = buffer_copied_;
+    return s;
+}
+
+// Makes the target share the data blocks of the source. Returns false if that
+// is not possible, for example, because the file system does not support it.
+
+bool CopyEngine::clone(int source_fd, int target_fd)
+{
+    return ioctl(target_fd, FICLONE, source_fd) == 0;
+}
+
+// Copies the data inside the kernel. Returns false if the kernel or file system
+// does not support this.
+
+bool CopyEngine::kernel_copy(int source_fd,
+                             int target_fd,
+                             boost::filesystem::path const& source,
+                             boost::filesystem::path const& target)
+{
+#ifdef SYS_copy_file_range
+    static size_t constexpr CHUNK_SIZE = 1024 * 1024 * 1024;
+
+    // We copy until EOF rather than st_size bytes, in case the file changes while we copy.
+    bool copied = false;
+    for (;;)
+    {
+        auto const n = syscall(SYS_copy_file_range, source_fd, nullptr, target_fd, nullptr, CHUNK_SIZE, 0);
+        if (n > 0)
+        {
+            copied = true;
+            continue;
+        }
+        if (n == 0)
+        {
+            return true;
+        }
+        // LCOV_EXCL_START
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (!copied && is_unsupported(errno))
+        {
+            return false;
+        }
+        throw_copy_error("copy_file_range", source, target, errno);
+        // LCOV_EXCL_STOP
+    }
+#else
+    return false;
+#endif
+}
+
+// LCOV_EXCL_START
+void CopyEngine::buffer_copy(int source_fd,
+                             int target_fd,
+                             boost::filesystem::path const& source,
+                             boost::filesystem::path const& target)
+{
+    static size_t constexpr BUF_SIZE = 1024 * 1024;
+
+    vector<char> buf(BUF_SIZE);
+    for (;;)
+    {
+        auto bytes_read = ::read(source_fd, buf.data(), buf.size());
+        if (bytes_read == 0)
+        {
+            return;
+        }
+        if (bytes_read == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw_copy_error("read", source, target, errno);
+        }
+        char const* p = buf.data();
+        while (bytes_read > 0)
+        {
+            auto bytes_written = ::write(target_fd, p, size_t(bytes_read));
+            if (bytes_written == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw_copy_error("write", source, target, errno);
+            }
+            p += bytes_written;
+            bytes_read -= bytes_written;
+        }
+    }
+}
+// LCOV_EXCL_STOP
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#pragma once
+
+#include <unity/storage/provider/WorkerPool.h>
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+// Copies files and directory trees. File data is copied inside the kernel where
+// possible: first as a reflink (FICLONE), which shares the data blocks on file systems
+// such as btrfs and XFS, then with copy_file_range(), and only if neither works with
+// read() and write(). The files in a tree are copied by up to max_threads threads,
+// which are borrowed from the bulk lane of a WorkerPool, so the number of copying
+// threads is bounded for the whole process, not per copy.
+// Errors are reported as boost::filesystem::filesystem_error.
+// This class is thread-safe.
+
+class CopyEngine
+{
+public:
+    struct Stats
+    {
+        int64_t cloned = 0;         // Files that were copied with FICLONE.
+        int64_t kernel_copied = 0;  // Files that were copied with copy_file_range().
+        int64_t buffer_copied = 0;  // Files that were copied with read() and write().
+    };
+
+    CopyEngine(unity::storage::provider::WorkerPool& pool, int max_threads);
+
+    CopyEngine(CopyEngine const&) = delete;
+    CopyEngine& operator=(CopyEngine const&) = delete;
+
+    // Copies source to target, which must not exist.
+    void copy_file(boost::filesystem::path const& source, boost::filesystem::path const& target);
+
+    // Copies the contents of the source directory into the existing target directory.
+    // Anything that has the temp file prefix or is not a file or directory is ignored.
+    void copy_contents(boost::filesystem::path const& source, boost::filesystem::path const& target);
+
+    Stats stats() const;
+
+private:
+    class TreeCopy;
+
+    bool clone(int source_fd, int target_fd);
+    bool kernel_copy(int source_fd,
+                     int target_fd,
+                     boost::filesystem::path const& source,
+                     boost::filesystem::path const& target);
+    void buffer_copy(int source_fd,
+                     int target_fd,
+                     boost::filesystem::path const& source,
+                     boost::filesystem::path const& target);
+
+    unity::storage::provider::WorkerPool& pool_;
+    int const max_threads_;
+    std::atomic<int64_t> cloned_;
+    std::atomic<int64_t> kernel_copied_;
+    std::atomic<int64_t> buffer_copied_;
+};
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "DirectoryReader.h"
+
+#include <boost/filesystem.hpp>
+
+#include <cstring>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+// Layout of the records returned by getdents64(). The name follows the fixed part
+// and is NUL-terminated.
+
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+size_t constexpr BUF_SIZE = 256 * 1024;
+
+[[ noreturn ]]
+void throw_error(char const* what, string const& path)
+{
+    boost::system::error_code ec(errno, boost::system::generic_category());
+    throw boost::filesystem::filesystem_error(what, path, ec);
+}
+
+}  // namespace
+
+DirectoryReader::DirectoryReader(string const& path, int dir_fd, int64_t pos)
+    : path_(path)
+    , dir_fd_(dir_fd)
+    , buf_(BUF_SIZE)
+    , buf_pos_(0)
+    , buf_end_(0)
+    , eof_(false)
+    , pos_(pos)
+{
+    if (pos != 0 && lseek(dir_fd_, off_t(pos), SEEK_SET) == -1)
+    {
+        throw_error("lseek", path_);
+    }
+}
+
+bool DirectoryReader::read(vector<Entry>& entries, size_t max_entries)
+{
+    size_t count = 0;
+    while (count < max_entries)
+    {
+        if (buf_pos_ == buf_end_ && !fill())
+        {
+            return false;
+        }
+        auto const rec = &buf_[buf_pos_];
+        linux_dirent64 d;
+        memcpy(&d, rec, offsetof(linux_dirent64, d_name));
+        buf_pos_ += d.d_reclen;
+        int64_t const pos = pos_;
+        pos_ = d.d_off;
+
+        char const* name = rec + offsetof(linux_dirent64, d_name);
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            continue;
+        }
+        entries.push_back(Entry{name, pos, d.d_off, d.d_type});
+        ++count;
+    }
+    return true;
+}
+
+// Reads the next batch of records into the buffer. Returns false at the end of the directory.
+
+bool DirectoryReader::fill()
+{
+    if (eof_)
+    {
+        return false;
+    }
+    for (;;)
+    {
+        auto bytes = syscall(SYS_getdents64, dir_fd_, buf_.data(), buf_.size());
+        if (bytes == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;  // LCOV_EXCL_LINE
+            }
+            throw_error("getdents64", path_);  // LCOV_EXCL_LINE
+        }
+        if (bytes == 0)
+        {
+            eof_ = true;
+            return false;
+        }
+        buf_pos_ = 0;
+        buf_end_ = size_t(bytes);
+        return true;
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reads the entries of a directory with getdents64(), which returns many entries per
+// system call. Each entry carries the directory position that follows it, so a later
+// reader can resume after that entry, even with a different file descriptor.
+
+class DirectoryReader
+{
+public:
+    struct Entry
+    {
+        std::string name;
+        int64_t pos;         // Position of this entry.
+        int64_t next_pos;    // Position of the entry that follows this one.
+        unsigned char type;  // DT_REG, DT_DIR, etc., or DT_UNKNOWN
+    };
+
+    // Starts reading at pos, which must be 0 or the next_pos of an entry. dir_fd must be
+    // a directory that was opened for reading. Throws boost::filesystem::filesystem_error
+    // if pos is invalid.
+    DirectoryReader(std::string const& path, int dir_fd, int64_t pos = 0);
+
+    DirectoryReader(DirectoryReader const&) = delete;
+    DirectoryReader& operator=(DirectoryReader const&) = delete;
+
+    // Appends up to max_entries entries (other than "." and "..") to entries.
+    // Returns false if the end of the directory was reached before max_entries entries
+    // were read. Throws boost::filesystem::filesystem_error if the directory cannot be read.
+    bool read(std::vector<Entry>& entries, size_t max_entries);
+
+private:
+    bool fill();
+
+    std::string const path_;
+    int const dir_fd_;
+    std::vector<char> buf_;
+    size_t buf_pos_;
+    size_t buf_end_;
+    bool eof_;
+    int64_t pos_;
+};
@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "GroupCommit.h"
+
+#include <unity/storage/internal/safe_strerror.h>
+#include <unity/storage/provider/Exceptions.h>
+#include <unity/util/ResourcePtr.h>
+
+#include <boost/throw_exception.hpp>
+
+#include <cstdio>
+#include <map>
+#include <set>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+typedef unity::util::ResourcePtr<int, function<void(int)>> FdPtr;
+
+auto const close_fd = [](int fd){ if (fd != -1) ::close(fd); };
+
+[[ noreturn ]]
+void throw_sync_error(string const& msg, int error)
+{
+    if (error == ENOSPC || error == EDQUOT)
+    {
+        BOOST_THROW_EXCEPTION(QuotaException(msg));  // LCOV_EXCL_LINE
+    }
+    BOOST_THROW_EXCEPTION(ResourceException(msg, error));  // LCOV_EXCL_LINE
+}
+
+// syncfs() returns writeback errors only since Linux 5.8.
+
+bool syncfs_reports_errors()
+{
+    struct utsname u;
+    int major = 0;
+    int minor = 0;
+    if (uname(&u) == -1 || sscanf(u.release, "%d.%d", &major, &minor) != 2)
+    {
+        return false;  // LCOV_EXCL_LINE
+    }
+    return major > 5 || (major == 5 && minor >= 8);
+}
+
+}  // namespace
+
+GroupCommit::GroupCommit(Durability durability, WorkerPool& pool)
+    : durability_(durability)
+    , pool_(pool)
+    , syncfs_reports_errors_(syncfs_reports_errors())
+    , stopped_(false)
+    , stats_()
+{
+    if (durability_ != Durability::none)
+    {
+        thread_ = thread(&GroupCommit::run, this);
+    }
+}
+
+GroupCommit::~GroupCommit()
+{
+    if (thread_.joinable())
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        cond_.notify_one();
+        thread_.join();  // The thread commits whatever is still pending before it returns.
+    }
+}
+
+Durability GroupCommit::durability() const
+{
+    return durability_;
+}
+
+void GroupCommit::commit(int fd, string const& dir, LinkFunc const& link, DoneFunc const& done)
+{
+    Request request{fd, dir, link, done, chrono::steady_clock::now(), nullptr};
+
+    if (durability_ == Durability::none)
+    {
+        try
+        {
+            link();
+        }
+        catch (std::exception const&)
+        {
+            request.error = current_exception();
+        }
+        record(request, true);
+        done(request.error);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        pending_.emplace_back(move(request));
+    }
+    cond_.notify_one();
+}
+
+GroupCommit::Stats GroupCommit::stats() const
+{
+    lock_guard<mutex> lock(mutex_);
+    return stats_;
+}
+
+void GroupCommit::run()
+{
+    unique_lock<mutex> lock(mutex_);
+    for (;;)
+    {
+        cond_.wait(lock, [this]{ return !pending_.empty() || stopped_; });
+        if (pending_.empty())
+        {
+            return;  // Stopped, and nothing left to commit.
+        }
+        vector<Request> batch;
+        batch.swap(pending_);
+        lock.unlock();
+        commit_batch(batch);
+        lock.lock();
+    }
+}
+
+void GroupCommit::commit_batch(vector<Request>& batch)
+{
+    using namespace unity::storage::internal;
+
+    // Sync the data of each file and link it into place. With a large batch, it is cheaper to flush
+    // each file system once. If syncfs() fails, we fall back to fdatasync() for the files on that file system.
+    // Otherwise, we start writeback for all files before waiting for the first, so the disk does not idle
+    // between files. Any error in the writeback is reported by fdatasync().
+    bool const use_syncfs = batch.size() >= SYNCFS_THRESHOLD;
+    if (!use_syncfs)
+    {
+        for (auto const& r : batch)
+        {
+            sync_file_range(r.fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        }
+    }
+    map<dev_t, bool> synced_devs;
+    int64_t syncfs_calls = 0;
+    for (auto& r : batch)
+    {
+        try
+        {
+            bool synced = false;
+            struct stat st;
+            if (use_syncfs && fstat(r.fd, &st) == 0)
+            {
+                auto it = synced_devs.find(st.st_dev);
+                if (it == synced_devs.end())
+                {
+                    it = synced_devs.emplace(st.st_dev, syncfs(r.fd) == 0).first;
+                    ++syncfs_calls;
+                }
+                synced = it->second && syncfs_reports_errors_;
+            }
+            if (!synced && fdatasync(r.fd) == -1)
+            {
+                // LCOV_EXCL_START
+                throw_sync_error("finish(): fdatasync() failed: " + safe_strerror(errno), errno);
+                // LCOV_EXCL_STOP
+            }
+            r.link();
+        }
+        catch (std::exception const&)
+        {
+            r.error = current_exception();
+        }
+    }
+
+    // Sync each parent folder once, so the new names are durable, too.
+    if (durability_ == Durability::full)
+    {
+        set<string> dirs;
+        for (auto const& r : batch)
+        {
+            if (!r.error)
+            {
+                dirs.insert(r.dir);
+            }
+        }
+        map<string, exception_ptr> dir_errors;
+        for (auto const& dir : dirs)
+        {
+            FdPtr fd(open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC), close_fd);
+            if (fd.get() == -1 || fsync(fd.get()) == -1)
+            {
+                // LCOV_EXCL_START
+                try
+                {
+                    throw_sync_error("finish(): cannot sync \"" + dir + "\": " + safe_strerror(errno), errno);
+                }
+                catch (std::exception const&)
+                {
+                    dir_errors[dir] = current_exception();
+                }
+                // LCOV_EXCL_STOP
+            }
+        }
+        for (auto& r : batch)
+        {
+            auto it = dir_errors.find(r.dir);
+            if (!r.error && it != dir_errors.end())
+            {
+                r.error = it->second;  // LCOV_EXCL_LINE
+            }
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        stats_.syncfs_calls += syncfs_calls;
+    }
+    bool new_batch = true;
+    for (auto const& r : batch)
+    {
+        record(r, new_batch);
+        new_batch = false;
+        complete(r);
+    }
+}
+
+// Completions can take a while (the upload job stats the file and looks up its content type),
+// so we hand them to the pool and get on with the next batch.
+
+void GroupCommit::complete(Request const& request)
+{
+    auto const done = request.done;
+    auto const error = request.error;
+    try
+    {
+        pool_.submit(WorkerPool::Lane::metadata, [done, error]{ done(error); });
+    }
+    // LCOV_EXCL_START
+    catch (std::exception const&)
+    {
+        done(error);  // The lane is saturated.
+    }
+    // LCOV_EXCL_STOP
+}
+
+void GroupCommit::record(Request const& request, bool new_batch)
+{
+    auto latency = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - request.start_time);
+
+    lock_guard<mutex> lock(mutex_);
+    if (new_batch)
+    {
+        ++stats_.batches;
+    }
+    ++stats_.files;
+    stats_.total_latency += latency;
+    stats_.max_latency = max(stats_.max_latency, latency);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/WorkerPool.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How hard finish() tries to make an uploaded file survive a crash or power failure.
+
+enum class Durability
+{
+    none,  // Leave it to the kernel to write the data back eventually.
+    data,  // Sync the file's data before the file appears under its final name.
+    full   // As for data, and also sync the parent folder, so the new name survives, too.
+};
+
+// Syncs uploaded files and links them into place. Uploads that finish while a batch
+// is being synced are collected into the next batch, so concurrent uploads share the
+// cost of the disk flushes instead of each waiting for its own. We start writeback for
+// all files of a batch before we wait for any of them, so the disk works on them together.
+// For a large batch, we call syncfs() once per file system instead of fdatasync() for
+// every file. (Before Linux 5.8, syncfs() does not report writeback errors, so we still
+// call fdatasync() for each file, which is cheap once the data is on disk.) Completions run
+// on the metadata lane of the worker pool, so they do not hold up the next batch. With
+// durability none, commit() does all the work immediately, on the calling thread.
+// This class is thread-safe.
+
+class GroupCommit
+{
+public:
+    // Moves the synced file into place. Throws a StorageException on error.
+    typedef std::function<void()> LinkFunc;
+
+    // Called with the exception thrown by the sync or link (if any) once the batch is done.
+    typedef std::function<void(std::exception_ptr)> DoneFunc;
+
+    struct Stats
+    {
+        int64_t batches;
+        int64_t files;
+        int64_t syncfs_calls;
+        std::chrono::nanoseconds total_latency;  // From commit() until done is called.
+        std::chrono::nanoseconds max_latency;
+    };
+
+    GroupCommit(Durability durability, unity::storage::provider::WorkerPool& pool);
+    ~GroupCommit();
+
+    GroupCommit(GroupCommit const&) = delete;
+    GroupCommit& operator=(GroupCommit const&) = delete;
+
+    Durability durability() const;
+
+    // fd is the file to sync and dir the folder it is linked into. The fd must remain
+    // open until done is called. link is called on the commit thread, and done on a
+    // thread of the pool (or on the commit thread if the metadata lane is full).
+    void commit(int fd, std::string const& dir, LinkFunc const& link, DoneFunc const& done);
+
+    Stats stats() const;
+
+    // Batches with at least this many files use syncfs() instead of fdatasync().
+    static size_t constexpr SYNCFS_THRESHOLD = 16;
+
+private:
+    struct Request
+    {
+        int fd;
+        std::string dir;
+        LinkFunc link;
+        DoneFunc done;
+        std::chrono::steady_clock::time_point start_time;
+        std::exception_ptr error;
+    };
+
+    void run();
+    void commit_batch(std::vector<Request>& batch);
+    void record(Request const& request, bool new_batch);
+    void complete(Request const& request);
+
+    Durability const durability_;
+    unity::storage::provider::WorkerPool& pool_;
+    bool const syncfs_reports_errors_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<Request> pending_;
+    bool stopped_;
+    Stats stats_;
+    std::thread thread_;  // Not started for durability none.
+};
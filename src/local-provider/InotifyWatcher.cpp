@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "InotifyWatcher.h"
+
+#include "utils.h"
+
+#include <unity/storage/internal/safe_strerror.h>
+
+#include <QDebug>
+
+#include <cassert>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace unity::storage;
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+// Changes are delivered this long after the first change of a batch, or once the batch is full.
+constexpr chrono::milliseconds BATCH_WINDOW{100};
+constexpr size_t MAX_BATCH_SIZE = 1000;
+
+// How long ignore_attrib_change() waits for the event, in case the attribute change failed.
+constexpr chrono::milliseconds IGNORE_ATTRIB_TIMEOUT{1000};
+
+constexpr uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO
+                                | IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+void close_fd(int fd)
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+}
+
+}  // namespace
+
+InotifyWatcher::InotifyWatcher(boost::filesystem::path const& root,
+                               Callback const& on_changes,
+                               OverflowCallback const& on_overflow,
+                               FailureCallback const& on_failure)
+    : root_(root.native())
+    , on_changes_(on_changes)
+    , on_overflow_(on_overflow)
+    , on_failure_(on_failure)
+    , inotify_fd_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC), close_fd)
+    , stop_fd_(eventfd(0, EFD_CLOEXEC), close_fd)
+    , failed_(false)
+{
+    assert(on_changes);
+    assert(on_overflow);
+    assert(on_failure);
+
+    if (inotify_fd_.get() == -1)
+    {
+        throw boost::filesystem::filesystem_error("InotifyWatcher(): inotify_init1() failed", root,
+            boost::system::error_code(errno, boost::system::system_category()));
+    }
+    if (stop_fd_.get() == -1)
+    {
+        throw boost::filesystem::filesystem_error("InotifyWatcher(): eventfd() failed", root,
+            boost::system::error_code(errno, boost::system::system_category()));
+    }
+    thread_ = thread(&InotifyWatcher::run, this);
+}
+
+InotifyWatcher::~InotifyWatcher()
+{
+    uint64_t one = 1;
+    if (write(stop_fd_.get(), &one, sizeof(one)) != sizeof(one))
+    {
+        abort();  // LCOV_EXCL_LINE  // Impossible for an eventfd.
+    }
+    thread_.join();
+}
+
+void InotifyWatcher::run()
+{
+    // inotify_event contains an int, so the buffer must be suitably aligned.
+    alignas(inotify_event) char buf[64 * 1024];
+
+    // Watching a large tree takes a while, so we don't do this in the constructor.
+    failed_ = !add_watches(root_);
+
+    for (;;)
+    {
+        if (failed_)
+        {
+            // We would miss changes in the directories we cannot watch, so we report
+            // what we have and give up instead of reporting only some changes.
+            flush();
+            for (auto const& w : watches_)
+            {
+                inotify_rm_watch(inotify_fd_.get(), w.first);
+            }
+            watches_.clear();
+            on_failure_();
+            return;
+        }
+
+        int timeout = -1;
+        if (!pending_.empty())
+        {
+            auto const remaining = flush_time_ - chrono::steady_clock::now();
+            timeout = max(0, int(chrono::duration_cast<chrono::milliseconds>(remaining).count()));
+        }
+
+        struct pollfd fds[2] = { { inotify_fd_.get(), POLLIN, 0 }, { stop_fd_.get(), POLLIN, 0 } };
+        int rc = poll(fds, 2, timeout);
+        // LCOV_EXCL_START
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            string msg = "InotifyWatcher: poll() failed: " + unity::storage::internal::safe_strerror(errno);
+            qCritical().noquote() << msg.c_str();
+            return;
+        }
+        // LCOV_EXCL_STOP
+        if (fds[1].revents != 0)
+        {
+            return;
+        }
+        if (rc == 0)
+        {
+            flush();
+            continue;
+        }
+
+        ssize_t len;
+        while ((len = read(inotify_fd_.get(), buf, sizeof(buf))) > 0)
+        {
+            for (char* p = buf; p < buf + len; )
+            {
+                auto const event = reinterpret_cast<inotify_event const*>(p);
+                handle_event(*event);
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (pending_.size() >= MAX_BATCH_SIZE)
+        {
+            flush();
+        }
+    }
+}
+
+// Adds a watch for dir and all directories below it. Returns false if we ran out of watches.
+
+bool InotifyWatcher::add_watches(string const& dir)
+{
+    int wd = inotify_add_watch(inotify_fd_.get(), dir.c_str(), WATCH_MASK);
+    if (wd == -1)
+    {
+        if (errno == ENOSPC)
+        {
+            qWarning().noquote() << "InotifyWatcher: cannot watch" << dir.c_str()
+                                 << "(increase fs.inotify.max_user_watches to watch more directories)";
+            return false;
+        }
+        return true;  // The directory may have disappeared already.
+    }
+    watches_[wd] = dir;
+
+    unique_ptr<DIR, int(*)(DIR*)> d(opendir(dir.c_str()), closedir);
+    if (!d)
+    {
+        return true;
+    }
+    while (auto entry = readdir(d.get()))
+    {
+        string const name = entry->d_name;
+        if (name == "." || name == ".." || is_reserved_path(name))
+        {
+            continue;
+        }
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN)
+        {
+            // LCOV_EXCL_START
+            struct stat st;
+            is_dir = fstatat(dirfd(d.get()), name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            // LCOV_EXCL_STOP
+        }
+        if (is_dir && !add_watches(dir + "/" + name))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Removes the watches for dir and all directories below it.
+
+void InotifyWatcher::remove_watches(string const& dir)
+{
+    string const prefix = dir + "/";
+    for (auto it = watches_.begin(); it != watches_.end(); )
+    {
+        if (it->second == dir || it->second.compare(0, prefix.size(), prefix) == 0)
+        {
+            inotify_rm_watch(inotify_fd_.get(), it->first);
+            it = watches_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void InotifyWatcher::handle_event(inotify_event const& event)
+{
+    if (event.mask & IN_Q_OVERFLOW)
+    {
+        // We lost events, so all we can tell clients is to re-read everything.
+        qWarning() << "InotifyWatcher: event queue overflow for" << root_.c_str();
+        flush();
+        on_overflow_();
+        return;
+    }
+    if (event.mask & IN_IGNORED)
+    {
+        watches_.erase(event.wd);  // Directory was deleted or its watch was removed.
+        return;
+    }
+
+    auto it = watches_.find(event.wd);
+    if (it == watches_.end() || event.len == 0)
+    {
+        return;  // Event for a watch we removed already, or for the watched directory itself.
+    }
+    string const parent_id = it->second;
+    string const name = event.name;
+    if (is_reserved_path(name))
+    {
+        return;
+    }
+    string const item_id = parent_id + "/" + name;
+
+    if (event.mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        if ((event.mask & IN_ISDIR) && !add_watches(item_id))
+        {
+            failed_ = true;
+        }
+        add_change(item_id, parent_id, ChangeType::created);
+    }
+    else if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        if (event.mask & IN_ISDIR)
+        {
+            remove_watches(item_id);
+        }
+        add_change(item_id, parent_id, ChangeType::deleted);
+    }
+    else
+    {
+        if ((event.mask & IN_ATTRIB) && is_ignored_attrib_change(item_id))
+        {
+            return;
+        }
+        add_change(item_id, parent_id, ChangeType::changed);
+    }
+}
+
+void InotifyWatcher::ignore_attrib_change(string const& item_id)
+{
+    auto const now = chrono::steady_clock::now();
+    lock_guard<mutex> lock(ignored_mutex_);
+    for (auto it = ignored_attribs_.begin(); it != ignored_attribs_.end(); )
+    {
+        it = it->second <= now ? ignored_attribs_.erase(it) : next(it);
+    }
+    ignored_attribs_[item_id] = now + IGNORE_ATTRIB_TIMEOUT;
+}
+
+bool InotifyWatcher::is_ignored_attrib_change(string const& item_id)
+{
+    lock_guard<mutex> lock(ignored_mutex_);
+    auto it = ignored_attribs_.find(item_id);
+    if (it == ignored_attribs_.end())
+    {
+        return false;
+    }
+    bool const ignored = it->second > chrono::steady_clock::now();
+    ignored_attribs_.erase(it);
+    return ignored;
+}
+
+void InotifyWatcher::add_change(string const& item_id, string const& parent_id, ChangeType type)
+{
+    if (pending_.empty())
+    {
+        flush_time_ = chrono::steady_clock::now() + BATCH_WINDOW;
+    }
+    auto it = pending_.find(item_id);
+    if (it == pending_.end())
+    {
+        pending_.emplace(item_id, ItemChange{item_id, parent_id, type});
+        return;
+    }
+    auto const merged = merge_changes(it->second.type, type);
+    if (merged == ChangeType::LAST_ENTRY__)
+    {
+        pending_.erase(it);
+    }
+    else
+    {
+        it->second.type = merged;
+    }
+}
+
+void InotifyWatcher::flush()
+{
+    if (pending_.empty())
+    {
+        return;
+    }
+    ItemChangeList changes;
+    changes.reserve(pending_.size());
+    for (auto const& p : pending_)
+    {
+        changes.push_back(p.second);
+    }
+    pending_.clear();
+    on_changes_(changes);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/Item.h>
+#include <unity/util/ResourcePtr.h>
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct inotify_event;
+
+// Watches a directory tree with inotify and reports changes to the items in the tree.
+// Changes that occur within a short window are coalesced per item (for example, a file
+// that is created and then written to is reported once, as created) and delivered as a
+// single batch. Newly created directories are watched as they appear; reserved paths are
+// ignored. If the kernel drops events, the watcher delivers the changes it has and calls
+// on_overflow, so the provider can tell clients to re-list the tree.
+// The watches are added by the watcher's thread, so the constructor does not walk the tree.
+// If a directory cannot be watched because the inotify watch limit is reached, the watcher
+// calls on_failure and stops; from then on, changes are no longer reported.
+// The callbacks are invoked on the watcher's thread. The provider's own attribute changes
+// (such as caching checksums in an xattr) can be excluded with ignore_attrib_change().
+
+class InotifyWatcher
+{
+public:
+    typedef std::function<void(unity::storage::provider::ItemChangeList const&)> Callback;
+    typedef std::function<void()> OverflowCallback;
+    typedef std::function<void()> FailureCallback;
+
+    InotifyWatcher(boost::filesystem::path const& root,
+                   Callback const& on_changes,
+                   OverflowCallback const& on_overflow,
+                   FailureCallback const& on_failure);
+    ~InotifyWatcher();
+
+    InotifyWatcher(InotifyWatcher const&) = delete;
+    InotifyWatcher& operator=(InotifyWatcher const&) = delete;
+
+    // Do not report the next attribute-only change of item_id. Call this before changing
+    // an attribute that clients do not see. Thread-safe.
+    void ignore_attrib_change(std::string const& item_id);
+
+private:
+    typedef unity::util::ResourcePtr<int, std::function<void(int)>> FdPtr;
+
+    void run();
+    bool add_watches(std::string const& dir);
+    void remove_watches(std::string const& dir);
+    void handle_event(inotify_event const& event);
+    bool is_ignored_attrib_change(std::string const& item_id);
+    void add_change(std::string const& item_id, std::string const& parent_id, unity::storage::ChangeType type);
+    void flush();
+
+    std::string const root_;
+    Callback const on_changes_;
+    OverflowCallback const on_overflow_;
+    FailureCallback const on_failure_;
+    FdPtr inotify_fd_;
+    FdPtr stop_fd_;
+
+    // Only accessed by the watcher thread once it is running.
+    std::unordered_map<int, std::string> watches_;  // Watch descriptor -> directory
+    std::map<std::string, unity::storage::provider::ItemChange> pending_;
+    std::chrono::steady_clock::time_point flush_time_;
+    bool failed_;  // Set if a directory could not be watched.
+
+    std::mutex ignored_mutex_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> ignored_attribs_;  // -> Expiry time
+
+    std::thread thread_;
+};
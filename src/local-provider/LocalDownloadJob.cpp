@@ -20,9 +20,16 @@
 
 #include "LocalProvider.h"
 #include "utils.h"
+#include <unity/storage/internal/EnvVars.h>
 #include <unity/storage/internal/safe_strerror.h>
 #include <unity/storage/provider/Exceptions.h>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+
 using namespace unity::storage::provider;
 using namespace std;
 
@@ -32,15 +39,29 @@ string const method = "download()";
 
 LocalDownloadJob::LocalDownloadJob(shared_ptr<LocalProvider> const& provider,
                                    string const& item_id,
-                                   string const& match_etag)
+                                   string const& match_etag,
+                                   int64_t offset,
+                                   int64_t length)
     : DownloadJob(to_string(++next_download_id))
     , provider_(provider)
     , item_id_(item_id)
+    , offset_(offset)
+    , hashed_st_()
+    , zero_copy_(unity::storage::internal::EnvVars::local_provider_zero_copy())
+    , send_socket_([](int fd){ if (fd != -1) ::close(fd); })
+    , stop_fd_([](int fd){ if (fd != -1) ::close(fd); })
+    , stop_(false)
+    , send_file_result_(send_complete)
 {
     using namespace boost::filesystem;
 
     // Sanitize parameters.
     provider_->throw_if_not_valid(method, item_id_);
+    if (offset < 0 || length < -1)
+    {
+        throw InvalidArgumentException(method + ": invalid range: offset = " + to_string(offset)
+                                       + ", length = " + to_string(length));
+    }
     try
     {
         auto st = status(item_id_);
@@ -73,7 +94,45 @@ LocalDownloadJob::LocalDownloadJob(shared_ptr<LocalProvider> const& provider,
                                 ": cannot open \"" + item_id + "\": " + file_->errorString().toStdString(),
                                 file_->error());
     }
-    bytes_to_write_ = file_->size();
+    int64_t const file_size = file_->size();
+    if (offset > file_size)
+    {
+        throw InvalidArgumentException(method + ": offset " + to_string(offset) + " is beyond the end of \""
+                                       + item_id + "\" (size = " + to_string(file_size) + ")");
+    }
+    download_size_ = length < 0 ? file_size - offset : min(length, file_size - offset);
+    partial_ = download_size_ != file_size;
+    bytes_to_read_ = download_size_;
+    bytes_to_write_ = download_size_;
+
+    if (!partial_ && unity::storage::internal::EnvVars::local_provider_hash_downloads())
+    {
+        if (fstat(file_->handle(), &hashed_st_) == 0)
+        {
+            auto cached = ContentHasher::load_cached(item_id_, hashed_st_);
+            int const algorithms = (ContentHasher::md5 | ContentHasher::crc32c)
+                                   & ~ContentHasher::algorithms_in(cached);
+            if (algorithms != 0)
+            {
+                hasher_.reset(new ContentHasher(algorithms));
+            }
+        }
+    }
+
+    if (zero_copy_)
+    {
+        start_send_file();
+        return;
+    }
+
+    if (offset > 0 && !file_->seek(offset))
+    {
+        // LCOV_EXCL_START
+        throw_storage_exception(method,
+                                ": cannot seek in \"" + item_id + "\": " + file_->errorString().toStdString(),
+                                file_->error());
+        // LCOV_EXCL_STOP
+    }
 
     // Make write socket ready.
     int dup_fd = dup(write_socket());
@@ -91,10 +150,14 @@ LocalDownloadJob::LocalDownloadJob(shared_ptr<LocalProvider> const& provider,
     QMetaObject::invokeMethod(this, "read_and_write_chunk", Qt::QueuedConnection);
 }
 
-LocalDownloadJob::~LocalDownloadJob() = default;
+LocalDownloadJob::~LocalDownloadJob()
+{
+    stop_send_file();
+}
 
 boost::future<void> LocalDownloadJob::cancel()
 {
+    stop_send_file();
     disconnect(&write_socket_, nullptr, this, nullptr);
     write_socket_.abort();
     file_->close();
@@ -105,10 +168,10 @@ boost::future<void> LocalDownloadJob::finish()
 {
     if (bytes_to_write_ > 0)
     {
-        auto file_size = file_->size();
-        auto written = file_size - bytes_to_write_;
-        string msg = "finish() method called too early, file \"" + item_id_ + "\" has size "
-                     + to_string(file_size) + " but only " + to_string(written) + " bytes were consumed";
+        auto written = download_size_ - bytes_to_write_;
+        string msg = string("finish() method called too early, ") + (partial_ ? "range of " : "") + "file \""
+                     + item_id_ + "\" has size " + to_string(download_size_) + " but only "
+                     + to_string(written) + " bytes were consumed";
         cancel();
         return boost::make_exceptional_future<void>(LogicException(msg));
     }
@@ -131,14 +194,20 @@ void LocalDownloadJob::read_and_write_chunk()
 
     if (bytes_to_write_ == 0)
     {
+        cache_checksums();
         file_->close();
         write_socket_.close();
         report_complete();
         return;
     }
 
+    if (bytes_to_read_ == 0)
+    {
+        return;  // The last chunk is still on its way to the client.
+    }
+
     QByteArray buf;
-    buf.resize(READ_SIZE);
+    buf.resize(int(min(READ_SIZE, qint64(bytes_to_read_))));
     auto bytes_read = file_->read(buf.data(), buf.size());
     try
     {
@@ -149,7 +218,19 @@ void LocalDownloadJob::read_and_write_chunk()
             throw_storage_exception(method, msg, file_->error());
             // LCOV_EXCL_STOP
         }
+        if (bytes_read == 0)
+        {
+            // LCOV_EXCL_START
+            string msg = method + ": \"" + item_id_ + "\": file was truncated during download";
+            throw ResourceException(msg, 0);
+            // LCOV_EXCL_STOP
+        }
         buf.resize(bytes_read);
+        bytes_to_read_ -= bytes_read;
+        if (hasher_)
+        {
+            hasher_->update(buf.constData(), size_t(bytes_read));
+        }
 
         auto bytes_written = write_socket_.write(buf);
         if (bytes_written == -1)
@@ -177,3 +258,239 @@ void LocalDownloadJob::read_and_write_chunk()
     }
     // LCOV_EXCL_STOP
 }
+
+// Start the thread that sends the file with sendfile(). sendfile() moves the data
+// inside the kernel, so it is neither copied into user space nor through the event loop.
+
+void LocalDownloadJob::start_send_file()
+{
+    using namespace unity::storage::internal;
+
+    int dup_fd = fcntl(write_socket(), F_DUPFD_CLOEXEC, 0);
+    if (dup_fd == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = "LocalDownloadJob(): dup() failed: " + safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    send_socket_.reset(dup_fd);
+    // The socket is non-blocking so we can wait for it to become writable or for
+    // a request to stop, whichever comes first.
+    int flags = fcntl(dup_fd, F_GETFL);
+    if (flags == -1 || fcntl(dup_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = "LocalDownloadJob(): cannot set O_NONBLOCK: " + safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    stop_fd_.reset(eventfd(0, EFD_CLOEXEC));
+    if (stop_fd_.get() == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = "LocalDownloadJob(): eventfd() failed: " + safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    send_file_thread_ = thread(&LocalDownloadJob::send_file, this);
+}
+
+// Runs on the send file thread. Once all data is written, or if something goes wrong,
+// we hand back to the main thread, which reports the outcome.
+
+void LocalDownloadJob::send_file()
+{
+    using namespace unity::storage::internal;
+
+    static int64_t constexpr SEND_SIZE = 4 * 1024 * 1024;
+
+    // If the client goes away, we want EPIPE instead of a signal.
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, nullptr);
+
+    try
+    {
+        while (bytes_to_write_ > 0 && !stop_)
+        {
+            off_t offset = offset_;
+            auto bytes_sent = sendfile(send_socket_.get(), file_->handle(), &offset,
+                                       size_t(min(int64_t(bytes_to_write_), SEND_SIZE)));
+            if (bytes_sent > 0)
+            {
+                if (hasher_)
+                {
+                    hash_sent_data(offset_, bytes_sent);
+                }
+                offset_ += bytes_sent;
+                bytes_to_write_ -= bytes_sent;
+                continue;
+            }
+            if (bytes_sent == 0)
+            {
+                // LCOV_EXCL_START
+                string msg = method + ": \"" + item_id_ + "\": file was truncated during download";
+                throw ResourceException(msg, 0);
+                // LCOV_EXCL_STOP
+            }
+            switch (errno)
+            {
+                case EINTR:
+                    break;
+                case EAGAIN:
+                    if (!wait_until_writable())
+                    {
+                        return;  // We were asked to stop.
+                    }
+                    break;
+                case EPIPE:
+                case ECONNRESET:
+                    // The client closed the socket. We leave it to finish() or cancel()
+                    // to report this, the same as for the event loop path.
+                    send_file_result_ = send_aborted;
+                    send_socket_.dealloc();
+                    QMetaObject::invokeMethod(this, "on_send_file_done", Qt::QueuedConnection);
+                    return;
+                default:
+                {
+                    // LCOV_EXCL_START
+                    string msg = method + ": \"" + item_id_ + "\": sendfile() failed: " + safe_strerror(errno);
+                    throw ResourceException(msg, errno);
+                    // LCOV_EXCL_STOP
+                }
+            }
+        }
+        if (stop_)
+        {
+            return;
+        }
+        send_file_result_ = send_complete;
+    }
+    // LCOV_EXCL_START
+    catch (std::exception const&)
+    {
+        send_file_result_ = send_error;
+        send_file_error_ = current_exception();
+    }
+    // LCOV_EXCL_STOP
+    send_socket_.dealloc();
+    QMetaObject::invokeMethod(this, "on_send_file_done", Qt::QueuedConnection);
+}
+
+// Wait until we can write to the socket. Returns false if we were asked to stop instead.
+
+bool LocalDownloadJob::wait_until_writable()
+{
+    struct pollfd fds[2];
+    fds[0].fd = send_socket_.get();
+    fds[0].events = POLLOUT;
+    fds[1].fd = stop_fd_.get();
+    fds[1].events = POLLIN;
+    while (!stop_)
+    {
+        if (poll(fds, 2, -1) > 0)
+        {
+            // We return true for POLLERR and POLLHUP, too, so the next sendfile() reports the error.
+            return !stop_ && fds[1].revents == 0;
+        }
+    }
+    return false;
+}
+
+// Ask the send file thread to stop and wait for it to finish. Called on the main thread.
+
+void LocalDownloadJob::stop_send_file()
+{
+    if (!send_file_thread_.joinable())
+    {
+        return;
+    }
+    stop_ = true;
+    uint64_t one = 1;
+    if (::write(stop_fd_.get(), &one, sizeof(one)) != sizeof(one))
+    {
+        abort();  // LCOV_EXCL_LINE  // Impossible
+    }
+    send_file_thread_.join();
+    send_socket_.dealloc();
+}
+
+void LocalDownloadJob::on_send_file_done()
+{
+    if (send_file_thread_.joinable())
+    {
+        send_file_thread_.join();
+    }
+    else
+    {
+        return;  // LCOV_EXCL_LINE  // cancel() got here first.
+    }
+    switch (send_file_result_)
+    {
+        case send_complete:
+            cache_checksums();
+            file_->close();
+            report_complete();
+            break;
+        // LCOV_EXCL_START
+        case send_error:
+            file_->close();
+            report_error(send_file_error_);
+            break;
+        // LCOV_EXCL_STOP
+        case send_aborted:
+            break;  // finish() or cancel() will report the error.
+        default:
+            abort();  // LCOV_EXCL_LINE  // Impossible
+    }
+}
+
+// Runs on the send file thread. sendfile() does not pass the data through user space, so
+// we read what was sent once more to hash it. The data is still in the page cache, so this
+// costs a single copy, which is less than the event loop path makes.
+
+void LocalDownloadJob::hash_sent_data(int64_t offset, int64_t bytes)
+{
+    using namespace unity::storage::internal;
+
+    static size_t constexpr HASH_BUF_SIZE = 256 * 1024;
+
+    hash_buf_.resize(HASH_BUF_SIZE);
+    while (bytes > 0)
+    {
+        auto const max_bytes = size_t(min(bytes, int64_t(hash_buf_.size())));
+        auto bytes_read = pread(file_->handle(), hash_buf_.data(), max_bytes, offset);
+        if (bytes_read <= 0)
+        {
+            // LCOV_EXCL_START
+            if (bytes_read == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            hasher_.reset();  // Not fatal, we just don't cache the checksums.
+            return;
+            // LCOV_EXCL_STOP
+        }
+        hasher_->update(hash_buf_.data(), size_t(bytes_read));
+        offset += bytes_read;
+        bytes -= bytes_read;
+    }
+}
+
+// Called on the main thread once the whole file was sent.
+
+void LocalDownloadJob::cache_checksums()
+{
+    if (!hasher_)
+    {
+        return;
+    }
+    struct stat st;
+    if (fstat(file_->handle(), &st) == 0 && ContentHasher::same_version(st, hashed_st_))
+    {
+        provider_->ignore_attrib_change(item_id_);
+        ContentHasher::store_cached(file_->handle(), st, hasher_->result());
+    }
+}
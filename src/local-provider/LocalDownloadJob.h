@@ -18,8 +18,12 @@
 
 #pragma once
 
+#include "ContentHasher.h"
+
 #include <unity/storage/provider/DownloadJob.h>
 
+#include <unity/util/ResourcePtr.h>
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
 #pragma GCC diagnostic ignored "-Wswitch-default"
@@ -27,6 +31,12 @@
 #include <QLocalSocket>
 #pragma GCC diagnostic pop
 
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
 class LocalProvider;
 
 class LocalDownloadJob : public QObject, public unity::storage::provider::DownloadJob
@@ -35,7 +45,9 @@ class LocalDownloadJob : public QObject, public unity::storage::provider::Downlo
 public:
     LocalDownloadJob(std::shared_ptr<LocalProvider> const& provider,
                      std::string const& item_id,
-                     std::string const& match_etag);
+                     std::string const& match_etag,
+                     int64_t offset,
+                     int64_t length);
     virtual ~LocalDownloadJob();
 
     virtual boost::future<void> cancel() override;
@@ -44,11 +56,41 @@ public:
 private Q_SLOTS:
     void on_bytes_written(qint64 bytes);
     void read_and_write_chunk();
+    void on_send_file_done();
 
 private:
+    enum SendFileResult { send_complete, send_error, send_aborted };
+
+    void start_send_file();
+    void send_file();
+    bool wait_until_writable();
+    void stop_send_file();
+    void hash_sent_data(int64_t offset, int64_t bytes);
+    void cache_checksums();
+
     std::shared_ptr<LocalProvider> const provider_;
     std::string const item_id_;
     std::unique_ptr<QFile> file_;
     QLocalSocket write_socket_;
-    int64_t bytes_to_write_;
+    int64_t offset_;                  // Offset of the next byte to send with sendfile()
+    int64_t download_size_;           // Size of the requested range
+    bool partial_;                    // True if the range does not cover the whole file
+    int64_t bytes_to_read_;           // Only used by the event loop path
+    std::atomic<int64_t> bytes_to_write_;
+
+    // For a download of the whole file, we compute the checksums that are not cached yet
+    // and cache them once the download completes, provided the file did not change.
+    std::unique_ptr<ContentHasher> hasher_;
+    struct stat hashed_st_;  // The file as it was when we started hashing it.
+
+    // With zero_copy_, a separate thread moves the data from the file to the
+    // socket with sendfile(), instead of copying it in the event loop.
+    bool const zero_copy_;
+    std::thread send_file_thread_;
+    unity::util::ResourcePtr<int, std::function<void(int)>> send_socket_;
+    unity::util::ResourcePtr<int, std::function<void(int)>> stop_fd_;
+    std::atomic<bool> stop_;
+    SendFileResult send_file_result_;
+    std::exception_ptr send_file_error_;
+    std::vector<char> hash_buf_;  // Used only by the send file thread.
 };
@@ -20,19 +20,35 @@
 
 #include "LocalDownloadJob.h"
 #include "LocalUploadJob.h"
+#include "TreeWalker.h"
 #include "utils.h"
 
+#include <unity/storage/internal/EnvVars.h>
 #include <unity/storage/internal/gobj_memory.h>
 #include <unity/storage/provider/Exceptions.h>
+#include <unity/storage/provider/MetadataKeys.h>
+#include <unity/storage/provider/WorkerPool.h>
+#include <unity/util/ResourcePtr.h>
 
 #include <boost/algorithm/string.hpp>
+#include <boost/algorithm/hex.hpp>
+#include <QDebug>
+
+#include <algorithm>
+#include <limits>
+
+#include <fcntl.h>
 
 using namespace unity::storage::provider;
 using namespace std;
+using unity::storage::ChangeType;
 
 namespace
 {
 
+// How long search() waits for the initial scan of the tree if there was no snapshot of the index.
+chrono::milliseconds const INDEX_READY_TIMEOUT(1000);
+
 // Return the root directory where we store files.
 // If SF_LOCAL_PROVIDER_ROOT is set (used for testing), any files are created
 // directly under the root. E.g., if we do root.createFile("foo.txt", ...), the file
@@ -86,61 +102,228 @@ string get_root_dir(string const& method)
     return data_dir;
 }
 
-// Copy a file or directory (recursively). Ignore anything that has the temp file prefix
-// or is not a file or directory.
+// Convert nanoseconds since the epoch into ISO 8601 date-time.
 
-void copy_recursively(boost::filesystem::path const& source, boost::filesystem::path const& target)
+string make_iso_date(int64_t nsecs_since_epoch)
 {
-    using namespace boost::filesystem;
+    static char const* const FMT = "%Y-%m-%dT%TZ";  // ISO 8601, no fractional seconds.
 
-    if (is_reserved_path(source))
+    struct tm time;
+    time_t secs_since_epoch = nsecs_since_epoch / 1000000000;
+    gmtime_r(&secs_since_epoch, &time);
+
+    char buf[128];
+    strftime(buf, sizeof(buf), FMT, &time);
+    return buf;
+}
+
+// A page token for list() is the name of the last entry that was returned,
+// hex-encoded because file names need not be valid UTF-8.
+// Because entries are returned in name order, the token remains valid while
+// entries are added to or removed from the directory.
+
+string make_page_token(string const& last_name)
+{
+    return boost::algorithm::hex(last_name);
+}
+
+string parse_page_token(string const& method, string const& page_token)
+{
+    try
     {
-        return;  // Don't copy temporary directories.
+        auto name = boost::algorithm::unhex(page_token);
+        if (!name.empty() && name.find('/') == string::npos)
+        {
+            return name;
+        }
     }
-
-    auto s = status(source);
-    if (is_regular_file(s))
+    catch (boost::algorithm::hex_decode_error const&)
     {
-        copy_file(source, target);
     }
-    else if (is_directory(s))
+    string msg = method + ": invalid page token: \"" + page_token + "\"";
+    throw boost::enable_current_exception(InvalidArgumentException(msg));
+}
+
+// Folders with more than this many pages of entries are listed in directory order, without
+// reading all the names first. The page token is then STREAM_TOKEN_PREFIX (which is not a hex
+// digit), followed by the directory position of the last entry that was returned and its
+// hex-encoded name.
+//
+// Directory positions are not stable on all file systems. Some number the entries by index,
+// so removing an entry shifts the positions of the ones after it. We therefore check that
+// the entry at the recorded position still has the recorded name and, if not, search for
+// the name from the start of the directory. Only if that entry was removed and positions are
+// unstable can the next page skip or repeat entries that were added or removed meanwhile.
+
+size_t const STREAM_THRESHOLD_PAGES = 16;
+char const STREAM_TOKEN_PREFIX = '@';
+
+struct StreamToken
+{
+    int64_t pos;
+    string last_name;
+};
+
+string make_stream_token(DirectoryReader::Entry const& last)
+{
+    return STREAM_TOKEN_PREFIX + to_string(last.pos) + ":" + boost::algorithm::hex(last.name);
+}
+
+bool is_stream_token(string const& page_token)
+{
+    return !page_token.empty() && page_token[0] == STREAM_TOKEN_PREFIX;
+}
+
+StreamToken parse_stream_token(string const& method, string const& page_token)
+{
+    try
     {
-        copy_directory(source, target);  // Poorly named in boost; this creates the target dir without recursion
-        for (directory_iterator it(source); it != directory_iterator(); ++it)
+        auto const colon = page_token.find(':');
+        if (colon != string::npos)
         {
-            path source_entry = it->path();
-            path target_entry = target;
-            target_entry /= source_entry.filename();
-            copy_recursively(source_entry, target_entry);
+            size_t pos;
+            auto dir_pos = stoll(page_token.substr(1, colon - 1), &pos);
+            auto name = boost::algorithm::unhex(page_token.substr(colon + 1));
+            if (pos == colon - 1 && dir_pos >= 0 && !name.empty() && name.find('/') == string::npos)
+            {
+                return StreamToken{dir_pos, name};
+            }
         }
     }
-    else
+    catch (std::logic_error const&)
+    {
+    }
+    catch (boost::algorithm::hex_decode_error const&)
     {
-        // Ignore everything that's not a directory or file.
     }
+    string msg = method + ": invalid page token: \"" + page_token + "\"";
+    throw boost::enable_current_exception(InvalidArgumentException(msg));
 }
 
-// Convert nanoseconds since the epoch into ISO 8601 date-time.
+// Returns a reader for dir_fd that starts at pos, even if dir_fd was read before.
 
-string make_iso_date(int64_t nsecs_since_epoch)
+unique_ptr<DirectoryReader> reader_at(string const& dir, int dir_fd, int64_t pos)
 {
-    static char const* const FMT = "%Y-%m-%dT%TZ";  // ISO 8601, no fractional seconds.
+    if (pos == 0 && lseek(dir_fd, 0, SEEK_SET) == -1)
+    {
+        // LCOV_EXCL_START
+        boost::system::error_code ec(errno, boost::system::generic_category());
+        throw boost::filesystem::filesystem_error("lseek", dir, ec);
+        // LCOV_EXCL_STOP
+    }
+    return unique_ptr<DirectoryReader>(new DirectoryReader(dir, dir_fd, pos));
+}
 
-    struct tm time;
-    time_t secs_since_epoch = nsecs_since_epoch / 1000000000;
-    gmtime_r(&secs_since_epoch, &time);
+// Returns a reader that is positioned after the last entry of the previous page.
 
-    char buf[128];
-    strftime(buf, sizeof(buf), FMT, &time);
-    return buf;
+unique_ptr<DirectoryReader> resume_stream(string const& dir, int dir_fd, StreamToken const& token)
+{
+    auto reader = reader_at(dir, dir_fd, token.pos);
+    vector<DirectoryReader::Entry> entries;
+    reader->read(entries, 1);
+    if (!entries.empty() && entries[0].name == token.last_name)
+    {
+        return reader;
+    }
+
+    // The position is stale, so we look for the name instead.
+    reader = reader_at(dir, dir_fd, 0);
+    entries.clear();
+    while (reader->read(entries, 1))
+    {
+        if (entries[0].name == token.last_name)
+        {
+            return reader;
+        }
+        entries.clear();
+    }
+
+    // The entry is gone. The best we can do is to continue at its old position.
+    return reader_at(dir, dir_fd, token.pos);
 }
 
+// Reads the next page of entries in directory order, skipping reserved names. Returns the
+// page token for the following page, or the empty string if there are no more entries.
+
+string read_stream_page(DirectoryReader& reader, size_t page_size, vector<string>& page)
+{
+    vector<DirectoryReader::Entry> entries;
+    bool more = true;
+    while (more && entries.size() <= page_size)
+    {
+        vector<DirectoryReader::Entry> batch;
+        more = reader.read(batch, page_size + 1 - entries.size());
+        for (auto& e : batch)
+        {
+            if (!boost::starts_with(e.name, TMPFILE_PREFIX))
+            {
+                entries.push_back(move(e));
+            }
+        }
+    }
+    string next_token;
+    if (entries.size() > page_size)
+    {
+        entries.resize(page_size);
+        next_token = make_stream_token(entries.back());
+    }
+    for (auto& e : entries)
+    {
+        page.push_back(move(e.name));
+    }
+    return next_token;
+}
+
+// Each list() thread stats at least this many entries.
+
+size_t const MIN_ENTRIES_PER_THREAD = 32;
+
+// A page token for search() and walk() is the path of the last item that was returned, relative
+// to the folder that is searched, hex-encoded for the same reason. walk() opens the folders
+// on that path, so a token must not lead outside the folder.
+
+string parse_search_token(string const& method, string const& page_token)
+{
+    try
+    {
+        auto path = boost::algorithm::unhex(page_token);
+        vector<string> components;
+        boost::split(components, path, boost::is_any_of("/"));
+        auto is_bad = [](string const& c) { return c.empty() || c == "." || c == ".."; };
+        if (none_of(components.begin(), components.end(), is_bad))
+        {
+            return path;
+        }
+    }
+    catch (boost::algorithm::hex_decode_error const&)
+    {
+    }
+    string msg = method + ": invalid page token: \"" + page_token + "\"";
+    throw boost::enable_current_exception(InvalidArgumentException(msg));
+}
+
+// Maximum number of changes returned by a single changes() call.
+
+size_t const MAX_CHANGES = 1000;
+
+// Number of directories for which we remember the entry names.
+
+size_t const MAX_DIRECTORY_SNAPSHOTS = 16;
+
+// How long we remember the free and used space of a file system. Operations that change
+// the amount of space in use (other than creating a folder) invalidate the cache,
+// so this limits only how long we miss changes made by other processes.
+
+chrono::steady_clock::duration const SPACE_CACHE_TTL = chrono::seconds(2);
+
 // Simple wrapper template that deals with exception handling so we don't
 // have to repeat ourselves endlessly in the various lambdas below.
+// The functor runs on the runtime's worker pool; cheap operations use
+// the metadata lane, and operations that can take a long time use the bulk lane.
 // The auto deduction of the return type requires C++ 14.
 
 template<typename F>
-auto invoke_async(string const& method, F& functor)
+auto invoke_async(string const& method, WorkerPool::Lane lane, F& functor)
 {
     auto lambda = [method, functor]
     {
@@ -163,79 +346,252 @@ auto invoke_async(string const& method, F& functor)
         }
         // LCOV_EXCL_STOP
     };
-    // TODO: boost::async is potentially expensive for some operations. Consider boost::asio thread pool?
-    return boost::async(boost::launch::async, lambda);
+    return ProviderBase::worker_pool().submit(lane, lambda);
+}
+
+Durability get_durability()
+{
+    auto const durability = unity::storage::internal::EnvVars::local_provider_durability();
+    if (durability == "none")
+    {
+        return Durability::none;
+    }
+    return durability == "full" ? Durability::full : Durability::data;
+}
+
+// Reads the file to compute its checksums and caches them. Returns nothing
+// if the file cannot be opened or was modified while we were reading it.
+
+ContentHasher::Checksums compute_checksums(string const& path,
+                                           struct stat const& expected_st,
+                                           int algorithms,
+                                           function<void()> const& before_store)
+{
+    unity::util::ResourcePtr<int, function<void(int)>> fd(open(path.c_str(), O_RDONLY | O_CLOEXEC),
+                                                          [](int d){ if (d != -1) ::close(d); });
+    if (fd.get() == -1)
+    {
+        return {};
+    }
+    auto checksums = ContentHasher::hash_file(path, fd.get(), algorithms);
+    struct stat st;
+    if (fstat(fd.get(), &st) == -1 || !ContentHasher::same_version(st, expected_st))
+    {
+        return {};  // LCOV_EXCL_LINE
+    }
+    before_store();
+    ContentHasher::store_cached(fd.get(), st, checksums);
+    return checksums;
 }
 
 }  // namespace
 
 LocalProvider::LocalProvider()
     : root_(boost::filesystem::canonical(get_root_dir("LocalProvider()")))
+    , path_validator_(root_)
+    , mime_types_(unity::storage::internal::EnvVars::local_provider_sniff_content())
+    , upload_session_dir_((root_ / (string(TMPFILE_PREFIX) + "-uploads")).native())
+    , page_size_(unity::storage::internal::EnvVars::local_provider_page_size())
+    , list_threads_(unity::storage::internal::EnvVars::local_provider_list_threads())
+    , space_generation_(0)
+    , copy_engine_(worker_pool(), unity::storage::internal::EnvVars::local_provider_copy_threads())
+    , watch_failed_(false)
 {
+    using unity::storage::internal::EnvVars;
+
+    int64_t const journal_size = int64_t(EnvVars::local_provider_journal_size()) * 1024 * 1024;
+    if (journal_size > 0)
+    {
+        auto journal_path = root_ / (string(TMPFILE_PREFIX) + "-journal");
+        try
+        {
+            journal_.reset(new ChangeJournal(root_.native(), journal_path.native(), journal_size));
+        }
+        // LCOV_EXCL_START
+        catch (boost::filesystem::filesystem_error const& e)
+        {
+            // Not fatal, changes() will fail, so clients fall back to listing everything.
+            qWarning().noquote() << "LocalProvider(): cannot open change journal:" << e.what();
+        }
+        // LCOV_EXCL_STOP
+    }
+
+    if (EnvVars::local_provider_index())
+    {
+        auto index_path = root_ / (string(TMPFILE_PREFIX) + "-index");
+        auto content_type = [this](string const& path, struct stat const& st)
+        {
+            return mime_types_.content_type(path, st);
+        };
+        index_.reset(new MetadataIndex(root_.native(), index_path.native(), content_type));
+    }
+
+    group_commit_.reset(new GroupCommit(get_durability(), worker_pool()));
+
+    auto trash_dir = root_ / (string(TMPFILE_PREFIX) + "-trash");
+    trash_.reset(new TrashPurger(trash_dir.native(), [this]{ invalidate_space_cache(); }));
+    // The jobs of suspended uploads do not survive a restart, so a session file that is
+    // older than the grace period was left behind by a provider that crashed or was killed.
+    trash_->expire_files(upload_session_dir_, chrono::milliseconds(EnvVars::provider_upload_grace_period_ms()));
+
+    if (EnvVars::local_provider_watch_changes())
+    {
+        auto on_changes = [this](ItemChangeList const& changes)
+        {
+            if (journal_)
+            {
+                journal_->append(changes);
+            }
+            if (index_)
+            {
+                index_->update(changes);
+            }
+            notify_changes(changes);
+        };
+        auto on_overflow = [this]
+        {
+            // We don't know what we missed, so all cursors expire, clients re-list everything,
+            // and the index rescans the tree.
+            ItemChangeList const root_changed{ ItemChange{ root_.native(), "", ChangeType::changed } };
+            if (journal_)
+            {
+                journal_->invalidate_cursors();
+            }
+            if (index_)
+            {
+                index_->update(root_changed);
+            }
+            notify_changes(root_changed);
+        };
+        auto on_failure = [this]
+        {
+            // The journal no longer sees all changes, so changes() fails from now on,
+            // and clients that are told about this change fall back to listing.
+            qWarning().noquote() << "LocalProvider: change notification is no longer available for"
+                                 << root_.native().c_str();
+            watch_failed_ = true;
+            notify_changes({ ItemChange{ root_.native(), "", ChangeType::changed } });
+        };
+        try
+        {
+            watcher_.reset(new InotifyWatcher(root_, on_changes, on_overflow, on_failure));
+        }
+        // LCOV_EXCL_START
+        catch (boost::filesystem::filesystem_error const& e)
+        {
+            // Not fatal, clients just won't receive change notifications.
+            qWarning().noquote() << "LocalProvider(): cannot watch for changes:" << e.what();
+        }
+        // LCOV_EXCL_STOP
+    }
 }
 
 LocalProvider::~LocalProvider() = default;
 
-boost::future<ItemList> LocalProvider::roots(vector<string> const& /* keys */, Context const& /* context */)
+boost::future<ItemList> LocalProvider::roots(vector<string> const& keys, Context const& /* context */)
 {
-    vector<Item> roots{ make_item("roots()", root_, status(root_)) };
+    vector<Item> roots{ make_item("roots()", root_, stat_path("roots()", root_.native()), plan_metadata(keys)) };
     return boost::make_ready_future(roots);
 }
 
 boost::future<tuple<ItemList, string>> LocalProvider::list(string const& item_id,
                                                            string const& page_token,
-                                                           vector<string> const& /* keys */,
+                                                           vector<string> const& keys,
                                                            Context const& /* context */)
 {
     string const method = "list()";
+    auto const md_keys = plan_metadata(keys);
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_list = [This, method, item_id, page_token]
+    auto do_list = [This, method, item_id, page_token, md_keys]
     {
         using namespace boost::filesystem;
 
         This->throw_if_not_valid(method, item_id);
-        if (!is_directory(item_id))
+
+        // We stat the entries relative to the directory, which saves the path lookup for each entry.
+        int fd = open(item_id.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
         {
-            string msg = method + ": \"" + item_id + "\" is not a folder";
-            throw boost::enable_current_exception(LogicException(msg));
+            if (errno == ENOTDIR)
+            {
+                string msg = method + ": \"" + item_id + "\" is not a folder";
+                throw boost::enable_current_exception(LogicException(msg));
+            }
+            boost::system::error_code ec(errno, boost::system::generic_category());
+            throw filesystem_error("open", item_id, ec);  // LCOV_EXCL_LINE
+        }
+        unity::util::ResourcePtr<int, function<void(int)>> dir_fd(fd, [](int d){ ::close(d); });
+        struct stat dir_st;
+        if (fstat(dir_fd.get(), &dir_st) == -1)
+        {
+            // LCOV_EXCL_START
+            boost::system::error_code ec(errno, boost::system::generic_category());
+            throw filesystem_error("fstat", item_id, ec);
+            // LCOV_EXCL_STOP
         }
-        vector<Item> items;
-        for (directory_iterator it(item_id); it != directory_iterator(); ++it)
+
+        vector<string> page;
+        string next_token;
+        size_t const page_size = This->page_size_ == 0 ? numeric_limits<size_t>::max() - 1 : This->page_size_;
+        if (is_stream_token(page_token))
         {
-            auto dirent = *it;
-            auto path = dirent.path();
-            if (is_reserved_path(path))
+            // Continue a listing in directory order where the previous page left off.
+            auto reader = resume_stream(item_id, dir_fd.get(), parse_stream_token(method, page_token));
+            next_token = read_stream_page(*reader, page_size, page);
+        }
+        else
+        {
+            string start_after;
+            size_t max_names = 0;
+            if (!page_token.empty())
             {
-                continue;  // Hide temp files that we create during copy() and move().
+                start_after = parse_page_token(method, page_token);
             }
-            Item i;
-            try
+            else if (This->page_size_ != 0)
             {
-                auto st = dirent.status();
-                i = This->make_item(method, path, st);
-                items.push_back(i);
+                max_names = STREAM_THRESHOLD_PAGES * This->page_size_;
             }
-            catch (std::exception const&)
+
+            vector<DirectoryReader::Entry> prefix;
+            auto names = This->directory_names(item_id, dir_fd.get(), dir_st, max_names, prefix);
+            if (names)
             {
-                // We ignore weird errors (such as entries that are not files or folders).
+                auto it = upper_bound(names->begin(), names->end(), start_after);
+                auto end = size_t(names->end() - it) > page_size ? it + ptrdiff_t(page_size) : names->end();
+                page.assign(it, end);
+                if (end != names->end())
+                {
+                    next_token = make_page_token(*prev(end));
+                }
+            }
+            else
+            {
+                // Too big to sort, so we return the first page in directory order, from what we read so far.
+                prefix.resize(page_size);
+                next_token = make_stream_token(prefix.back());
+                for (auto& e : prefix)
+                {
+                    page.push_back(move(e.name));
+                }
             }
         }
-        return tuple<ItemList, string>(items, "");
+        return tuple<ItemList, string>(This->make_items(method, item_id, dir_fd.get(), page, md_keys), next_token);
     };
 
-    return invoke_async(method, do_list);
+    return invoke_async(method, WorkerPool::Lane::metadata, do_list);
 }
 
 boost::future<ItemList> LocalProvider::lookup(string const& parent_id,
                                               string const& name,
-                                              vector<string> const& /* keys */,
+                                              vector<string> const& keys,
                                               Context const& /* context */)
 {
     string const method = "lookup()";
+    auto const md_keys = plan_metadata(keys);
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_lookup = [This, method, parent_id, name]
+    auto do_lookup = [This, method, parent_id, name, md_keys]
     {
         using namespace boost::filesystem;
 
@@ -244,42 +600,46 @@ boost::future<ItemList> LocalProvider::lookup(string const& parent_id,
         path p = parent_id;
         p /= sanitized_name;
         This->throw_if_not_valid(method, p.native());
-        auto st = status(p);
-        return vector<Item>{ This->make_item(method, p, st) };
+        auto st = stat_path(method, p.native());
+        return vector<Item>{ This->make_item(method, p, st, md_keys) };
     };
 
-    return invoke_async(method, do_lookup);
+    return invoke_async(method, WorkerPool::Lane::metadata, do_lookup);
 }
 
 boost::future<Item> LocalProvider::metadata(string const& item_id,
-                                            vector<string> const& /* keys */,
+                                            vector<string> const& keys,
                                             Context const& /* context */)
 {
     string const method = "metadata()";
+    auto const md_keys = plan_metadata(keys);
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_metadata = [This, method, item_id]
+    auto do_metadata = [This, method, item_id, md_keys]
     {
         using namespace boost::filesystem;
 
         This->throw_if_not_valid(method, item_id);
         path p = item_id;
-        auto st = status(p);
-        return This->make_item(method, p, st);
+        auto st = stat_path(method, item_id);
+        return This->make_item(method, p, st, md_keys, {}, true);
     };
 
-    return invoke_async(method, do_metadata);
+    // If the client asked for a checksum that is not cached, we have to read the whole file.
+    bool const may_hash = ContentHasher::algorithms_for(md_keys) != 0 && !md_keys.all();
+    return invoke_async(method, may_hash ? WorkerPool::Lane::bulk : WorkerPool::Lane::metadata, do_metadata);
 }
 
 boost::future<Item> LocalProvider::create_folder(string const& parent_id,
                                                  string const& name,
-                                                 vector<string> const& /* keys */,
+                                                 vector<string> const& keys,
                                                  Context const& /* context */)
 {
     string const method = "create_folder()";
+    auto const md_keys = plan_metadata(keys);
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_create = [This, method, parent_id, name]
+    auto do_create = [This, method, parent_id, name, md_keys]
     {
         using namespace boost::filesystem;
 
@@ -294,11 +654,12 @@ boost::future<Item> LocalProvider::create_folder(string const& parent_id,
             throw boost::enable_current_exception(ExistsException(msg, p.native(), name));
         }
         create_directory(p);
-        auto st = status(p);
-        return This->make_item(method, p, st);
+        This->record_change(p.native(), ChangeType::created);
+        auto st = stat_path(method, p.native());
+        return This->make_item(method, p, st, md_keys);
     };
 
-    return invoke_async(method, do_create);
+    return invoke_async(method, WorkerPool::Lane::metadata, do_create);
 }
 
 boost::future<unique_ptr<UploadJob>> LocalProvider::create_file(string const& parent_id,
@@ -306,34 +667,43 @@ boost::future<unique_ptr<UploadJob>> LocalProvider::create_file(string const& pa
                                                                 int64_t size,
                                                                 string const& /* content_type */,
                                                                 bool allow_overwrite,
-                                                                vector<string> const& /* keys */,
+                                                                vector<string> const& keys,
                                                                 Context const& /* context */)
 {
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
     boost::promise<unique_ptr<UploadJob>> p;
-    p.set_value(make_unique<LocalUploadJob>(This, parent_id, name, size, allow_overwrite));
+    p.set_value(make_unique<LocalUploadJob>(This, parent_id, name, size, allow_overwrite, keys));
     return p.get_future();
 }
 
 boost::future<unique_ptr<UploadJob>> LocalProvider::update(string const& item_id,
                                                            int64_t size,
                                                            string const& old_etag,
-                                                           vector<string> const& /* keys */,
+                                                           vector<string> const& keys,
                                                            Context const& /* context */)
 {
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
     boost::promise<unique_ptr<UploadJob>> p;
-    p.set_value(make_unique<LocalUploadJob>(This, item_id, size, old_etag));
+    p.set_value(make_unique<LocalUploadJob>(This, item_id, size, old_etag, keys));
     return p.get_future();
 }
 
 boost::future<unique_ptr<DownloadJob>> LocalProvider::download(string const& item_id,
                                                                string const& match_etag,
-                                                               Context const& /* context */)
+                                                               Context const& context)
+{
+    return download_range(item_id, match_etag, 0, -1, context);
+}
+
+boost::future<unique_ptr<DownloadJob>> LocalProvider::download_range(string const& item_id,
+                                                                     string const& match_etag,
+                                                                     int64_t offset,
+                                                                     int64_t length,
+                                                                     Context const& /* context */)
 {
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
     boost::promise<unique_ptr<DownloadJob>> p;
-    p.set_value(make_unique<LocalDownloadJob>(This, item_id, match_etag));
+    p.set_value(make_unique<LocalDownloadJob>(This, item_id, match_etag, offset, length));
     return p.get_future();
 }
 
@@ -347,27 +717,35 @@ boost::future<void> LocalProvider::delete_item(string const& item_id, Context co
         using namespace boost::filesystem;
 
         This->throw_if_not_valid(method, item_id);
-        if (canonical(item_id).native() == This->root_)
+        if (item_id == This->root_.native())
         {
             string msg = method + ": cannot delete root";
             throw boost::enable_current_exception(PermissionException(msg));
         }
-        remove_all(item_id);
+        // Removing a large tree takes a long time, so we move folders into the trash,
+        // which is emptied in the background. Files can be removed right away.
+        if (!is_directory(symlink_status(item_id)) || !This->trash_->move_to_trash(item_id))
+        {
+            remove_all(item_id);
+        }
+        This->record_change(item_id, ChangeType::deleted);
+        This->invalidate_space_cache();
     };
 
-    return invoke_async(method, do_delete);
+    return invoke_async(method, WorkerPool::Lane::bulk, do_delete);
 }
 
 boost::future<Item> LocalProvider::move(string const& item_id,
                                         string const& new_parent_id,
                                         string const& new_name,
-                                        vector<string> const& /* keys */,
+                                        vector<string> const& keys,
                                         Context const& /* context */)
 {
     string const method = "move()";
+    auto const md_keys = plan_metadata(keys);
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_move = [This, method, item_id, new_parent_id, new_name]
+    auto do_move = [This, method, item_id, new_parent_id, new_name, md_keys]
     {
         using namespace boost::filesystem;
 
@@ -383,7 +761,7 @@ boost::future<Item> LocalProvider::move(string const& item_id,
             string msg = method + ": \"" + target_path.native() + "\" exists already";
             throw boost::enable_current_exception(ExistsException(msg, target_path.native(), new_name));
         }
-        if (canonical(item_id).native() == This->root_)
+        if (item_id == This->root_.native())
         {
             string msg = method + ": cannot move root";
             throw boost::enable_current_exception(PermissionException(msg));
@@ -395,23 +773,26 @@ boost::future<Item> LocalProvider::move(string const& item_id,
         // it is not the end of the world.
         // TODO: deal with EXDEV
         rename(item_id, target_path);
-        auto st = status(target_path);
-        return This->make_item(method, target_path, st);
+        This->record_change(item_id, ChangeType::deleted);
+        This->record_change(target_path.native(), ChangeType::created);
+        auto st = stat_path(method, target_path.native());
+        return This->make_item(method, target_path, st, md_keys);
     };
 
-    return invoke_async(method, do_move);
+    return invoke_async(method, WorkerPool::Lane::metadata, do_move);
 }
 
 boost::future<Item> LocalProvider::copy(string const& item_id,
                                         string const& new_parent_id,
                                         string const& new_name,
-                                        vector<string> const& /* keys */,
+                                        vector<string> const& keys,
                                         Context const& /* context */)
 {
     string const method = "copy()";
+    auto const md_keys = plan_metadata(keys);
 
     auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
-    auto do_copy = [This, method, item_id, new_parent_id, new_name]
+    auto do_copy = [This, method, item_id, new_parent_id, new_name, md_keys]
     {
         using namespace boost::filesystem;
 
@@ -433,36 +814,449 @@ boost::future<Item> LocalProvider::copy(string const& item_id,
             // For recursive copy, we create a temporary directory in lieu of target_path and recursively copy
             // everything into the temporary directory. This ensures that we don't invalidate directory iterators
             // by creating things while we are iterating, potentially getting trapped in an infinite loop.
-            path tmp_path = canonical(parent_path);
+            // It also means that the copy appears atomically once it is complete.
+            path tmp_path = parent_path;
             tmp_path /= unique_path(string(TMPFILE_PREFIX) + "-%%%%-%%%%-%%%%-%%%%");
             create_directories(tmp_path);
-            for (directory_iterator it(item_id); it != directory_iterator(); ++it)
+            try
             {
-                if (is_reserved_path(it->path()))
-                {
-                    continue;  // Don't recurse into the temporary directory
-                }
-                file_status s = it->status();
-                if (is_directory(s) || is_regular_file(s))
-                {
-                    path source_entry = it->path();
-                    path target_entry = tmp_path;
-                    target_entry /= source_entry.filename();
-                    copy_recursively(source_entry, target_entry);
-                }
+                This->copy_engine_.copy_contents(item_id, tmp_path);
+            }
+            catch (filesystem_error const&)
+            {
+                boost::system::error_code ec;
+                remove_all(tmp_path, ec);  // Don't leave a partial copy behind.
+                throw;
             }
             rename(tmp_path, target_path);
         }
         else
         {
-            copy_file(item_id, target_path);
+            This->copy_engine_.copy_file(item_id, target_path);
+        }
+        This->record_change(target_path.native(), ChangeType::created);
+        This->invalidate_space_cache();
+
+        auto st = stat_path(method, target_path.native());
+        return This->make_item(method, target_path, st, md_keys);
+    };
+
+    return invoke_async(method, WorkerPool::Lane::bulk, do_copy);
+}
+
+boost::future<tuple<ItemChangeList, ItemList, string>> LocalProvider::changes(string const& cursor,
+                                                                             vector<string> const& keys,
+                                                                             Context const& /* context */)
+{
+    string const method = "changes()";
+    auto const md_keys = plan_metadata(keys);
+
+    auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
+    auto do_changes = [This, method, cursor, md_keys]
+    {
+        if (!This->journal_)
+        {
+            string msg = method + ": change journal is not available";
+            throw boost::enable_current_exception(LogicException(msg));
+        }
+        if (This->watch_failed_)
+        {
+            string msg = method + ": changes are not available because the root cannot be watched";
+            throw boost::enable_current_exception(LogicException(msg));
+        }
+
+        ItemChangeList changes;
+        string next_cursor;
+        if (cursor.empty())
+        {
+            next_cursor = This->journal_->cursor();
+        }
+        else if (!This->journal_->read(cursor, MAX_CHANGES, changes, next_cursor))
+        {
+            string msg = method + ": invalid or expired cursor: \"" + cursor + "\"";
+            throw boost::enable_current_exception(InvalidArgumentException(msg));
+        }
+
+        ItemList items;
+        for (auto const& c : changes)
+        {
+            struct stat st;
+            if (c.type == ChangeType::deleted || lstat(c.item_id.c_str(), &st) == -1)
+            {
+                continue;  // Item was removed since.
+            }
+            try
+            {
+                items.push_back(This->make_item(method, c.item_id, st, md_keys));
+            }
+            catch (std::exception const&)
+            {
+                // We ignore weird errors (such as entries that are not files or folders).
+            }
+        }
+        return make_tuple(changes, items, next_cursor);
+    };
+
+    return invoke_async(method, WorkerPool::Lane::metadata, do_changes);
+}
+
+boost::future<tuple<ItemList, string>> LocalProvider::search(string const& parent_id,
+                                                             string const& query,
+                                                             string const& page_token,
+                                                             vector<string> const& keys,
+                                                             Context const& /* context */)
+{
+    string const method = "search()";
+    auto const md_keys = plan_metadata(keys);
+
+    auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
+    auto do_search = [This, method, parent_id, query, page_token, md_keys]
+    {
+        if (!This->index_)
+        {
+            string msg = method + ": search index is not available";
+            throw boost::enable_current_exception(LogicException(msg));
+        }
+
+        This->throw_if_not_valid(method, parent_id);
+        auto const parent_st = stat_path(method, parent_id);
+        if (!S_ISDIR(parent_st.st_mode))
+        {
+            string msg = method + ": \"" + parent_id + "\" is not a folder";
+            throw boost::enable_current_exception(LogicException(msg));
+        }
+
+        string start_after;
+        if (!page_token.empty())
+        {
+            start_after = parent_id + "/" + parse_search_token(method, page_token);
+        }
+
+        // The initial scan of a large tree can take minutes, so we do not park a pool thread
+        // until it completes. Instead, the client has to try again later.
+        if (!This->index_->wait_until_ready(INDEX_READY_TIMEOUT))
+        {
+            string msg = method + ": the search index is still being built, try again later";
+            throw boost::enable_current_exception(ResourceException(msg, EAGAIN));
+        }
+
+        bool more;
+        auto const ids = This->index_->search(parent_id, query, start_after, This->page_size_, more);
+        ItemList items;
+        for (auto const& id : ids)
+        {
+            struct stat st;
+            if (stat(id.c_str(), &st) == -1)
+            {
+                continue;  // Removed since the index was updated.
+            }
+            try
+            {
+                items.push_back(This->make_item(method, id, st, md_keys));
+            }
+            catch (std::exception const&)
+            {
+                // We ignore weird errors (such as entries that are not files or folders).
+            }
+        }
+        string next_token;
+        if (more)
+        {
+            next_token = make_page_token(ids.back().substr(parent_id.size() + 1));
+        }
+        return tuple<ItemList, string>(items, next_token);
+    };
+
+    return invoke_async(method, WorkerPool::Lane::metadata, do_search);
+}
+
+boost::future<tuple<ItemList, string>> LocalProvider::walk(string const& parent_id,
+                                                           int32_t max_depth,
+                                                           string const& page_token,
+                                                           vector<string> const& keys,
+                                                           Context const& /* context */)
+{
+    string const method = "walk()";
+    auto const md_keys = plan_metadata(keys);
+
+    auto This = dynamic_pointer_cast<LocalProvider>(shared_from_this());
+    auto do_walk = [This, method, parent_id, max_depth, page_token, md_keys]
+    {
+        if (max_depth < 0)
+        {
+            string msg = method + ": invalid max_depth: " + to_string(max_depth);
+            throw boost::enable_current_exception(InvalidArgumentException(msg));
+        }
+        This->throw_if_not_valid(method, parent_id);
+        auto const parent_st = stat_path(method, parent_id);
+        if (!S_ISDIR(parent_st.st_mode))
+        {
+            string msg = method + ": \"" + parent_id + "\" is not a folder";
+            throw boost::enable_current_exception(LogicException(msg));
+        }
+
+        string start_after;
+        if (!page_token.empty())
+        {
+            start_after = parse_search_token(method, page_token);
+        }
+
+        vector<TreeWalker::Entry> entries;
+        bool more = false;
+        if (This->page_size_ == 0)
+        {
+            // Everything goes on one page, so we read the whole tree with several threads.
+            entries = TreeWalker::walk(worker_pool(), parent_id, max_depth, This->list_threads_);
+            if (!start_after.empty())
+            {
+                auto it = upper_bound(entries.begin(), entries.end(), start_after,
+                                      [](string const& p, TreeWalker::Entry const& e)
+                                      {
+                                          return TreeWalker::path_less(p, e.path);
+                                      });
+                entries.erase(entries.begin(), it);
+            }
+        }
+        else
+        {
+            // Each page reads only as much of the tree as it needs. The folders that contain the
+            // last entry of the previous page are read again, so we remember their names.
+            auto read_names = [This](string const& dir, int dir_fd, struct stat const& dir_st)
+            {
+                vector<DirectoryReader::Entry> prefix;
+                return This->directory_names(dir, dir_fd, dir_st, 0, prefix);
+            };
+            entries = TreeWalker::walk_page(parent_id, max_depth, start_after, This->page_size_, read_names, more);
+        }
+
+        vector<unique_ptr<Item>> results(entries.size());
+        auto make_one = [&](size_t i)
+        {
+            auto const& e = entries[i];
+            try
+            {
+                results[i].reset(new Item(This->make_item(method, boost::filesystem::path(parent_id) / e.path,
+                                                          e.st, md_keys)));
+                results[i]->metadata[unity::storage::metadata::PATH] = e.path;
+            }
+            catch (std::exception const&)
+            {
+                // We ignore weird errors (such as entries that are not files or folders).
+            }
+        };
+        parallel_for(worker_pool(), results.size(), This->list_threads_, MIN_ENTRIES_PER_THREAD, make_one);
+
+        ItemList items;
+        items.reserve(results.size());
+        for (auto& item : results)
+        {
+            if (item)
+            {
+                items.push_back(move(*item));
+            }
+        }
+        string next_token;
+        if (more)
+        {
+            next_token = make_page_token(entries.back().path);
+        }
+        return tuple<ItemList, string>(items, next_token);
+    };
+
+    // Like list(), walk() uses the metadata lane. The tree walk borrows more threads from
+    // that lane, so it must not hold a bulk thread while it waits for them.
+    return invoke_async(method, WorkerPool::Lane::metadata, do_walk);
+}
+
+// Add a change made by the provider itself to the journal and the index. The watcher reports the same
+// change a little later, but both must be up to date by the time the operation completes.
+
+void LocalProvider::record_change(string const& item_id, ChangeType type)
+{
+    auto const parent_id = boost::filesystem::path(item_id).parent_path().native();
+    ItemChangeList const changes{ ItemChange{ item_id, parent_id, type } };
+    if (journal_)
+    {
+        journal_->append(changes);
+    }
+    if (index_)
+    {
+        index_->update(changes);
+    }
+}
+
+// Drop the cached free and used space. Called after an operation has changed
+// the amount of space in use.
+
+void LocalProvider::invalidate_space_cache()
+{
+    lock_guard<mutex> lock(space_mutex_);
+    space_cache_.clear();
+    ++space_generation_;
+}
+
+GroupCommit& LocalProvider::group_commit()
+{
+    return *group_commit_;
+}
+
+// Caching checksums in an xattr changes the file's attributes, but clients cannot
+// see the difference, so the watcher should not report the file as changed.
+
+void LocalProvider::ignore_attrib_change(string const& item_id) const
+{
+    if (watcher_)
+    {
+        watcher_->ignore_attrib_change(item_id);
+    }
+}
+
+string const& LocalProvider::upload_session_dir() const
+{
+    return upload_session_dir_;
+}
+
+// Return the free and used space of the file system that contains the item.
+
+LocalProvider::SpaceInfo LocalProvider::get_space_info(boost::filesystem::path const& item_path,
+                                                       struct stat const& st) const
+{
+    auto const now = chrono::steady_clock::now();
+    uint64_t generation;
+    {
+        lock_guard<mutex> lock(space_mutex_);
+        auto it = space_cache_.find(st.st_dev);
+        if (it != space_cache_.end() && it->second.expiry_time > now)
+        {
+            return it->second;
+        }
+        generation = space_generation_;
+    }
+
+    auto const info = boost::filesystem::space(item_path);
+    SpaceInfo si{int64_t(info.available), int64_t(info.capacity - info.available), now + SPACE_CACHE_TTL};
+
+    // If the cache was invalidated while we called statvfs(), our result may predate
+    // the change, so we return it, but don't keep it.
+    lock_guard<mutex> lock(space_mutex_);
+    if (space_generation_ == generation)
+    {
+        space_cache_[st.st_dev] = si;
+    }
+    return si;
+}
+
+// Return the sorted names of the entries in dir, excluding our temp files.
+// If the directory is unchanged since we last read it, return the names we read then.
+
+LocalProvider::NameList LocalProvider::directory_names(string const& dir,
+                                                      int dir_fd,
+                                                      struct stat const& dir_st,
+                                                      size_t max_names,
+                                                      vector<DirectoryReader::Entry>& prefix)
+{
+    int64_t const mtime_nsecs = get_mtime_nsecs(dir_st);
+    auto const now = chrono::steady_clock::now();
+    {
+        lock_guard<mutex> lock(snapshots_mutex_);
+        auto it = snapshots_.find(dir);
+        if (it != snapshots_.end() && it->second.mtime_nsecs == mtime_nsecs)
+        {
+            it->second.last_used = now;
+            return it->second.names;
+        }
+    }
+
+    // Reserved names are not counted towards max_names, so they can't make us return less than a page.
+    DirectoryReader reader(dir, dir_fd);
+    auto names = make_shared<vector<string>>();
+    bool more = true;
+    while (more && (max_names == 0 || names->size() <= max_names))
+    {
+        size_t const batch_size = max_names == 0 ? 4096 : max_names + 1 - names->size();
+        vector<DirectoryReader::Entry> entries;
+        more = reader.read(entries, batch_size);
+        for (auto& e : entries)
+        {
+            if (boost::starts_with(e.name, TMPFILE_PREFIX))
+            {
+                continue;  // Hide temp files that we create during copy() and move().
+            }
+            names->push_back(e.name);
+            prefix.push_back(move(e));
         }
+    }
+    if (max_names != 0 && names->size() > max_names)
+    {
+        return nullptr;
+    }
+    prefix.clear();
+    sort(names->begin(), names->end());
+
+    // The file system may not update the directory mtime if an entry is added
+    // within the timestamp granularity, so we don't remember directories that
+    // were modified very recently. Otherwise, we could miss such an entry.
+    auto const age_nsecs = chrono::system_clock::now().time_since_epoch() / chrono::nanoseconds(1) - mtime_nsecs;
+    if (age_nsecs < 1000000000)
+    {
+        return names;
+    }
+
+    lock_guard<mutex> lock(snapshots_mutex_);
+    snapshots_[dir] = DirectorySnapshot{mtime_nsecs, names, now};
+    if (snapshots_.size() > MAX_DIRECTORY_SNAPSHOTS)
+    {
+        auto oldest = min_element(snapshots_.begin(), snapshots_.end(),
+                                  [](decltype(snapshots_)::value_type const& a,
+                                     decltype(snapshots_)::value_type const& b)
+                                  {
+                                      return a.second.last_used < b.second.last_used;
+                                  });
+        snapshots_.erase(oldest);
+    }
+    return names;
+}
+
+// Stat the named entries of dir and make items for them, in the same order. Entries that
+// were removed since we read the directory, or that are neither files nor folders, are skipped.
+// With many entries, several threads share the work, so a slow file system (such as a network
+// mount) can serve several stat() calls at the same time.
 
-        auto st = status(target_path);
-        return This->make_item(method, target_path, st);
+ItemList LocalProvider::make_items(string const& method,
+                                   string const& dir,
+                                   int dir_fd,
+                                   vector<string> const& names,
+                                   MetadataKeys const& keys) const
+{
+    vector<unique_ptr<Item>> results(names.size());
+    auto make_one = [&](size_t i)
+    {
+        struct stat st;
+        if (fstatat(dir_fd, names[i].c_str(), &st, 0) == -1)
+        {
+            return;
+        }
+        try
+        {
+            results[i].reset(new Item(make_item(method, boost::filesystem::path(dir) / names[i], st, keys)));
+        }
+        catch (std::exception const&)
+        {
+            // We ignore weird errors (such as entries that are not files or folders).
+        }
     };
+    parallel_for(worker_pool(), names.size(), list_threads_, MIN_ENTRIES_PER_THREAD, make_one);
 
-    return invoke_async(method, do_copy);
+    ItemList items;
+    items.reserve(names.size());
+    for (auto& item : results)
+    {
+        if (item)
+        {
+            items.push_back(move(*item));
+        }
+    }
+    return items;
 }
 
 // Make sure that id does not point outside the root.
@@ -471,24 +1265,18 @@ void LocalProvider::throw_if_not_valid(string const& method, string const& id) c
 {
     using namespace boost::filesystem;
 
-    string suspect_id;
+    // id must denote the root or have the root as a prefix. We also disallow things
+    // such as <root>/blah/../blah even though they lead to the correct path.
+    bool valid = false;
     try
     {
-        suspect_id = canonical(id).native();
+        valid = path_validator_.is_valid(id);
     }
     catch (filesystem_error const& e)
     {
         throw_storage_exception(method, e);
     }
-
-    // Disallow things such as <root>/blah/../blah even though they lead to the correct path.
-    if (suspect_id != id)
-    {
-        throw boost::enable_current_exception(InvalidArgumentException(method + ": invalid id: \"" + id + "\""));
-    }
-    // id must denote the root or have the root as a prefix.
-    auto const root_id = root_.native();
-    if (id != root_id && !boost::starts_with(id, root_id + "/"))
+    if (!valid)
     {
         throw boost::enable_current_exception(InvalidArgumentException(method + ": invalid id: \"" + id + "\""));
     }
@@ -498,81 +1286,137 @@ void LocalProvider::throw_if_not_valid(string const& method, string const& id) c
 
 Item LocalProvider::make_item(string const& method,
                               boost::filesystem::path const& item_path,
-                              boost::filesystem::file_status const& st) const
+                              struct stat const& st,
+                              MetadataKeys const& keys,
+                              ContentHasher::Checksums const& checksums,
+                              bool hash_if_missing) const
 {
     using namespace unity::storage;
     using namespace unity::storage::metadata;
     using namespace boost::filesystem;
 
+    // Everything comes from st or the space cache, so we usually don't
+    // make any more system calls for the item itself. We compute only
+    // the metadata that was asked for, except for the size and modification
+    // time of files, which the client API requires.
+
     map<string, MetadataValue> meta;
 
     string const item_id = item_path.native();
-    int64_t const mtime_nsecs = get_mtime_nsecs(method, item_id);
-    string const iso_mtime = make_iso_date(mtime_nsecs);
+    int64_t const mtime_nsecs = get_mtime_nsecs(st);
 
     ItemType type;
     string name = item_path.filename().native();
     vector<string> parents{item_path.parent_path().native()};
     string etag;
-    switch (st.type())
-    {
-        case regular_file:
-            type = ItemType::file;
-            etag = to_string(mtime_nsecs);
-            meta.insert({SIZE_IN_BYTES, int64_t(file_size(item_path))});
-            break;
-        case directory_file:
-            if (item_path == root_)
-            {
-                name = "/";
-                parents.clear();
-                type = ItemType::root;
-            }
-            else
-            {
-                type = ItemType::folder;
-            }
-            break;
-        default:
-            throw boost::enable_current_exception(
-                    NotExistsException(method + ": \"" + item_id + "\" is neither a file nor a folder", item_id));
+    if (S_ISREG(st.st_mode))
+    {
+        type = ItemType::file;
+        etag = to_string(mtime_nsecs);
+        meta.insert({SIZE_IN_BYTES, int64_t(st.st_size)});
+        meta.insert({LAST_MODIFIED_TIME, make_iso_date(mtime_nsecs)});
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+        if (item_path == root_)
+        {
+            name = "/";
+            parents.clear();
+            type = ItemType::root;
+        }
+        else
+        {
+            type = ItemType::folder;
+        }
+        if (keys.contains(LAST_MODIFIED_TIME))
+        {
+            meta.insert({LAST_MODIFIED_TIME, make_iso_date(mtime_nsecs)});
+        }
+    }
+    else
+    {
+        throw boost::enable_current_exception(
+                NotExistsException(method + ": \"" + item_id + "\" is neither a file nor a folder", item_id));
     }
 
+    if (keys.contains(FREE_SPACE_BYTES) || keys.contains(USED_SPACE_BYTES))
+    {
+        auto const info = get_space_info(item_path, st);
+        meta.insert({FREE_SPACE_BYTES, info.free_bytes});
+        meta.insert({USED_SPACE_BYTES, info.used_bytes});
+    }
 
-    auto const info = space(item_path);
-    meta.insert({FREE_SPACE_BYTES, int64_t(info.available)});
-    meta.insert({USED_SPACE_BYTES, int64_t(info.capacity - info.available)});
-
-    meta.insert({LAST_MODIFIED_TIME, iso_mtime});
-    meta.insert({CONTENT_TYPE, get_content_type(item_id, type)});
+    if (keys.contains(CONTENT_TYPE))
+    {
+        meta.insert({CONTENT_TYPE, get_content_type(item_id, type, st)});
+    }
 
-    auto perms = st.permissions();
-    bool writable;
-    if (type == ItemType::file)
+    if (keys.contains(WRITABLE))
     {
-        writable = perms & owner_write;
+        bool writable;
+        if (type == ItemType::file)
+        {
+            writable = st.st_mode & S_IWUSR;
+        }
+        else
+        {
+            writable = st.st_mode & S_IWUSR && st.st_mode & S_IXUSR;
+        }
+        meta.insert({WRITABLE, writable});
     }
-    else
+
+    // Checksums come from the caller (if it just hashed the file) or from the cache. If a
+    // checksum is not cached, we compute it only if hash_if_missing is set (by metadata(), which
+    // returns a single item) and the client asked for it explicitly. Otherwise, list() would read
+    // every file in the folder.
+    int const wanted = type == ItemType::file ? ContentHasher::algorithms_for(keys) : 0;
+    if (wanted != 0)
     {
-        writable = perms & owner_write && perms & owner_exe;
+        auto known = checksums.empty() ? ContentHasher::load_cached(item_id, st) : checksums;
+        int const missing = wanted & ~ContentHasher::algorithms_in(known);
+        if (missing != 0 && hash_if_missing && !keys.all())
+        {
+            auto computed = compute_checksums(item_id, st, missing, [&]{ ignore_attrib_change(item_id); });
+            known.insert(computed.begin(), computed.end());
+        }
+        for (auto const& c : known)
+        {
+            if (keys.contains(c.first))
+            {
+                meta.insert({c.first, c.second});
+            }
+        }
     }
-    meta.insert({WRITABLE, writable});
 
     return Item{ item_id, parents, name, etag, type, meta };
 }
 
-string LocalProvider::get_content_type(string const& filename, unity::storage::ItemType type) const
+// Return the metadata to compute for the keys requested by the client.
+// By default, we return everything we have.
+
+MetadataKeys LocalProvider::plan_metadata(vector<string> const& keys)
 {
-    if (type != unity::storage::ItemType::file)
+    using namespace unity::storage::metadata;
+
+    static vector<string> const default_keys =
     {
-        return "inode/directory";
-    }
+        SIZE_IN_BYTES,
+        LAST_MODIFIED_TIME,
+        FREE_SPACE_BYTES,
+        USED_SPACE_BYTES,
+        CONTENT_TYPE,
+        WRITABLE
+    };
+    return MetadataKeys(keys, default_keys);
+}
 
-    auto mime_type = mime_db_.mimeTypeForFile(QString::fromStdString(filename), QMimeDatabase::MatchExtension);
-    if (!mime_type.isValid())
+string LocalProvider::get_content_type(string const& filename,
+                                       unity::storage::ItemType type,
+                                       struct stat const& st) const
+{
+    if (type != unity::storage::ItemType::file)
     {
-        return "application/octet-stream";  // LCOV_EXCL_LINE
+        return "inode/directory";
     }
-
-    return mime_type.name().toStdString();
+    return mime_types_.content_type(filename, st);
 }
@@ -18,10 +18,29 @@
 
 #pragma once
 
+#include "ChangeJournal.h"
+#include "ContentHasher.h"
+#include "CopyEngine.h"
+#include "DirectoryReader.h"
+#include "GroupCommit.h"
+#include "InotifyWatcher.h"
+#include "MetadataIndex.h"
+#include "MimeTypeCache.h"
+#include "PathValidator.h"
+#include "TrashPurger.h"
+
+#include <unity/storage/provider/MetadataKeys.h>
 #include <unity/storage/provider/ProviderBase.h>
 
 #include <boost/filesystem.hpp>
-#include <QMimeDatabase>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <sys/stat.h>
 
 class LocalProvider : public unity::storage::provider::ProviderBase
 {
@@ -62,6 +81,12 @@ public:
         std::string const& item_id,
         std::string const& match_etag,
         unity::storage::provider::Context const& ctx) override;
+    boost::future<std::unique_ptr<unity::storage::provider::DownloadJob>> download_range(
+        std::string const& item_id,
+        std::string const& match_etag,
+        int64_t offset,
+        int64_t length,
+        unity::storage::provider::Context const& ctx) override;
     boost::future<void> delete_item(std::string const& item_id,
         unity::storage::provider::Context const& ctx) override;
     boost::future<unity::storage::provider::Item> move(
@@ -74,15 +99,93 @@ public:
         std::string const& new_name,
         std::vector<std::string> const& metadata_keys,
         unity::storage::provider::Context const& ctx) override;
+    boost::future<std::tuple<unity::storage::provider::ItemChangeList,
+                             unity::storage::provider::ItemList,
+                             std::string>> changes(
+        std::string const& cursor,
+        std::vector<std::string> const& metadata_keys,
+        unity::storage::provider::Context const& ctx) override;
+    boost::future<std::tuple<unity::storage::provider::ItemList, std::string>> search(
+        std::string const& parent_id,
+        std::string const& query,
+        std::string const& page_token,
+        std::vector<std::string> const& metadata_keys,
+        unity::storage::provider::Context const& ctx) override;
+    boost::future<std::tuple<unity::storage::provider::ItemList, std::string>> walk(
+        std::string const& parent_id,
+        int32_t max_depth,
+        std::string const& page_token,
+        std::vector<std::string> const& metadata_keys,
+        unity::storage::provider::Context const& ctx) override;
 
     void throw_if_not_valid(std::string const& method, std::string const& id) const;
     unity::storage::provider::Item make_item(std::string const& method,
                                              boost::filesystem::path const& item_path,
-                                             boost::filesystem::file_status const& st) const;
+                                             struct stat const& st,
+                                             unity::storage::provider::MetadataKeys const& keys,
+                                             ContentHasher::Checksums const& checksums = {},
+                                             bool hash_if_missing = false) const;
+    static unity::storage::provider::MetadataKeys plan_metadata(std::vector<std::string> const& keys);
+    void invalidate_space_cache();
+    void record_change(std::string const& item_id, unity::storage::ChangeType type);
+    void ignore_attrib_change(std::string const& item_id) const;
+    GroupCommit& group_commit();
+    std::string const& upload_session_dir() const;
 
 private:
-    std::string get_content_type(std::string const& filename, unity::storage::ItemType type) const;
+    typedef std::shared_ptr<std::vector<std::string> const> NameList;
+
+    // Sorted names of the entries in a directory, so list() can resume after the
+    // last name it returned. We keep the most recently used lists, so a paged list()
+    // does not re-read the directory for each page unless the directory changed.
+    struct DirectorySnapshot
+    {
+        int64_t mtime_nsecs;
+        NameList names;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    // Free and used space of a file system. Every item reports these, so we
+    // remember them for a short while instead of calling statvfs() for each item.
+    struct SpaceInfo
+    {
+        int64_t free_bytes;
+        int64_t used_bytes;
+        std::chrono::steady_clock::time_point expiry_time;
+    };
+
+    std::string get_content_type(std::string const& filename,
+                                 unity::storage::ItemType type,
+                                 struct stat const& st) const;
+    SpaceInfo get_space_info(boost::filesystem::path const& item_path, struct stat const& st) const;
+    NameList directory_names(std::string const& dir,
+                             int dir_fd,
+                             struct stat const& dir_st,
+                             size_t max_names,
+                             std::vector<DirectoryReader::Entry>& prefix);
+    unity::storage::provider::ItemList make_items(std::string const& method,
+                                                  std::string const& dir,
+                                                  int dir_fd,
+                                                  std::vector<std::string> const& names,
+                                                  unity::storage::provider::MetadataKeys const& keys) const;
 
     boost::filesystem::path const root_;
-    QMimeDatabase mime_db_;
+    PathValidator path_validator_;
+    mutable MimeTypeCache mime_types_;
+    std::string const upload_session_dir_;  // Suspended uploads keep their data here.
+    size_t const page_size_;
+    int const list_threads_;
+    std::mutex snapshots_mutex_;
+    std::map<std::string, DirectorySnapshot> snapshots_;
+    mutable std::mutex space_mutex_;
+    mutable std::map<dev_t, SpaceInfo> space_cache_;
+    mutable uint64_t space_generation_;  // Incremented by invalidate_space_cache().
+    CopyEngine copy_engine_;
+    std::unique_ptr<ChangeJournal> journal_;  // Null if the journal is disabled or cannot be opened.
+    std::unique_ptr<MetadataIndex> index_;    // Null if the index is disabled.
+    std::atomic<bool> watch_failed_;          // Set if the watcher gave up, so the journal misses changes.
+    // Last, so the commit, purger, and watcher threads stop before the other members go away.
+    std::unique_ptr<GroupCommit> group_commit_;
+    std::unique_ptr<TrashPurger> trash_;
+    std::unique_ptr<InotifyWatcher> watcher_;  // Null if change notification is disabled.
 };
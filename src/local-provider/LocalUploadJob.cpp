@@ -20,16 +20,41 @@
 
 #include "LocalProvider.h"
 #include "utils.h"
+#include <unity/storage/internal/EnvVars.h>
 #include <unity/storage/internal/safe_strerror.h>
 #include <unity/storage/provider/Exceptions.h>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 using namespace unity::storage::provider;
 using namespace std;
+using unity::storage::ChangeType;
 
 static int next_upload_id = 0;
 
+namespace
+{
+
+// Throws QuotaException if we ran out of space, and ResourceException otherwise.
+
+[[ noreturn ]]
+void throw_write_error(string const& msg, int error)
+{
+    if (error == ENOSPC || error == EDQUOT)
+    {
+        BOOST_THROW_EXCEPTION(QuotaException(msg));
+    }
+    BOOST_THROW_EXCEPTION(ResourceException(msg, error));  // LCOV_EXCL_LINE
+}
+
+auto const close_fd = [](int fd){ if (fd != -1) ::close(fd); };
+
+}  // namespace
+
 LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider, int64_t size, const string& method)
     : UploadJob(to_string(++next_upload_id))
     , provider_(provider)
@@ -37,7 +62,14 @@ LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider, int64_
     , bytes_to_write_(size)
     , method_(method)
     , state_(in_progress)
-    , tmp_fd_([](int fd){ if (fd != -1) ::close(fd); })
+    , tmp_fd_(close_fd)
+    , zero_copy_(unity::storage::internal::EnvVars::local_provider_zero_copy())
+    , receive_socket_(close_fd)
+    , pipe_read_fd_(close_fd)
+    , pipe_write_fd_(close_fd)
+    , stop_fd_(close_fd)
+    , stop_mode_(keep_receiving)
+    , use_splice_(true)
 {
 }
 
@@ -45,13 +77,15 @@ LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
                                string const& parent_id,
                                string const& name,
                                int64_t size,
-                               bool allow_overwrite)
+                               bool allow_overwrite,
+                               vector<string> const& metadata_keys)
     : LocalUploadJob(provider, size, "create_file()")
 {
     using namespace boost::filesystem;
 
     parent_id_ = parent_id;
     allow_overwrite_ = allow_overwrite;
+    metadata_keys_ = metadata_keys;
 
     provider_->throw_if_not_valid(method_, parent_id);
 
@@ -71,12 +105,14 @@ LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
 LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
                                string const& item_id,
                                int64_t size,
-                               string const& old_etag)
+                               string const& old_etag,
+                               vector<string> const& metadata_keys)
     : LocalUploadJob(provider, size, "update()")
 {
     using namespace boost::filesystem;
 
     item_id_ = item_id;
+    metadata_keys_ = metadata_keys;
     provider_->throw_if_not_valid(method_, item_id);
     try
     {
@@ -107,7 +143,10 @@ LocalUploadJob::LocalUploadJob(shared_ptr<LocalProvider> const& provider,
     prepare_channels();
 }
 
-LocalUploadJob::~LocalUploadJob() = default;
+LocalUploadJob::~LocalUploadJob()
+{
+    stop_receive_file(stop_now);
+}
 
 void LocalUploadJob::prepare_channels()
 {
@@ -144,6 +183,27 @@ void LocalUploadJob::prepare_channels()
         file_->open(tmp_fd_.get(), QIODevice::WriteOnly, QFileDevice::DontCloseHandle);
     }
 
+    // If the client asked for checksums, we compute them as the data arrives. splice() does not
+    // pass the data through user space, so the receive thread has to copy it through a buffer instead.
+    int const algorithms = ContentHasher::algorithms_for(LocalProvider::plan_metadata(metadata_keys_));
+    if (algorithms != 0)
+    {
+        hasher_.reset(new ContentHasher(algorithms));
+        use_splice_ = false;
+    }
+
+    preallocate();
+    attach_socket();
+}
+
+void LocalUploadJob::attach_socket()
+{
+    if (zero_copy_)
+    {
+        start_receive_file();
+        return;
+    }
+
     // Make read socket ready.
     int dup_fd = dup(read_socket());
     if (dup_fd == -1)
@@ -158,18 +218,214 @@ void LocalUploadJob::prepare_channels()
     connect(&read_socket_, &QIODevice::readChannelFinished, this, &LocalUploadJob::on_read_channel_finished);
 }
 
+// Allocate the space for the upload up front. This avoids fragmenting the file
+// and, if the file system does not have enough space, fails the upload before
+// the client has sent any data.
+
+void LocalUploadJob::preallocate()
+{
+    using namespace unity::storage::internal;
+
+    if (size_ <= 0)
+    {
+        return;
+    }
+    if (fallocate(tmp_fd_.get(), FALLOC_FL_KEEP_SIZE, 0, size_) == -1)
+    {
+        int const error = errno;
+        if (error == EOPNOTSUPP || error == ENOSYS)
+        {
+            return;  // LCOV_EXCL_LINE  // The file system cannot preallocate, so we find out when we write.
+        }
+        if (!use_linkat_)
+        {
+            // LCOV_EXCL_START
+            string filename = file_->fileName().toStdString();
+            ::unlink(filename.c_str());
+            // LCOV_EXCL_STOP
+        }
+        string msg = method_ + ": cannot allocate " + to_string(size_) + " bytes for \"" + item_id_ + "\": "
+                     + safe_strerror(error);
+        throw_write_error(msg, error);
+    }
+}
+
 boost::future<void> LocalUploadJob::cancel()
 {
-    if (state_ == in_progress)
+    if (state_ == in_progress || state_ == suspended)
+    {
+        abort_upload();
+    }
+    return boost::make_ready_future();
+}
+
+// The client went away. We keep the data we received so far in a tmp file with
+// a reserved name, so the client can reconnect and send the remainder.
+
+boost::future<int64_t> LocalUploadJob::suspend()
+{
+    using namespace unity::storage::internal;
+
+    if (zero_copy_)
+    {
+        stop_receive_file(drain_and_stop);  // Receive any remaining unread data.
+        if (receive_error_)
+        {
+            abort_upload();
+            try
+            {
+                rethrow_exception(receive_error_);
+            }
+            catch (StorageException const&)
+            {
+                return boost::make_exceptional_future<int64_t>(boost::current_exception());
+            }
+            // LCOV_EXCL_START
+            catch (std::exception const& e)
+            {
+                return boost::make_exceptional_future<int64_t>(UnknownException(e.what()));
+            }
+            // LCOV_EXCL_STOP
+        }
+    }
+    else
+    {
+        on_bytes_ready();  // Read any remaining unread buffered data.
+        if (state_ != in_progress)
+        {
+            // on_bytes_ready() has reported the error already.
+            return boost::make_exceptional_future<int64_t>(LogicException("suspend(): upload has failed"));
+        }
+        disconnect(&read_socket_, nullptr, this, nullptr);
+        read_socket_.abort();
+    }
+
+    try
+    {
+        if (!file_->flush())
+        {
+            // LCOV_EXCL_START
+            string msg = "suspend(): cannot flush output file: " + file_->errorString().toStdString();
+            throw_storage_exception("suspend()", msg, file_->error());
+            // LCOV_EXCL_STOP
+        }
+        if (session_path_.empty())
+        {
+            if (use_linkat_)
+            {
+                // Session files live in one directory, so the next provider can remove
+                // the ones that were abandoned without searching the whole tree.
+                auto const& session_dir = provider_->upload_session_dir();
+                if (mkdir(session_dir.c_str(), 0700) == -1 && errno != EEXIST)
+                {
+                    // LCOV_EXCL_START
+                    string msg = "suspend(): cannot create \"" + session_dir + "\": " + safe_strerror(errno);
+                    BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
+                    // LCOV_EXCL_STOP
+                }
+                session_path_ = session_dir + "/" + upload_id();
+                auto old_path = string("/proc/self/fd/") + std::to_string(tmp_fd_.get());
+                ::unlink(session_path_.c_str());  // In case an earlier provider left it behind.
+                int rc = linkat(-1, old_path.c_str(), tmp_fd_.get(), session_path_.c_str(), AT_SYMLINK_FOLLOW);
+                if (rc == -1 && errno == EXDEV)
+                {
+                    // LCOV_EXCL_START
+                    // The parent folder is a mount point below the root. The session file stays
+                    // next to the upload, where it is not expired if the provider goes away.
+                    auto parent_path = boost::filesystem::path(item_id_).parent_path();
+                    session_path_ = parent_path.native() + "/" + TMPFILE_PREFIX + "-upload-" + upload_id();
+                    ::unlink(session_path_.c_str());
+                    rc = linkat(-1, old_path.c_str(), tmp_fd_.get(), session_path_.c_str(), AT_SYMLINK_FOLLOW);
+                    // LCOV_EXCL_STOP
+                }
+                if (rc == -1)
+                {
+                    // LCOV_EXCL_START
+                    string msg = "suspend(): linkat \"" + old_path + "\" to \"" + session_path_ + "\" failed: "
+                                 + safe_strerror(errno);
+                    session_path_.clear();
+                    BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
+                    // LCOV_EXCL_STOP
+                }
+            }
+            else
+            {
+                session_path_ = file_->fileName().toStdString();  // LCOV_EXCL_LINE
+            }
+        }
+        // The committed offset must not run ahead of the data on disk.
+        if (fdatasync(tmp_fd_.get()) == -1)
+        {
+            // LCOV_EXCL_START
+            string msg = "suspend(): cannot sync \"" + session_path_ + "\": " + safe_strerror(errno);
+            throw_write_error(msg, errno);
+            // LCOV_EXCL_STOP
+        }
+    }
+    catch (StorageException const&)
     {
         abort_upload();
+        return boost::make_exceptional_future<int64_t>(boost::current_exception());
+    }
+
+    state_ = suspended;
+    return boost::make_ready_future<int64_t>(size_ - bytes_to_write_);
+}
+
+// A client reconnected. read_socket() is a new socket, and we continue
+// writing where we left off.
+
+boost::future<void> LocalUploadJob::resume()
+{
+    if (state_ != suspended)
+    {
+        // LCOV_EXCL_START
+        return boost::make_exceptional_future<void>(LogicException("resume(): upload is not suspended"));
+        // LCOV_EXCL_STOP
+    }
+    try
+    {
+        stop_mode_ = keep_receiving;
+        attach_socket();
     }
+    // LCOV_EXCL_START
+    catch (StorageException const&)
+    {
+        return boost::make_exceptional_future<void>(boost::current_exception());
+    }
+    // LCOV_EXCL_STOP
+    state_ = in_progress;
     return boost::make_ready_future();
 }
 
 boost::future<Item> LocalUploadJob::finish()
 {
-    on_bytes_ready();  // Read any remaining unread buffered data.
+    if (zero_copy_)
+    {
+        stop_receive_file(drain_and_stop);  // Receive any remaining unread data.
+        if (receive_error_)
+        {
+            abort_upload();
+            try
+            {
+                rethrow_exception(receive_error_);
+            }
+            catch (StorageException const&)
+            {
+                return boost::make_exceptional_future<Item>(boost::current_exception());
+            }
+            // LCOV_EXCL_START
+            catch (std::exception const& e)
+            {
+                return boost::make_exceptional_future<Item>(UnknownException(e.what()));
+            }
+            // LCOV_EXCL_STOP
+        }
+    }
+    else
+    {
+        on_bytes_ready();  // Read any remaining unread buffered data.
+    }
 
     if (bytes_to_write_ > 0)
     {
@@ -225,40 +481,20 @@ boost::future<Item> LocalUploadJob::finish()
             // LCOV_EXCL_STOP
         }
 
-        // Link the anonymous tmp file into the file system.
-        using namespace unity::storage::internal;
-
-        if (use_linkat_)
+        if (hasher_)
         {
-            auto old_path = string("/proc/self/fd/") + std::to_string(tmp_fd_.get());
-            ::unlink(item_id_.c_str());  // linkat() will not remove existing file: http://lwn.net/Articles/559969/
-            if (linkat(-1, old_path.c_str(), tmp_fd_.get(), item_id_.c_str(), AT_SYMLINK_FOLLOW) == -1)
+            // Linking or renaming the file does not change its inode, size, or mtime,
+            // so the cached checksums remain valid.
+            checksums_ = hasher_->result();
+            struct stat st;
+            if (fstat(tmp_fd_.get(), &st) == 0)
             {
-                // LCOV_EXCL_START
-                string msg = "finish(): linkat \"" + old_path + "\" to \"" + item_id_ + "\" failed: "
-                             + safe_strerror(errno);
-                BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
-                // LCOV_EXCL_STOP
+                ContentHasher::store_cached(tmp_fd_.get(), st, checksums_);
             }
         }
-        else
-        {
-            // LCOV_EXCL_START
-            auto old_path = file_->fileName().toStdString();
-            if (rename(old_path.c_str(), item_id_.c_str()) == -1)
-            {
-                string msg = "finish(): rename \"" + old_path + "\" to \"" + item_id_ + "\" failed: "
-                             + safe_strerror(errno);
-                BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
-            }
-            // LCOV_EXCL_STOP
-        }
 
         file_->close();
         read_socket_.close();
-
-        auto st = boost::filesystem::status(item_id_);
-        return boost::make_ready_future<Item>(provider_->make_item(method_, item_id_, st));
     }
     catch (StorageException const&)
     {
@@ -281,6 +517,91 @@ boost::future<Item> LocalUploadJob::finish()
         return boost::make_exceptional_future<Item>(UnknownException(e.what()));
     }
     // LCOV_EXCL_STOP
+
+    // The group commit syncs the file as required by the durability policy before linking it into place.
+    // With durability none, it links the file immediately, so the future is ready when we return.
+    auto promise = make_shared<boost::promise<Item>>();
+    auto future = promise->get_future();
+    auto parent = boost::filesystem::path(item_id_).parent_path().native();
+    provider_->group_commit().commit(tmp_fd_.get(), parent,
+                                     [this]{ link_into_place(); },
+                                     [this, promise](exception_ptr error){ complete_finish(*promise, error); });
+    return future;
+}
+
+// Link the tmp file into the file system. Called by the group commit.
+
+void LocalUploadJob::link_into_place()
+{
+    using namespace unity::storage::internal;
+
+    if (use_linkat_ && session_path_.empty())
+    {
+        auto old_path = string("/proc/self/fd/") + std::to_string(tmp_fd_.get());
+        ::unlink(item_id_.c_str());  // linkat() will not remove existing file: http://lwn.net/Articles/559969/
+        if (linkat(-1, old_path.c_str(), tmp_fd_.get(), item_id_.c_str(), AT_SYMLINK_FOLLOW) == -1)
+        {
+            // LCOV_EXCL_START
+            string msg = "finish(): linkat \"" + old_path + "\" to \"" + item_id_ + "\" failed: "
+                         + safe_strerror(errno);
+            BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
+            // LCOV_EXCL_STOP
+        }
+    }
+    else
+    {
+        // The tmp file has a name because the upload was resumed, or because O_TMPFILE is not supported.
+        auto old_path = session_path_.empty() ? file_->fileName().toStdString() : session_path_;
+        if (rename(old_path.c_str(), item_id_.c_str()) == -1)
+        {
+            // LCOV_EXCL_START
+            string msg = "finish(): rename \"" + old_path + "\" to \"" + item_id_ + "\" failed: "
+                         + safe_strerror(errno);
+            BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
+            // LCOV_EXCL_STOP
+        }
+    }
+}
+
+// Called by the group commit once the file is linked into place (or failed to be).
+
+void LocalUploadJob::complete_finish(boost::promise<Item>& promise, exception_ptr error)
+{
+    try
+    {
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+        provider_->record_change(item_id_, parent_id_.empty() ? ChangeType::changed : ChangeType::created);
+        provider_->invalidate_space_cache();
+
+        auto st = stat_path(method_, item_id_);
+        auto const keys = LocalProvider::plan_metadata(metadata_keys_);
+        auto item = provider_->make_item(method_, item_id_, st, keys, checksums_);
+        promise.set_value(item);
+    }
+    catch (StorageException const&)
+    {
+        promise.set_exception(boost::current_exception());
+    }
+    // LCOV_EXCL_START
+    catch (boost::filesystem::filesystem_error const& e)
+    {
+        try
+        {
+            throw_storage_exception("finish()", e);
+        }
+        catch (StorageException const&)
+        {
+            promise.set_exception(boost::current_exception());
+        }
+    }
+    catch (std::exception const& e)
+    {
+        promise.set_exception(UnknownException(e.what()));
+    }
+    // LCOV_EXCL_STOP
 }
 
 void LocalUploadJob::on_bytes_ready()
@@ -317,6 +638,10 @@ void LocalUploadJob::on_bytes_ready()
                 throw_storage_exception(method_, msg, QFileDevice::FatalError);
                 // LCOV_EXCL_STOP
             }
+            if (hasher_)
+            {
+                hasher_->update(buf.constData(), size_t(buf.size()));
+            }
         }
     }
     catch (std::exception const&)
@@ -333,11 +658,16 @@ void LocalUploadJob::on_read_channel_finished()
 
 void LocalUploadJob::abort_upload()
 {
+    stop_receive_file(stop_now);
     state_ = cancelled;
     disconnect(&read_socket_, nullptr, this, nullptr);
     read_socket_.abort();
     file_->close();
-    if (!use_linkat_)
+    if (!session_path_.empty())
+    {
+        ::unlink(session_path_.c_str());  // Don't leave any temp file behind.
+    }
+    else if (!use_linkat_)
     {
         // LCOV_EXCL_START
         string filename = file_->fileName().toStdString();
@@ -346,3 +676,280 @@ void LocalUploadJob::abort_upload()
     }
     bytes_to_write_ = 0;
 }
+
+// Start the thread that receives the data. splice() moves the data from the socket
+// into a pipe and from the pipe into the file without copying it into user space,
+// and we read only as much as fits into the pipe, so memory use does not depend
+// on how fast the client sends.
+
+void LocalUploadJob::start_receive_file()
+{
+    using namespace unity::storage::internal;
+
+    static int constexpr PIPE_SIZE = 1024 * 1024;
+
+    int dup_fd = fcntl(read_socket(), F_DUPFD_CLOEXEC, 0);
+    if (dup_fd == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = method_ + ": dup() failed: " + safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    receive_socket_.reset(dup_fd);
+    // The socket is non-blocking so we can wait for it to become readable or for
+    // a request to stop, whichever comes first.
+    int flags = fcntl(dup_fd, F_GETFL);
+    if (flags == -1 || fcntl(dup_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = method_ + ": cannot set O_NONBLOCK: " + safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = method_ + ": pipe2() failed: " + safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    pipe_read_fd_.reset(pipe_fds[0]);
+    pipe_write_fd_.reset(pipe_fds[1]);
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, PIPE_SIZE);  // Larger chunks mean fewer system calls. Failure is harmless.
+    stop_fd_.reset(eventfd(0, EFD_CLOEXEC));
+    if (stop_fd_.get() == -1)
+    {
+        // LCOV_EXCL_START
+        string msg = method_ + ": eventfd() failed: " + safe_strerror(errno);
+        throw ResourceException(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+    receive_thread_ = thread(&LocalUploadJob::receive_file, this);
+}
+
+// Runs on the receive thread until the client closes its end of the socket, something
+// goes wrong, or we are asked to stop. If something goes wrong, we hand back to the
+// main thread, which reports the error.
+
+void LocalUploadJob::receive_file()
+{
+    using namespace unity::storage::internal;
+
+    try
+    {
+        while (stop_mode_ != stop_now)
+        {
+            ssize_t bytes_received;
+            if (bytes_to_write_ > 0)
+            {
+                bytes_received = receive_chunk(bytes_to_write_);
+            }
+            else
+            {
+                // We have all the data, so the only thing left to read is EOF.
+                char c;
+                bytes_received = recv(receive_socket_.get(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+                if (bytes_received > 0)
+                {
+                    bytes_to_write_ = -1;
+                    string msg = method_ + ": received more than the expected number (" + to_string(size_)
+                                 + ") of bytes";
+                    BOOST_THROW_EXCEPTION(LogicException(msg));
+                }
+            }
+            if (bytes_received == 0)
+            {
+                return;  // EOF. finish() checks whether we got all the data.
+            }
+            if (bytes_received > 0)
+            {
+                continue;
+            }
+            switch (errno)
+            {
+                case EINTR:
+                    break;  // LCOV_EXCL_LINE
+                case EAGAIN:
+                    if (stop_mode_ != keep_receiving)
+                    {
+                        return;  // We have drained the socket.
+                    }
+                    wait_until_readable();
+                    break;
+                default:
+                {
+                    // LCOV_EXCL_START
+                    string msg = method_ + ": cannot read from socket: " + safe_strerror(errno);
+                    BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
+                    // LCOV_EXCL_STOP
+                }
+            }
+        }
+    }
+    catch (std::exception const&)
+    {
+        receive_error_ = current_exception();
+        QMetaObject::invokeMethod(this, "on_receive_file_done", Qt::QueuedConnection);
+    }
+}
+
+// Moves up to max_bytes from the socket into the file. Returns the number of
+// bytes received, 0 for EOF, or -1 with errno set if nothing could be read.
+
+ssize_t LocalUploadJob::receive_chunk(int64_t max_bytes)
+{
+    static int64_t constexpr CHUNK_SIZE = 1024 * 1024;
+    static size_t constexpr BUF_SIZE = 64 * 1024;
+
+    if (use_splice_)
+    {
+        auto bytes_received = splice(receive_socket_.get(), nullptr, pipe_write_fd_.get(), nullptr,
+                                     size_t(min(max_bytes, CHUNK_SIZE)), SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (bytes_received > 0)
+        {
+            splice_to_file(bytes_received);
+            bytes_to_write_ -= bytes_received;
+            return bytes_received;
+        }
+        if (bytes_received == 0 || errno != EINVAL)
+        {
+            return bytes_received;
+        }
+        // LCOV_EXCL_START
+        // Older kernels cannot splice from a Unix domain socket.
+        use_splice_ = false;
+        // LCOV_EXCL_STOP
+    }
+
+    buf_.resize(BUF_SIZE);
+    auto bytes_received = ::read(receive_socket_.get(), buf_.data(), size_t(min(max_bytes, int64_t(BUF_SIZE))));
+    if (bytes_received > 0)
+    {
+        write_to_file(buf_.data(), size_t(bytes_received));
+        bytes_to_write_ -= bytes_received;
+    }
+    return bytes_received;
+}
+
+// Moves the given number of bytes from the pipe into the file.
+
+void LocalUploadJob::splice_to_file(int64_t bytes)
+{
+    using namespace unity::storage::internal;
+
+    while (bytes > 0)
+    {
+        auto bytes_written = splice(pipe_read_fd_.get(), nullptr, tmp_fd_.get(), nullptr, size_t(bytes), SPLICE_F_MOVE);
+        if (bytes_written > 0)
+        {
+            bytes -= bytes_written;
+            continue;
+        }
+        // LCOV_EXCL_START
+        if (bytes_written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes_written == -1 && errno == EINVAL)
+        {
+            // The file system does not support splice(), so we copy what is in the pipe.
+            use_splice_ = false;
+            buf_.resize(size_t(bytes));
+            auto bytes_read = ::read(pipe_read_fd_.get(), buf_.data(), buf_.size());
+            if (bytes_read != bytes)
+            {
+                string msg = method_ + ": cannot read from pipe: " + safe_strerror(errno);
+                BOOST_THROW_EXCEPTION(ResourceException(msg, errno));
+            }
+            write_to_file(buf_.data(), buf_.size());
+            return;
+        }
+        string msg = method_ + ": cannot write to \"" + item_id_ + "\": " + safe_strerror(errno);
+        throw_write_error(msg, errno);
+        // LCOV_EXCL_STOP
+    }
+}
+
+void LocalUploadJob::write_to_file(char const* buf, size_t bytes)
+{
+    using namespace unity::storage::internal;
+
+    if (hasher_)
+    {
+        hasher_->update(buf, bytes);
+    }
+    while (bytes > 0)
+    {
+        auto bytes_written = ::write(tmp_fd_.get(), buf, bytes);
+        if (bytes_written == -1)
+        {
+            // LCOV_EXCL_START
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            string msg = method_ + ": cannot write to \"" + item_id_ + "\": " + safe_strerror(errno);
+            throw_write_error(msg, errno);
+            // LCOV_EXCL_STOP
+        }
+        buf += bytes_written;
+        bytes -= size_t(bytes_written);
+    }
+}
+
+// Wait until we can read from the socket or we are asked to stop.
+
+void LocalUploadJob::wait_until_readable()
+{
+    struct pollfd fds[2];
+    fds[0].fd = receive_socket_.get();
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_fd_.get();
+    fds[1].events = POLLIN;
+    while (stop_mode_ == keep_receiving)
+    {
+        // We return for POLLERR and POLLHUP, too, so the next read reports the error or EOF.
+        if (poll(fds, 2, -1) > 0)
+        {
+            return;
+        }
+    }
+}
+
+// Ask the receive thread to stop and wait for it to finish. Called on the main thread.
+// With drain_and_stop, the thread first receives whatever data the socket has buffered.
+
+void LocalUploadJob::stop_receive_file(StopMode mode)
+{
+    if (!receive_thread_.joinable())
+    {
+        return;
+    }
+    stop_mode_ = mode;
+    uint64_t one = 1;
+    if (::write(stop_fd_.get(), &one, sizeof(one)) != sizeof(one))
+    {
+        abort();  // LCOV_EXCL_LINE  // Impossible
+    }
+    receive_thread_.join();
+    receive_socket_.dealloc();
+    pipe_read_fd_.dealloc();
+    pipe_write_fd_.dealloc();
+}
+
+void LocalUploadJob::on_receive_file_done()
+{
+    if (!receive_thread_.joinable())
+    {
+        return;  // finish() or cancel() got here first.
+    }
+    receive_thread_.join();
+    if (state_ == in_progress)
+    {
+        auto error = receive_error_;
+        abort_upload();
+        report_error(error);
+    }
+}
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include "ContentHasher.h"
+
 #include <unity/storage/provider/UploadJob.h>
 
 #include <unity/util/ResourcePtr.h>
@@ -29,6 +31,11 @@
 #include <QLocalSocket>
 #pragma GCC diagnostic pop
 
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <thread>
+
 class LocalProvider;
 
 class LocalUploadJob : public QObject, public unity::storage::provider::UploadJob
@@ -42,30 +49,48 @@ public:
                    std::string const& parent_id,
                    std::string const& name,
                    int64_t size,
-                   bool allow_overwrite);
+                   bool allow_overwrite,
+                   std::vector<std::string> const& metadata_keys = {});
     // update()
     LocalUploadJob(std::shared_ptr<LocalProvider> const& provider,
                    std::string const& item_id,
                    int64_t size,
-                   std::string const& old_etag);
+                   std::string const& old_etag,
+                   std::vector<std::string> const& metadata_keys = {});
     virtual ~LocalUploadJob();
 
     virtual boost::future<void> cancel() override;
     virtual boost::future<unity::storage::provider::Item> finish() override;
+    virtual boost::future<int64_t> suspend() override;
+    virtual boost::future<void> resume() override;
 
 private Q_SLOTS:
     void on_bytes_ready();
     void on_read_channel_finished();
+    void on_receive_file_done();
 
 private:
-    enum State { in_progress, finished, cancelled };
+    enum State { in_progress, suspended, finished, cancelled };
+    enum StopMode { keep_receiving, drain_and_stop, stop_now };
 
     void prepare_channels();
+    void attach_socket();
+    void preallocate();
     void abort_upload();
+    void link_into_place();
+    void complete_finish(boost::promise<unity::storage::provider::Item>& promise, std::exception_ptr error);
+
+    void start_receive_file();
+    void receive_file();
+    ssize_t receive_chunk(int64_t max_bytes);
+    void splice_to_file(int64_t bytes);
+    void write_to_file(char const* buf, size_t bytes);
+    void wait_until_readable();
+    void stop_receive_file(StopMode mode);
 
     std::shared_ptr<LocalProvider> const provider_;
     int64_t const size_;
-    int64_t bytes_to_write_;
+    std::atomic<int64_t> bytes_to_write_;
     std::unique_ptr<QFile> file_;
     QLocalSocket read_socket_;
     std::string const method_;
@@ -74,6 +99,23 @@ private:
     std::string old_etag_;   // Empty for create_file()
     std::string parent_id_;  // Empty for update()
     bool allow_overwrite_;   // Undefined for update()
+    std::vector<std::string> metadata_keys_;
     unity::util::ResourcePtr<int, std::function<void(int)>> tmp_fd_;
     bool use_linkat_;
+    std::string session_path_;  // Reserved name of the tmp file once the upload was suspended.
+    std::unique_ptr<ContentHasher> hasher_;  // Null if the client did not ask for checksums.
+    ContentHasher::Checksums checksums_;
+
+    // With zero_copy_, a separate thread moves the data from the socket to tmp_fd_
+    // through a pipe with splice(), instead of copying it through the event loop.
+    bool const zero_copy_;
+    std::thread receive_thread_;
+    unity::util::ResourcePtr<int, std::function<void(int)>> receive_socket_;
+    unity::util::ResourcePtr<int, std::function<void(int)>> pipe_read_fd_;
+    unity::util::ResourcePtr<int, std::function<void(int)>> pipe_write_fd_;
+    unity::util::ResourcePtr<int, std::function<void(int)>> stop_fd_;
+    std::atomic<int> stop_mode_;
+    bool use_splice_;        // Used only by the receive thread.
+    std::vector<char> buf_;  // Used only by the receive thread if splice() is not supported.
+    std::exception_ptr receive_error_;
 };
@@ -0,0 +1,780 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#include "MetadataIndex.h"
+
+#include "utils.h"
+
+#include <unity/storage/internal/safe_strerror.h>
+#include <unity/util/ResourcePtr.h>
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace unity::storage;
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+// Snapshot format: the header, followed by the content types, followed by the entries in path order.
+// Each content type is a uint32_t length followed by the string; each entry is a Record
+// followed by the path. Content types and entries are padded to a multiple of 8 bytes.
+
+struct Header
+{
+    char magic[8];
+    uint64_t num_types;
+    uint64_t num_entries;
+    int64_t root_mtime_nsecs;  // Zero in snapshots written by older versions, which forces a rescan.
+    uint64_t reserved[4];
+};
+
+struct Record
+{
+    int64_t size_in_bytes;
+    int64_t mtime_nsecs;
+    uint32_t path_len;
+    uint32_t type_index;
+};
+
+char const SNAPSHOT_MAGIC[8] = { 'S', 'F', 'I', 'N', 'D', 'X', '0', '1' };
+
+char const FOLDER_TYPE[] = "inode/directory";
+
+// search() locks the index for at most this many entries at a time.
+size_t const SEARCH_CHUNK_SIZE = 1000;
+
+typedef unity::util::ResourcePtr<int, std::function<void(int)>> FdPtr;
+
+void close_fd(int fd)
+{
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+}
+
+uint64_t padded(uint64_t size)
+{
+    return (size + 7) & ~uint64_t(7);
+}
+
+void append_padded(string& buf, void const* data, size_t size)
+{
+    buf.append(static_cast<char const*>(data), size);
+    buf.append(padded(size) - size, '\0');
+}
+
+string to_lower(string s)
+{
+    transform(s.begin(), s.end(), s.begin(), [](unsigned char c) { return char(tolower(c)); });
+    return s;
+}
+
+struct Query
+{
+    vector<string> words;       // Lower case
+    vector<string> type_prefixes;
+};
+
+Query parse_query(string const& query)
+{
+    static string const TYPE_TAG = "type:";
+
+    Query q;
+    istringstream s(query);
+    string term;
+    while (s >> term)
+    {
+        if (term.compare(0, TYPE_TAG.size(), TYPE_TAG) == 0)
+        {
+            q.type_prefixes.push_back(to_lower(term.substr(TYPE_TAG.size())));
+        }
+        else
+        {
+            q.words.push_back(to_lower(term));
+        }
+    }
+    return q;
+}
+
+bool matches(Query const& q, string const& rel_path, string const& type)
+{
+    if (!all_of(q.type_prefixes.begin(), q.type_prefixes.end(),
+                [&type](string const& p) { return type.compare(0, p.size(), p) == 0; }))
+    {
+        return false;
+    }
+    if (q.words.empty())
+    {
+        return true;
+    }
+    auto const slash = rel_path.rfind('/');
+    auto const name = to_lower(slash == string::npos ? rel_path : rel_path.substr(slash + 1));
+    return all_of(q.words.begin(), q.words.end(), [&name](string const& w) { return name.find(w) != string::npos; });
+}
+
+}  // namespace
+
+MetadataIndex::MetadataIndex(string const& root, string const& snapshot_path, TypeFunc const& content_type)
+    : root_(root)
+    , snapshot_path_(snapshot_path)
+    , content_type_(content_type)
+    , root_mtime_nsecs_(0)
+    , ready_(false)
+    , rescan_requested_(false)
+    , scanning_(true)  // Until the snapshot is loaded.
+    , stop_(false)
+{
+    assert(content_type);
+
+    scanner_ = thread(&MetadataIndex::run_scanner, this);
+}
+
+MetadataIndex::~MetadataIndex()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+        cond_.notify_all();
+    }
+    scanner_.join();
+    if (ready_)
+    {
+        save_snapshot();
+    }
+}
+
+void MetadataIndex::update(ItemChangeList const& changes)
+{
+    for (auto const& c : changes)
+    {
+        string rel;
+        if (!to_relative(c.item_id, rel))
+        {
+            continue;
+        }
+        if (rel.empty())
+        {
+            // The root changed, so we may have missed changes.
+            lock_guard<mutex> lock(mutex_);
+            rescan_requested_ = true;
+            cond_.notify_all();
+            continue;
+        }
+        if (is_reserved_path(rel))
+        {
+            continue;
+        }
+
+        // We stat the item (and scan new folders) before locking, so searches are not held up.
+        // The update includes the parent folder, whose modification time has changed, too.
+        auto u = make_update(rel, c.type);
+        auto const root_mtime = rel.find('/') == string::npos ? root_mtime_nsecs() : 0;
+        lock_guard<mutex> lock(mutex_);
+        apply(u, entries_);
+        if (root_mtime != 0)
+        {
+            root_mtime_nsecs_ = root_mtime;
+        }
+        if (scanning_)
+        {
+            pending_.push_back(move(u));
+        }
+    }
+}
+
+vector<string> MetadataIndex::search(string const& parent_id,
+                                     string const& query,
+                                     string const& start_after,
+                                     size_t max_results,
+                                     bool& more)
+{
+    more = false;
+
+    string parent;
+    string start;
+    if (!to_relative(parent_id, parent) || (!start_after.empty() && !to_relative(start_after, start)))
+    {
+        return {};
+    }
+    auto const q = parse_query(query);
+    string const prefix = parent.empty() ? "" : parent + "/";
+
+    struct Candidate
+    {
+        string rel_path;
+        Entry entry;
+    };
+
+    vector<string> ids;
+    string last = start;  // The last entry we looked at.
+    bool done = false;
+    while (!done)
+    {
+        // We collect the candidates of one chunk with the index locked, and check them without the lock.
+        vector<Candidate> candidates;
+        {
+            lock_guard<mutex> lock(mutex_);
+            if (!ready_)
+            {
+                return {};
+            }
+            auto it = last < prefix ? entries_.lower_bound(prefix) : entries_.upper_bound(last);
+            auto const end = entries_.end();
+            size_t n = 0;
+            for (; it != end && n < SEARCH_CHUNK_SIZE && it->first.compare(0, prefix.size(), prefix) == 0; ++it, ++n)
+            {
+                if (matches(q, it->first, *it->second.content_type))
+                {
+                    candidates.push_back(Candidate{ it->first, it->second });
+                }
+            }
+            done = it == end || it->first.compare(0, prefix.size(), prefix) != 0;
+            if (n != 0)
+            {
+                last = prev(it)->first;
+            }
+        }
+
+        for (auto& c : candidates)
+        {
+            Entry const indexed = c.entry;
+            if (!refresh_entry(c.rel_path, c.entry))
+            {
+                continue;  // Removed since.
+            }
+            if ((c.entry.mtime_nsecs != indexed.mtime_nsecs || c.entry.size_in_bytes != indexed.size_in_bytes)
+                && !matches(q, c.rel_path, *c.entry.content_type))
+            {
+                continue;  // Changed since, and no longer matches.
+            }
+            if (max_results != 0 && ids.size() == max_results)
+            {
+                more = true;
+                return ids;
+            }
+            ids.push_back(root_ + "/" + c.rel_path);
+        }
+    }
+    return ids;
+}
+
+bool MetadataIndex::wait_until_ready(chrono::milliseconds timeout)
+{
+    unique_lock<mutex> lock(mutex_);
+    return cond_.wait_for(lock, timeout, [this]{ return ready_ || stop_; }) && ready_;
+}
+
+// Scans the whole tree whenever a rescan is requested. The result of the scan replaces
+// the index in one go, so searches see either the old or the new state.
+
+void MetadataIndex::run_scanner()
+{
+    // Loading a large snapshot takes a while, so the constructor leaves this to us.
+    EntryMap loaded;
+    int64_t loaded_root_mtime = 0;
+    bool const have_snapshot = load_snapshot(loaded, loaded_root_mtime);
+    {
+        lock_guard<mutex> lock(mutex_);
+        scanning_ = false;
+        if (have_snapshot)
+        {
+            // Updates that arrived while we were loading are newer than the snapshot.
+            for (auto const& u : pending_)
+            {
+                apply(u, loaded);
+            }
+            entries_.swap(loaded);
+            root_mtime_nsecs_ = loaded_root_mtime;
+            ready_ = true;
+            cond_.notify_all();
+        }
+        else
+        {
+            rescan_requested_ = true;
+        }
+        pending_.clear();
+    }
+    if (have_snapshot && is_stale())
+    {
+        lock_guard<mutex> lock(mutex_);
+        rescan_requested_ = true;
+    }
+
+    for (;;)
+    {
+        {
+            unique_lock<mutex> lock(mutex_);
+            cond_.wait(lock, [this]{ return stop_ || rescan_requested_; });
+            if (stop_)
+            {
+                return;
+            }
+            rescan_requested_ = false;
+            scanning_ = true;
+            pending_.clear();
+        }
+
+        // The modification times are taken before the contents are read, so a change made
+        // during the scan can only make the snapshot look stale, never current.
+        auto const root_mtime = root_mtime_nsecs();
+        EntryList list;
+        collect_children("", list);
+        EntryMap fresh;
+        for (auto& e : list)
+        {
+            fresh.emplace(move(e.first), e.second);
+        }
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            scanning_ = false;
+            if (stop_)
+            {
+                return;  // Incomplete scan.
+            }
+            // Changes that happened while we were scanning may or may not be reflected
+            // in the scan result, so we apply them again.
+            for (auto const& u : pending_)
+            {
+                apply(u, fresh);
+            }
+            pending_.clear();
+            entries_.swap(fresh);
+            root_mtime_nsecs_ = root_mtime;
+            ready_ = true;
+            cond_.notify_all();
+        }
+        save_snapshot();
+    }
+}
+
+// Returns true if a folder was changed since its entry was made. Costs one stat()
+// per folder, which is much cheaper than a rescan of the whole tree.
+
+bool MetadataIndex::is_stale()
+{
+    vector<pair<string, int64_t>> folders;
+    int64_t root_mtime;
+    {
+        lock_guard<mutex> lock(mutex_);
+        root_mtime = root_mtime_nsecs_;
+        for (auto const& e : entries_)
+        {
+            if (e.second.size_in_bytes == -1)
+            {
+                folders.emplace_back(e.first, e.second.mtime_nsecs);
+            }
+        }
+    }
+    if (root_mtime == 0 || root_mtime != root_mtime_nsecs())
+    {
+        return true;
+    }
+    for (auto const& f : folders)
+    {
+        if (stop_)
+        {
+            return false;
+        }
+        struct stat st;
+        if (stat((root_ + "/" + f.first).c_str(), &st) == -1 || get_mtime_nsecs(st) != f.second)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Adds the entry for rel_path and, if recursive is set and rel_path is a folder,
+// the entries for everything below it. Returns false if rel_path does not exist
+// or is neither a file nor a folder.
+
+bool MetadataIndex::collect(string const& rel_path, bool recursive, EntryList& entries)
+{
+    string const path = root_ + "/" + rel_path;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == -1)
+    {
+        return false;
+    }
+    bool const is_link = S_ISLNK(st.st_mode);
+    if (is_link && stat(path.c_str(), &st) == -1)
+    {
+        return false;
+    }
+    Entry e;
+    if (!make_entry(rel_path, st, e))
+    {
+        return false;
+    }
+    entries.emplace_back(rel_path, e);
+    if (recursive && S_ISDIR(st.st_mode) && !is_link)
+    {
+        collect_children(rel_path, entries);
+    }
+    return true;
+}
+
+// Adds the entries for everything below rel_dir. We don't follow symbolic links to folders,
+// so we cannot end up in a loop.
+
+void MetadataIndex::collect_children(string const& rel_dir, EntryList& entries)
+{
+    vector<string> dirs{ rel_dir };
+    while (!dirs.empty() && !stop_)
+    {
+        auto const dir = move(dirs.back());
+        dirs.pop_back();
+
+        string const path = dir.empty() ? root_ : root_ + "/" + dir;
+        int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            continue;  // Removed since, or no permission.
+        }
+        unique_ptr<DIR, int(*)(DIR*)> d(fdopendir(fd), closedir);
+        if (!d)
+        {
+            // LCOV_EXCL_START
+            ::close(fd);
+            continue;
+            // LCOV_EXCL_STOP
+        }
+        while (auto dirent = readdir(d.get()))
+        {
+            string const name = dirent->d_name;
+            if (name == "." || name == ".." || is_reserved_path(name))
+            {
+                continue;
+            }
+            struct stat st;
+            if (fstatat(fd, dirent->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+            {
+                continue;
+            }
+            bool const is_link = S_ISLNK(st.st_mode);
+            if (is_link && fstatat(fd, dirent->d_name, &st, 0) == -1)
+            {
+                continue;  // Dangling link.
+            }
+            string rel = dir.empty() ? name : dir + "/" + name;
+            Entry e;
+            if (!make_entry(rel, st, e))
+            {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode) && !is_link)
+            {
+                dirs.push_back(rel);
+            }
+            entries.emplace_back(move(rel), e);
+        }
+    }
+}
+
+int64_t MetadataIndex::root_mtime_nsecs() const
+{
+    struct stat st;
+    return stat(root_.c_str(), &st) == -1 ? 0 : get_mtime_nsecs(st);
+}
+
+// Checks whether the item at rel_path still has the size and modification time of entry.
+// If not, updates entry and the index. Returns false if the item no longer exists.
+
+bool MetadataIndex::refresh_entry(string const& rel_path, Entry& entry)
+{
+    struct stat st;
+    if (stat((root_ + "/" + rel_path).c_str(), &st) == -1)
+    {
+        return false;
+    }
+    int64_t const size = S_ISDIR(st.st_mode) ? -1 : int64_t(st.st_size);
+    if (get_mtime_nsecs(st) == entry.mtime_nsecs && size == entry.size_in_bytes)
+    {
+        return true;
+    }
+    if (!make_entry(rel_path, st, entry))
+    {
+        return false;
+    }
+    lock_guard<mutex> lock(mutex_);
+    auto it = entries_.find(rel_path);
+    if (it != entries_.end())
+    {
+        it->second = entry;
+    }
+    return true;
+}
+
+bool MetadataIndex::make_entry(string const& rel_path, struct stat const& st, Entry& entry)
+{
+    entry.mtime_nsecs = get_mtime_nsecs(st);
+    if (S_ISREG(st.st_mode))
+    {
+        entry.size_in_bytes = st.st_size;
+        entry.content_type = intern(content_type_(root_ + "/" + rel_path, st));
+        return true;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        entry.size_in_bytes = -1;
+        entry.content_type = intern(FOLDER_TYPE);
+        return true;
+    }
+    return false;
+}
+
+// New folders are scanned, so we pick up anything that was created or moved into them.
+// The parent folder is included, so its modification time stays current.
+
+MetadataIndex::Update MetadataIndex::make_update(string const& rel_path, ChangeType type)
+{
+    Update u{ rel_path, false, false, {} };
+    if (type != ChangeType::deleted)
+    {
+        u.recursive = type == ChangeType::created;
+        u.exists = collect(rel_path, u.recursive, u.entries);
+    }
+    auto const slash = rel_path.rfind('/');
+    if (slash != string::npos)
+    {
+        collect(rel_path.substr(0, slash), false, u.entries);
+    }
+    return u;
+}
+
+void MetadataIndex::apply(Update const& u, EntryMap& entries)
+{
+    if (!u.exists || u.recursive)
+    {
+        erase_subtree(u.path, entries);
+    }
+    for (auto const& e : u.entries)
+    {
+        entries[e.first] = e.second;
+    }
+}
+
+void MetadataIndex::erase_subtree(string const& rel_path, EntryMap& entries)
+{
+    entries.erase(rel_path);
+
+    // All paths below rel_path start with "<rel_path>/" and sort before "<rel_path>0".
+    string prefix = rel_path + "/";
+    auto const begin = entries.lower_bound(prefix);
+    prefix.back() = '/' + 1;
+    entries.erase(begin, entries.lower_bound(prefix));
+}
+
+bool MetadataIndex::to_relative(string const& id, string& rel) const
+{
+    if (id == root_)
+    {
+        rel.clear();
+        return true;
+    }
+    if (id.size() <= root_.size() + 1 || id.compare(0, root_.size(), root_) != 0 || id[root_.size()] != '/')
+    {
+        return false;
+    }
+    rel = id.substr(root_.size() + 1);
+    return true;
+}
+
+// There are only a few hundred distinct content types, so each entry stores a pointer to a shared copy.
+
+string const* MetadataIndex::intern(string const& content_type)
+{
+    lock_guard<mutex> lock(types_mutex_);
+    return &*content_types_.insert(content_type).first;
+}
+
+// Loads the snapshot written by a previous instance. Returns false if there is
+// no snapshot or it is corrupt, in which case searches wait for the initial scan.
+
+bool MetadataIndex::load_snapshot(EntryMap& entries, int64_t& root_mtime)
+{
+    FdPtr fd(::open(snapshot_path_.c_str(), O_RDONLY | O_CLOEXEC), close_fd);
+    struct stat st;
+    if (fd.get() == -1 || fstat(fd.get(), &st) == -1 || uint64_t(st.st_size) < sizeof(Header))
+    {
+        return false;
+    }
+    uint64_t const size = st.st_size;
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (addr == MAP_FAILED)
+    {
+        return false;  // LCOV_EXCL_LINE
+    }
+    unique_ptr<void, function<void(void*)>> map(addr, [size](void* a) { munmap(a, size); });
+    char const* const base = static_cast<char const*>(addr);
+
+    auto const& h = *reinterpret_cast<Header const*>(base);
+    if (memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0)
+    {
+        return false;
+    }
+
+    uint64_t offset = sizeof(Header);
+    vector<string const*> types;
+    for (uint64_t i = 0; i < h.num_types; ++i)
+    {
+        uint32_t len;
+        if (offset > size || size - offset < sizeof(len))
+        {
+            return false;
+        }
+        memcpy(&len, base + offset, sizeof(len));
+        if (size - offset - sizeof(len) < len)
+        {
+            return false;
+        }
+        types.push_back(intern(string(base + offset + sizeof(len), len)));
+        offset += padded(sizeof(len) + len);
+    }
+
+    entries.clear();
+    for (uint64_t i = 0; i < h.num_entries; ++i)
+    {
+        if (offset > size || size - offset < sizeof(Record))
+        {
+            return false;
+        }
+        auto const& r = *reinterpret_cast<Record const*>(base + offset);
+        if (r.path_len == 0 || size - offset - sizeof(Record) < r.path_len || r.type_index >= types.size())
+        {
+            return false;
+        }
+        string path(base + offset + sizeof(Record), r.path_len);
+        entries.emplace_hint(entries.end(), move(path), Entry{ r.size_in_bytes, r.mtime_nsecs, types[r.type_index] });
+        offset += padded(sizeof(Record) + r.path_len);
+    }
+
+    root_mtime = h.root_mtime_nsecs;
+    return true;
+}
+
+// Writes the snapshot to a temporary file that replaces the snapshot once complete,
+// so a crash cannot leave a partial snapshot behind. Failure to write the snapshot
+// is not fatal; the next instance rescans the tree before it answers searches.
+
+void MetadataIndex::save_snapshot()
+{
+    string buf;
+    int64_t root_mtime;
+    {
+        lock_guard<mutex> lock(mutex_);
+
+        unordered_map<string const*, uint32_t> type_indexes;
+        string types;
+        for (auto const& e : entries_)
+        {
+            auto const t = e.second.content_type;
+            if (type_indexes.emplace(t, type_indexes.size()).second)
+            {
+                // The length and the string are padded together, as load_snapshot() expects.
+                uint32_t const len = t->size();
+                types.append(reinterpret_cast<char const*>(&len), sizeof(len));
+                types.append(*t);
+                types.append(padded(sizeof(len) + len) - sizeof(len) - len, '\0');
+            }
+        }
+
+        Header h = {};
+        memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        h.num_types = type_indexes.size();
+        h.num_entries = entries_.size();
+        h.root_mtime_nsecs = root_mtime_nsecs_;
+        root_mtime = h.root_mtime_nsecs;
+        buf.reserve(sizeof(h) + types.size() + entries_.size() * (sizeof(Record) + 32));
+        buf.append(reinterpret_cast<char const*>(&h), sizeof(h));
+        buf += types;
+        for (auto const& e : entries_)
+        {
+            Record r{ e.second.size_in_bytes, e.second.mtime_nsecs,
+                      uint32_t(e.first.size()), type_indexes[e.second.content_type] };
+            buf.append(reinterpret_cast<char const*>(&r), sizeof(r));
+            append_padded(buf, e.first.data(), e.first.size());
+        }
+    }
+
+    // The snapshot is in the root, so writing it changes the modification time of the root.
+    // If the root had not changed otherwise, we record the new time, so the next instance
+    // does not consider the snapshot stale because of the snapshot itself.
+    bool const root_current = root_mtime != 0 && root_mtime == root_mtime_nsecs();
+
+    string const tmp_path = snapshot_path_ + ".tmp";
+    FdPtr fd(::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600), close_fd);
+    if (fd.get() == -1)
+    {
+        return;  // The root may have been removed.
+    }
+    size_t written = 0;
+    while (written < buf.size())
+    {
+        auto const rc = ::write(fd.get(), buf.data() + written, buf.size() - written);
+        if (rc == -1)
+        {
+            // LCOV_EXCL_START
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            qWarning().noquote() << "MetadataIndex: cannot write" << tmp_path.c_str() << ":"
+                                 << unity::storage::internal::safe_strerror(errno).c_str();
+            ::unlink(tmp_path.c_str());
+            return;
+            // LCOV_EXCL_STOP
+        }
+        written += rc;
+    }
+    if (::rename(tmp_path.c_str(), snapshot_path_.c_str()) == -1)
+    {
+        ::unlink(tmp_path.c_str());  // LCOV_EXCL_LINE
+        return;                      // LCOV_EXCL_LINE
+    }
+    if (root_current)
+    {
+        int64_t const new_root_mtime = root_mtime_nsecs();
+        lock_guard<mutex> lock(mutex_);
+        if (root_mtime_nsecs_ == root_mtime  // No change to the root was reported meanwhile.
+            && ::pwrite(fd.get(), &new_root_mtime, sizeof(new_root_mtime), offsetof(Header, root_mtime_nsecs))
+               == ssize_t(sizeof(new_root_mtime)))
+        {
+            root_mtime_nsecs_ = new_root_mtime;
+        }
+    }
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#pragma once
+
+#include <unity/storage/provider/Item.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Index of the name, type, size, modification time, and content type of all items below
+// the root, so search() can find items without walking the tree. The index is kept
+// in memory and updated with the changes made by the provider and the changes reported
+// by the watcher. When the index is destroyed, it writes a snapshot to disk; the next
+// instance loads the snapshot on its scanner thread, so searches work soon after the
+// provider starts, without a scan and without holding up the constructor. To pick up changes
+// that were made while no provider was running, it then compares the modification time of
+// each folder with the one in the snapshot, and rescans the tree in the background only if
+// a folder has changed. (Adding, removing, or renaming an entry changes the modification time
+// of its folder.) A change to the root (reported if the watcher lost events) also triggers a rescan.
+// The index may lag behind the file system, so search() checks the size and modification time
+// of each match, and updates the entry (and re-checks the query) if the item has changed.
+// This class is thread-safe.
+
+class MetadataIndex
+{
+public:
+    // Returns the content type of the file at path.
+    typedef std::function<std::string(std::string const& path, struct stat const& st)> TypeFunc;
+
+    MetadataIndex(std::string const& root, std::string const& snapshot_path, TypeFunc const& content_type);
+    ~MetadataIndex();
+
+    MetadataIndex(MetadataIndex const&) = delete;
+    MetadataIndex& operator=(MetadataIndex const&) = delete;
+
+    void update(unity::storage::provider::ItemChangeList const& changes);
+
+    // Returns the ids of the items below parent_id (at any depth) that match query, in path order,
+    // starting after the item start_after (or from the beginning if start_after is empty).
+    // At most max_results ids are returned (0 means unlimited); more is set if there are more matches.
+    // The query is a list of whitespace-separated terms. A term of the form "type:<prefix>" matches
+    // items whose content type starts with prefix; any other term matches items whose name
+    // contains the term (ignoring case). An item must match all terms.
+    // If the index has not been built yet, no ids are returned; call wait_until_ready() first.
+    // The index is locked for a limited number of entries at a time, so updates are not held up by a
+    // search of a large tree.
+    std::vector<std::string> search(std::string const& parent_id,
+                                    std::string const& query,
+                                    std::string const& start_after,
+                                    size_t max_results,
+                                    bool& more);
+
+    // Waits until the index has been built (from the snapshot or by the initial scan), for at most timeout.
+    // Returns false if the index is not ready by then.
+    bool wait_until_ready(std::chrono::milliseconds timeout);
+
+private:
+    struct Entry
+    {
+        int64_t size_in_bytes;       // -1 for folders
+        int64_t mtime_nsecs;
+        std::string const* content_type;  // Points into content_types_
+    };
+    typedef std::map<std::string, Entry> EntryMap;  // Keyed by path relative to the root
+    typedef std::vector<std::pair<std::string, Entry>> EntryList;
+
+    struct Update
+    {
+        std::string path;
+        bool exists;
+        bool recursive;
+        EntryList entries;
+    };
+
+    void run_scanner();
+    bool is_stale();
+    bool collect(std::string const& rel_path, bool recursive, EntryList& entries);
+    void collect_children(std::string const& rel_dir, EntryList& entries);
+    bool make_entry(std::string const& rel_path, struct stat const& st, Entry& entry);
+    int64_t root_mtime_nsecs() const;
+    bool refresh_entry(std::string const& rel_path, Entry& entry);
+    Update make_update(std::string const& rel_path, unity::storage::ChangeType type);
+    static void apply(Update const& u, EntryMap& entries);
+    static void erase_subtree(std::string const& rel_path, EntryMap& entries);
+    bool to_relative(std::string const& id, std::string& rel) const;
+    std::string const* intern(std::string const& content_type);
+    bool load_snapshot(EntryMap& entries, int64_t& root_mtime);
+    void save_snapshot();
+
+    std::string const root_;
+    std::string const snapshot_path_;
+    TypeFunc const content_type_;
+
+    std::mutex types_mutex_;
+    std::unordered_set<std::string> content_types_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    EntryMap entries_;
+    int64_t root_mtime_nsecs_;  // The root is not in entries_.
+    bool ready_;              // Set once we have loaded a snapshot or completed a scan.
+    bool rescan_requested_;
+    bool scanning_;                // Set while we load the snapshot or scan the tree.
+    std::vector<Update> pending_;  // Updates that arrived during a scan, re-applied to the scan result.
+    std::atomic<bool> stop_;
+
+    std::thread scanner_;
+};
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "MimeTypeCache.h"
+
+#include "utils.h"
+
+#include <boost/algorithm/string.hpp>
+#include <QMimeDatabase>
+
+using namespace std;
+
+namespace
+{
+
+char const DEFAULT_CONTENT_TYPE[] = "application/octet-stream";
+
+// Upper bounds on the number of cache entries, in case someone creates
+// lots of files with random extensions.
+
+size_t const MAX_EXTENSIONS = 2000;
+size_t const MAX_SNIFFED_TYPES = 10000;
+
+// QMimeDatabase is thread-safe, but all instances share the same data behind a
+// single global mutex, so lookups are serialized no matter which instance we use.
+// The caches in front of the database are what keep threads from contending for it.
+
+QMimeDatabase& mime_db()
+{
+    static QMimeDatabase db;
+    return db;
+}
+
+string type_name(QMimeType const& mime_type)
+{
+    if (!mime_type.isValid())
+    {
+        return DEFAULT_CONTENT_TYPE;  // LCOV_EXCL_LINE
+    }
+    return mime_type.name().toStdString();
+}
+
+}  // namespace
+
+MimeTypeCache::MimeTypeCache(bool sniff_content)
+    : sniff_content_(sniff_content)
+{
+    // An extension is ambiguous if a glob pattern that ends in that extension matches
+    // more than the extension (such as "*.tar.gz"), or is case-sensitive (such as "*.C").
+    for (auto const& mime_type : mime_db().allMimeTypes())
+    {
+        for (auto const& glob : mime_type.globPatterns())
+        {
+            if (!glob.startsWith("*."))
+            {
+                continue;
+            }
+            auto const suffix = glob.mid(2);
+            auto const extension = suffix.mid(suffix.lastIndexOf('.') + 1).toLower();
+            if (suffix.contains('.') || suffix.contains('*') || suffix.contains('?') || suffix.contains('[')
+                || suffix != suffix.toLower())
+            {
+                ambiguous_extensions_.insert(extension.toStdString());
+            }
+        }
+    }
+}
+
+string MimeTypeCache::content_type(string const& path, struct stat const& st)
+{
+    auto const slash = path.rfind('/');
+    auto const name = path.substr(slash == string::npos ? 0 : slash + 1);
+    auto const dot = name.rfind('.');
+    if (dot == string::npos || dot == 0 || dot == name.size() - 1)
+    {
+        // No extension. Globs such as "Makefile" match the entire name, so there is nothing to cache.
+        if (sniff_content_)
+        {
+            return type_for_contents(path, st);
+        }
+        return type_name(mime_db().mimeTypeForFile(QString::fromStdString(path), QMimeDatabase::MatchExtension));
+    }
+    return type_for_extension(path, boost::to_lower_copy(name.substr(dot + 1)));
+}
+
+string MimeTypeCache::type_for_extension(string const& path, string const& extension)
+{
+    if (ambiguous_extensions_.find(extension) != ambiguous_extensions_.end())
+    {
+        return type_name(mime_db().mimeTypeForFile(QString::fromStdString(path), QMimeDatabase::MatchExtension));
+    }
+
+    {
+        shared_lock<shared_timed_mutex> lock(extensions_mutex_);
+        auto it = extension_types_.find(extension);
+        if (it != extension_types_.end())
+        {
+            return it->second;
+        }
+    }
+
+    auto type = type_name(mime_db().mimeTypeForFile(QString::fromStdString(path), QMimeDatabase::MatchExtension));
+
+    lock_guard<shared_timed_mutex> lock(extensions_mutex_);
+    if (extension_types_.size() < MAX_EXTENSIONS)
+    {
+        extension_types_.emplace(extension, type);
+    }
+    return type;
+}
+
+// Reading the contents of a file is expensive, so we remember the type
+// until the file is modified.
+
+string MimeTypeCache::type_for_contents(string const& path, struct stat const& st)
+{
+    auto const key = make_pair(st.st_dev, st.st_ino);
+    int64_t const mtime_nsecs = get_mtime_nsecs(st);
+    {
+        lock_guard<mutex> lock(sniffed_mutex_);
+        auto it = sniffed_types_.find(key);
+        if (it != sniffed_types_.end() && it->second.mtime_nsecs == mtime_nsecs)
+        {
+            return it->second.content_type;
+        }
+    }
+
+    auto type = type_name(mime_db().mimeTypeForFile(QString::fromStdString(path), QMimeDatabase::MatchDefault));
+
+    lock_guard<mutex> lock(sniffed_mutex_);
+    if (sniffed_types_.size() >= MAX_SNIFFED_TYPES)
+    {
+        sniffed_types_.clear();
+    }
+    sniffed_types_[key] = SniffedType{mtime_nsecs, type};
+    return type;
+}
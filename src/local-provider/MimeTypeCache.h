@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <sys/stat.h>
+
+// Determines the content type of files. Looking up a file name in the MIME database
+// matches the name against all glob patterns, which is expensive. Almost all
+// files are typed by their extension, so we remember the type for each extension.
+// This class is thread-safe.
+
+class MimeTypeCache
+{
+public:
+    // If sniff_content is true, files without an extension are typed by their contents.
+    MimeTypeCache(bool sniff_content);
+
+    MimeTypeCache(MimeTypeCache const&) = delete;
+    MimeTypeCache& operator=(MimeTypeCache const&) = delete;
+
+    std::string content_type(std::string const& path, struct stat const& st);
+
+private:
+    std::string type_for_extension(std::string const& path, std::string const& extension);
+    std::string type_for_contents(std::string const& path, struct stat const& st);
+
+    bool const sniff_content_;
+
+    // Extensions for which the type does not depend on the extension alone, such as "gz"
+    // (because of "*.tar.gz"). Set by the constructor and read-only after that.
+    std::unordered_set<std::string> ambiguous_extensions_;
+
+    std::shared_timed_mutex extensions_mutex_;
+    std::unordered_map<std::string, std::string> extension_types_;
+
+    struct SniffedType
+    {
+        int64_t mtime_nsecs;
+        std::string content_type;
+    };
+
+    std::mutex sniffed_mutex_;
+    std::map<std::pair<dev_t, ino_t>, SniffedType> sniffed_types_;
+};
@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#include "PathValidator.h"
+
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
+
+using namespace std;
+
+namespace
+{
+
+// Same layout as struct open_how in <linux/openat2.h>, which older headers do not have.
+struct OpenHow
+{
+    uint64_t flags;
+    uint64_t mode;
+    uint64_t resolve;
+};
+
+uint64_t constexpr RESOLVE_NO_MAGICLINKS_FLAG = 0x02;
+uint64_t constexpr RESOLVE_NO_SYMLINKS_FLAG = 0x04;
+uint64_t constexpr RESOLVE_BENEATH_FLAG = 0x08;
+
+auto const close_fd = [](int fd){ if (fd != -1) ::close(fd); };
+
+[[ noreturn ]]
+void throw_error(string const& what, string const& path, int error)
+{
+    boost::system::error_code ec(error, boost::system::system_category());
+    throw boost::filesystem::filesystem_error(what, path, ec);
+}
+
+// Returns false if openat2() cannot be used. Besides kernels that do not have it (ENOSYS),
+// seccomp filters of some container runtimes reject unknown system calls with EPERM, and
+// kernels that do not know the resolve flags we need return EINVAL or E2BIG.
+
+bool have_openat2(int root_fd)
+{
+    OpenHow how = {};
+    how.flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH_FLAG | RESOLVE_NO_SYMLINKS_FLAG | RESOLVE_NO_MAGICLINKS_FLAG;
+    int fd = int(syscall(SYS_openat2, root_fd, ".", &how, sizeof(how)));
+    if (fd != -1)
+    {
+        ::close(fd);
+        return true;
+    }
+    return errno != ENOSYS && errno != EPERM && errno != EINVAL && errno != E2BIG;  // LCOV_EXCL_LINE
+}
+
+}  // namespace
+
+PathValidator::PathValidator(boost::filesystem::path const& root)
+    : root_(root.native())
+    , root_fd_(open(root_.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC), close_fd)
+    , have_openat2_(false)
+{
+    if (root_fd_.get() == -1)
+    {
+        throw_error("open", root_, errno);  // LCOV_EXCL_LINE
+    }
+    have_openat2_ = have_openat2(root_fd_.get());
+}
+
+bool PathValidator::is_valid(string const& id) const
+{
+    if (id == root_)
+    {
+        return true;
+    }
+    if (!is_canonical_form(id))
+    {
+        return false;
+    }
+    if (!have_openat2_)
+    {
+        return is_valid_slow(id);  // LCOV_EXCL_LINE
+    }
+
+    // The kernel resolves the path relative to the root, and fails if that would
+    // lead outside the root or through a symbolic link (including the last component).
+    auto const rel_path = id.substr(root_.size() + 1);
+    OpenHow how = {};
+    how.flags = O_PATH | O_CLOEXEC;
+    how.resolve = RESOLVE_BENEATH_FLAG | RESOLVE_NO_SYMLINKS_FLAG | RESOLVE_NO_MAGICLINKS_FLAG;
+    int fd = int(syscall(SYS_openat2, root_fd_.get(), rel_path.c_str(), &how, sizeof(how)));
+    if (fd == -1)
+    {
+        if (errno == ELOOP || errno == EXDEV)
+        {
+            return false;  // A symbolic link or an attempt to escape the root.
+        }
+        throw_error("openat2", id, errno);
+    }
+    ::close(fd);
+    return true;
+}
+
+// Returns true if id is inside the root and does not contain empty, "." or ".." components.
+
+bool PathValidator::is_canonical_form(string const& id) const
+{
+    if (id.size() <= root_.size() + 1 || id.compare(0, root_.size(), root_) != 0 || id[root_.size()] != '/')
+    {
+        return false;
+    }
+    size_t start = root_.size() + 1;
+    for (;;)
+    {
+        auto end = id.find('/', start);
+        auto len = (end == string::npos ? id.size() : end) - start;
+        if (len == 0
+            || (len == 1 && id[start] == '.')
+            || (len == 2 && id[start] == '.' && id[start + 1] == '.'))
+        {
+            return false;
+        }
+        if (end == string::npos)
+        {
+            return true;
+        }
+        start = end + 1;
+    }
+}
+
+// LCOV_EXCL_START
+bool PathValidator::is_valid_slow(string const& id) const
+{
+    return boost::filesystem::canonical(id).native() == id;
+}
+// LCOV_EXCL_STOP
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#pragma once
+
+#include <unity/util/ResourcePtr.h>
+
+#include <boost/filesystem.hpp>
+
+#include <functional>
+#include <string>
+
+// Checks that an id denotes an existing path below the root that does not contain symbolic
+// links, "." or ".." (that is, the id is its own canonical path). Each id is resolved with
+// a single openat2(RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS) relative to the root, so the kernel
+// guarantees that the result is inside the root, and we do not need to walk the path or
+// cache anything about its parents. If openat2() is not available (because the kernel is
+// too old or a seccomp filter rejects it), we fall back on canonical().
+// This class is thread-safe.
+
+class PathValidator
+{
+public:
+    PathValidator(boost::filesystem::path const& root);
+
+    PathValidator(PathValidator const&) = delete;
+    PathValidator& operator=(PathValidator const&) = delete;
+
+    // Returns false if id is not a canonical path inside the root. Throws
+    // boost::filesystem::filesystem_error if id or one of its parents does not exist.
+    bool is_valid(std::string const& id) const;
+
+private:
+    typedef unity::util::ResourcePtr<int, std::function<void(int)>> FdPtr;
+
+    bool is_canonical_form(std::string const& id) const;
+    bool is_valid_slow(std::string const& id) const;
+
+    std::string const root_;
+    FdPtr root_fd_;
+    bool have_openat2_;
+};
@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#include "TrashPurger.h"
+
+#include <unity/util/ResourcePtr.h>
+
+#include <cstring>
+#include <memory>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace
+{
+
+typedef unity::util::ResourcePtr<int, function<void(int)>> FdPtr;
+
+auto const close_fd = [](int fd){ if (fd != -1) ::close(fd); };
+
+// Lower the CPU and I/O priority of the calling thread, so purging
+// does not get in the way of the operations that clients are waiting for.
+
+void set_low_priority()
+{
+    static int constexpr IOPRIO_WHO_PROCESS = 1;
+    static int constexpr IOPRIO_CLASS_IDLE = 3;
+    static int constexpr IOPRIO_CLASS_SHIFT = 13;
+
+    // On Linux, both calls apply to the thread with the given ID, not the whole process.
+    auto const tid = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, id_t(tid), 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+}
+
+}  // namespace
+
+TrashPurger::TrashPurger(string const& trash_dir, function<void()> const& on_purged)
+    : trash_dir_(trash_dir)
+    , on_purged_(on_purged)
+    , pending_(true)  // Remove whatever a previous instance left behind.
+    , max_age_(0)
+    , stopped_(false)
+{
+    thread_ = thread(&TrashPurger::run, this);
+}
+
+TrashPurger::~TrashPurger()
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cond_.notify_one();
+    thread_.join();
+}
+
+bool TrashPurger::move_to_trash(boost::filesystem::path const& path)
+{
+    using namespace boost::filesystem;
+
+    if (mkdir(trash_dir_.c_str(), 0700) == -1 && errno != EEXIST)
+    {
+        // LCOV_EXCL_START
+        boost::system::error_code ec(errno, boost::system::system_category());
+        throw filesystem_error("mkdir", trash_dir_, ec);
+        // LCOV_EXCL_STOP
+    }
+    auto trash_path = trash_dir_ / unique_path("%%%%-%%%%-%%%%-%%%%");
+    boost::system::error_code ec;
+    rename(path, trash_path, ec);
+    if (ec)
+    {
+        // LCOV_EXCL_START
+        if (ec.value() == EXDEV)
+        {
+            return false;
+        }
+        throw filesystem_error("rename", path, trash_path, ec);
+        // LCOV_EXCL_STOP
+    }
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        pending_ = true;
+    }
+    cond_.notify_one();
+    return true;
+}
+
+void TrashPurger::expire_files(string const& dir, chrono::milliseconds max_age)
+{
+    {
+        lock_guard<mutex> lock(mutex_);
+        expire_dir_ = dir;
+        max_age_ = max_age;
+        pending_ = true;
+    }
+    cond_.notify_one();
+}
+
+void TrashPurger::run()
+{
+    set_low_priority();
+
+    unique_lock<mutex> lock(mutex_);
+    for (;;)
+    {
+        cond_.wait(lock, [this]{ return pending_ || stopped_; });
+        if (stopped_)
+        {
+            return;
+        }
+        pending_ = false;
+        string expire_dir;
+        swap(expire_dir, expire_dir_);
+        auto const max_age = max_age_;
+        lock.unlock();
+        purge();
+        if (!expire_dir.empty())
+        {
+            remove_expired(expire_dir, max_age);
+        }
+        lock.lock();
+    }
+}
+
+void TrashPurger::purge()
+{
+    FdPtr fd(open(trash_dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC), close_fd);
+    if (fd.get() == -1)
+    {
+        return;  // Nothing was ever deleted.
+    }
+    remove_contents(fd.get());
+    on_purged_();
+}
+
+// Remove everything in the directory, relative to the directory fd, so we don't
+// look up the full path for every entry. Errors are ignored; if something cannot
+// be removed now, we try again next time. Returns false if we were asked to stop.
+
+bool TrashPurger::remove_contents(int dir_fd)
+{
+    int dup_fd = fcntl(dir_fd, F_DUPFD_CLOEXEC, 0);
+    if (dup_fd == -1)
+    {
+        return true;  // LCOV_EXCL_LINE
+    }
+    unique_ptr<DIR, int(*)(DIR*)> dir(fdopendir(dup_fd), closedir);  // Takes ownership of dup_fd.
+    if (!dir)
+    {
+        // LCOV_EXCL_START
+        ::close(dup_fd);
+        return true;
+        // LCOV_EXCL_STOP
+    }
+    while (struct dirent* entry = readdir(dir.get()))
+    {
+        if (stopped_)
+        {
+            return false;
+        }
+        char const* name = entry->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        {
+            continue;
+        }
+        bool is_dir = entry->d_type == DT_DIR;
+        if (entry->d_type == DT_UNKNOWN)
+        {
+            // LCOV_EXCL_START
+            struct stat st;
+            is_dir = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            // LCOV_EXCL_STOP
+        }
+        if (is_dir)
+        {
+            FdPtr sub_fd(openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC), close_fd);
+            if (sub_fd.get() == -1)
+            {
+                continue;  // LCOV_EXCL_LINE
+            }
+            fchmod(sub_fd.get(), S_IRWXU);  // We cannot remove the entries of a read-only directory.
+            if (!remove_contents(sub_fd.get()))
+            {
+                return false;
+            }
+            unlinkat(dir_fd, name, AT_REMOVEDIR);
+        }
+        else
+        {
+            unlinkat(dir_fd, name, 0);
+        }
+    }
+    return true;
+}
+
+// Remove the regular files in dir whose mtime is older than max_age. Like remove_contents(),
+// this ignores errors; whatever cannot be removed now is found again by the next instance.
+
+void TrashPurger::remove_expired(string const& dir, chrono::milliseconds max_age)
+{
+    FdPtr fd(open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC), close_fd);
+    if (fd.get() == -1)
+    {
+        return;  // Nothing was ever put there.
+    }
+    int dup_fd = fcntl(fd.get(), F_DUPFD_CLOEXEC, 0);
+    if (dup_fd == -1)
+    {
+        return;  // LCOV_EXCL_LINE
+    }
+    unique_ptr<DIR, int(*)(DIR*)> d(fdopendir(dup_fd), closedir);  // Takes ownership of dup_fd.
+    if (!d)
+    {
+        // LCOV_EXCL_START
+        ::close(dup_fd);
+        return;
+        // LCOV_EXCL_STOP
+    }
+    auto const now = chrono::system_clock::now();
+    bool removed = false;
+    while (struct dirent* entry = readdir(d.get()))
+    {
+        if (stopped_)
+        {
+            return;
+        }
+        struct stat st;
+        if (fstatat(fd.get(), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        auto const mtime = chrono::system_clock::from_time_t(st.st_mtim.tv_sec)
+                           + chrono::duration_cast<chrono::system_clock::duration>(
+                                 chrono::nanoseconds(st.st_mtim.tv_nsec));
+        if (now - mtime >= max_age && unlinkat(fd.get(), entry->d_name, 0) == 0)
+        {
+            removed = true;
+        }
+    }
+    if (removed)
+    {
+        on_purged_();
+    }
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Deletes directory trees in the background. Deleting a large tree can take a long time,
+// so instead of removing it synchronously, we rename it into a trash directory (which is
+// a reserved path, so it never shows up in the provider) and a low-priority thread removes
+// it from there. Anything left in the trash when the process exits is removed once the
+// next instance starts. The same thread also removes files that a previous instance
+// abandoned in a directory, such as the data of suspended uploads that were never resumed.
+// This class is thread-safe.
+
+class TrashPurger
+{
+public:
+    // on_purged is called on the purger thread whenever it has removed something.
+    TrashPurger(std::string const& trash_dir, std::function<void()> const& on_purged);
+    ~TrashPurger();
+
+    TrashPurger(TrashPurger const&) = delete;
+    TrashPurger& operator=(TrashPurger const&) = delete;
+
+    // Moves path into the trash. Returns false if path is on a different file system
+    // than the trash, in which case the caller has to remove it. Throws
+    // boost::filesystem::filesystem_error for other errors.
+    bool move_to_trash(boost::filesystem::path const& path);
+
+    // Removes the regular files in dir that were last modified more than max_age ago.
+    void expire_files(std::string const& dir, std::chrono::milliseconds max_age);
+
+private:
+    void run();
+    void purge();
+    bool remove_contents(int dir_fd);
+    void remove_expired(std::string const& dir, std::chrono::milliseconds max_age);
+
+    std::string const trash_dir_;
+    std::function<void()> const on_purged_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool pending_;
+    std::string expire_dir_;  // Empty if there is nothing to expire.
+    std::chrono::milliseconds max_age_;
+    std::atomic<bool> stopped_;
+    std::thread thread_;
+};
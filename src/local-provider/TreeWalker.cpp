@@ -0,0 +1,566 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include "TreeWalker.h"
+
+#include "DirectoryReader.h"
+#include "utils.h"
+#include <unity/util/ResourcePtr.h>
+
+#include <boost/algorithm/string/join.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/range/iterator_range.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+typedef unity::util::ResourcePtr<int, function<void(int)>> FdPtr;
+
+auto const close_fd = [](int fd){ if (fd != -1) ::close(fd); };
+
+// The entries of one directory, sorted by name. subdirs[i] is the node for entries[i]
+// if that entry is a directory that the walk descends into, and null otherwise.
+
+struct Node
+{
+    vector<TreeWalker::Entry> entries;
+    vector<unique_ptr<Node>> subdirs;
+};
+
+void flatten(Node& node, vector<TreeWalker::Entry>& result)
+{
+    for (size_t i = 0; i < node.entries.size(); ++i)
+    {
+        result.push_back(move(node.entries[i]));
+        if (node.subdirs[i])
+        {
+            flatten(*node.subdirs[i], result);
+        }
+    }
+}
+
+// Returns the names of the entries in a directory, sorted and without our temp files.
+
+vector<string> sorted_names(string const& dir, int dir_fd)
+{
+    vector<DirectoryReader::Entry> dents;
+    DirectoryReader reader(dir, dir_fd);
+    while (reader.read(dents, 4096))
+    {
+    }
+
+    vector<string> names;
+    names.reserve(dents.size());
+    for (auto& d : dents)
+    {
+        if (!boost::starts_with(d.name, TMPFILE_PREFIX))
+        {
+            names.push_back(move(d.name));
+        }
+    }
+    sort(names.begin(), names.end());
+    return names;
+}
+
+// Stats an entry of a directory. Returns false if the walk skips the entry. Otherwise, st
+// is the status of the entry (or of its target, for a link), and is_dir is set if the walk
+// may descend into the entry.
+
+bool stat_entry(int dir_fd, string const& name, struct stat& st, bool& is_dir)
+{
+    if (fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == -1)
+    {
+        return false;  // Removed since we read the directory.
+    }
+    is_dir = S_ISDIR(st.st_mode);
+    if (S_ISLNK(st.st_mode) && fstatat(dir_fd, name.c_str(), &st, 0) == -1)
+    {
+        return false;  // Dangling link.
+    }
+    return S_ISREG(st.st_mode) || S_ISDIR(st.st_mode);
+}
+
+int open_dir(int dir_fd, char const* name)
+{
+    return openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+[[noreturn]] void throw_open_error(boost::filesystem::path const& dir)
+{
+    boost::system::error_code ec(errno, boost::system::generic_category());
+    throw boost::filesystem::filesystem_error("open", dir, ec);
+}
+
+}  // namespace
+
+class TreeWalker::Walk
+{
+public:
+    Walk(WorkerPool& pool, boost::filesystem::path const& root, int max_depth, int max_threads)
+        : pool_(pool)
+        , root_(root)
+        , max_depth_(max_depth)
+        , max_threads_(max(1, max_threads))
+        , queues_(new Queue[max_threads_])
+        , queued_(0)
+        , pending_(0)
+        , num_entries_(0)
+        , failed_(false)
+        , helpers_(make_shared<Helpers>())
+    {
+    }
+
+    vector<Entry> run()
+    {
+        // The calling thread reads the root, so any error for the root goes straight to the caller.
+        Node root;
+        read_directory(Job{&root, "", 0}, 0, true);
+        work(0);
+        {
+            // Helpers that have not started yet must not touch this walk once we return.
+            unique_lock<mutex> lock(helpers_->m);
+            helpers_->closed = true;
+            helpers_->idle.wait(lock, [this]{ return helpers_->active == 0; });
+        }
+        if (error_)
+        {
+            rethrow_exception(error_);  // LCOV_EXCL_LINE
+        }
+
+        vector<Entry> result;
+        result.reserve(num_entries_);
+        flatten(root, result);
+        return result;
+    }
+
+private:
+    struct Job
+    {
+        Node* node;
+        string path;  // Relative to the root.
+        int depth;    // 0 for the root.
+    };
+
+    struct Queue
+    {
+        mutex m;
+        deque<Job> jobs;
+    };
+
+    // Shared with the helpers we submit to the pool, which may start after run() has returned.
+    struct Helpers
+    {
+        mutex m;
+        condition_variable idle;
+        int started = 0;
+        int active = 0;
+        bool closed = false;
+    };
+
+    // Reads directories until there is no work left anywhere.
+
+    void work(int self)
+    {
+        Job job;
+        while (!failed_)
+        {
+            if (take(self, job))
+            {
+                try
+                {
+                    read_directory(job, self, false);
+                }
+                // LCOV_EXCL_START
+                catch (std::exception const&)
+                {
+                    set_error(current_exception());
+                }
+                // LCOV_EXCL_STOP
+                if (--pending_ == 0)
+                {
+                    wake_all();
+                }
+                continue;
+            }
+            unique_lock<mutex> lock(idle_mutex_);
+            idle_cond_.wait(lock, [this]{ return queued_ > 0 || pending_ == 0 || failed_; });
+            if (pending_ == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    // Takes the most recently pushed job from our own queue or, failing that,
+    // the oldest job from another thread's queue.
+
+    bool take(int self, Job& job)
+    {
+        {
+            Queue& q = queues_[self];
+            lock_guard<mutex> lock(q.m);
+            if (!q.jobs.empty())
+            {
+                job = move(q.jobs.back());
+                q.jobs.pop_back();
+                --queued_;
+                return true;
+            }
+        }
+        for (int i = 1; i < max_threads_; ++i)
+        {
+            Queue& q = queues_[(self + i) % max_threads_];
+            lock_guard<mutex> lock(q.m);
+            if (!q.jobs.empty())
+            {
+                job = move(q.jobs.front());
+                q.jobs.pop_front();
+                --queued_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void push(int self, vector<Job>& jobs)
+    {
+        if (jobs.empty())
+        {
+            return;
+        }
+        pending_ += jobs.size();
+        {
+            Queue& q = queues_[self];
+            lock_guard<mutex> lock(q.m);
+            for (auto& j : jobs)
+            {
+                q.jobs.push_back(move(j));
+            }
+            queued_ += jobs.size();
+        }
+        add_helper();
+        wake_all();
+    }
+
+    // Borrows another pool thread if there is more work than the running threads can pick up.
+
+    void add_helper()
+    {
+        int id;
+        {
+            lock_guard<mutex> lock(helpers_->m);
+            if (queued_ <= size_t(helpers_->started) || helpers_->started >= max_threads_ - 1)
+            {
+                return;
+            }
+            id = ++helpers_->started;
+        }
+        auto helpers = helpers_;
+        try
+        {
+            pool_.submit(WorkerPool::Lane::metadata, [this, helpers, id]
+            {
+                {
+                    lock_guard<mutex> lock(helpers->m);
+                    if (helpers->closed)
+                    {
+                        return;
+                    }
+                    ++helpers->active;
+                }
+                work(id);
+                lock_guard<mutex> lock(helpers->m);
+                if (--helpers->active == 0)
+                {
+                    helpers->idle.notify_one();
+                }
+            });
+        }
+        // LCOV_EXCL_START
+        catch (std::exception const&)
+        {
+            // The lane is saturated. We don't try again; the threads we have take the work.
+            lock_guard<mutex> lock(helpers_->m);
+            helpers_->started = max_threads_;
+        }
+        // LCOV_EXCL_STOP
+    }
+
+    void wake_all()
+    {
+        {
+            lock_guard<mutex> lock(idle_mutex_);
+        }
+        idle_cond_.notify_all();
+    }
+
+    void set_error(exception_ptr e)
+    {
+        {
+            lock_guard<mutex> lock(idle_mutex_);
+            if (!error_)
+            {
+                error_ = e;
+            }
+            failed_ = true;
+        }
+        idle_cond_.notify_all();
+    }
+
+    // Reads and stats the entries of a directory into job.node, and queues the sub-directories.
+
+    void read_directory(Job const& job, int self, bool is_root)
+    {
+        using namespace boost::filesystem;
+
+        path const dir = job.path.empty() ? root_ : root_ / job.path;
+        FdPtr fd(open_dir(AT_FDCWD, dir.native().c_str()), close_fd);
+        if (fd.get() == -1)
+        {
+            if (is_root)
+            {
+                throw_open_error(dir);
+            }
+            return;  // Unreadable, or removed since we read its parent.
+        }
+
+        vector<string> names;
+        try
+        {
+            names = sorted_names(dir.native(), fd.get());
+        }
+        // LCOV_EXCL_START
+        catch (filesystem_error const&)
+        {
+            if (is_root)
+            {
+                throw;
+            }
+            return;
+        }
+        // LCOV_EXCL_STOP
+
+        bool const descend = max_depth_ == 0 || job.depth + 1 < max_depth_;
+        Node& node = *job.node;
+        node.entries.reserve(names.size());
+        node.subdirs.reserve(names.size());
+        vector<Job> subdirs;
+        for (auto const& name : names)
+        {
+            struct stat st;
+            bool is_dir;
+            if (!stat_entry(fd.get(), name, st, is_dir))
+            {
+                continue;
+            }
+            string entry_path = job.path.empty() ? name : job.path + '/' + name;
+            unique_ptr<Node> sub;
+            if (is_dir && descend)
+            {
+                sub.reset(new Node);
+                subdirs.push_back(Job{sub.get(), entry_path, job.depth + 1});
+            }
+            node.entries.push_back(Entry{move(entry_path), st});
+            node.subdirs.push_back(move(sub));
+        }
+        num_entries_ += node.entries.size();
+        push(self, subdirs);
+    }
+
+    WorkerPool& pool_;
+    boost::filesystem::path const root_;
+    int const max_depth_;
+    int const max_threads_;
+    unique_ptr<Queue[]> queues_;
+    atomic<size_t> queued_;   // Jobs in the queues.
+    atomic<size_t> pending_;  // Jobs in the queues or being worked on.
+    atomic<size_t> num_entries_;
+    atomic<bool> failed_;
+    mutex idle_mutex_;
+    condition_variable idle_cond_;
+    exception_ptr error_;
+    shared_ptr<Helpers> const helpers_;
+};
+
+// Produces one page of a walk, depth-first on the calling thread, and stops as soon as the page is full.
+
+class TreeWalker::PageWalk
+{
+public:
+    PageWalk(boost::filesystem::path const& root, int max_depth, size_t max_entries, NameReader const& read_names)
+        : root_(root)
+        , max_depth_(max_depth)
+        , max_entries_(max_entries)
+        , read_names_(read_names)
+        , more_(false)
+    {
+    }
+
+    vector<Entry> run(string const& start_after, bool& more)
+    {
+        FdPtr root_fd(open_dir(AT_FDCWD, root_.native().c_str()), close_fd);
+        if (root_fd.get() == -1)
+        {
+            throw_open_error(root_);
+        }
+        if (start_after.empty())
+        {
+            walk_dir(root_fd.get(), "", 0, "", false);
+        }
+        else
+        {
+            vector<string> names;
+            boost::split(names, start_after, [](char c){ return c == '/'; });
+            resume(root_fd.get(), names, 0);
+        }
+        more = more_;
+        return move(entries_);
+    }
+
+private:
+    // Resumes the walk in the folder at the given depth on the path to start_after. If the next
+    // folder on that path (or start_after itself) is a folder whose contents are part of the walk,
+    // we first resume in that folder. Then come the entries that follow that folder (or start_after)
+    // in this folder. If a folder on the path is gone, the walk continues after it in its parent.
+    // Returns false once the page is full.
+
+    bool resume(int dir_fd, vector<string> const& names, size_t depth)
+    {
+        if (depth < names.size() && (max_depth_ == 0 || int(depth) + 1 < max_depth_))
+        {
+            FdPtr fd(open_dir(dir_fd, names[depth].c_str()), close_fd);
+            if (fd.get() != -1 && !resume(fd.get(), names, depth + 1))
+            {
+                return false;
+            }
+        }
+        string const rel = boost::join(boost::make_iterator_range(names.begin(), names.begin() + depth), "/");
+        string const after = depth < names.size() ? names[depth] : "";
+        return walk_dir(dir_fd, rel, int(depth), after, true);
+    }
+
+    // Adds the entries of the folder at rel whose names sort after "after" (all of them if it is empty),
+    // each followed by its contents. Returns false once the page is full.
+
+    bool walk_dir(int dir_fd, string const& rel, int depth, string const& after, bool resumed)
+    {
+        using namespace boost::filesystem;
+
+        path const dir = rel.empty() ? root_ : root_ / rel;
+        shared_ptr<vector<string> const> names;
+        try
+        {
+            struct stat dir_st;
+            if (resumed && read_names_ && fstat(dir_fd, &dir_st) == 0)
+            {
+                names = read_names_(dir.native(), dir_fd, dir_st);
+            }
+            else
+            {
+                names = make_shared<vector<string>>(sorted_names(dir.native(), dir_fd));
+            }
+        }
+        // LCOV_EXCL_START
+        catch (filesystem_error const&)
+        {
+            if (depth == 0)
+            {
+                throw;
+            }
+            return true;
+        }
+        // LCOV_EXCL_STOP
+
+        bool const descend = max_depth_ == 0 || depth + 1 < max_depth_;
+        auto it = after.empty() ? names->begin() : upper_bound(names->begin(), names->end(), after);
+        for (; it != names->end(); ++it)
+        {
+            struct stat st;
+            bool is_dir;
+            if (!stat_entry(dir_fd, *it, st, is_dir))
+            {
+                continue;
+            }
+            if (entries_.size() == max_entries_)
+            {
+                more_ = true;
+                return false;
+            }
+            string entry_path = rel.empty() ? *it : rel + '/' + *it;
+            entries_.push_back(Entry{entry_path, st});
+            if (is_dir && descend)
+            {
+                FdPtr fd(open_dir(dir_fd, it->c_str()), close_fd);
+                if (fd.get() != -1 && !walk_dir(fd.get(), entry_path, depth + 1, "", false))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    boost::filesystem::path const root_;
+    int const max_depth_;
+    size_t const max_entries_;
+    NameReader const& read_names_;
+    vector<Entry> entries_;
+    bool more_;
+};
+
+vector<TreeWalker::Entry> TreeWalker::walk(WorkerPool& pool,
+                                           boost::filesystem::path const& root,
+                                           int max_depth,
+                                           int max_threads)
+{
+    return Walk(pool, root, max_depth, max_threads).run();
+}
+
+vector<TreeWalker::Entry> TreeWalker::walk_page(boost::filesystem::path const& root,
+                                                int max_depth,
+                                                string const& start_after,
+                                                size_t max_entries,
+                                                NameReader const& read_names,
+                                                bool& more)
+{
+    return PageWalk(root, max_depth, max_entries, read_names).run(start_after, more);
+}
+
+bool TreeWalker::path_less(string const& a, string const& b)
+{
+    // '/' sorts before any other character, so the contents of "a" come before "a-b".
+    auto key = [](char c) { return c == '/' ? 0 : int(static_cast<unsigned char>(c)) + 1; };
+    return lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(),
+                                   [&key](char x, char y) { return key(x) < key(y); });
+}
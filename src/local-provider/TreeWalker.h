@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#pragma once
+
+#include <unity/storage/provider/WorkerPool.h>
+
+#include <boost/filesystem.hpp>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Walks a directory tree with up to max_threads threads. Each thread keeps its own
+// deque of directories that remain to be read. A thread pushes the sub-directories it
+// finds onto the back of its own deque and takes its next directory from there, so
+// it works depth-first and mostly on directories it has just seen. A thread whose
+// deque is empty steals from the front of another thread's deque, which holds the
+// directories that are closest to the root and therefore likely to be the largest
+// pieces of work. The calling thread does its share; further threads are borrowed from
+// the metadata lane of a WorkerPool only once there is work to steal. If the pool has no
+// thread to spare, the calling thread does all the work.
+//
+// Entries with the temp file prefix and entries that are neither files nor directories
+// are skipped. Symbolic links are reported with the status of their target, but are
+// not followed during the walk. Directories below the root that cannot be read are
+// reported, but not descended into.
+//
+// walk_page() returns one page of the same sequence without reading the rest of the tree.
+
+class TreeWalker
+{
+public:
+    struct Entry
+    {
+        std::string path;  // Relative to the root of the walk.
+        struct stat st;
+    };
+
+    // Returns the entries below root, down to max_depth levels (0 means no limit).
+    // The result is in depth-first order, with the entries of each directory sorted by name.
+    // That is also the order in which path_less() sorts the paths.
+    // Throws boost::filesystem::filesystem_error if root cannot be read.
+    static std::vector<Entry> walk(unity::storage::provider::WorkerPool& pool,
+                                   boost::filesystem::path const& root,
+                                   int max_depth,
+                                   int max_threads);
+
+    // Returns the sorted names of the entries in dir (an absolute path), without temp files.
+    // dir_fd is open for reading, and dir_st is the status of dir.
+    typedef std::function<std::shared_ptr<std::vector<std::string> const>(std::string const& dir,
+                                                                         int dir_fd,
+                                                                         struct stat const& dir_st)> NameReader;
+
+    // Returns up to max_entries of the entries that walk() returns after start_after, or from the
+    // start if start_after is empty, and sets more if further entries follow. start_after need not
+    // exist any more. The page reads only the folders it reports and the folders that contain
+    // start_after; the latter are read with read_names, so a caller can keep their names from one
+    // page to the next. The folders on the path to start_after are opened without following
+    // symbolic links; start_after must not contain empty, "." or ".." components.
+    // Throws boost::filesystem::filesystem_error if root cannot be read.
+    static std::vector<Entry> walk_page(boost::filesystem::path const& root,
+                                        int max_depth,
+                                        std::string const& start_after,
+                                        size_t max_entries,
+                                        NameReader const& read_names,
+                                        bool& more);
+
+    // Compares relative paths component by component.
+    static bool path_less(std::string const& a, std::string const& b);
+
+private:
+    class Walk;
+    class PageWalk;
+};
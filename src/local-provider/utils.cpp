@@ -24,6 +24,11 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/exception/enable_current_exception.hpp>
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
 #include <sys/stat.h>
 
 using namespace unity::storage::provider;
@@ -43,9 +48,28 @@ int64_t get_mtime_nsecs(string const& method, string const& path)
         throw boost::enable_current_exception(ResourceException(msg, errno));
         // LCOV_EXCL_STOP
     }
+    return get_mtime_nsecs(st);
+}
+
+int64_t get_mtime_nsecs(struct stat const& st)
+{
     return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
 }
 
+// Stat path, following symbolic links. Errors are reported the same way
+// as the boost::filesystem errors in the remainder of the provider.
+
+struct stat stat_path(string const& method, string const& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1)
+    {
+        boost::system::error_code ec(errno, boost::system::generic_category());
+        throw_storage_exception(method, boost::filesystem::filesystem_error("stat", path, ec));
+    }
+    return st;
+}
+
 // Return true if the path uses the temp file prefix.
 
 bool is_reserved_path(boost::filesystem::path const& path)
@@ -84,6 +108,98 @@ boost::filesystem::path sanitize(string const& method, string const& name)
     return p;
 }
 
+// Return the type of a change that follows an earlier change to the same item, so
+// a sequence of changes can be reported as a single change. Returns LAST_ENTRY__
+// if the two changes cancel each other out (the item was created and then deleted).
+
+unity::storage::ChangeType merge_changes(unity::storage::ChangeType earlier, unity::storage::ChangeType later)
+{
+    using unity::storage::ChangeType;
+
+    switch (later)
+    {
+        case ChangeType::created:
+            return earlier == ChangeType::deleted ? ChangeType::changed : ChangeType::created;
+        case ChangeType::changed:
+            return earlier == ChangeType::created ? ChangeType::created : ChangeType::changed;
+        case ChangeType::deleted:
+            return earlier == ChangeType::created ? ChangeType::LAST_ENTRY__ : ChangeType::deleted;
+        default:
+            abort();  // LCOV_EXCL_LINE  // Impossible
+    }
+}
+
+// Call fn(i) for each i in [0, count), spread over up to max_threads threads, including
+// the calling thread. The other threads are borrowed from the metadata lane of pool, so
+// we never create threads of our own. The calling thread takes items, too, so the loop
+// completes even if no pool thread becomes available, and a helper that starts after the
+// calling thread ran out of items returns immediately. Each thread gets at least
+// min_per_thread calls, so a small count runs on the calling thread only. fn must not throw.
+
+void parallel_for(WorkerPool& pool,
+                  size_t count,
+                  int max_threads,
+                  size_t min_per_thread,
+                  function<void(size_t)> const& fn)
+{
+    size_t num_threads = count / max(min_per_thread, size_t(1));
+    num_threads = max(min(num_threads, size_t(max(max_threads, 0))), size_t(1));
+
+    // Helpers may start after we have returned, so they share ownership of the state
+    // and touch fn only while we are waiting for them.
+    struct State
+    {
+        atomic<size_t> next{0};
+        mutex m;
+        condition_variable idle;
+        int active = 0;
+        bool closed = false;
+    };
+    auto state = make_shared<State>();
+    auto const fn_ptr = &fn;
+
+    for (size_t t = 1; t < num_threads; ++t)
+    {
+        try
+        {
+            pool.submit(WorkerPool::Lane::metadata, [state, count, fn_ptr]
+            {
+                {
+                    lock_guard<mutex> lock(state->m);
+                    if (state->closed)
+                    {
+                        return;
+                    }
+                    ++state->active;
+                }
+                size_t i;
+                while ((i = state->next++) < count)
+                {
+                    (*fn_ptr)(i);
+                }
+                lock_guard<mutex> lock(state->m);
+                if (--state->active == 0)
+                {
+                    state->idle.notify_one();
+                }
+            });
+        }
+        catch (std::exception const&)
+        {
+            break;  // The lane is saturated, so we do the remaining work ourselves.
+        }
+    }
+
+    size_t i;
+    while ((i = state->next++) < count)
+    {
+        fn(i);
+    }
+    unique_lock<mutex> lock(state->m);
+    state->closed = true;
+    state->idle.wait(lock, [&]{ return state->active == 0; });
+}
+
 // Throw a StorageException that corresponds to a boost::filesystem_error.
 
 void throw_storage_exception(string const& method, boost::filesystem::filesystem_error const& e)
@@ -18,6 +18,9 @@
 
 #pragma once
 
+#include <unity/storage/common.h>
+#include <unity/storage/provider/WorkerPool.h>
+
 #include <boost/filesystem.hpp>
 
 #pragma GCC diagnostic push
@@ -27,13 +30,24 @@
 #include <QString>
 #pragma GCC diagnostic pop
 
+#include <functional>
 #include <string>
 
+#include <sys/stat.h>
+
 constexpr char const* TMPFILE_PREFIX = ".storage-framework";
 
 int64_t get_mtime_nsecs(std::string const& method, std::string const& path);
+int64_t get_mtime_nsecs(struct stat const& st);
+struct stat stat_path(std::string const& method, std::string const& path);
 bool is_reserved_path(boost::filesystem::path const& path);
 boost::filesystem::path sanitize(std::string const& method, std::string const& name);
+unity::storage::ChangeType merge_changes(unity::storage::ChangeType earlier, unity::storage::ChangeType later);
+void parallel_for(unity::storage::provider::WorkerPool& pool,
+                  size_t count,
+                  int max_threads,
+                  size_t min_per_thread,
+                  std::function<void(size_t)> const& fn);
 
 [[ noreturn ]]
 void throw_storage_exception(std::string const& method, boost::filesystem::filesystem_error const& e);
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/MetadataKeys.h>
+#include <unity/storage/common.h>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+
+MetadataKeys::MetadataKeys(vector<string> const& keys, vector<string> const& default_keys)
+    : all_(false)
+{
+    auto const& requested = keys.empty() ? default_keys : keys;
+    for (auto const& k : requested)
+    {
+        if (k == metadata::ALL)
+        {
+            all_ = true;
+            keys_.clear();
+            break;
+        }
+        keys_.insert(k);
+    }
+}
+
+bool MetadataKeys::contains(string const& key) const
+{
+    return all_ || keys_.find(key) != keys_.end();
+}
+
+bool MetadataKeys::all() const
+{
+    return all_;
+}
+
+}
+}
+}
@@ -17,6 +17,10 @@
  */
 
 #include <unity/storage/provider/ProviderBase.h>
+#include <unity/storage/provider/DownloadJob.h>
+#include <unity/storage/provider/Exceptions.h>
+#include <unity/storage/provider/WorkerPool.h>
+#include <unity/storage/provider/internal/ProviderBaseImpl.h>
 
 namespace unity
 {
@@ -26,11 +30,66 @@ namespace provider
 {
 
 ProviderBase::ProviderBase()
+    : p_(new internal::ProviderBaseImpl)
 {
 }
 
 ProviderBase::~ProviderBase() = default;
 
+boost::future<std::tuple<ItemChangeList, ItemList, std::string>> ProviderBase::changes(
+    std::string const& /* cursor */,
+    std::vector<std::string> const& /* keys */,
+    Context const& /* context */)
+{
+    return boost::make_exceptional_future<std::tuple<ItemChangeList, ItemList, std::string>>(
+        LogicException("changes(): provider does not keep track of changes"));
+}
+
+boost::future<std::unique_ptr<DownloadJob>> ProviderBase::download_range(std::string const& item_id,
+                                                                        std::string const& match_etag,
+                                                                        int64_t offset,
+                                                                        int64_t length,
+                                                                        Context const& context)
+{
+    if (offset == 0 && length < 0)
+    {
+        return download(item_id, match_etag, context);
+    }
+    return boost::make_exceptional_future<std::unique_ptr<DownloadJob>>(
+        LogicException("download_range(): provider does not support partial downloads"));
+}
+
+boost::future<std::tuple<ItemList, std::string>> ProviderBase::search(std::string const& /* parent_id */,
+                                                                      std::string const& /* query */,
+                                                                      std::string const& /* page_token */,
+                                                                      std::vector<std::string> const& /* keys */,
+                                                                      Context const& /* context */)
+{
+    return boost::make_exceptional_future<std::tuple<ItemList, std::string>>(
+        LogicException("search(): provider does not support searches"));
+}
+
+boost::future<std::tuple<ItemList, std::string>> ProviderBase::walk(std::string const& /* parent_id */,
+                                                                    int32_t /* max_depth */,
+                                                                    std::string const& /* page_token */,
+                                                                    std::vector<std::string> const& /* keys */,
+                                                                    Context const& /* context */)
+{
+    return boost::make_exceptional_future<std::tuple<ItemList, std::string>>(
+        LogicException("walk(): provider does not support walks"));
+}
+
+WorkerPool& ProviderBase::worker_pool()
+{
+    static WorkerPool pool(WorkerPool::default_options());
+    return pool;
+}
+
+void ProviderBase::notify_changes(ItemChangeList const& changes)
+{
+    p_->notify_changes(changes);
+}
+
 }
 }
 }
@@ -31,7 +31,12 @@ namespace provider
 {
 
 ServerBase::ServerBase(std::string const& bus_name, std::string const& account_service_id)
-    : p_(new internal::ServerImpl(this, bus_name, account_service_id))
+    : p_(new internal::ServerImpl(this, bus_name, account_service_id, DispatchMode::main_thread))
+{
+}
+
+ServerBase::ServerBase(std::string const& bus_name, std::string const& account_service_id, DispatchMode mode)
+    : p_(new internal::ServerImpl(this, bus_name, account_service_id, mode))
 {
 }
 
@@ -17,6 +17,7 @@
  */
 
 #include <unity/storage/provider/UploadJob.h>
+#include <unity/storage/provider/Exceptions.h>
 #include <unity/storage/provider/internal/UploadJobImpl.h>
 
 #include <QCoreApplication>
@@ -69,6 +70,18 @@ void UploadJob::report_error(std::exception_ptr p)
     p_->report_error(p);
 }
 
+boost::future<int64_t> UploadJob::suspend()
+{
+    return boost::make_exceptional_future<int64_t>(
+        LogicException("suspend(): provider does not support resumable uploads"));
+}
+
+boost::future<void> UploadJob::resume()
+{
+    return boost::make_exceptional_future<void>(
+        LogicException("resume(): provider does not support resumable uploads"));
+}
+
 }
 }
 }
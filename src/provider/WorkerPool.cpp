@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/WorkerPool.h>
+#include <unity/storage/internal/EnvVars.h>
+#include <unity/storage/provider/internal/WorkerPoolImpl.h>
+
+#include <thread>
+
+using namespace std;
+using unity::storage::internal::EnvVars;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+
+WorkerPool::WorkerPool(Options const& options)
+    : p_(new internal::WorkerPoolImpl(options))
+{
+}
+
+WorkerPool::~WorkerPool() = default;
+
+WorkerPool::LaneStats WorkerPool::stats(Lane lane) const
+{
+    return p_->stats(lane);
+}
+
+WorkerPool::Options const& WorkerPool::options() const
+{
+    return p_->options();
+}
+
+WorkerPool::Options WorkerPool::default_options()
+{
+    Options options;
+    options.metadata_threads = EnvVars::provider_metadata_threads();
+    if (options.metadata_threads == 0)
+    {
+        options.metadata_threads = max(2u, thread::hardware_concurrency());
+    }
+    options.bulk_threads = max(1, EnvVars::provider_bulk_threads());
+    options.max_queue_depth = EnvVars::provider_max_queue_depth();
+    return options;
+}
+
+void WorkerPool::post(Lane lane, function<void()> closure)
+{
+    p_->post(lane, move(closure));
+}
+
+}
+}
+}
@@ -17,15 +17,18 @@
  */
 
 #include <unity/storage/provider/internal/DBusPeerCache.h>
+#include <unity/storage/internal/EnvVars.h>
 #include "businterface.h"
 
 #include <QDBusPendingCallWatcher>
+#include <QDBusServiceWatcher>
 
 #include <assert.h>
 #include <vector>
 #include <sys/apparmor.h>
 
 using namespace std;
+using unity::storage::internal::EnvVars;
 
 namespace {
 
@@ -36,8 +39,6 @@ char const UNIX_USER_ID[] = "UnixUserID";
 char const PROCESS_ID[] = "ProcessID";
 char const LINUX_SECURITY_LABEL[] = "LinuxSecurityLabel";
 
-int const MAX_CACHE_SIZE = 50;
-
 }
 
 namespace unity
@@ -56,14 +57,35 @@ struct DBusPeerCache::Request
 {
     QDBusPendingCallWatcher watcher;
     std::vector<boost::promise<DBusPeerCache::Credentials>> promises;
+    bool disconnected = false;  // The peer went away before the reply arrived.
 
     Request(QDBusPendingReply<QVariantMap> const& call) : watcher(call) {}
 };
 
 DBusPeerCache::DBusPeerCache(QDBusConnection const& bus)
+    : DBusPeerCache(bus,
+                    EnvVars::provider_peer_cache_size(),
+                    chrono::milliseconds(EnvVars::provider_peer_cache_ttl_ms()))
+{
+}
+
+DBusPeerCache::DBusPeerCache(QDBusConnection const& bus, int capacity, chrono::milliseconds ttl)
     : bus_daemon_(new BusInterface(DBUS_BUS_NAME, DBUS_BUS_PATH, bus))
+    , watcher_(new QDBusServiceWatcher)
     , apparmor_enabled_(aa_is_enabled())
+    , capacity_(capacity)
+    , ttl_(ttl)
 {
+    // Unique connection names are never reused, so a peer that has
+    // disconnected will never send us another request. The watcher adds
+    // a NameOwnerChanged match with arg0=<peer> for each watched peer.
+    watcher_->setConnection(bus);
+    watcher_->setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    QObject::connect(watcher_.get(), &QDBusServiceWatcher::serviceUnregistered,
+                     [this](QString const& peer)
+                     {
+                         this->peer_disconnected(peer);
+                     });
 }
 
 DBusPeerCache::~DBusPeerCache() = default;
@@ -71,54 +93,78 @@ DBusPeerCache::~DBusPeerCache() = default;
 boost::future<DBusPeerCache::Credentials> DBusPeerCache::get(QString const& peer)
 {
     // Return the credentials directly if they are cached
-    try
-    {
-        Credentials const& credentials = cache_.at(peer);
-        boost::promise<Credentials> p;
-        p.set_value(credentials);
-        return p.get_future();
-    }
-    catch (std::out_of_range const &)
+    auto credentials = lookup(peer);
+    if (credentials)
     {
-        // ignore
+        ++stats_.hits;
+        return boost::make_ready_future(*credentials);
     }
 
-    // If the credentials exist in the previous generation of the
-    // cache, move them to the current generation.
-    try
+    // If the credentials are already being requested, add ourselves
+    // to the callback list. Otherwise, ask the bus daemon.
+    boost::promise<Credentials> promise;
+    auto future = promise.get_future();
+    auto it = pending_.find(peer);
+    if (it != pending_.end())
     {
-        Credentials& credentials = old_cache_.at(peer);
-        // No real way to get coverage here because we'd
-        // need more than 50 peers with different credentials.
-        // LCOV_EXCL_START
-        cache_.emplace(peer, std::move(credentials));
-        old_cache_.erase(peer);
-        boost::promise<Credentials> p;
-        p.set_value(credentials);
-        return p.get_future();
-        // LCOV_EXCL_STOP
+        ++stats_.joined;
+        it->second->promises.emplace_back(std::move(promise));
+        return future;
     }
-    catch (std::out_of_range const &)
+    start_request(peer).promises.emplace_back(std::move(promise));
+    return future;
+}
+
+void DBusPeerCache::prefetch(QString const& peer)
+{
+    if (lookup(peer) || pending_.find(peer) != pending_.end())
     {
-        // ignore
+        return;
     }
+    start_request(peer);
+}
 
-    boost::promise<Credentials> promise;
-    auto future = promise.get_future();
-    // If the credentials are already being requested, add ourselves
-    // to the callback list.
-    try
+DBusPeerCache::Stats DBusPeerCache::stats() const
+{
+    Stats s = stats_;
+    s.in_flight = pending_.size();
+    return s;
+}
+
+int DBusPeerCache::size() const
+{
+    return int(cache_.size());
+}
+
+// Returns the cached credentials for peer (and marks them as most recently used),
+// or nullptr if they are not cached or have expired.
+
+DBusPeerCache::Credentials const* DBusPeerCache::lookup(QString const& peer)
+{
+    auto it = cache_.find(peer);
+    if (it == cache_.end())
     {
-        unique_ptr<Request>& request = pending_.at(peer);
-        request->promises.emplace_back(std::move(promise));
-        return future;
+        return nullptr;
     }
-    catch (std::out_of_range const &)
+    auto entry = it->second;
+    if (ttl_.count() != 0 && entry->expiry <= chrono::steady_clock::now())
     {
-        // ignore
+        ++stats_.expired;
+        erase(peer);
+        return nullptr;
     }
+    lru_.splice(lru_.begin(), lru_, entry);
+    return &entry->credentials;
+}
 
-    // Ask the bus daemon for the peer's credentials
+DBusPeerCache::Request& DBusPeerCache::start_request(QString const& peer)
+{
+    ++stats_.misses;
+    if (capacity_ > 0)
+    {
+        // Watch from the start, so we notice if the peer goes away before the reply arrives.
+        watcher_->addWatchedService(peer);
+    }
     unique_ptr<Request> request(
         new Request(bus_daemon_->GetConnectionCredentials(peer)));
     QObject::connect(&request->watcher, &QDBusPendingCallWatcher::finished,
@@ -126,9 +172,56 @@ boost::future<DBusPeerCache::Credentials> DBusPeerCache::get(QString const& peer
                      {
                          this->received_credentials(peer, *watcher);
                      });
-    request->promises.emplace_back(std::move(promise));
+    auto& r = *request;
     pending_.emplace(peer, std::move(request));
-    return future;
+    return r;
+}
+
+void DBusPeerCache::insert(QString const& peer, Credentials const& credentials)
+{
+    if (capacity_ <= 0)
+    {
+        return;
+    }
+    erase(peer);
+    while (cache_.size() >= size_t(capacity_))
+    {
+        ++stats_.evicted;
+        QString const victim = lru_.back().peer;  // erase() destroys the entry.
+        erase(victim);
+    }
+    lru_.push_front({peer, credentials, chrono::steady_clock::now() + ttl_});
+    cache_.emplace(peer, lru_.begin());
+}
+
+// Removes peer from the cache. We stop watching the peer unless a request for it is in flight.
+
+void DBusPeerCache::erase(QString const& peer)
+{
+    auto it = cache_.find(peer);
+    if (it != cache_.end())
+    {
+        lru_.erase(it->second);
+        cache_.erase(it);
+        if (pending_.find(peer) == pending_.end())
+        {
+            watcher_->removeWatchedService(peer);
+        }
+    }
+}
+
+void DBusPeerCache::peer_disconnected(QString const& peer)
+{
+    auto it = pending_.find(peer);
+    if (it != pending_.end())
+    {
+        it->second->disconnected = true;
+    }
+    if (cache_.find(peer) != cache_.end())
+    {
+        ++stats_.invalidated;
+        erase(peer);
+    }
 }
 
 void DBusPeerCache::received_credentials(QString const& peer, QDBusPendingReply<QVariantMap> const& reply)
@@ -172,22 +265,25 @@ void DBusPeerCache::received_credentials(QString const& peer, QDBusPendingReply<
         }
     }
 
-    // If we've hit our maximum cache size, start a new generation.
-    if (cache_.size() >= MAX_CACHE_SIZE)
+    // Don't cache failures; the next request for this peer tries again. If the peer
+    // disconnected meanwhile, the credentials are still correct for the request that
+    // asked for them, but the peer will not send another one.
+    auto& request = *pending_.at(peer);
+    if (credentials.valid && !request.disconnected)
     {
-        // LCOV_EXCL_START
-        old_cache_ = std::move(cache_);
-        cache_.clear();
-        // LCOV_EXCL_STOP
+        insert(peer, credentials);
     }
-    cache_.emplace(peer, credentials);
 
     // Notify anyone waiting on the request and remove it from the map:
-    for (auto& promise : pending_.at(peer)->promises)
+    for (auto& promise : request.promises)
     {
         promise.set_value(credentials);
     }
     pending_.erase(peer);
+    if (cache_.find(peer) == cache_.end())
+    {
+        watcher_->removeWatchedService(peer);
+    }
 }
 
 }  // namespace internal
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/DispatchPool.h>
+
+#include <unity/storage/provider/internal/MainLoopExecutor.h>
+
+#include <QThread>
+
+#include <cassert>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+class DispatchPool::Thread : public QThread
+{
+public:
+    Thread(MainLoopExecutor& executor)
+        : executor_(executor)
+    {
+    }
+
+protected:
+    void run() override
+    {
+        executor_.make_current();
+        exec();
+    }
+
+private:
+    MainLoopExecutor& executor_;
+};
+
+DispatchPool::DispatchPool(int num_threads)
+    : next_(0)
+{
+    assert(num_threads > 0);
+
+    for (int i = 0; i < num_threads; ++i)
+    {
+        unique_ptr<MainLoopExecutor> executor(new MainLoopExecutor);
+        unique_ptr<Thread> thread(new Thread(*executor));
+        thread->setObjectName(QStringLiteral("dispatch-%1").arg(i));
+        executor->moveToThread(thread.get());
+        thread->start();
+        executors_.push_back(move(executor));
+        threads_.push_back(move(thread));
+    }
+}
+
+DispatchPool::~DispatchPool()
+{
+    for (auto& t : threads_)
+    {
+        t->quit();
+    }
+    for (auto& t : threads_)
+    {
+        t->wait();
+    }
+}
+
+int DispatchPool::size() const
+{
+    return int(threads_.size());
+}
+
+MainLoopExecutor& DispatchPool::next_executor()
+{
+    return *executors_[next_++ % executors_.size()];
+}
+
+}  // namespace internal
+}  // namespace provider
+}  // namespace storage
+}  // namespace unity
@@ -23,6 +23,7 @@
 #include <unity/storage/provider/internal/dbusmarshal.h>
 #include <unity/storage/provider/internal/DBusPeerCache.h>
 #include <unity/storage/provider/internal/MainLoopExecutor.h>
+#include <unity/storage/provider/internal/RequestStats.h>
 #include <unity/storage/provider/ProviderBase.h>
 #include <unity/storage/provider/Exceptions.h>
 
@@ -48,9 +49,11 @@ namespace internal
 
 Handler::Handler(shared_ptr<AccountData> const& account,
                  Callback const& callback,
-                 QDBusConnection const& bus, QDBusMessage const& message)
+                 QDBusConnection const& bus, QDBusMessage const& message,
+                 MainLoopExecutor* dispatcher)
     : account_(account), callback_(callback), bus_(bus), message_(message),
-      activity_(account->inactivity_timer())
+      dispatcher_(dispatcher), activity_(account->inactivity_timer()),
+      start_time_(chrono::steady_clock::now())
 {
 }
 
@@ -65,7 +68,10 @@ void Handler::begin()
         return;
     }
 
-    // Otherwise, try to authenticate and wait for the result.
+    // Otherwise, try to authenticate and wait for the result. Meanwhile, ask for
+    // the peer credentials, so they are likely to be cached by the time we need them.
+    fast_path_ = false;
+    account_->dbus_peer().prefetch(message_.service());
     account_->authenticate(true, retry_);
     connect(account_.get(), &AccountData::authenticated,
             this, &Handler::on_authenticated);
@@ -75,44 +81,72 @@ void Handler::on_authenticated()
 {
     disconnect(account_.get(), &AccountData::authenticated,
                this, &Handler::on_authenticated);
+    authenticated_time_ = chrono::steady_clock::now();
     if (!account_->has_credentials())
     {
         string msg = "Handler::begin(): could not retrieve account credentials";
         qDebug() << QString::fromStdString(msg);
         auto ep = make_exception_ptr(UnauthorizedException(msg));
         marshal_exception(ep);
+        fast_path_ = false;
         QMetaObject::invokeMethod(this, "send_reply", Qt::QueuedConnection);
         return;
     }
 
     // Need to put security check in here.
     auto peer_future = account_->dbus_peer().get(message_.service());
+    if (peer_future.is_ready())
+    {
+        // Cache hit, so there is no need to wait for the event loop.
+        peer_credentials_received(peer_future.get());
+        return;
+    }
+    fast_path_ = false;
     creds_future_ = peer_future.then(
         EXEC_IN_MAIN
         [this](decltype(peer_future) f)
         {
-            auto info = f.get();
-            if (info.valid)
-            {
-                context_ = {info.uid, info.pid, std::move(info.label),
-                            account_->credentials()};
-                QMetaObject::invokeMethod(this, "credentials_received",
-                                          Qt::QueuedConnection);
-            }
-            else
-            {
-                string msg = "Handler::begin(): could not retrieve D-Bus peer credentials";
-                qDebug() << QString::fromStdString(msg);
-                auto ep = make_exception_ptr(UnauthorizedException(msg));
-                marshal_exception(ep);
-                QMetaObject::invokeMethod(this, "send_reply",
-                                          Qt::QueuedConnection);
-            }
+            peer_credentials_received(f.get());
         });
 }
 
+void Handler::peer_credentials_received(DBusPeerCache::Credentials info)
+{
+    credentials_time_ = chrono::steady_clock::now();
+    if (info.valid)
+    {
+        context_ = {info.uid, info.pid, std::move(info.label),
+                    account_->credentials()};
+        credentials_received();
+    }
+    else
+    {
+        string msg = "Handler::begin(): could not retrieve D-Bus peer credentials";
+        qDebug() << QString::fromStdString(msg);
+        auto ep = make_exception_ptr(UnauthorizedException(msg));
+        marshal_exception(ep);
+        fast_path_ = false;
+        QMetaObject::invokeMethod(this, "send_reply",
+                                  Qt::QueuedConnection);
+    }
+}
+
 void Handler::credentials_received()
 {
+    if (dispatcher_)
+    {
+        dispatcher_->submit([this]{ call_provider(); });
+        return;
+    }
+    call_provider();
+}
+
+// Runs on the dispatch thread, if there is one. The handler is not touched by the
+// main thread again until handle_unauthorized() or done() are invoked.
+
+void Handler::call_provider()
+{
+    called_time_ = chrono::steady_clock::now();
     boost::future<QDBusMessage> msg_future;
     try
     {
@@ -121,33 +155,63 @@ void Handler::credentials_received()
     catch (std::exception const& e)
     {
         qDebug() << "provider method threw an exception:" << e.what();
+        ready_time_ = chrono::steady_clock::now();
         marshal_exception(current_exception());
-        QMetaObject::invokeMethod(this, "send_reply", Qt::QueuedConnection);
+        reply_ready();
         return;
     }
+    if (msg_future.is_ready())
+    {
+        // The provider (and the reply continuation, which ran inline)
+        // completed synchronously, so we can reply right away.
+        provider_done(std::move(msg_future));
+        return;
+    }
+    fast_path_ = false;
     reply_future_ = msg_future.then(
-        EXEC_IN_MAIN
+        EXEC_IN_DISPATCH
         [this](decltype(msg_future) f)
         {
-            try
-            {
-                reply_ = f.get();
-            }
-            catch (UnauthorizedException const& e)
-            {
-                QMetaObject::invokeMethod(this, "handle_unauthorized",
-                                          Qt::QueuedConnection,
-                                          Q_ARG(std::exception_ptr, current_exception()));
-                return;
-            }
-            catch (std::exception const& e)
-            {
-                marshal_exception(current_exception());
-            }
-            QMetaObject::invokeMethod(this, "send_reply", Qt::QueuedConnection);
+            provider_done(std::move(f));
         });
 }
 
+void Handler::provider_done(boost::future<QDBusMessage> f)
+{
+    ready_time_ = chrono::steady_clock::now();
+    try
+    {
+        reply_ = f.get();
+    }
+    catch (UnauthorizedException const& e)
+    {
+        fast_path_ = false;
+        QMetaObject::invokeMethod(this, "handle_unauthorized",
+                                  Qt::QueuedConnection,
+                                  Q_ARG(std::exception_ptr, current_exception()));
+        return;
+    }
+    catch (std::exception const& e)
+    {
+        marshal_exception(current_exception());
+    }
+    reply_ready();
+}
+
+void Handler::reply_ready()
+{
+    if (dispatcher_)
+    {
+        // QDBusConnection::send() is thread-safe, so there is no need to
+        // bounce the reply through the main thread.
+        bus_.send(reply_);
+        sent_time_ = chrono::steady_clock::now();
+        QMetaObject::invokeMethod(this, "done", Qt::QueuedConnection);
+        return;
+    }
+    send_reply();
+}
+
 void Handler::handle_unauthorized(exception_ptr ep)
 {
     if (retry_)
@@ -167,9 +231,39 @@ void Handler::handle_unauthorized(exception_ptr ep)
 void Handler::send_reply()
 {
     bus_.send(reply_);
+    sent_time_ = chrono::steady_clock::now();
+    record_stats();
     Q_EMIT finished();
 }
 
+void Handler::done()
+{
+    record_stats();
+    Q_EMIT finished();
+}
+
+// Stages that were never reached (because of an error) count as zero.
+
+void Handler::record_stats()
+{
+    auto nsecs = [](TimePoint const& from, TimePoint const& to) -> int64_t
+    {
+        if (from == TimePoint() || to == TimePoint() || to < from)
+        {
+            return 0;
+        }
+        return chrono::duration_cast<chrono::nanoseconds>(to - from).count();
+    };
+
+    RequestStats::Timings t;
+    t.authenticate_nsecs = nsecs(start_time_, authenticated_time_);
+    t.peer_nsecs = nsecs(authenticated_time_, credentials_time_);
+    t.dispatch_nsecs = nsecs(credentials_time_, called_time_);
+    t.provider_nsecs = nsecs(called_time_, ready_time_);
+    t.reply_nsecs = nsecs(ready_time_, sent_time_);
+    RequestStats::instance().record(message_.member().toStdString(), t, fast_path_);
+}
+
 void Handler::marshal_exception(exception_ptr ep)
 {
     try
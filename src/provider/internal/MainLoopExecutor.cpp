@@ -21,16 +21,17 @@
 #include <QCoreApplication>
 #include <QEvent>
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace {
 
-class WorkEvent : public QEvent {
-public:
-    typedef unity::storage::provider::internal::MainLoopExecutor::work work;
+// Posted to wake up the event loop when the queue goes from empty to non-empty.
 
-    WorkEvent(work&& closure)
-        : QEvent(WorkEvent::eventType()), closure_(std::move(closure))
+class WakeupEvent : public QEvent {
+public:
+    WakeupEvent()
+        : QEvent(WakeupEvent::eventType())
     {
     }
 
@@ -39,10 +40,20 @@ public:
         static auto type = static_cast<QEvent::Type>(QEvent::registerEventType());
         return type;
     }
-
-    work closure_;
 };
 
+void update_max(std::atomic<int64_t>& max, int64_t value)
+{
+    int64_t old = max.load(std::memory_order_relaxed);
+    while (value > old && !max.compare_exchange_weak(old, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+// The executor for the event loop of the calling thread, if that is not the main thread.
+
+thread_local unity::storage::provider::internal::MainLoopExecutor* current_executor = nullptr;
+
 }
 
 namespace unity
@@ -54,20 +65,53 @@ namespace provider
 namespace internal
 {
 
+constexpr int MainLoopExecutor::MAX_BATCH;
+
 MainLoopExecutor::MainLoopExecutor()
+    : head_(&stub_)
+    , tail_(&stub_)
 {
 }
 
+MainLoopExecutor::~MainLoopExecutor()
+{
+    // Closures that never ran are discarded, as Qt discards pending events for a deleted object.
+    while (Node* node = pop())
+    {
+        delete node;
+    }
+}
+
 MainLoopExecutor& MainLoopExecutor::instance()
 {
     static MainLoopExecutor instance;
     return instance;
 }
 
+MainLoopExecutor& MainLoopExecutor::current()
+{
+    return current_executor ? *current_executor : instance();
+}
+
+// Called by a dispatch thread before it enters its event loop.
+
+void MainLoopExecutor::make_current()
+{
+    current_executor = this;
+}
+
 void MainLoopExecutor::submit(work&& closure)
 {
-    QCoreApplication::instance()->postEvent(
-        this, new WorkEvent(std::move(closure)));
+    Node* node = new Node;
+    node->closure = std::move(closure);
+    node->enqueue_time = std::chrono::steady_clock::now();
+    push(node);
+
+    // Only the first closure after a drain needs to wake up the event loop.
+    if (!wakeup_pending_.exchange(true))
+    {
+        post_wakeup();
+    }
 }
 
 void MainLoopExecutor::close()
@@ -87,15 +131,113 @@ bool MainLoopExecutor::try_executing_one()
 
 bool MainLoopExecutor::event(QEvent *e)
 {
-    if (e->type() != WorkEvent::eventType())
+    if (e->type() != WakeupEvent::eventType())
     {
         return QObject::event(e);
     }
-    auto *we = static_cast<WorkEvent*>(e);
-    execute(we->closure_);
+    drain();
     return true;
 }
 
+MainLoopExecutor::Stats MainLoopExecutor::stats() const
+{
+    Stats s;
+    s.wakeups = wakeups_;
+    s.executed = executed_;
+    s.max_batch = max_batch_;
+    s.total_latency_nsecs = total_latency_nsecs_;
+    s.max_latency_nsecs = max_latency_nsecs_;
+    return s;
+}
+
+// Intrusive MPSC queue (after Dmitry Vyukov). push() is wait-free and can be called
+// from any thread. pop() is called only from the thread of the event loop. It returns
+// nullptr if the queue is empty, or if a producer has swapped head_ but not yet linked
+// its node, in which case that producer posts a wake-up once it has done so.
+
+void MainLoopExecutor::push(Node* node) noexcept
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node* prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+MainLoopExecutor::Node* MainLoopExecutor::pop() noexcept
+{
+    Node* tail = tail_;
+    Node* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &stub_)
+    {
+        if (!next)
+        {
+            return nullptr;
+        }
+        tail_ = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next)
+    {
+        tail_ = next;
+        return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next)
+    {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void MainLoopExecutor::post_wakeup()
+{
+    QCoreApplication::postEvent(this, new WakeupEvent);
+}
+
+void MainLoopExecutor::drain()
+{
+    // Clear the flag before looking at the queue, so a closure that is pushed from
+    // now on either is seen below or posts another wake-up.
+    wakeup_pending_.store(false);
+    ++wakeups_;
+
+    int64_t count = 0;
+    int64_t total_latency = 0;
+    int64_t max_latency = 0;
+    while (count < MAX_BATCH)
+    {
+        Node* node = pop();
+        if (!node)
+        {
+            break;
+        }
+        auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - node->enqueue_time).count();
+        total_latency += latency;
+        max_latency = std::max(max_latency, int64_t(latency));
+        execute(node->closure);
+        delete node;
+        ++count;
+    }
+    executed_ += count;
+    total_latency_nsecs_ += total_latency;
+    update_max(max_batch_, count);
+    update_max(max_latency_nsecs_, max_latency);
+
+    // If we stopped because of the cap, let the event loop handle other
+    // events (such as incoming messages) before running the remainder.
+    if (count == MAX_BATCH && !wakeup_pending_.exchange(true))
+    {
+        post_wakeup();
+    }
+}
+
 void MainLoopExecutor::execute(work& closure) noexcept
 {
     closure();
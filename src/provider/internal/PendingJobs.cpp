@@ -17,6 +17,7 @@
  */
 
 #include <unity/storage/provider/internal/PendingJobs.h>
+#include <unity/storage/internal/EnvVars.h>
 #include <unity/storage/provider/DownloadJob.h>
 #include <unity/storage/provider/Exceptions.h>
 #include <unity/storage/provider/UploadJob.h>
@@ -24,11 +25,15 @@
 #include <unity/storage/provider/internal/MainLoopExecutor.h>
 #include <unity/storage/provider/internal/UploadJobImpl.h>
 
+#include <QPointer>
+#include <QTimer>
+
 #include <cassert>
 #include <cstdio>
 #include <stdexcept>
 
 using namespace std;
+using unity::storage::internal::EnvVars;
 
 namespace unity
 {
@@ -41,6 +46,7 @@ namespace internal
 
 PendingJobs::PendingJobs(QDBusConnection const& bus, QObject *parent)
     : QObject(parent)
+    , grace_period_ms_(EnvVars::provider_upload_grace_period_ms())
 {
     watcher_.setConnection(bus);
     watcher_.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
@@ -58,6 +64,10 @@ PendingJobs::~PendingJobs()
     {
         cancel_job(pair.second, "upload " + pair.second->upload_id());
     }
+    for (const auto& pair : suspended_uploads_)
+    {
+        cancel_job(pair.second.job, "upload " + pair.first);
+    }
 }
 
 void PendingJobs::add_download(QString const& client_bus_name,
@@ -91,7 +101,7 @@ shared_ptr<DownloadJob> PendingJobs::remove_download(QString const& client_bus_n
 }
 
 void PendingJobs::add_upload(QString const& client_bus_name,
-                             unique_ptr<UploadJob> &&job)
+                             shared_ptr<UploadJob> const& job)
 {
     lock_guard<mutex> guard(lock_);
 
@@ -99,8 +109,7 @@ void PendingJobs::add_upload(QString const& client_bus_name,
     const auto job_id = make_pair(client_bus_name, job->upload_id());
     assert(uploads_.find(job_id) == uploads_.end());
 
-    shared_ptr<UploadJob> j(std::move(job));
-    uploads_.emplace(job_id, j);
+    uploads_.emplace(job_id, job);
     watch_peer(client_bus_name);
 }
 
@@ -120,6 +129,43 @@ shared_ptr<UploadJob> PendingJobs::remove_upload(QString const& client_bus_name,
     return job;
 }
 
+int64_t PendingJobs::suspended_upload_offset(Context const& ctx, string const& upload_id)
+{
+    lock_guard<mutex> guard(lock_);
+
+    auto it = suspended_uploads_.find(upload_id);
+    if (it == suspended_uploads_.cend() || !it->second.job->p_->is_owner(ctx))
+    {
+        throw LogicException("No such upload: " + upload_id);
+    }
+    return it->second.offset;
+}
+
+shared_ptr<UploadJob> PendingJobs::remove_suspended_upload(Context const& ctx,
+                                                           string const& upload_id,
+                                                           int64_t& offset)
+{
+    lock_guard<mutex> guard(lock_);
+
+    // We pretend that uploads started by other clients do not exist.
+    auto it = suspended_uploads_.find(upload_id);
+    if (it == suspended_uploads_.cend() || !it->second.job->p_->is_owner(ctx))
+    {
+        throw LogicException("No such upload: " + upload_id);
+    }
+    auto job = it->second.job;
+    offset = it->second.offset;
+    suspended_uploads_.erase(it);
+    return job;
+}
+
+// Cancels an upload that was removed from the suspended uploads, but could not be resumed.
+
+void PendingJobs::abandon_upload(shared_ptr<UploadJob> const& job)
+{
+    cancel_job(job, "upload " + job->upload_id());
+}
+
 void PendingJobs::watch_peer(QString const& bus_name)
 {
     auto it = services_.find(bus_name);
@@ -171,7 +217,7 @@ void PendingJobs::service_disconnected(QString const& service_name)
     {
         auto job = it->second;
         it = uploads_.erase(it);
-        cancel_job(job, "upload " + job->upload_id());
+        suspend_upload(job);
     }
 }
 
@@ -181,27 +227,103 @@ void PendingJobs::service_disconnected(QString const& service_name)
 template<typename Job>
 void PendingJobs::cancel_job(shared_ptr<Job> const& job, string const& identifier)
 {
-    auto f = job->p_->cancel(*job);
+    keep_until_ready(job, job->p_->cancel(*job), "cancelling job '" + identifier + "'");
+}
+
+// Suspends the upload of a client that went away, so the client can resume it
+// after reconnecting. The upload is cancelled if the provider cannot suspend it,
+// or if no client resumes it within the grace period.
+
+void PendingJobs::suspend_upload(shared_ptr<UploadJob> const& job)
+{
+    auto const identifier = "upload " + job->upload_id();
+    if (grace_period_ms_ == 0)
+    {
+        cancel_job(job, identifier);
+        return;
+    }
+
+    QPointer<PendingJobs> self(this);
+    auto f = job->p_->suspend(*job);
+    auto suspended = f.then(
+        EXEC_IN_MAIN
+        [self, job, identifier](decltype(f) f) {
+            int64_t offset;
+            try
+            {
+                offset = f.get();
+            }
+            catch (std::exception const&)
+            {
+                // Most providers do not support resumable uploads, so this is not worth logging.
+                if (self)
+                {
+                    self->cancel_job(job, identifier);
+                }
+                return;
+            }
+            if (!self)
+            {
+                job->p_->cancel(*job);  // We were destroyed while the upload was being suspended.
+                return;
+            }
+
+            auto const upload_id = job->upload_id();
+            int64_t serial;
+            {
+                lock_guard<mutex> guard(self->lock_);
+                serial = ++self->next_serial_;
+                self->suspended_uploads_[upload_id] = SuspendedUpload{job, offset, serial};
+            }
+            QTimer::singleShot(self->grace_period_ms_, self.data(), [self, upload_id, serial]{
+                self->expire_upload(upload_id, serial);
+            });
+        });
+    keep_until_ready(job, move(suspended), "suspending " + identifier);
+}
+
+void PendingJobs::expire_upload(string const& upload_id, int64_t serial)
+{
+    shared_ptr<UploadJob> job;
+    {
+        lock_guard<mutex> guard(lock_);
+
+        auto it = suspended_uploads_.find(upload_id);
+        if (it == suspended_uploads_.end() || it->second.serial != serial)
+        {
+            return;  // The upload was resumed in the meantime.
+        }
+        job = it->second.job;
+        suspended_uploads_.erase(it);
+    }
+    cancel_job(job, "upload " + upload_id);
+}
+
+// Keeps the job alive until the future is ready, and logs any error.
+
+void PendingJobs::keep_until_ready(shared_ptr<void> const& job,
+                                   boost::future<void> f,
+                                   string const& action)
+{
     // This continuation also ensures that the job remains
-    // alive until the cancel method has completed.
-    auto cancel_future = std::make_shared<boost::future<void>>();
-    *cancel_future = f.then(
+    // alive until the future is ready.
+    auto cont_future = std::make_shared<boost::future<void>>();
+    *cont_future = f.then(
         EXEC_IN_MAIN
-        [job, identifier, cancel_future](decltype(f) f) {
+        [job, action, cont_future](decltype(f) f) {
             try
             {
                 f.get();
             }
             catch (std::exception const& e)
             {
-                fprintf(stderr, "Error cancelling job '%s': %s\n",
-                        identifier.c_str(), e.what());
+                fprintf(stderr, "Error %s: %s\n", action.c_str(), e.what());
             }
 
             // Break the reference cycle between the continuation
             // future and closure, while making sure the future
             // survives long enough to be marked ready.
-            auto fut = std::make_shared<boost::future<void>>(std::move(*cancel_future));
+            auto fut = std::make_shared<boost::future<void>>(std::move(*cont_future));
             MainLoopExecutor::instance().submit([fut]{});
         });
 }
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/ProviderBaseImpl.h>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+void ProviderBaseImpl::set_change_listener(ChangeListener const& listener)
+{
+    lock_guard<mutex> lock(mutex_);
+    listener_ = listener;
+}
+
+void ProviderBaseImpl::notify_changes(ItemChangeList const& changes)
+{
+    if (changes.empty())
+    {
+        return;
+    }
+    lock_guard<mutex> lock(mutex_);
+    if (listener_)
+    {
+        listener_(changes);
+    }
+}
+
+}
+}
+}
+}
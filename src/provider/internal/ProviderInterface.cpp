@@ -22,13 +22,17 @@
 #include <unity/storage/provider/ProviderBase.h>
 #include <unity/storage/provider/UploadJob.h>
 #include <unity/storage/provider/internal/AccountData.h>
+#include <unity/storage/provider/internal/DispatchPool.h>
 #include <unity/storage/provider/internal/DownloadJobImpl.h>
 #include <unity/storage/provider/internal/MainLoopExecutor.h>
 #include <unity/storage/provider/internal/PendingJobs.h>
+#include <unity/storage/provider/internal/ProviderBaseImpl.h>
+#include <unity/storage/provider/internal/RequestStats.h>
 #include <unity/storage/provider/internal/UploadJobImpl.h>
 #include <unity/storage/provider/internal/dbusmarshal.h>
 
 #include <OnlineAccounts/AuthenticationData>
+#include <QDataStream>
 #include <QDebug>
 
 using namespace std;
@@ -46,6 +50,77 @@ vector<string> to_vector(QList<QString> const& l)
     return v;
 }
 
+// Builds the reply from the provider's future. If the future is ready already (as it is for
+// providers that answer from a cache), the reply is built right away, so the handler can send it
+// without returning to the event loop. Otherwise, it is built in the event loop of the calling thread.
+
+template<typename T, typename F>
+boost::future<QDBusMessage> make_reply(boost::future<T>& f, F&& build_reply)
+{
+    using namespace unity::storage::provider::internal;
+
+    if (f.is_ready())
+    {
+        try
+        {
+            return boost::make_ready_future(build_reply(std::move(f)));
+        }
+        catch (...)
+        {
+            return boost::make_exceptional_future<QDBusMessage>(boost::current_exception());
+        }
+    }
+    return f.then(EXEC_IN_DISPATCH std::forward<F>(build_reply));
+}
+
+// Identifies a read-only request for coalescing. The key includes the client's security label,
+// so clients with different confinement never share a result. (The account is implied because
+// each ProviderInterface has its own coalescers.)
+
+template<typename... Args>
+string request_key(QDBusMessage const& message,
+                   unity::storage::provider::Context const& ctx,
+                   Args const&... args)
+{
+    QByteArray key;
+    QDataStream s(&key, QIODevice::WriteOnly);
+    s << message.member() << QString::fromStdString(ctx.security_label);
+    int dummy[] = { 0, (s << args, 0)... };
+    (void)dummy;
+    return key.toStdString();
+}
+
+// Calls start() unless an identical request is in flight already, in which case
+// the request waits for the result of that call.
+
+template<typename T, typename F, typename... Args>
+boost::future<T> coalesce(unity::storage::provider::internal::RequestCoalescer<T> const& calls,
+                          QDBusMessage const& message,
+                          unity::storage::provider::Context const& ctx,
+                          F&& start,
+                          Args const&... args)
+{
+    using namespace unity::storage::provider::internal;
+
+    bool coalesced;
+    auto f = calls.call(request_key(message, ctx, args...), std::forward<F>(start), coalesced);
+    if (coalesced)
+    {
+        RequestStats::instance().record_coalesced(message.member().toStdString());
+    }
+    return f;
+}
+
+QList<unity::storage::internal::ItemChange> to_item_changes(unity::storage::provider::ItemChangeList const& changes)
+{
+    QList<unity::storage::internal::ItemChange> l;
+    for (auto const& c : changes)
+    {
+        l.append({ QString::fromStdString(c.item_id), QString::fromStdString(c.parent_id), c.type });
+    }
+    return l;
+}
+
 }
 
 namespace unity {
@@ -53,21 +128,44 @@ namespace storage {
 namespace provider {
 namespace internal {
 
-ProviderInterface::ProviderInterface(shared_ptr<AccountData> const& account, QObject *parent)
-    : QObject(parent), account_(account)
+ProviderInterface::ProviderInterface(shared_ptr<AccountData> const& account,
+                                     DispatchPool* dispatch_pool,
+                                     QObject *parent)
+    : QObject(parent), account_(account), dispatch_pool_(dispatch_pool),
+      account_executor_(dispatch_pool ? &dispatch_pool->next_executor() : nullptr)
 {
+    account_->provider().p_->set_change_listener([this](ItemChangeList const&) { queue_changes(); });
 }
 
-ProviderInterface::~ProviderInterface() = default;
+ProviderInterface::~ProviderInterface()
+{
+    account_->provider().p_->set_change_listener(nullptr);
+}
 
-void ProviderInterface::queue_request(Handler::Callback callback)
+void ProviderInterface::queue_request(Handler::Callback callback, Affinity affinity)
 {
+    // Mutating requests for an account all go to the same thread, so the provider methods
+    // are called in the order in which the requests arrived. That orders the calls only;
+    // the provider may complete the operations in any order (for example, if it runs
+    // them on a worker pool), and each reply is sent when its operation completes.
+    // Read-only requests can go anywhere.
+    MainLoopExecutor* dispatcher = nullptr;
+    if (dispatch_pool_ && affinity == Affinity::any_thread)
+    {
+        dispatcher = &dispatch_pool_->next_executor();
+    }
+    else if (dispatch_pool_ && affinity == Affinity::account_thread)
+    {
+        dispatcher = account_executor_;
+    }
     unique_ptr<Handler> handler(
-        new Handler(account_, callback, connection(), message()));
+        new Handler(account_, callback, connection(), message(), dispatcher));
     connect(handler.get(), &Handler::finished, this, &ProviderInterface::request_finished);
     setDelayedReply(true);
-    handler->begin();
-    requests_.emplace(handler.get(), std::move(handler));
+    // The handler may finish before begin() returns, so it must be in requests_ by then.
+    Handler* h = handler.get();
+    requests_.emplace(h, std::move(handler));
+    h->begin();
 }
 
 void ProviderInterface::request_finished()
@@ -90,17 +188,60 @@ void ProviderInterface::request_finished()
     handler->deleteLater();
 }
 
+// Hand the read end of the download socket to the client and keep the job
+// until the client calls FinishDownload.
+
+QDBusMessage ProviderInterface::start_download(shared_ptr<AccountData> const& account,
+                                               QDBusMessage const& message,
+                                               unique_ptr<DownloadJob> job)
+{
+    job->p_->set_activity(account->inactivity_timer());
+    auto download_id = QString::fromStdString(job->download_id());
+    QDBusUnixFileDescriptor file_desc;
+    int fd = job->p_->take_read_socket();
+    file_desc.setFileDescriptor(fd);
+    close(fd);
+
+    account->jobs().add_download(message.service(), std::move(job));
+    return message.createReply({
+            QVariant(download_id),
+            QVariant::fromValue(file_desc),
+        });
+}
+
+void ProviderInterface::queue_changes()
+{
+    lock_guard<mutex> lock(changes_mutex_);
+    if (!changes_pending_)
+    {
+        changes_pending_ = true;
+        QMetaObject::invokeMethod(this, "flush_changes", Qt::QueuedConnection);
+    }
+}
+
+void ProviderInterface::flush_changes()
+{
+    {
+        lock_guard<mutex> lock(changes_mutex_);
+        changes_pending_ = false;
+    }
+    Q_EMIT ItemsChanged();
+}
+
 QList<ProviderInterface::IMD> ProviderInterface::Roots(QList<QString> const& keys)
 {
-    queue_request([keys](shared_ptr<AccountData> const& account, Context const& ctx, QDBusMessage const& message) {
-            auto f = account->provider().roots(to_vector(keys), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+    queue_request([keys, calls = roots_calls_](shared_ptr<AccountData> const& account,
+                                               Context const& ctx,
+                                               QDBusMessage const& message) {
+            auto f = coalesce(calls, message, ctx,
+                              [&] { return account->provider().roots(to_vector(keys), ctx); },
+                              keys);
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     auto roots = f.get();
                     return message.createReply(QVariant::fromValue(roots));
                 });
-        });
+        }, Affinity::any_thread);
     return {};
 }
 
@@ -109,12 +250,16 @@ QList<ProviderInterface::IMD> ProviderInterface::List(QString const& item_id,
                                                       QList<QString> const& keys,
                                                       QString& /*next_token*/)
 {
-    queue_request([item_id, page_token, keys](shared_ptr<AccountData> const& account,
-                                              Context const& ctx,
-                                              QDBusMessage const& message) {
-            auto f = account->provider().list(item_id.toStdString(), page_token.toStdString(), to_vector(keys), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+    queue_request([item_id, page_token, keys, calls = list_calls_](shared_ptr<AccountData> const& account,
+                                                                   Context const& ctx,
+                                                                   QDBusMessage const& message) {
+            auto f = coalesce(calls, message, ctx,
+                              [&] {
+                                  return account->provider().list(item_id.toStdString(), page_token.toStdString(),
+                                                                  to_vector(keys), ctx);
+                              },
+                              item_id, page_token, keys);
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     vector<Item> children;
                     string next_token;
@@ -124,7 +269,7 @@ QList<ProviderInterface::IMD> ProviderInterface::List(QString const& item_id,
                             QVariant(QString::fromStdString(next_token)),
                         });
                 });
-        });
+        }, Affinity::any_thread);
     return {};
 }
 
@@ -132,33 +277,38 @@ QList<ProviderInterface::IMD> ProviderInterface::Lookup(QString const& parent_id
                                                         QString const& name,
                                                         QList<QString> const& keys)
 {
-    queue_request([parent_id, name, keys](shared_ptr<AccountData> const& account,
-                                          Context const& ctx,
-                                          QDBusMessage const& message) {
-            auto f = account->provider().lookup(parent_id.toStdString(), name.toStdString(), to_vector(keys), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+    queue_request([parent_id, name, keys, calls = lookup_calls_](shared_ptr<AccountData> const& account,
+                                                                 Context const& ctx,
+                                                                 QDBusMessage const& message) {
+            auto f = coalesce(calls, message, ctx,
+                              [&] {
+                                  return account->provider().lookup(parent_id.toStdString(), name.toStdString(),
+                                                                    to_vector(keys), ctx);
+                              },
+                              parent_id, name, keys);
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     auto items = f.get();
                     return message.createReply(QVariant::fromValue(items));
                 });
-        });
+        }, Affinity::any_thread);
     return {};
 }
 
 ProviderInterface::IMD ProviderInterface::Metadata(QString const& item_id, QList<QString> const& keys)
 {
-    queue_request([item_id, keys](shared_ptr<AccountData> const& account,
-                                  Context const& ctx,
-                                  QDBusMessage const& message) {
-            auto f = account->provider().metadata(item_id.toStdString(), to_vector(keys), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+    queue_request([item_id, keys, calls = metadata_calls_](shared_ptr<AccountData> const& account,
+                                                           Context const& ctx,
+                                                           QDBusMessage const& message) {
+            auto f = coalesce(calls, message, ctx,
+                              [&] { return account->provider().metadata(item_id.toStdString(), to_vector(keys), ctx); },
+                              item_id, keys);
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     auto item = f.get();
                     return message.createReply(QVariant::fromValue(item));
                 });
-        });
+        }, Affinity::any_thread);
     return {};
 }
 
@@ -171,13 +321,12 @@ ProviderInterface::IMD ProviderInterface::CreateFolder(QString const& parent_id,
                                           QDBusMessage const& message) {
             auto f = account->provider().create_folder(
                 parent_id.toStdString(), name.toStdString(), to_vector(keys), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     auto item = f.get();
                     return message.createReply(QVariant::fromValue(item));
                 });
-        });
+        }, Affinity::account_thread);
     return {};
 }
 
@@ -197,9 +346,10 @@ QString ProviderInterface::CreateFile(QString const& parent_id,
                 size, content_type.toStdString(), allow_overwrite, to_vector(keys), ctx);
             return f.then(
                 EXEC_IN_MAIN
-                [account, message](decltype(f) f) -> QDBusMessage {
+                [account, ctx, message](decltype(f) f) -> QDBusMessage {
                     auto job = f.get();
                     job->p_->set_activity(account->inactivity_timer());
+                    job->p_->set_owner(ctx);
                     auto upload_id = QString::fromStdString(job->upload_id());
                     QDBusUnixFileDescriptor file_desc;
                     int fd = job->p_->take_write_socket();
@@ -229,9 +379,10 @@ QString ProviderInterface::Update(QString const& item_id,
                 item_id.toStdString(), size, old_etag.toStdString(), to_vector(keys), ctx);
             return f.then(
                 EXEC_IN_MAIN
-                [account, message](decltype(f) f) -> QDBusMessage {
+                [account, ctx, message](decltype(f) f) -> QDBusMessage {
                     auto job = f.get();
                     job->p_->set_activity(account->inactivity_timer());
+                    job->p_->set_owner(ctx);
                     auto upload_id = QString::fromStdString(job->upload_id());
                     QDBusUnixFileDescriptor file_desc;
                     int fd = job->p_->take_write_socket();
@@ -285,29 +436,90 @@ void ProviderInterface::CancelUpload(QString const& upload_id)
         });
 }
 
-QString ProviderInterface::Download(QString const& item_id, QString const& match_etag, QDBusUnixFileDescriptor& /*file_descriptor*/)
+qlonglong ProviderInterface::UploadOffset(QString const& upload_id)
 {
-    queue_request([item_id, match_etag](shared_ptr<AccountData> const& account, Context const& ctx, QDBusMessage const& message) {
-            auto f = account->provider().download(
-                item_id.toStdString(), match_etag.toStdString(), ctx);
+    queue_request([upload_id](shared_ptr<AccountData> const& account,
+                              Context const& ctx,
+                              QDBusMessage const& message) {
+            // Throws if the upload is not suspended
+            auto offset = account->jobs().suspended_upload_offset(ctx, upload_id.toStdString());
+            return boost::make_ready_future(message.createReply(QVariant(qlonglong(offset))));
+        });
+    return 0;
+}
+
+qlonglong ProviderInterface::ResumeUpload(QString const& upload_id, QDBusUnixFileDescriptor& /*file_descriptor*/)
+{
+    queue_request([upload_id](shared_ptr<AccountData> const& account,
+                              Context const& ctx,
+                              QDBusMessage const& message) {
+            // Throws if the upload is not suspended
+            int64_t offset;
+            auto job = account->jobs().remove_suspended_upload(ctx, upload_id.toStdString(), offset);
+            auto f = job->p_->resume(*job);
             return f.then(
                 EXEC_IN_MAIN
-                [account, message](decltype(f) f) -> QDBusMessage {
-                    auto job = f.get();
-                    job->p_->set_activity(account->inactivity_timer());
-                    auto download_id = QString::fromStdString(job->download_id());
+                [account, message, job, offset](decltype(f) f) -> QDBusMessage {
+                    try
+                    {
+                        f.get();
+                    }
+                    catch (std::exception const&)
+                    {
+                        account->jobs().abandon_upload(job);
+                        throw;
+                    }
                     QDBusUnixFileDescriptor file_desc;
-                    int fd = job->p_->take_read_socket();
+                    int fd = job->p_->take_write_socket();
                     file_desc.setFileDescriptor(fd);
                     close(fd);
 
-                    account->jobs().add_download(message.service(), std::move(job));
+                    account->jobs().add_upload(message.service(), job);
                     return message.createReply({
-                            QVariant(download_id),
+                            QVariant(qlonglong(offset)),
                             QVariant::fromValue(file_desc),
                         });
                 });
         });
+    return 0;
+}
+
+QString ProviderInterface::Download(QString const& item_id, QString const& match_etag, QDBusUnixFileDescriptor& /*file_descriptor*/)
+{
+    queue_request([item_id, match_etag](shared_ptr<AccountData> const& account, Context const& ctx, QDBusMessage const& message) {
+            auto f = account->provider().download(
+                item_id.toStdString(), match_etag.toStdString(), ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    return start_download(account, message, f.get());
+                });
+        });
+    return "";
+}
+
+QString ProviderInterface::DownloadRange(QString const& item_id,
+                                         QString const& match_etag,
+                                         int64_t offset,
+                                         int64_t length,
+                                         QDBusUnixFileDescriptor& /*file_descriptor*/)
+{
+    queue_request([item_id, match_etag, offset, length](shared_ptr<AccountData> const& account,
+                                                        Context const& ctx,
+                                                        QDBusMessage const& message) {
+            if (offset < 0 || length < -1)
+            {
+                throw InvalidArgumentException("download_range(): invalid range: offset = " + to_string(offset)
+                                               + ", length = " + to_string(length));
+            }
+            auto f = account->provider().download_range(
+                item_id.toStdString(), match_etag.toStdString(), offset, length, ctx);
+            return f.then(
+                EXEC_IN_MAIN
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    return start_download(account, message, f.get());
+                });
+        });
     return "";
 }
 
@@ -335,13 +547,12 @@ void ProviderInterface::Delete(QString const& item_id)
     queue_request([item_id](shared_ptr<AccountData> const& account, Context const& ctx, QDBusMessage const& message) {
             auto f = account->provider().delete_item(
                 item_id.toStdString(), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     f.get();
                     return message.createReply();
                 });
-        });
+        }, Affinity::account_thread);
 }
 
 ProviderInterface::IMD ProviderInterface::Move(QString const& item_id,
@@ -355,13 +566,12 @@ ProviderInterface::IMD ProviderInterface::Move(QString const& item_id,
             auto f = account->provider().move(
                 item_id.toStdString(), new_parent_id.toStdString(),
                 new_name.toStdString(), to_vector(keys), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     auto item = f.get();
                     return message.createReply(QVariant::fromValue(item));
                 });
-        });
+        }, Affinity::account_thread);
     return {};
 }
 
@@ -376,13 +586,87 @@ ProviderInterface::IMD ProviderInterface::Copy(QString const& item_id,
             auto f = account->provider().copy(
                 item_id.toStdString(), new_parent_id.toStdString(),
                 new_name.toStdString(), to_vector(keys), ctx);
-            return f.then(
-                EXEC_IN_MAIN
+            return make_reply(f,
                 [account, message](decltype(f) f) -> QDBusMessage {
                     auto item = f.get();
                     return message.createReply(QVariant::fromValue(item));
                 });
-        });
+        }, Affinity::account_thread);
+    return {};
+}
+
+QList<unity::storage::internal::ItemChange> ProviderInterface::Changes(QString const& cursor,
+                                                                      QList<QString> const& keys,
+                                                                      QList<IMD>& /*items*/,
+                                                                      QString& /*next_cursor*/)
+{
+    queue_request([cursor, keys](shared_ptr<AccountData> const& account,
+                                 Context const& ctx,
+                                 QDBusMessage const& message) {
+            auto f = account->provider().changes(cursor.toStdString(), to_vector(keys), ctx);
+            return make_reply(f,
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    ItemChangeList changes;
+                    vector<Item> items;
+                    string next_cursor;
+                    tie(changes, items, next_cursor) = f.get();
+                    return message.createReply({
+                            QVariant::fromValue(to_item_changes(changes)),
+                            QVariant::fromValue(items),
+                            QVariant(QString::fromStdString(next_cursor)),
+                        });
+                });
+        }, Affinity::any_thread);
+    return {};
+}
+
+QList<ProviderInterface::IMD> ProviderInterface::Search(QString const& parent_id,
+                                                        QString const& query,
+                                                        QString const& page_token,
+                                                        QList<QString> const& keys,
+                                                        QString& /*next_token*/)
+{
+    queue_request([parent_id, query, page_token, keys](shared_ptr<AccountData> const& account,
+                                                       Context const& ctx,
+                                                       QDBusMessage const& message) {
+            auto f = account->provider().search(parent_id.toStdString(), query.toStdString(),
+                                                page_token.toStdString(), to_vector(keys), ctx);
+            return make_reply(f,
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    vector<Item> items;
+                    string next_token;
+                    tie(items, next_token) = f.get();
+                    return message.createReply({
+                            QVariant::fromValue(items),
+                            QVariant(QString::fromStdString(next_token)),
+                        });
+                });
+        }, Affinity::any_thread);
+    return {};
+}
+
+QList<ProviderInterface::IMD> ProviderInterface::Walk(QString const& parent_id,
+                                                      int max_depth,
+                                                      QString const& page_token,
+                                                      QList<QString> const& keys,
+                                                      QString& /*next_token*/)
+{
+    queue_request([parent_id, max_depth, page_token, keys](shared_ptr<AccountData> const& account,
+                                                           Context const& ctx,
+                                                           QDBusMessage const& message) {
+            auto f = account->provider().walk(parent_id.toStdString(), max_depth,
+                                              page_token.toStdString(), to_vector(keys), ctx);
+            return make_reply(f,
+                [account, message](decltype(f) f) -> QDBusMessage {
+                    vector<Item> items;
+                    string next_token;
+                    tie(items, next_token) = f.get();
+                    return message.createReply({
+                            QVariant::fromValue(items),
+                            QVariant(QString::fromStdString(next_token)),
+                        });
+                });
+        }, Affinity::any_thread);
     return {};
 }
 
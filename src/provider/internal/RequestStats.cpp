@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/RequestStats.h>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+RequestStats& RequestStats::instance()
+{
+    static RequestStats instance;
+    return instance;
+}
+
+void RequestStats::record(string const& method, Timings const& timings, bool fast_path)
+{
+    lock_guard<mutex> lock(mutex_);
+    auto& t = totals_[method];
+    ++t.requests;
+    if (fast_path)
+    {
+        ++t.fast_path;
+    }
+    t.timings.authenticate_nsecs += timings.authenticate_nsecs;
+    t.timings.peer_nsecs += timings.peer_nsecs;
+    t.timings.dispatch_nsecs += timings.dispatch_nsecs;
+    t.timings.provider_nsecs += timings.provider_nsecs;
+    t.timings.reply_nsecs += timings.reply_nsecs;
+}
+
+void RequestStats::record_coalesced(string const& method)
+{
+    lock_guard<mutex> lock(mutex_);
+    ++totals_[method].coalesced;
+}
+
+RequestStats::Totals RequestStats::totals(string const& method) const
+{
+    lock_guard<mutex> lock(mutex_);
+    auto it = totals_.find(method);
+    return it == totals_.end() ? Totals() : it->second;
+}
+
+void RequestStats::reset()
+{
+    lock_guard<mutex> lock(mutex_);
+    totals_.clear();
+}
+
+}  // namespace internal
+}  // namespace provider
+}  // namespace storage
+}  // namespace unity
@@ -18,7 +18,9 @@
 
 #include <unity/storage/provider/internal/ServerImpl.h>
 #include <unity/storage/internal/EnvVars.h>
+#include <unity/storage/internal/dbusmarshal.h>
 #include <unity/storage/provider/ProviderBase.h>
+#include <unity/storage/provider/WorkerPool.h>
 #include <unity/storage/provider/internal/FixedAccountData.h>
 #include <unity/storage/provider/internal/MainLoopExecutor.h>
 #include <unity/storage/provider/internal/OnlineAccountData.h>
@@ -27,6 +29,8 @@
 
 #include <QDebug>
 
+#include <thread>
+
 using namespace std;
 using unity::storage::internal::EnvVars;
 using unity::storage::internal::InactivityTimer;
@@ -40,15 +44,21 @@ namespace provider
 namespace internal
 {
 
-ServerImpl::ServerImpl(ServerBase* server, string const& bus_name, string const& account_service_id)
+ServerImpl::ServerImpl(ServerBase* server,
+                       string const& bus_name,
+                       string const& account_service_id,
+                       DispatchMode dispatch_mode)
     : server_(server)
     , bus_name_(bus_name)
     , service_id_(account_service_id)
+    , dispatch_mode_(dispatch_mode)
     , trace_message_handler_("storage_provider")
 {
     qRegisterMetaType<std::exception_ptr>();
     qDBusRegisterMetaType<Item>();
     qDBusRegisterMetaType<std::vector<Item>>();
+    qDBusRegisterMetaType<unity::storage::internal::ItemChange>();
+    qDBusRegisterMetaType<QList<unity::storage::internal::ItemChange>>();
 }
 
 ServerImpl::~ServerImpl() = default;
@@ -73,11 +83,27 @@ void ServerImpl::init(int& argc, char **argv, QDBusConnection *bus)
 
     dbus_peer_ = make_shared<DBusPeerCache>(*bus_);
 
+    // Start the worker threads now, rather than when the first request arrives.
+    auto const& options = ProviderBase::worker_pool().options();
+    qDebug() << "Worker pool:" << options.metadata_threads << "metadata threads,"
+             << options.bulk_threads << "bulk threads, max queue depth" << options.max_queue_depth;
+
 #ifdef SF_SUPPORTS_EXECUTORS
     // Ensure the executor is instantiated in the main thread.
     MainLoopExecutor::instance();
 #endif
 
+    if (dispatch_mode_ == DispatchMode::thread_pool)
+    {
+        int num_threads = EnvVars::provider_dispatch_threads();
+        if (num_threads <= 0)
+        {
+            num_threads = max(1u, thread::hardware_concurrency());
+        }
+        dispatch_pool_.reset(new DispatchPool(num_threads));
+        qDebug() << "Dispatch pool:" << num_threads << "threads";
+    }
+
     if (service_id_.empty())
     {
         // If we have an empty service ID, create a single instance of
@@ -145,7 +171,7 @@ void ServerImpl::add_account(OnlineAccounts::Account* account)
             server_->make_provider(), dbus_peer_, inactivity_timer_, *bus_);
     }
     unique_ptr<ProviderInterface> iface(
-        new ProviderInterface(account_data));
+        new ProviderInterface(account_data, dispatch_pool_.get()));
     // this instance is managed by Qt's parent/child memory management
     new ProviderAdaptor(iface.get());
 
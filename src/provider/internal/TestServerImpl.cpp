@@ -17,10 +17,13 @@
  */
 
 #include <unity/storage/provider/internal/TestServerImpl.h>
+#include <unity/storage/internal/EnvVars.h>
 #include <unity/storage/internal/InactivityTimer.h>
+#include <unity/storage/internal/dbusmarshal.h>
 #include <unity/storage/provider/Exceptions.h>
 #include <unity/storage/provider/ProviderBase.h>
 #include <unity/storage/provider/internal/DBusPeerCache.h>
+#include <unity/storage/provider/internal/DispatchPool.h>
 #include <unity/storage/provider/internal/FixedAccountData.h>
 #include <unity/storage/provider/internal/OnlineAccountData.h>
 #include <unity/storage/provider/internal/ProviderInterface.h>
@@ -30,8 +33,10 @@
 #include <OnlineAccounts/Account>
 
 #include <stdexcept>
+#include <thread>
 
 using namespace std;
+using unity::storage::internal::EnvVars;
 using unity::storage::internal::InactivityTimer;
 
 namespace
@@ -51,13 +56,26 @@ namespace internal
 TestServerImpl::TestServerImpl(shared_ptr<ProviderBase> const& provider,
                                OnlineAccounts::Account* account,
                                QDBusConnection const& connection,
-                               string const& object_path)
+                               string const& object_path,
+                               DispatchMode mode)
     : connection_(connection), object_path_(object_path),
       inactivity_timer_(make_shared<InactivityTimer>(TIMEOUT))
 {
     qRegisterMetaType<std::exception_ptr>();
     qDBusRegisterMetaType<Item>();
     qDBusRegisterMetaType<std::vector<Item>>();
+    qDBusRegisterMetaType<unity::storage::internal::ItemChange>();
+    qDBusRegisterMetaType<QList<unity::storage::internal::ItemChange>>();
+
+    if (mode == DispatchMode::thread_pool)
+    {
+        int num_threads = EnvVars::provider_dispatch_threads();
+        if (num_threads <= 0)
+        {
+            num_threads = max(1u, thread::hardware_concurrency());
+        }
+        dispatch_pool_.reset(new DispatchPool(num_threads));
+    }
 
     auto peer_cache = make_shared<DBusPeerCache>(connection_);
     shared_ptr<AccountData> account_data;
@@ -71,7 +89,7 @@ TestServerImpl::TestServerImpl(shared_ptr<ProviderBase> const& provider,
         account_data = make_shared<FixedAccountData>(
             provider, peer_cache, inactivity_timer_, connection_);
     }
-    interface_.reset(new ProviderInterface(account_data));
+    interface_.reset(new ProviderInterface(account_data, dispatch_pool_.get()));
     new ProviderAdaptor(interface_.get());
 
     if (!connection_.registerObject(QString::fromStdString(object_path_),
@@ -45,6 +45,11 @@ namespace internal
 
 UploadJobImpl::UploadJobImpl(std::string const& upload_id)
     : upload_id_(upload_id)
+{
+    create_sockets();
+}
+
+void UploadJobImpl::create_sockets()
 {
     int socks[2];
     if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0)
@@ -114,6 +119,17 @@ void UploadJobImpl::set_activity(std::shared_ptr<InactivityTimer> const& inactiv
     activity_ = ActivityNotifier(inactivity_timer);
 }
 
+void UploadJobImpl::set_owner(Context const& ctx)
+{
+    owner_uid_ = ctx.uid;
+    owner_label_ = ctx.security_label;
+}
+
+bool UploadJobImpl::is_owner(Context const& ctx) const
+{
+    return ctx.uid == owner_uid_ && ctx.security_label == owner_label_;
+}
+
 void UploadJobImpl::report_error(exception_ptr p)
 {
     if (read_socket_ >= 0)
@@ -147,6 +163,39 @@ boost::future<void> UploadJobImpl::cancel(UploadJob& job)
     return job.cancel();
 }
 
+boost::future<int64_t> UploadJobImpl::suspend(UploadJob& job)
+{
+    lock_guard<mutex> guard(completion_lock_);
+    if (completed_)
+    {
+        return boost::make_exceptional_future<int64_t>(LogicException("suspend(): upload has failed already"));
+    }
+    return job.suspend();
+}
+
+boost::future<void> UploadJobImpl::resume(UploadJob& job)
+{
+    // The old sockets were connected to the client that went away.
+    if (read_socket_ >= 0)
+    {
+        close(read_socket_);
+        read_socket_ = -1;
+    }
+    if (write_socket_ >= 0)
+    {
+        close(write_socket_);
+        write_socket_ = -1;
+    }
+    create_sockets();
+
+    lock_guard<mutex> guard(completion_lock_);
+    if (completed_)
+    {
+        return boost::make_exceptional_future<void>(LogicException("resume(): upload has failed already"));
+    }
+    return job.resume();
+}
+
 }
 }
 }
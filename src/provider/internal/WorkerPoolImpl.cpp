@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/WorkerPoolImpl.h>
+#include <unity/storage/provider/Exceptions.h>
+
+#include <cassert>
+
+#include <errno.h>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace provider
+{
+namespace internal
+{
+
+namespace
+{
+
+void update_max(atomic<int64_t>& max, int64_t val)
+{
+    int64_t old = max.load();
+    while (val > old && !max.compare_exchange_weak(old, val))
+    {
+    }
+}
+
+}  // namespace
+
+WorkerPoolImpl::WorkerPoolImpl(WorkerPool::Options const& options)
+    : options_(options)
+{
+    if (options.metadata_threads < 1 || options.bulk_threads < 1)
+    {
+        throw InvalidArgumentException("WorkerPool(): number of threads must be > 0");
+    }
+    if (options.max_queue_depth < 0)
+    {
+        throw InvalidArgumentException("WorkerPool(): max_queue_depth must be >= 0");
+    }
+    start(metadata_lane_, "metadata", options.metadata_threads);
+    start(bulk_lane_, "bulk", options.bulk_threads);
+}
+
+WorkerPoolImpl::~WorkerPoolImpl()
+{
+    stopped_ = true;
+    stop(metadata_lane_);
+    stop(bulk_lane_);
+}
+
+void WorkerPoolImpl::post(WorkerPool::Lane l, function<void()> closure)
+{
+    assert(closure);
+
+    auto& ln = lane(l);
+    auto const queued = ++ln.queued;
+    if (options_.max_queue_depth > 0 && queued > options_.max_queue_depth)
+    {
+        --ln.queued;
+        ++ln.rejected;
+        string msg = "WorkerPool: " + ln.name + " queue is full (max_queue_depth = "
+                     + to_string(options_.max_queue_depth) + ")";
+        throw ResourceException(msg, EAGAIN);
+    }
+    update_max(ln.max_queued, queued);
+
+    auto const index = ln.next_worker++ % ln.workers.size();
+    auto& worker = *ln.workers[index];
+    {
+        lock_guard<mutex> lock(worker.mutex);
+        worker.tasks.push_back(Task{move(closure), chrono::steady_clock::now()});
+    }
+    // Notify while holding the wakeup mutex, so a worker that has just found
+    // all queues empty cannot miss the update of queued.
+    lock_guard<mutex> lock(ln.wakeup_mutex);
+    ln.wakeup.notify_one();
+}
+
+WorkerPool::LaneStats WorkerPoolImpl::stats(WorkerPool::Lane l) const
+{
+    auto const& ln = lane(l);
+
+    WorkerPool::LaneStats s;
+    s.queued = ln.queued;
+    s.max_queued = ln.max_queued;
+    s.executed = ln.executed;
+    s.stolen = ln.stolen;
+    s.rejected = ln.rejected;
+    s.total_wait_nsecs = ln.total_wait_nsecs;
+    s.max_wait_nsecs = ln.max_wait_nsecs;
+    return s;
+}
+
+WorkerPool::Options const& WorkerPoolImpl::options() const
+{
+    return options_;
+}
+
+WorkerPoolImpl::Lane& WorkerPoolImpl::lane(WorkerPool::Lane l)
+{
+    return l == WorkerPool::Lane::metadata ? metadata_lane_ : bulk_lane_;
+}
+
+WorkerPoolImpl::Lane const& WorkerPoolImpl::lane(WorkerPool::Lane l) const
+{
+    return l == WorkerPool::Lane::metadata ? metadata_lane_ : bulk_lane_;
+}
+
+void WorkerPoolImpl::start(Lane& ln, string const& name, int num_threads)
+{
+    ln.name = name;
+    for (int i = 0; i < num_threads; ++i)
+    {
+        ln.workers.emplace_back(new Worker);
+    }
+    // Start the threads only once all queues exist, because a thread may start stealing immediately.
+    for (size_t i = 0; i < ln.workers.size(); ++i)
+    {
+        ln.workers[i]->thread = thread(&WorkerPoolImpl::run, this, ref(ln), i);
+    }
+}
+
+void WorkerPoolImpl::stop(Lane& ln)
+{
+    {
+        lock_guard<mutex> lock(ln.wakeup_mutex);
+        ln.wakeup.notify_all();
+    }
+    for (auto& w : ln.workers)
+    {
+        if (w->thread.joinable())
+        {
+            w->thread.join();
+        }
+    }
+}
+
+// Pop the oldest task from our own queue or, if that is empty, steal the
+// oldest task from one of our siblings.
+
+bool WorkerPoolImpl::try_pop(Lane& ln, size_t index, Task& task)
+{
+    auto const num_workers = ln.workers.size();
+    for (size_t i = 0; i < num_workers; ++i)
+    {
+        auto& w = *ln.workers[(index + i) % num_workers];
+        lock_guard<mutex> lock(w.mutex);
+        if (!w.tasks.empty())
+        {
+            task = move(w.tasks.front());
+            w.tasks.pop_front();
+            --ln.queued;
+            if (i != 0)
+            {
+                ++ln.stolen;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPoolImpl::run(Lane& ln, size_t index)
+{
+    while (!stopped_)
+    {
+        Task task;
+        if (!try_pop(ln, index, task))
+        {
+            unique_lock<mutex> lock(ln.wakeup_mutex);
+            ln.wakeup.wait(lock, [this, &ln]{ return stopped_ || ln.queued > 0; });
+            continue;
+        }
+
+        auto const wait_time = chrono::steady_clock::now() - task.enqueue_time;
+        auto const wait_nsecs = chrono::duration_cast<chrono::nanoseconds>(wait_time).count();
+        ln.total_wait_nsecs += wait_nsecs;
+        update_max(ln.max_wait_nsecs, wait_nsecs);
+
+        task.closure();  // Closures are packaged tasks, so they do not throw.
+        ++ln.executed;
+    }
+}
+
+}
+}
+}
+}
@@ -38,7 +38,17 @@ TestServer::TestServer(shared_ptr<ProviderBase> const& provider,
                        QDBusConnection const& connection,
                        string const& object_path)
     : p_(new internal::TestServerImpl(provider, account,
-                                      connection, object_path))
+                                      connection, object_path, DispatchMode::main_thread))
+{
+}
+
+TestServer::TestServer(shared_ptr<ProviderBase> const& provider,
+                       OnlineAccounts::Account* account,
+                       QDBusConnection const& connection,
+                       string const& object_path,
+                       DispatchMode mode)
+    : p_(new internal::TestServerImpl(provider, account,
+                                      connection, object_path, mode))
 {
 }
 
@@ -113,6 +113,11 @@ ItemJob* Account::get(QString const& itemId, QStringList const& keys) const
     return p_->get(itemId, keys);
 }
 
+ChangeWatcher* Account::watchChanges() const
+{
+    return p_->watchChanges();
+}
+
 bool Account::operator==(Account const& other) const
 {
     return p_->operator==(*other.p_);
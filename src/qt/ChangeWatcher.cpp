@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/qt/ChangeWatcher.h>
+
+#include <unity/storage/qt/Account.h>
+#include <unity/storage/qt/internal/ChangeWatcherImpl.h>
+
+using namespace unity::storage::qt;
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace qt
+{
+
+ChangeWatcher::ChangeWatcher(unique_ptr<internal::ChangeWatcherImpl> p)
+    : p_(move(p))
+{
+}
+
+ChangeWatcher::~ChangeWatcher() = default;
+
+bool ChangeWatcher::isValid() const
+{
+    return p_->isValid();
+}
+
+StorageError ChangeWatcher::error() const
+{
+    return p_->error();
+}
+
+Account ChangeWatcher::account() const
+{
+    return p_->account();
+}
+
+}  // namespace qt
+}  // namespace storage
+}  // namespace unity
@@ -147,11 +147,21 @@ Uploader* Item::createUploader(ConflictPolicy policy, qint64 sizeInBytes, QStrin
     return p_->createUploader(policy, sizeInBytes, keys);
 }
 
+Uploader* Item::resumeUpload(QString const& uploadId, qint64 sizeInBytes) const
+{
+    return p_->resumeUpload(uploadId, sizeInBytes);
+}
+
 Downloader* Item::createDownloader(ConflictPolicy policy) const
 {
     return p_->createDownloader(policy);
 }
 
+Downloader* Item::createDownloader(ConflictPolicy policy, qint64 offset, qint64 length) const
+{
+    return p_->createDownloader(policy, offset, length);
+}
+
 ItemListJob* Item::list(QStringList const& keys) const
 {
     return p_->list(keys);
@@ -162,6 +172,16 @@ ItemListJob* Item::lookup(QString const& name, QStringList const& keys) const
     return p_->lookup(name, keys);
 }
 
+ItemListJob* Item::search(QString const& query, QStringList const& keys) const
+{
+    return p_->search(query, keys);
+}
+
+ItemListJob* Item::walk(int maxDepth, QStringList const& keys) const
+{
+    return p_->walk(maxDepth, keys);
+}
+
 ItemJob* Item::createFolder(QString const& name, QStringList const& keys) const
 {
     return p_->createFolder(name, keys);
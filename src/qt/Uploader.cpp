@@ -69,6 +69,16 @@ Item Uploader::item() const
     return p_->item();
 }
 
+QString Uploader::uploadId() const
+{
+    return p_->uploadId();
+}
+
+qint64 Uploader::offset() const
+{
+    return p_->offset();
+}
+
 void Uploader::cancel()
 {
     p_->cancel();
@@ -20,6 +20,7 @@
 
 #include "ProviderInterface.h"
 #include <unity/storage/qt/Account.h>
+#include <unity/storage/qt/internal/ChangeWatcherImpl.h>
 #include <unity/storage/qt/internal/ItemImpl.h>
 #include <unity/storage/qt/internal/ItemJobImpl.h>
 #include <unity/storage/qt/internal/ItemListJobImpl.h>
@@ -140,6 +141,26 @@ ItemJob* AccountImpl::get(QString const& itemId, QStringList const& keys) const
     return ItemJobImpl::make_job(This, method, reply, validate);
 }
 
+ChangeWatcher* AccountImpl::watchChanges() const
+{
+    QString const method = "Account::watchChanges()";
+
+    if (!is_valid_)
+    {
+        auto e = StorageErrorImpl::logic_error(method + ": cannot create watcher from invalid account");
+        return ChangeWatcherImpl::make_watcher(e);
+    }
+    auto runtime = runtime_impl_.lock();
+    if (!runtime || !runtime->isValid())
+    {
+        auto e = StorageErrorImpl::runtime_destroyed_error(method + ": Runtime was destroyed previously");
+        return ChangeWatcherImpl::make_watcher(e);
+    }
+
+    auto This = const_pointer_cast<AccountImpl>(shared_from_this());
+    return ChangeWatcherImpl::make_watcher(This);
+}
+
 bool AccountImpl::operator==(AccountImpl const& other) const
 {
     if (is_valid_)
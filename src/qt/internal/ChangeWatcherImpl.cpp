@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/qt/internal/ChangeWatcherImpl.h>
+
+#include "ProviderInterface.h"
+#include <unity/storage/qt/Account.h>
+#include <unity/storage/qt/internal/AccountImpl.h>
+#include <unity/storage/qt/internal/Handler.h>
+#include <unity/storage/qt/internal/RuntimeImpl.h>
+
+#include <cassert>
+
+using namespace std;
+
+namespace unity
+{
+namespace storage
+{
+namespace qt
+{
+namespace internal
+{
+
+ChangeWatcherImpl::ChangeWatcherImpl(shared_ptr<AccountImpl> const& account_impl)
+    : account_impl_(account_impl)
+{
+    assert(account_impl);
+
+    connect(account_impl_->provider().get(), &::ProviderInterface::ItemsChanged,
+            this, &ChangeWatcherImpl::items_changed);
+    fetch_changes(false);  // Get a cursor for the current state.
+}
+
+ChangeWatcherImpl::ChangeWatcherImpl(StorageError const& error)
+    : error_(error)
+{
+}
+
+bool ChangeWatcherImpl::isValid() const
+{
+    return error_.type() == StorageError::NoError;
+}
+
+StorageError ChangeWatcherImpl::error() const
+{
+    return error_;
+}
+
+Account ChangeWatcherImpl::account() const
+{
+    return account_impl_ ? account_impl_ : Account();
+}
+
+// The signal only tells us that something changed, so we ask the provider what changed.
+
+void ChangeWatcherImpl::items_changed()
+{
+    if (fetching_)
+    {
+        pending_ = true;
+        return;
+    }
+    fetch_changes(true);
+}
+
+// Calls Changes() with our cursor until there are no more changes. notified is false if the provider
+// did not tell us about changes, that is, when we need a new cursor because we don't have one yet.
+
+void ChangeWatcherImpl::fetch_changes(bool notified)
+{
+    fetching_ = true;
+    pending_ = false;
+    bool const have_cursor = !cursor_.isEmpty();
+
+    auto reply = account_impl_->provider()->Changes(cursor_, QStringList());
+
+    auto process_reply = [this, notified, have_cursor](decltype(reply)& r)
+    {
+        fetching_ = false;
+        auto runtime = account_impl_->runtime_impl();
+        if (!runtime || !runtime->isValid())
+        {
+            return;
+        }
+
+        auto const changes = r.argumentAt<0>();
+        cursor_ = r.argumentAt<2>();
+        if (!have_cursor)
+        {
+            if (notified)
+            {
+                Q_EMIT public_instance_->changesLost();  // We have nothing to compare with.
+            }
+        }
+        else if (!changes.isEmpty())
+        {
+            QList<ItemChange> item_changes;
+            item_changes.reserve(changes.size());
+            for (auto const& c : changes)
+            {
+                ItemChange::Type type;
+                switch (c.type)
+                {
+                    case storage::ChangeType::created:
+                        type = ItemChange::Created;
+                        break;
+                    case storage::ChangeType::deleted:
+                        type = ItemChange::Deleted;
+                        break;
+                    default:
+                        type = ItemChange::Changed;
+                        break;
+                }
+                item_changes.append(ItemChange{c.item_id, c.parent_id, type});
+            }
+            Q_EMIT public_instance_->itemsChanged(item_changes);
+            fetch_changes(false);  // There may be more.
+            return;
+        }
+        if (pending_)
+        {
+            fetch_changes(true);
+        }
+    };
+
+    auto process_error = [this, notified, have_cursor](StorageError const&)
+    {
+        // The cursor expired, or the provider does not keep track of changes.
+        fetching_ = false;
+        cursor_.clear();
+        auto runtime = account_impl_->runtime_impl();
+        if (!runtime || !runtime->isValid())
+        {
+            return;
+        }
+
+        if (have_cursor || notified)
+        {
+            Q_EMIT public_instance_->changesLost();
+        }
+        if (have_cursor || pending_)
+        {
+            fetch_changes(!have_cursor);  // Start over with a new cursor.
+        }
+    };
+
+    new Handler<QDBusPendingReply<QList<storage::internal::ItemChange>,
+                                  QList<storage::internal::ItemMetadata>,
+                                  QString>>(this, reply, process_reply, process_error);
+}
+
+ChangeWatcher* ChangeWatcherImpl::make_watcher(shared_ptr<AccountImpl> const& account_impl)
+{
+    unique_ptr<ChangeWatcherImpl> impl(new ChangeWatcherImpl(account_impl));
+    auto watcher = new ChangeWatcher(move(impl));
+    watcher->p_->public_instance_ = watcher;
+    return watcher;
+}
+
+ChangeWatcher* ChangeWatcherImpl::make_watcher(StorageError const& error)
+{
+    unique_ptr<ChangeWatcherImpl> impl(new ChangeWatcherImpl(error));
+    auto watcher = new ChangeWatcher(move(impl));
+    watcher->p_->public_instance_ = watcher;
+    return watcher;
+}
+
+}  // namespace internal
+}  // namespace qt
+}  // namespace storage
+}  // namespace unity
@@ -47,6 +47,12 @@ HandlerBase::HandlerBase(QObject* parent,
     connect(&watcher_, &QDBusPendingCallWatcher::finished, this, &HandlerBase::finished);
 }
 
+void HandlerBase::wait_and_process_now()
+{
+    watcher_.waitForFinished();
+    finished(&watcher_);
+}
+
 void HandlerBase::finished(QDBusPendingCallWatcher* call)
 {
     deleteLater();
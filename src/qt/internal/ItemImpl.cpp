@@ -280,6 +280,41 @@ Uploader* ItemImpl::createUploader(Item::ConflictPolicy policy, qint64 sizeInByt
     return UploaderImpl::make_job(This, method, reply, validate, policy, sizeInBytes);
 }
 
+Uploader* ItemImpl::resumeUpload(QString const& uploadId, qint64 sizeInBytes) const
+{
+    QString const method = "Item::resumeUpload()";
+
+    auto invalid_job = check_invalid_or_destroyed<UploaderImpl>(method);
+    if (invalid_job)
+    {
+        return invalid_job;
+    }
+    if (uploadId.isEmpty())
+    {
+        auto e = StorageErrorImpl::invalid_argument_error(method + ": upload ID cannot be empty");
+        return UploaderImpl::make_job(e);
+    }
+    if (sizeInBytes < 0)
+    {
+        auto e = StorageErrorImpl::invalid_argument_error(method + ": size must be >= 0");
+        return UploaderImpl::make_job(e);
+    }
+
+    auto validate = [method](storage::internal::ItemMetadata const& md)
+    {
+        if (md.type != storage::ItemType::file)
+        {
+            QString msg = method + ": impossible folder item returned by provider (id = " + md.item_id + ")";
+            qCritical().noquote() << msg;
+            throw StorageErrorImpl::local_comms_error(msg);
+        }
+    };
+
+    auto reply = account_impl_->provider()->ResumeUpload(uploadId);
+    auto This = const_pointer_cast<ItemImpl>(shared_from_this());
+    return UploaderImpl::make_job(This, method, reply, validate, uploadId, sizeInBytes);
+}
+
 Downloader* ItemImpl::createDownloader(Item::ConflictPolicy policy) const
 {
     QString const method = "Item::createDownloader()";
@@ -301,6 +336,38 @@ Downloader* ItemImpl::createDownloader(Item::ConflictPolicy policy) const
     return DownloaderImpl::make_job(This, method, reply);
 }
 
+Downloader* ItemImpl::createDownloader(Item::ConflictPolicy policy, qint64 offset, qint64 length) const
+{
+    QString const method = "Item::createDownloader()";
+
+    auto invalid_job = check_invalid_or_destroyed<DownloaderImpl>(method);
+    if (invalid_job)
+    {
+        return invalid_job;
+    }
+    if (md_.type != storage::ItemType::file)
+    {
+        auto e = StorageErrorImpl::logic_error(method + ": cannot download a folder");
+        return DownloaderImpl::make_job(e);
+    }
+    if (offset < 0 || length < -1)
+    {
+        auto e = StorageErrorImpl::invalid_argument_error(method + ": invalid range: offset = "
+                                                          + QString::number(offset)
+                                                          + ", length = " + QString::number(length));
+        return DownloaderImpl::make_job(e);
+    }
+    if (offset == 0 && length == -1)
+    {
+        return createDownloader(policy);  // Works with providers that cannot download part of a file.
+    }
+
+    auto etag = policy == Item::ConflictPolicy::IgnoreConflict ? "" : md_.etag;
+    auto reply = account_impl_->provider()->DownloadRange(md_.item_id, etag, offset, length);
+    auto This = const_pointer_cast<ItemImpl>(shared_from_this());
+    return DownloaderImpl::make_job(This, method, reply);
+}
+
 ItemListJob* ItemImpl::list(QStringList const& keys) const
 {
     QString const method = "Item::list()";
@@ -360,6 +427,81 @@ ItemListJob* ItemImpl::lookup(QString const& name, QStringList const& keys) cons
     return ItemListJobImpl::make_job(This, method, reply, validate);
 }
 
+ItemListJob* ItemImpl::search(QString const& query, QStringList const& keys) const
+{
+    QString const method = "Item::search()";
+
+    auto invalid_job = check_invalid_or_destroyed<MultiItemListJobImpl>(method);
+    if (invalid_job)
+    {
+        return invalid_job;
+    }
+    if (md_.type == storage::ItemType::file)
+    {
+        auto e = StorageErrorImpl::logic_error(method + ": cannot perform search on a file");
+        return ItemListJobImpl::make_job(e);
+    }
+
+    auto validate = [method](storage::internal::ItemMetadata const& md)
+    {
+        if (md.type == storage::ItemType::root)
+        {
+            QString msg = method + ": impossible root item returned by provider (id = " + md.item_id + ")";
+            qCritical().noquote() << msg;
+            throw StorageErrorImpl::local_comms_error(msg);
+        }
+    };
+
+    auto fetch_next = [this, query, keys](QString const& page_token)
+    {
+        return account_impl_->provider()->Search(md_.item_id, query, page_token, keys);
+    };
+
+    auto reply = account_impl_->provider()->Search(md_.item_id, query, "", keys);
+    auto This = const_pointer_cast<ItemImpl>(shared_from_this());
+    return MultiItemListJobImpl::make_job(This, method, reply, validate, fetch_next);
+}
+
+ItemListJob* ItemImpl::walk(int maxDepth, QStringList const& keys) const
+{
+    QString const method = "Item::walk()";
+
+    auto invalid_job = check_invalid_or_destroyed<MultiItemListJobImpl>(method);
+    if (invalid_job)
+    {
+        return invalid_job;
+    }
+    if (md_.type == storage::ItemType::file)
+    {
+        auto e = StorageErrorImpl::logic_error(method + ": cannot perform walk on a file");
+        return ItemListJobImpl::make_job(e);
+    }
+    if (maxDepth < 0)
+    {
+        auto e = StorageErrorImpl::invalid_argument_error(method + ": invalid maxDepth: " + QString::number(maxDepth));
+        return ItemListJobImpl::make_job(e);
+    }
+
+    auto validate = [method](storage::internal::ItemMetadata const& md)
+    {
+        if (md.type == storage::ItemType::root)
+        {
+            QString msg = method + ": impossible root item returned by provider (id = " + md.item_id + ")";
+            qCritical().noquote() << msg;
+            throw StorageErrorImpl::local_comms_error(msg);
+        }
+    };
+
+    auto fetch_next = [this, maxDepth, keys](QString const& page_token)
+    {
+        return account_impl_->provider()->Walk(md_.item_id, maxDepth, page_token, keys);
+    };
+
+    auto reply = account_impl_->provider()->Walk(md_.item_id, maxDepth, "", keys);
+    auto This = const_pointer_cast<ItemImpl>(shared_from_this());
+    return MultiItemListJobImpl::make_job(This, method, reply, validate, fetch_next);
+}
+
 ItemJob* ItemImpl::createFolder(QString const& name, QStringList const& keys) const
 {
     QString const method = "Item::createFolder()";
@@ -24,6 +24,7 @@
 #include <unity/storage/qt/internal/AccountImpl.h>
 #include <unity/storage/qt/internal/AccountsJobImpl.h>
 #include <unity/storage/qt/internal/StorageErrorImpl.h>
+#include <unity/storage/qt/ChangeWatcher.h>
 #include <unity/storage/qt/Downloader.h>
 #include <unity/storage/qt/ItemJob.h>
 #include <unity/storage/qt/ItemListJob.h>
@@ -53,6 +54,9 @@ void register_meta_types()
     qRegisterMetaType<unity::storage::qt::AccountsJob::Status>();
     qRegisterMetaType<unity::storage::qt::Account>();
     qRegisterMetaType<QList<unity::storage::qt::Account>>();
+    qRegisterMetaType<unity::storage::qt::ItemChange>();
+    qRegisterMetaType<QList<unity::storage::qt::ItemChange>>();
+    qRegisterMetaType<unity::storage::qt::ItemChange::Type>();
     qRegisterMetaType<unity::storage::qt::Downloader::Status>();
     qRegisterMetaType<unity::storage::qt::Item>();
     qRegisterMetaType<QList<unity::storage::qt::Item>>();
@@ -64,6 +68,9 @@ void register_meta_types()
     qDBusRegisterMetaType<unity::storage::internal::ItemMetadata>();
     qDBusRegisterMetaType<QList<unity::storage::internal::ItemMetadata>>();
 
+    qDBusRegisterMetaType<unity::storage::internal::ItemChange>();
+    qDBusRegisterMetaType<QList<unity::storage::internal::ItemChange>>();
+
     qDBusRegisterMetaType<unity::storage::internal::AccountDetails>();
     qDBusRegisterMetaType<QList<unity::storage::internal::AccountDetails>>();
 }
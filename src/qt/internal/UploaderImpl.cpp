@@ -55,69 +55,51 @@ UploaderImpl::UploaderImpl(shared_ptr<ItemImpl> const& item_impl,
     assert(!method.isEmpty());
     assert(size_in_bytes >= 0);
 
-    auto process_reply = [this, method](QDBusPendingReply<QString, QDBusUnixFileDescriptor>& r)
+    auto process_reply = [this](QDBusPendingReply<QString, QDBusUnixFileDescriptor>& r)
     {
-        if (status_ != Uploader::Status::Loading)
-        {
-            return;  // Don't transition to a final state more than once.
-        }
-
-        auto runtime = item_impl_->runtime_impl();
-        if (!runtime || !runtime->isValid())
-        {
-            QString msg = method + ": Runtime was destroyed previously";
-            error_ = StorageErrorImpl::runtime_destroyed_error(msg);
-            socket_.abort();
-            public_instance_->setErrorString(msg);
-            status_ = Uploader::Status::Error;
-            Q_EMIT public_instance_->statusChanged(status_);
-            return;
-        }
+        connect_socket(r.argumentAt<0>(), r.argumentAt<1>());
+    };
 
-        upload_id_ = r.argumentAt<0>();
-        fd_ = r.argumentAt<1>();
-        if (fd_.fileDescriptor() < 0)
-        {
-            // LCOV_EXCL_START
-            QString msg = method + ": invalid file descriptor returned by provider";
-            qCritical().noquote() << msg;
-            error_ = StorageErrorImpl::local_comms_error(msg);
-            socket_.abort();
-            public_instance_->setErrorString(msg);
-            status_ = Uploader::Status::Error;
-            Q_EMIT public_instance_->statusChanged(status_);
-            return;
-            // LCOV_EXCL_STOP
-        }
+    auto process_error = [this](StorageError const& error)
+    {
+        set_error(error);
+    };
 
-        // We forward any QIODevice signals emitted by the socket to the public instance.
-        connect(&socket_, &QIODevice::aboutToClose, public_instance_, &QIODevice::aboutToClose);
-        connect(&socket_, &QIODevice::bytesWritten, public_instance_, &QIODevice::bytesWritten);
-        connect(&socket_, &QIODevice::readChannelFinished, public_instance_, &QIODevice::readChannelFinished);
-        connect(&socket_, &QIODevice::readyRead, public_instance_, &QIODevice::readyRead);
+    handler_ = new Handler<QDBusPendingReply<QString, QDBusUnixFileDescriptor>>(this, reply,
+                                                                                process_reply, process_error);
+}
 
-#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
-        connect(&socket_, &QIODevice::channelBytesWritten, public_instance_, &QIODevice::channelBytesWritten);
-        connect(&socket_, &QIODevice::channelReadyRead, public_instance_, &QIODevice::channelReadyRead);
-#endif
+UploaderImpl::UploaderImpl(shared_ptr<ItemImpl> const& item_impl,
+                           QString const& method,
+                           QDBusPendingReply<qlonglong, QDBusUnixFileDescriptor>& reply,
+                           std::function<void(storage::internal::ItemMetadata const&)> const& validate,
+                           QString const& upload_id,
+                           qint64 size_in_bytes)
+    : status_(Uploader::Status::Loading)
+    , method_(method)
+    , item_impl_(item_impl)
+    , validate_(validate)
+    , size_in_bytes_(size_in_bytes)
+{
+    assert(item_impl);
+    assert(validate);
+    assert(!method.isEmpty());
+    assert(!upload_id.isEmpty());
+    assert(size_in_bytes >= 0);
 
-        socket_.setSocketDescriptor(fd_.fileDescriptor(), QLocalSocket::ConnectedState, QIODevice::WriteOnly);
-        flush_buffer();
-        status_ = Uploader::Status::Ready;
-        Q_EMIT public_instance_->statusChanged(status_);
+    auto process_reply = [this, upload_id](QDBusPendingReply<qlonglong, QDBusUnixFileDescriptor>& r)
+    {
+        offset_ = r.argumentAt<0>();
+        connect_socket(upload_id, r.argumentAt<1>());
     };
 
     auto process_error = [this](StorageError const& error)
     {
-        // TODO: This does not set the method
-        error_ = error;
-        status_ = Uploader::Status::Error;
-        socket_.abort();
-        public_instance_->setErrorString(error.errorString());
-        Q_EMIT public_instance_->statusChanged(status_);
+        set_error(error);
     };
 
-    handler_ = new Handler<QDBusPendingReply<QString, QDBusUnixFileDescriptor>>(this, reply, process_reply, process_error);
+    handler_ = new Handler<QDBusPendingReply<qlonglong, QDBusUnixFileDescriptor>>(this, reply,
+                                                                                  process_reply, process_error);
 }
 
 UploaderImpl::UploaderImpl(StorageError const& e)
@@ -177,6 +159,16 @@ Item UploaderImpl::item() const
     return Item(item_impl_);
 }
 
+QString UploaderImpl::uploadId() const
+{
+    return upload_id_;
+}
+
+qint64 UploaderImpl::offset() const
+{
+    return offset_;
+}
+
 void UploaderImpl::cancel()
 {
     static QString const method = "Uploader::cancel()";
@@ -409,6 +401,20 @@ Uploader* UploaderImpl::make_job(shared_ptr<ItemImpl> const& item_impl,
     return uploader;
 }
 
+Uploader* UploaderImpl::make_job(shared_ptr<ItemImpl> const& item_impl,
+                                 QString const& method,
+                                 QDBusPendingReply<qlonglong, QDBusUnixFileDescriptor>& reply,
+                                 std::function<void(storage::internal::ItemMetadata const&)> const& validate,
+                                 QString const& upload_id,
+                                 qint64 size_in_bytes)
+{
+    unique_ptr<UploaderImpl> impl(new UploaderImpl(item_impl, method, reply, validate, upload_id, size_in_bytes));
+    auto uploader = new Uploader(move(impl));
+    uploader->open(QIODevice::WriteOnly);
+    uploader->p_->public_instance_ = uploader;
+    return uploader;
+}
+
 Uploader* UploaderImpl::make_job(StorageError const& e)
 {
     unique_ptr<UploaderImpl> impl(new UploaderImpl(e));
@@ -422,6 +428,68 @@ Uploader* UploaderImpl::make_job(StorageError const& e)
     return uploader;
 }
 
+void UploaderImpl::connect_socket(QString const& upload_id, QDBusUnixFileDescriptor const& fd)
+{
+    if (status_ != Uploader::Status::Loading)
+    {
+        return;  // Don't transition to a final state more than once.
+    }
+
+    auto runtime = item_impl_->runtime_impl();
+    if (!runtime || !runtime->isValid())
+    {
+        QString msg = method_ + ": Runtime was destroyed previously";
+        error_ = StorageErrorImpl::runtime_destroyed_error(msg);
+        socket_.abort();
+        public_instance_->setErrorString(msg);
+        status_ = Uploader::Status::Error;
+        Q_EMIT public_instance_->statusChanged(status_);
+        return;
+    }
+
+    upload_id_ = upload_id;
+    fd_ = fd;
+    if (fd_.fileDescriptor() < 0)
+    {
+        // LCOV_EXCL_START
+        QString msg = method_ + ": invalid file descriptor returned by provider";
+        qCritical().noquote() << msg;
+        error_ = StorageErrorImpl::local_comms_error(msg);
+        socket_.abort();
+        public_instance_->setErrorString(msg);
+        status_ = Uploader::Status::Error;
+        Q_EMIT public_instance_->statusChanged(status_);
+        return;
+        // LCOV_EXCL_STOP
+    }
+
+    // We forward any QIODevice signals emitted by the socket to the public instance.
+    connect(&socket_, &QIODevice::aboutToClose, public_instance_, &QIODevice::aboutToClose);
+    connect(&socket_, &QIODevice::bytesWritten, public_instance_, &QIODevice::bytesWritten);
+    connect(&socket_, &QIODevice::readChannelFinished, public_instance_, &QIODevice::readChannelFinished);
+    connect(&socket_, &QIODevice::readyRead, public_instance_, &QIODevice::readyRead);
+
+#if QT_VERSION >= QT_VERSION_CHECK(5, 7, 0)
+    connect(&socket_, &QIODevice::channelBytesWritten, public_instance_, &QIODevice::channelBytesWritten);
+    connect(&socket_, &QIODevice::channelReadyRead, public_instance_, &QIODevice::channelReadyRead);
+#endif
+
+    socket_.setSocketDescriptor(fd_.fileDescriptor(), QLocalSocket::ConnectedState, QIODevice::WriteOnly);
+    flush_buffer();
+    status_ = Uploader::Status::Ready;
+    Q_EMIT public_instance_->statusChanged(status_);
+}
+
+void UploaderImpl::set_error(StorageError const& error)
+{
+    // TODO: This does not set the method
+    error_ = error;
+    status_ = Uploader::Status::Error;
+    socket_.abort();
+    public_instance_->setErrorString(error.errorString());
+    Q_EMIT public_instance_->statusChanged(status_);
+}
+
 qint64 UploaderImpl::flush_buffer()
 {
     qint64 bytes_written = 0;
@@ -0,0 +1,646 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+// Micro-benchmarks for the local provider. These do not check timings;
+// they print the results so we can compare them across changes.
+
+#include "../../src/local-provider/LocalProvider.h"
+
+#include <unity/storage/common.h>
+#include <unity/storage/provider/ProviderBase.h>
+#include <unity/storage/provider/WorkerPool.h>
+#include <unity/storage/qt/client-api.h>
+#include <utils/ProviderFixture.h>
+
+#include <gtest/gtest.h>
+#include <QCoreApplication>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace unity::storage;
+using namespace std;
+
+namespace
+{
+
+int const NUM_ENTRIES = 50000;
+int const NUM_RUNS = 5;
+
+// Counts the system calls made by the calling thread, using the raw_syscalls:sys_enter
+// tracepoint. The counter is not available if tracefs is not mounted or if we
+// do not have permission to use the tracepoint.
+
+class SyscallCounter
+{
+public:
+    SyscallCounter()
+    {
+        for (auto dir : { "/sys/kernel/tracing", "/sys/kernel/debug/tracing" })
+        {
+            ifstream id_file(string(dir) + "/events/raw_syscalls/sys_enter/id");
+            uint64_t id;
+            if (id_file >> id)
+            {
+                perf_event_attr attr = {};
+                attr.size = sizeof(attr);
+                attr.type = PERF_TYPE_TRACEPOINT;
+                attr.config = id;
+                attr.disabled = 1;
+                fd_ = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+                break;
+            }
+        }
+    }
+
+    ~SyscallCounter()
+    {
+        if (fd_ != -1)
+        {
+            close(fd_);
+        }
+    }
+
+    SyscallCounter(SyscallCounter const&) = delete;
+    SyscallCounter& operator=(SyscallCounter const&) = delete;
+
+    bool is_valid() const
+    {
+        return fd_ != -1;
+    }
+
+    void start()
+    {
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    int64_t stop()
+    {
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t count = 0;
+        if (read(fd_, &count, sizeof(count)) != sizeof(count))
+        {
+            return -1;
+        }
+        return count;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+int const DOWNLOAD_SIZE = 512 * 1024 * 1024;
+int64_t const UPLOAD_SIZE = int64_t(4) * 1024 * 1024 * 1024;
+int const SIGNAL_WAIT_TIME = 60000;
+
+// Returns the user and system CPU time used by the process so far.
+
+double cpu_seconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+// Resets the peak resident set size of the process.
+
+void reset_peak_rss()
+{
+    ofstream("/proc/self/clear_refs") << "5";
+}
+
+// Returns the peak resident set size of the process in KiB, or -1 if it is not available.
+
+int64_t peak_rss_kib()
+{
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line))
+    {
+        if (line.compare(0, 7, "VmHWM:\t") == 0)
+        {
+            return stoll(line.substr(7));
+        }
+    }
+    return -1;
+}
+
+class TransferBenchmark : public ProviderFixture
+{
+protected:
+    void SetUp() override
+    {
+        tmp_dir_.reset(new QTemporaryDir(TEST_DIR "/bench.XXXXXX"));
+        ASSERT_TRUE(tmp_dir_->isValid());
+        setenv("SF_LOCAL_PROVIDER_ROOT", tmp_dir_->path().toStdString().c_str(), true);
+
+        ProviderFixture::SetUp();
+        runtime_.reset(new qt::Runtime(connection()));
+        acc_ = runtime_->make_test_account(service_connection_->baseService(), object_path());
+    }
+
+    void TearDown() override
+    {
+        runtime_.reset();
+        ProviderFixture::TearDown();
+        tmp_dir_.reset();
+    }
+
+    unique_ptr<QTemporaryDir> tmp_dir_;
+    unique_ptr<qt::Runtime> runtime_;
+    qt::Account acc_;
+};
+
+}  // namespace
+
+TEST(LocalProviderBenchmark, list)
+{
+    QTemporaryDir tmp_dir(TEST_DIR "/bench.XXXXXX");
+    ASSERT_TRUE(tmp_dir.isValid());
+    string const root = tmp_dir.path().toStdString();
+    setenv("SF_LOCAL_PROVIDER_ROOT", root.c_str(), true);
+
+    for (int i = 0; i < NUM_ENTRIES; ++i)
+    {
+        string const path = root + "/file" + to_string(i) + ".txt";
+        int fd = creat(path.c_str(), 0644);
+        ASSERT_NE(-1, fd);
+        close(fd);
+    }
+
+    auto p = make_shared<LocalProvider>();
+
+    // The metadata lane has a single thread (see main()), so the counter that
+    // we create on the lane counts the system calls made by list().
+    auto& pool = provider::ProviderBase::worker_pool();
+    ASSERT_EQ(1, pool.options().metadata_threads);
+    auto counter = pool.submit(provider::WorkerPool::Lane::metadata,
+                               []{ return make_shared<SyscallCounter>(); }).get();
+
+    // Warm up the page cache and the directory snapshot.
+    auto items = get<0>(p->list(root, "", {}, provider::Context()).get());
+    ASSERT_EQ(size_t(NUM_ENTRIES), items.size());
+
+    int64_t best_nsecs = numeric_limits<int64_t>::max();
+    int64_t syscalls = -1;
+    for (int i = 0; i < NUM_RUNS; ++i)
+    {
+        if (counter->is_valid())
+        {
+            counter->start();
+        }
+        auto start_time = chrono::steady_clock::now();
+        items = get<0>(p->list(root, "", {}, provider::Context()).get());
+        auto nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+        if (counter->is_valid())
+        {
+            syscalls = counter->stop();
+        }
+        ASSERT_EQ(size_t(NUM_ENTRIES), items.size());
+        best_nsecs = min(best_nsecs, int64_t(nsecs));
+    }
+
+    cout << "list() of " << NUM_ENTRIES << " entries: " << best_nsecs / NUM_ENTRIES << " ns/item";
+    if (syscalls >= 0)
+    {
+        cout << ", " << double(syscalls) / NUM_ENTRIES << " syscalls/item";
+    }
+    else
+    {
+        cout << ", syscalls/item not available (no access to the raw_syscalls tracepoint)";
+    }
+    cout << endl;
+
+    // Cost per item depending on the requested metadata. A file picker
+    // asks only for the size (which is always returned for files).
+    vector<pair<string, vector<string>>> const key_sets =
+    {
+        { "minimal keys", { metadata::SIZE_IN_BYTES } },
+        { "default keys", {} },
+        { "__ALL__", { metadata::ALL } }
+    };
+    for (auto const& ks : key_sets)
+    {
+        best_nsecs = numeric_limits<int64_t>::max();
+        for (int i = 0; i < NUM_RUNS; ++i)
+        {
+            auto start_time = chrono::steady_clock::now();
+            items = get<0>(p->list(root, "", ks.second, provider::Context()).get());
+            auto nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+            ASSERT_EQ(size_t(NUM_ENTRIES), items.size());
+            best_nsecs = min(best_nsecs, int64_t(nsecs));
+        }
+        cout << "list() with " << ks.first << ": " << best_nsecs / NUM_ENTRIES << " ns/item" << endl;
+    }
+}
+
+// Compares finding the images in a tree with search() against a client walking
+// the tree with list() and filtering the results itself.
+
+TEST(LocalProviderBenchmark, search)
+{
+    int const NUM_DIRS = 100;
+    int const FILES_PER_DIR = NUM_ENTRIES / NUM_DIRS;
+
+    QTemporaryDir tmp_dir(TEST_DIR "/bench.XXXXXX");
+    ASSERT_TRUE(tmp_dir.isValid());
+    string const root = tmp_dir.path().toStdString();
+    setenv("SF_LOCAL_PROVIDER_ROOT", root.c_str(), true);
+
+    int num_images = 0;
+    for (int d = 0; d < NUM_DIRS; ++d)
+    {
+        string const dir = root + "/dir" + to_string(d);
+        ASSERT_EQ(0, mkdir(dir.c_str(), 0755));
+        for (int i = 0; i < FILES_PER_DIR; ++i)
+        {
+            bool const is_image = i % 100 == 0;
+            num_images += is_image;
+            string const path = dir + "/file" + to_string(i) + (is_image ? ".jpg" : ".txt");
+            int fd = creat(path.c_str(), 0644);
+            ASSERT_NE(-1, fd);
+            close(fd);
+        }
+    }
+
+    auto p = make_shared<LocalProvider>();
+    vector<string> const keys{ metadata::CONTENT_TYPE };
+
+    // The first search waits for the initial scan of the tree.
+    auto start_time = chrono::steady_clock::now();
+    auto items = get<0>(p->search(root, "type:image/", "", keys, provider::Context()).get());
+    auto nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+    ASSERT_EQ(size_t(num_images), items.size());
+    cout << "initial index scan of " << NUM_ENTRIES << " entries: " << nsecs / 1000000 << " ms" << endl;
+
+    int64_t best_search_nsecs = numeric_limits<int64_t>::max();
+    for (int i = 0; i < NUM_RUNS; ++i)
+    {
+        start_time = chrono::steady_clock::now();
+        items = get<0>(p->search(root, "type:image/", "", keys, provider::Context()).get());
+        nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+        ASSERT_EQ(size_t(num_images), items.size());
+        best_search_nsecs = min(best_search_nsecs, int64_t(nsecs));
+    }
+
+    int64_t best_list_nsecs = numeric_limits<int64_t>::max();
+    for (int i = 0; i < NUM_RUNS; ++i)
+    {
+        start_time = chrono::steady_clock::now();
+        size_t found = 0;
+        vector<string> folders{ root };
+        while (!folders.empty())
+        {
+            auto const folder = folders.back();
+            folders.pop_back();
+            for (auto const& item : get<0>(p->list(folder, "", keys, provider::Context()).get()))
+            {
+                if (item.type == ItemType::folder)
+                {
+                    folders.push_back(item.item_id);
+                }
+                else if (boost::get<string>(item.metadata.at(metadata::CONTENT_TYPE)).compare(0, 6, "image/") == 0)
+                {
+                    ++found;
+                }
+            }
+        }
+        nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+        ASSERT_EQ(size_t(num_images), found);
+        best_list_nsecs = min(best_list_nsecs, int64_t(nsecs));
+    }
+
+    cout << "search() for " << num_images << " images among " << NUM_ENTRIES << " entries: "
+         << best_search_nsecs / 1000 << " us, recursive list(): " << best_list_nsecs / 1000 << " us ("
+         << NUM_DIRS + 1 << " calls)" << endl;
+}
+
+// Compares walking a tree with walk(), using one and several threads, against
+// a client walking the tree with list().
+
+TEST(LocalProviderBenchmark, walk)
+{
+    int const NUM_DIRS = 100;
+    int const FILES_PER_DIR = NUM_ENTRIES / NUM_DIRS;
+
+    QTemporaryDir tmp_dir(TEST_DIR "/bench.XXXXXX");
+    ASSERT_TRUE(tmp_dir.isValid());
+    string const root = tmp_dir.path().toStdString();
+    setenv("SF_LOCAL_PROVIDER_ROOT", root.c_str(), true);
+
+    for (int d = 0; d < NUM_DIRS; ++d)
+    {
+        string const dir = root + "/dir" + to_string(d % 10) + (d < 10 ? "" : "/sub" + to_string(d));
+        ASSERT_EQ(0, mkdir(dir.c_str(), 0755));
+        for (int i = 0; i < FILES_PER_DIR; ++i)
+        {
+            int fd = creat((dir + "/file" + to_string(i)).c_str(), 0644);
+            ASSERT_NE(-1, fd);
+            close(fd);
+        }
+    }
+    size_t const num_items = NUM_DIRS + NUM_DIRS * FILES_PER_DIR;
+    vector<string> const keys{ metadata::SIZE_IN_BYTES };
+
+    for (char const* threads : { "1", "4" })
+    {
+        setenv("SF_LOCAL_PROVIDER_LIST_THREADS", threads, true);
+        auto p = make_shared<LocalProvider>();
+        int64_t best_nsecs = numeric_limits<int64_t>::max();
+        for (int i = 0; i < NUM_RUNS; ++i)
+        {
+            auto start_time = chrono::steady_clock::now();
+            auto items = get<0>(p->walk(root, 0, "", keys, provider::Context()).get());
+            auto nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+            ASSERT_EQ(num_items, items.size());
+            best_nsecs = min(best_nsecs, int64_t(nsecs));
+        }
+        cout << "walk() of " << num_items << " items with " << threads << " thread(s): "
+             << best_nsecs / 1000 << " us" << endl;
+    }
+    unsetenv("SF_LOCAL_PROVIDER_LIST_THREADS");
+
+    auto p = make_shared<LocalProvider>();
+    int64_t best_nsecs = numeric_limits<int64_t>::max();
+    for (int i = 0; i < NUM_RUNS; ++i)
+    {
+        auto start_time = chrono::steady_clock::now();
+        size_t found = 0;
+        vector<string> folders{ root };
+        while (!folders.empty())
+        {
+            auto const folder = folders.back();
+            folders.pop_back();
+            for (auto const& item : get<0>(p->list(folder, "", keys, provider::Context()).get()))
+            {
+                if (item.type == ItemType::folder)
+                {
+                    folders.push_back(item.item_id);
+                }
+                ++found;
+            }
+        }
+        auto nsecs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_time).count();
+        ASSERT_EQ(num_items, found);
+        best_nsecs = min(best_nsecs, int64_t(nsecs));
+    }
+    cout << "recursive list() of " << num_items << " items: " << best_nsecs / 1000 << " us ("
+         << NUM_DIRS + 1 << " calls)" << endl;
+}
+
+// Compares downloads through the event loop with zero-copy downloads.
+// The CPU time includes the client reading the data, which is the same for both.
+
+TEST_F(TransferBenchmark, download)
+{
+    using namespace unity::storage::qt;
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    string const path = tmp_dir_->path().toStdString() + "/large_file";
+    {
+        string const chunk(1024 * 1024, 'x');
+        int fd = creat(path.c_str(), 0644);
+        ASSERT_NE(-1, fd);
+        for (int i = 0; i < DOWNLOAD_SIZE / int(chunk.size()); ++i)
+        {
+            ASSERT_EQ(ssize_t(chunk.size()), write(fd, chunk.data(), chunk.size()));
+        }
+        close(fd);
+    }
+
+    unique_ptr<ItemJob> job(acc_.get(QString::fromStdString(path)));
+    QSignalSpy job_spy(job.get(), &ItemJob::statusChanged);
+    ASSERT_TRUE(job_spy.wait(SIGNAL_WAIT_TIME));
+    ASSERT_EQ(ItemJob::Finished, job->status());
+    auto file = job->item();
+
+    for (auto const mode : { "0", "1" })
+    {
+        setenv("SF_LOCAL_PROVIDER_ZERO_COPY", mode, true);
+
+        auto const start_time = chrono::steady_clock::now();
+        auto const start_cpu = cpu_seconds();
+
+        unique_ptr<Downloader> downloader(file.createDownloader(Item::ErrorIfConflict));
+        int64_t n_read = 0;
+        QObject::connect(downloader.get(), &QIODevice::readyRead,
+                         [&]{ n_read += downloader->readAll().size(); });
+        QSignalSpy read_finished_spy(downloader.get(), &QIODevice::readChannelFinished);
+        ASSERT_TRUE(read_finished_spy.wait(SIGNAL_WAIT_TIME));
+        QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+        downloader->close();
+        while (downloader->status() == Downloader::Ready)
+        {
+            ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+        }
+        ASSERT_EQ(Downloader::Finished, downloader->status());
+        ASSERT_EQ(int64_t(DOWNLOAD_SIZE), n_read);
+
+        auto const secs = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+        auto const cpu = cpu_seconds() - start_cpu;
+        double const gib = double(DOWNLOAD_SIZE) / (1024 * 1024 * 1024);
+        cout << "download() " << (string(mode) == "1" ? "zero-copy" : "event loop") << ": "
+             << gib * 1024 / secs << " MiB/s, " << cpu / gib << " CPU s/GiB" << endl;
+    }
+}
+
+// Compares uploads through the event loop with zero-copy uploads. The client
+// writes at most a few chunks ahead, so the peak RSS is mostly the provider's.
+
+TEST_F(TransferBenchmark, upload)
+{
+    using namespace unity::storage::qt;
+
+    struct statvfs st;
+    ASSERT_EQ(0, statvfs(tmp_dir_->path().toStdString().c_str(), &st));
+    if (int64_t(st.f_bavail) * int64_t(st.f_frsize) < 2 * UPLOAD_SIZE)
+    {
+        cout << "upload(): skipped, not enough space in " << tmp_dir_->path().toStdString() << endl;
+        return;
+    }
+
+    set_provider(unique_ptr<provider::ProviderBase>(new LocalProvider));
+
+    string const path = tmp_dir_->path().toStdString() + "/large_file";
+    int fd = creat(path.c_str(), 0644);
+    ASSERT_NE(-1, fd);
+    close(fd);
+
+    unique_ptr<ItemJob> job(acc_.get(QString::fromStdString(path)));
+    QSignalSpy job_spy(job.get(), &ItemJob::statusChanged);
+    ASSERT_TRUE(job_spy.wait(SIGNAL_WAIT_TIME));
+    ASSERT_EQ(ItemJob::Finished, job->status());
+    auto file = job->item();
+
+    string const chunk(1024 * 1024, 'x');
+    for (auto const mode : { "0", "1" })
+    {
+        setenv("SF_LOCAL_PROVIDER_ZERO_COPY", mode, true);
+        reset_peak_rss();
+
+        auto const start_time = chrono::steady_clock::now();
+
+        unique_ptr<Uploader> uploader(file.createUploader(Item::IgnoreConflict, UPLOAD_SIZE));
+        int64_t n_written = 0;
+        auto write_more = [&]
+        {
+            while (n_written < UPLOAD_SIZE && uploader->bytesToWrite() < 4 * int64_t(chunk.size()))
+            {
+                ASSERT_EQ(int64_t(chunk.size()), uploader->write(chunk.data(), chunk.size()));
+                n_written += chunk.size();
+            }
+            if (n_written == UPLOAD_SIZE && uploader->isOpen())
+            {
+                uploader->close();
+            }
+        };
+        QObject::connect(uploader.get(), &QIODevice::bytesWritten, write_more);
+        write_more();
+
+        QSignalSpy status_spy(uploader.get(), &Uploader::statusChanged);
+        while (uploader->status() == Uploader::Loading || uploader->status() == Uploader::Ready)
+        {
+            ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+        }
+        ASSERT_EQ(Uploader::Finished, uploader->status()) << uploader->error().errorString().toStdString();
+        ASSERT_EQ(UPLOAD_SIZE, uploader->item().sizeInBytes());
+
+        auto const secs = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+        auto const rss = peak_rss_kib();
+        cout << "upload() " << (string(mode) == "1" ? "zero-copy" : "event loop") << ": "
+             << double(UPLOAD_SIZE) / (1024 * 1024) / secs << " MiB/s, peak RSS ";
+        if (rss >= 0)
+        {
+            cout << rss / 1024 << " MiB" << endl;
+        }
+        else
+        {
+            cout << "not available" << endl;
+        }
+    }
+}
+
+// Compares the durability policies for many small concurrent uploads. The commit latency
+// is the time from the client closing an uploader until the upload is finished.
+
+TEST_F(TransferBenchmark, upload_durability)
+{
+    using namespace unity::storage::qt;
+
+    int const num_files = 2048;
+    int const concurrency = 32;
+    string const contents(16 * 1024, 'x');
+
+    for (auto const durability : { "none", "data", "full" })
+    {
+        setenv("SF_LOCAL_PROVIDER_DURABILITY", durability, true);
+        auto local_provider = new LocalProvider;
+        set_provider(unique_ptr<provider::ProviderBase>(local_provider));
+
+        unique_ptr<ItemJob> job(acc_.get(tmp_dir_->path()));
+        QSignalSpy job_spy(job.get(), &ItemJob::statusChanged);
+        ASSERT_TRUE(job_spy.wait(SIGNAL_WAIT_TIME));
+        ASSERT_EQ(ItemJob::Finished, job->status());
+        auto folder = job->item();
+
+        chrono::nanoseconds total_latency(0);
+        chrono::nanoseconds max_latency(0);
+        auto const start_time = chrono::steady_clock::now();
+
+        for (int first = 0; first < num_files; first += concurrency)
+        {
+            vector<unique_ptr<Uploader>> uploaders;
+            for (int i = first; i < first + concurrency; ++i)
+            {
+                auto name = QString::fromStdString(string(durability) + "-" + to_string(i));
+                uploaders.emplace_back(folder.createFile(name, Item::IgnoreConflict, contents.size(), ""));
+            }
+            for (auto const& uploader : uploaders)
+            {
+                QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+                while (uploader->status() == Uploader::Loading)
+                {
+                    ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+                }
+                ASSERT_EQ(Uploader::Ready, uploader->status()) << uploader->error().errorString().toStdString();
+                ASSERT_EQ(int64_t(contents.size()), uploader->write(contents.data(), contents.size()));
+            }
+
+            // Close all uploaders at once, so their commits can be batched.
+            auto const close_time = chrono::steady_clock::now();
+            vector<chrono::steady_clock::time_point> finish_times(uploaders.size());
+            for (size_t i = 0; i < uploaders.size(); ++i)
+            {
+                QObject::connect(uploaders[i].get(), &Uploader::statusChanged,
+                                 [&finish_times, i]{ finish_times[i] = chrono::steady_clock::now(); });
+                uploaders[i]->close();
+            }
+            for (auto const& uploader : uploaders)
+            {
+                QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+                while (uploader->status() == Uploader::Ready)
+                {
+                    ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+                }
+                ASSERT_EQ(Uploader::Finished, uploader->status()) << uploader->error().errorString().toStdString();
+            }
+            for (auto const& t : finish_times)
+            {
+                auto latency = chrono::duration_cast<chrono::nanoseconds>(t - close_time);
+                total_latency += latency;
+                max_latency = max(max_latency, latency);
+            }
+        }
+
+        auto const secs = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+        auto const stats = local_provider->group_commit().stats();
+        cout << "upload() durability " << durability << ": " << num_files / secs << " files/s, commit latency "
+             << total_latency.count() / num_files / 1000 << " us mean, " << max_latency.count() / 1000 << " us max, "
+             << double(stats.files) / max(stats.batches, int64_t(1)) << " files/batch, "
+             << stats.syncfs_calls << " syncfs() calls" << endl;
+    }
+    unsetenv("SF_LOCAL_PROVIDER_DURABILITY");
+}
+
+int main(int argc, char** argv)
+{
+    setenv("LANG", "C", true);
+    setenv("SF_PROVIDER_METADATA_THREADS", "1", true);
+    setenv("SF_LOCAL_PROVIDER_PAGE_SIZE", "0", true);
+
+    QCoreApplication app(argc, argv);
+
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
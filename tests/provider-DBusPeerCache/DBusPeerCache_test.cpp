@@ -30,14 +30,17 @@
 #include <QCoreApplication>
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
+#include <QElapsedTimer>
 #include <QSignalSpy>
 
 #include <unistd.h>
 #include <sys/types.h>
+#include <chrono>
 #include <exception>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <thread>
 
 using namespace std;
 using namespace unity::storage::provider;
@@ -137,6 +140,192 @@ TEST_F(DBusPeerCacheTest, get_credentials)
     EXPECT_EQ(dbus_->accounts_service_process().processId(), creds.pid);
 }
 
+namespace
+{
+
+QString accounts_service_name(QDBusConnection const& conn)
+{
+    QDBusReply<QString> reply = conn.interface()->serviceOwner("com.ubuntu.OnlineAccounts.Manager");
+    return reply.isValid() ? reply.value() : QString();
+}
+
+// Process events until pred() returns true or the timeout expires.
+
+template<typename Pred>
+bool process_until(Pred pred, int timeout_ms = 5000)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!pred())
+    {
+        if (timer.elapsed() > timeout_ms)
+        {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return true;
+}
+
+}  // namespace
+
+TEST_F(DBusPeerCacheTest, stats)
+{
+    auto peer_name = accounts_service_name(connection());
+    ASSERT_FALSE(peer_name.isEmpty());
+
+    internal::DBusPeerCache cache(connection(), 10, chrono::seconds(60));
+
+    // The second lookup joins the request of the first one.
+    auto f1 = cache.get(peer_name);
+    auto f2 = cache.get(peer_name);
+    EXPECT_EQ(1, cache.stats().in_flight);
+    EXPECT_TRUE(wait_on_future(f1).valid);
+    EXPECT_TRUE(f2.get().valid);
+
+    auto f3 = cache.get(peer_name);
+    ASSERT_TRUE(f3.is_ready());
+    EXPECT_EQ(dbus_->accounts_service_process().processId(), f3.get().pid);
+
+    auto s = cache.stats();
+    EXPECT_EQ(1, s.hits);
+    EXPECT_EQ(1, s.misses);
+    EXPECT_EQ(1, s.joined);
+    EXPECT_EQ(0, s.in_flight);
+    EXPECT_EQ(1, cache.size());
+}
+
+TEST_F(DBusPeerCacheTest, lru_eviction)
+{
+    auto peer1 = accounts_service_name(connection());
+    auto peer2 = connection().baseService();
+    ASSERT_FALSE(peer1.isEmpty());
+
+    internal::DBusPeerCache cache(connection(), 1, chrono::seconds(60));
+
+    auto f = cache.get(peer1);
+    EXPECT_TRUE(wait_on_future(f).valid);
+    f = cache.get(peer2);
+    auto creds = wait_on_future(f);
+    EXPECT_TRUE(creds.valid);
+    EXPECT_EQ(getpid(), creds.pid);
+    EXPECT_EQ(1, cache.size());
+    EXPECT_EQ(1, cache.stats().evicted);
+
+    // peer2 is still cached, peer1 is not.
+    EXPECT_TRUE(cache.get(peer2).is_ready());
+    f = cache.get(peer1);
+    EXPECT_FALSE(f.is_ready());
+    EXPECT_TRUE(wait_on_future(f).valid);
+    EXPECT_EQ(3, cache.stats().misses);
+}
+
+TEST_F(DBusPeerCacheTest, ttl)
+{
+    auto peer_name = accounts_service_name(connection());
+    ASSERT_FALSE(peer_name.isEmpty());
+
+    internal::DBusPeerCache cache(connection(), 10, chrono::milliseconds(1));
+
+    auto f = cache.get(peer_name);
+    EXPECT_TRUE(wait_on_future(f).valid);
+    this_thread::sleep_for(chrono::milliseconds(5));
+    f = cache.get(peer_name);
+    EXPECT_FALSE(f.is_ready());
+    EXPECT_TRUE(wait_on_future(f).valid);
+
+    auto s = cache.stats();
+    EXPECT_EQ(1, s.expired);
+    EXPECT_EQ(2, s.misses);
+    EXPECT_EQ(0, s.hits);
+}
+
+TEST_F(DBusPeerCacheTest, disabled)
+{
+    auto peer_name = accounts_service_name(connection());
+    ASSERT_FALSE(peer_name.isEmpty());
+
+    internal::DBusPeerCache cache(connection(), 0, chrono::seconds(60));
+
+    auto f = cache.get(peer_name);
+    EXPECT_TRUE(wait_on_future(f).valid);
+    EXPECT_EQ(0, cache.size());
+    f = cache.get(peer_name);
+    EXPECT_FALSE(f.is_ready());
+    EXPECT_TRUE(wait_on_future(f).valid);
+    EXPECT_EQ(2, cache.stats().misses);
+}
+
+TEST_F(DBusPeerCacheTest, invalidate_on_disconnect)
+{
+    internal::DBusPeerCache cache(connection(), 10, chrono::seconds(60));
+
+    QString const conn_name = "peer-cache-test";
+    QString peer_name;
+    {
+        auto conn = QDBusConnection::connectToBus(dbus_->busAddress(), conn_name);
+        ASSERT_TRUE(conn.isConnected());
+        peer_name = conn.baseService();
+    }
+    auto f = cache.get(peer_name);
+    EXPECT_TRUE(wait_on_future(f).valid);
+    EXPECT_EQ(1, cache.size());
+
+    QDBusConnection::disconnectFromBus(conn_name);
+    ASSERT_TRUE(process_until([&cache]{ return cache.stats().invalidated == 1; }));
+    EXPECT_EQ(0, cache.size());
+}
+
+TEST_F(DBusPeerCacheTest, evicted_peer_not_watched)
+{
+    internal::DBusPeerCache cache(connection(), 1, chrono::seconds(60));
+
+    QString const evicted_conn = "peer-cache-evicted";
+    QString const cached_conn = "peer-cache-cached";
+    QString evicted_peer;
+    QString cached_peer;
+    {
+        auto conn = QDBusConnection::connectToBus(dbus_->busAddress(), evicted_conn);
+        ASSERT_TRUE(conn.isConnected());
+        evicted_peer = conn.baseService();
+        conn = QDBusConnection::connectToBus(dbus_->busAddress(), cached_conn);
+        ASSERT_TRUE(conn.isConnected());
+        cached_peer = conn.baseService();
+    }
+    auto f = cache.get(evicted_peer);
+    EXPECT_TRUE(wait_on_future(f).valid);
+    f = cache.get(cached_peer);
+    EXPECT_TRUE(wait_on_future(f).valid);
+    EXPECT_EQ(1, cache.stats().evicted);
+
+    // Only the peer that is still cached is invalidated. The bus reports the
+    // disconnects in order, so the evicted peer's would have arrived first.
+    QDBusConnection::disconnectFromBus(evicted_conn);
+    QDBusConnection::disconnectFromBus(cached_conn);
+    ASSERT_TRUE(process_until([&cache]{ return cache.size() == 0; }));
+    EXPECT_EQ(1, cache.stats().invalidated);
+}
+
+TEST_F(DBusPeerCacheTest, prefetch)
+{
+    auto peer_name = accounts_service_name(connection());
+    ASSERT_FALSE(peer_name.isEmpty());
+
+    internal::DBusPeerCache cache(connection(), 10, chrono::seconds(60));
+
+    cache.prefetch(peer_name);
+    cache.prefetch(peer_name);  // No-op, request is in flight already.
+    EXPECT_EQ(1, cache.stats().in_flight);
+    auto f = cache.get(peer_name);
+    EXPECT_TRUE(wait_on_future(f).valid);
+    cache.prefetch(peer_name);  // No-op, credentials are cached.
+
+    auto s = cache.stats();
+    EXPECT_EQ(1, s.misses);
+    EXPECT_EQ(1, s.joined);
+    EXPECT_EQ(0, s.in_flight);
+}
+
 int main(int argc, char **argv)
 {
     QCoreApplication app(argc, argv);
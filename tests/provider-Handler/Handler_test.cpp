@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/internal/dbus_error.h>
+#include <unity/storage/provider/ProviderBase.h>
+#include <unity/storage/provider/internal/RequestStats.h>
+
+#include "../provider-ProviderInterface/TestProvider.h"
+
+#include <utils/ProviderFixture.h>
+#include <utils/gtest_printer.h>
+
+#include <gtest/gtest.h>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+using namespace std;
+using unity::storage::ItemType;
+using unity::storage::provider::Context;
+using unity::storage::provider::DispatchMode;
+using unity::storage::provider::Item;
+using unity::storage::provider::ProviderBase;
+using unity::storage::provider::internal::RequestStats;
+
+namespace
+{
+
+const QString PROVIDER_ERROR = unity::storage::internal::DBUS_ERROR_PREFIX;
+
+// Returns metadata from another thread, so the future is not ready when the runtime gets it.
+
+class AsyncProvider : public TestProvider
+{
+public:
+    boost::future<Item> metadata(string const& item_id,
+                                 vector<string> const& /*keys*/,
+                                 Context const& /*ctx*/) override
+    {
+        auto p = make_shared<boost::promise<Item>>();
+        thread([p, item_id]
+        {
+            this_thread::sleep_for(chrono::milliseconds(10));
+            p->set_value(Item{item_id, {}, "Root", "etag", ItemType::root, {}});
+        }).detach();
+        return p->get_future();
+    }
+};
+
+// Once hold() has been called, holds on to metadata requests until release() is called,
+// so identical requests overlap.
+
+class GatedProvider : public TestProvider
+{
+public:
+    boost::future<Item> metadata(string const& item_id,
+                                 vector<string> const& /*keys*/,
+                                 Context const& /*ctx*/) override
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (!held_)
+        {
+            return boost::make_ready_future(Item{item_id, {}, "Root", "etag", ItemType::root, {}});
+        }
+        ++calls_;
+        pending_.emplace_back(item_id, boost::promise<Item>());
+        return pending_.back().second.get_future();
+    }
+
+    void hold()
+    {
+        lock_guard<mutex> lock(mutex_);
+        held_ = true;
+    }
+
+    int calls() const
+    {
+        lock_guard<mutex> lock(mutex_);
+        return calls_;
+    }
+
+    void release()
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (auto& p : pending_)
+        {
+            p.second.set_value(Item{p.first, {}, "Root", "etag", ItemType::root, {}});
+        }
+        pending_.clear();
+    }
+
+private:
+    mutable mutex mutex_;
+    bool held_ = false;
+    int calls_ = 0;
+    vector<pair<string, boost::promise<Item>>> pending_;
+};
+
+template<typename Pred>
+bool process_until(Pred pred, int timeout_ms = 5000)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!pred())
+    {
+        if (timer.elapsed() > timeout_ms)
+        {
+            return false;
+        }
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return true;
+}
+
+void print_breakdown(string const& method)
+{
+    auto const totals = RequestStats::instance().totals(method);
+    auto const& t = totals.timings;
+    auto avg = [&totals](int64_t nsecs)
+    {
+        return nsecs / 1000.0 / max(totals.requests, int64_t(1));
+    };
+    cout << method << ": " << totals.requests << " requests, " << totals.fast_path << " on the fast path" << endl
+         << fixed << setprecision(1)
+         << "    authenticate: " << setw(8) << avg(t.authenticate_nsecs) << " us" << endl
+         << "    peer:         " << setw(8) << avg(t.peer_nsecs) << " us" << endl
+         << "    dispatch:     " << setw(8) << avg(t.dispatch_nsecs) << " us" << endl
+         << "    provider:     " << setw(8) << avg(t.provider_nsecs) << " us" << endl
+         << "    reply:        " << setw(8) << avg(t.reply_nsecs) << " us" << endl;
+}
+
+}  // namespace
+
+class HandlerTest : public ProviderFixture
+{
+protected:
+    void SetUp() override
+    {
+        ProviderFixture::SetUp();
+        client_.reset(new ProviderClient(bus_name(), object_path(), connection()));
+        RequestStats::instance().reset();
+    }
+
+    void TearDown() override
+    {
+        client_.reset();
+        ProviderFixture::TearDown();
+    }
+
+    // The first request from a client has to wait for the peer credentials.
+    void warm_up()
+    {
+        auto reply = client_->Metadata("root_id", QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        RequestStats::instance().reset();
+    }
+
+    // Sends identical Metadata requests plus one with different keys while the provider
+    // holds on to them. Only two provider calls should be made.
+    void check_coalescing(GatedProvider* provider)
+    {
+        warm_up();
+        provider->hold();
+
+        int const num_requests = 5;
+        vector<QDBusPendingReply<unity::storage::internal::ItemMetadata>> replies;
+        for (int i = 0; i < num_requests; ++i)
+        {
+            replies.push_back(client_->Metadata("root_id", QList<QString>()));
+        }
+        auto other_reply = client_->Metadata("root_id", QList<QString>{"size_in_bytes"});
+
+        ASSERT_TRUE(process_until([provider]
+        {
+            return provider->calls() == 2 &&
+                   RequestStats::instance().totals("Metadata").coalesced == num_requests - 1;
+        }));
+        provider->release();
+        for (auto& reply : replies)
+        {
+            wait_for(reply);
+            ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+            EXPECT_EQ("root_id", reply.value().item_id);
+        }
+        wait_for(other_reply);
+        ASSERT_TRUE(other_reply.isValid()) << other_reply.error().message().toStdString();
+        EXPECT_EQ(2, provider->calls());
+
+        auto totals = RequestStats::instance().totals("Metadata");
+        EXPECT_EQ(num_requests + 1, totals.requests);
+        EXPECT_EQ(num_requests - 1, totals.coalesced);
+
+        // Results are not cached once the call has completed.
+        auto reply = client_->Metadata("root_id", QList<QString>());
+        ASSERT_TRUE(process_until([provider] { return provider->calls() == 3; }));
+        provider->release();
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_EQ(num_requests - 1, RequestStats::instance().totals("Metadata").coalesced);
+    }
+
+    std::unique_ptr<ProviderClient> client_;
+};
+
+TEST_F(HandlerTest, fast_path)
+{
+    set_provider(unique_ptr<ProviderBase>(new TestProvider));
+    warm_up();
+
+    for (int i = 0; i < 10; ++i)
+    {
+        auto reply = client_->Metadata("root_id", QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        EXPECT_EQ("root_id", reply.value().item_id);
+    }
+    auto totals = RequestStats::instance().totals("Metadata");
+    EXPECT_EQ(10, totals.requests);
+    EXPECT_EQ(10, totals.fast_path);
+    EXPECT_GT(totals.timings.provider_nsecs, 0);
+}
+
+TEST_F(HandlerTest, fast_path_error)
+{
+    set_provider(unique_ptr<ProviderBase>(new TestProvider));
+    warm_up();
+
+    auto reply = client_->Metadata("no_such_id", QList<QString>());
+    wait_for(reply);
+    ASSERT_FALSE(reply.isValid());
+    EXPECT_EQ(PROVIDER_ERROR + "NotExistsException", reply.error().name());
+    EXPECT_EQ(1, RequestStats::instance().totals("Metadata").fast_path);
+}
+
+TEST_F(HandlerTest, slow_provider)
+{
+    set_provider(unique_ptr<ProviderBase>(new AsyncProvider));
+    warm_up();
+
+    auto reply = client_->Metadata("root_id", QList<QString>());
+    wait_for(reply);
+    ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    EXPECT_EQ("root_id", reply.value().item_id);
+
+    auto totals = RequestStats::instance().totals("Metadata");
+    EXPECT_EQ(1, totals.requests);
+    EXPECT_EQ(0, totals.fast_path);
+    EXPECT_GE(totals.timings.provider_nsecs, 10000000);
+}
+
+TEST_F(HandlerTest, fast_path_thread_pool)
+{
+    set_provider(unique_ptr<ProviderBase>(new TestProvider), 2, DispatchMode::thread_pool);
+    warm_up();
+
+    auto reply = client_->Lookup("root_id", "Child", QList<QString>());
+    wait_for(reply);
+    ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+    ASSERT_EQ(1, reply.value().size());
+    EXPECT_EQ("Child", reply.value()[0].name);
+    EXPECT_EQ(1, RequestStats::instance().totals("Lookup").fast_path);
+}
+
+TEST_F(HandlerTest, coalesce)
+{
+    auto provider = new GatedProvider;
+    set_provider(unique_ptr<ProviderBase>(provider));
+    check_coalescing(provider);
+}
+
+TEST_F(HandlerTest, coalesce_thread_pool)
+{
+    auto provider = new GatedProvider;
+    set_provider(unique_ptr<ProviderBase>(provider), 2, DispatchMode::thread_pool);
+    check_coalescing(provider);
+}
+
+TEST_F(HandlerTest, latency_breakdown)
+{
+    set_provider(unique_ptr<ProviderBase>(new TestProvider));
+    warm_up();
+
+    int const num_requests = 500;
+    for (int i = 0; i < num_requests; ++i)
+    {
+        auto metadata_reply = client_->Metadata("root_id", QList<QString>());
+        auto lookup_reply = client_->Lookup("root_id", "Child", QList<QString>());
+        wait_for(metadata_reply);
+        wait_for(lookup_reply);
+        ASSERT_TRUE(metadata_reply.isValid()) << metadata_reply.error().message().toStdString();
+        ASSERT_TRUE(lookup_reply.isValid()) << lookup_reply.error().message().toStdString();
+    }
+    EXPECT_EQ(num_requests, RequestStats::instance().totals("Metadata").fast_path);
+    EXPECT_EQ(num_requests, RequestStats::instance().totals("Lookup").fast_path);
+    print_breakdown("Metadata");
+    print_breakdown("Lookup");
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    qDBusRegisterMetaType<unity::storage::internal::ItemMetadata>();
+    qDBusRegisterMetaType<QList<unity::storage::internal::ItemMetadata>>();
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/internal/MainLoopExecutor.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#include <gtest/gtest.h>
+#pragma GCC diagnostic pop
+
+#include <boost/thread/future.hpp>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEvent>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace unity::storage::provider::internal;
+
+namespace
+{
+
+// Process events until pred() returns true or the timeout expires.
+
+template<typename Pred>
+bool process_until(Pred pred, int timeout_ms = 10000)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!pred())
+    {
+        if (timer.elapsed() > timeout_ms)
+        {
+            return false;
+        }
+        QCoreApplication::processEvents();
+    }
+    return true;
+}
+
+// Records how many closures had run by the time it receives an event.
+
+class Probe : public QObject
+{
+public:
+    Probe(int const& count)
+        : count_(count)
+    {
+    }
+
+    bool event(QEvent* e) override
+    {
+        if (e->type() != QEvent::User)
+        {
+            return QObject::event(e);
+        }
+        seen_ = count_;
+        return true;
+    }
+
+    int seen_ = -1;
+
+private:
+    int const& count_;
+};
+
+}  // namespace
+
+TEST(MainLoopExecutor, runs_in_order)
+{
+    auto& executor = MainLoopExecutor::instance();
+    auto const before = executor.stats();
+
+    int const num_closures = 1000;
+    vector<int> order;
+    for (int i = 0; i < num_closures; ++i)
+    {
+        executor.submit([&order, i]{ order.push_back(i); });
+    }
+    EXPECT_TRUE(order.empty());  // Nothing runs until we return to the event loop.
+    ASSERT_TRUE(process_until([&]{ return order.size() == size_t(num_closures); }));
+    for (int i = 0; i < num_closures; ++i)
+    {
+        ASSERT_EQ(i, order[i]);
+    }
+
+    // Closures are run in batches, not one event per closure.
+    auto const after = executor.stats();
+    EXPECT_EQ(num_closures, after.executed - before.executed);
+    auto const wakeups = after.wakeups - before.wakeups;
+    EXPECT_GE(wakeups, num_closures / MainLoopExecutor::MAX_BATCH);
+    EXPECT_LE(wakeups, num_closures / MainLoopExecutor::MAX_BATCH + 2);
+    EXPECT_EQ(MainLoopExecutor::MAX_BATCH, after.max_batch);
+    EXPECT_GE(after.max_latency_nsecs, 0);
+    EXPECT_GE(after.total_latency_nsecs - before.total_latency_nsecs, 0);
+}
+
+TEST(MainLoopExecutor, batch_cap_lets_other_events_run)
+{
+    auto& executor = MainLoopExecutor::instance();
+
+    int count = 0;
+    int const num_closures = 4 * MainLoopExecutor::MAX_BATCH;
+    for (int i = 0; i < num_closures; ++i)
+    {
+        executor.submit([&count]{ ++count; });
+    }
+    Probe probe(count);
+    QCoreApplication::postEvent(&probe, new QEvent(QEvent::User));
+
+    ASSERT_TRUE(process_until([&]{ return count == num_closures && probe.seen_ != -1; }));
+    EXPECT_GT(probe.seen_, 0);
+    EXPECT_LT(probe.seen_, num_closures);
+}
+
+TEST(MainLoopExecutor, multiple_producers)
+{
+    auto& executor = MainLoopExecutor::instance();
+
+    int const num_threads = 4;
+    int const per_thread = 20000;
+    vector<vector<int>> seen(num_threads);  // Only touched by the main thread.
+    atomic<int> count(0);
+
+    vector<thread> producers;
+    for (int t = 0; t < num_threads; ++t)
+    {
+        producers.emplace_back([&, t]
+        {
+            for (int i = 0; i < per_thread; ++i)
+            {
+                executor.submit([&, t, i]
+                {
+                    seen[t].push_back(i);
+                    ++count;
+                });
+            }
+        });
+    }
+    bool const done = process_until([&]{ return count == num_threads * per_thread; });
+    for (auto& p : producers)
+    {
+        p.join();
+    }
+    ASSERT_TRUE(done);
+
+    // Closures from the same thread run in the order in which they were submitted.
+    for (int t = 0; t < num_threads; ++t)
+    {
+        ASSERT_EQ(size_t(per_thread), seen[t].size());
+        for (int i = 0; i < per_thread; ++i)
+        {
+            ASSERT_EQ(i, seen[t][i]);
+        }
+    }
+}
+
+TEST(MainLoopExecutor, continuation)
+{
+    boost::promise<int> p;
+    auto f = p.get_future();
+    auto main_id = this_thread::get_id();
+    thread::id continuation_id;
+    auto f2 = f.then(EXEC_IN_MAIN [&continuation_id](decltype(f) f)
+    {
+        continuation_id = this_thread::get_id();
+        return f.get() + 1;
+    });
+    thread t([&p]{ p.set_value(41); });
+    t.join();
+
+    ASSERT_TRUE(process_until([&]{ return f2.is_ready(); }));
+    EXPECT_EQ(42, f2.get());
+    EXPECT_EQ(main_id, continuation_id);
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
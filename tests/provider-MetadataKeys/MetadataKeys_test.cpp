@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/MetadataKeys.h>
+#include <unity/storage/common.h>
+
+#include <gtest/gtest.h>
+
+using namespace unity::storage;
+using namespace unity::storage::provider;
+using namespace std;
+
+TEST(MetadataKeys, requested_keys)
+{
+    MetadataKeys keys({metadata::CONTENT_TYPE}, {metadata::SIZE_IN_BYTES});
+    EXPECT_FALSE(keys.all());
+    EXPECT_TRUE(keys.contains(metadata::CONTENT_TYPE));
+    EXPECT_FALSE(keys.contains(metadata::SIZE_IN_BYTES));
+    EXPECT_FALSE(keys.contains(metadata::WRITABLE));
+}
+
+TEST(MetadataKeys, default_keys)
+{
+    MetadataKeys keys({}, {metadata::SIZE_IN_BYTES, metadata::WRITABLE});
+    EXPECT_FALSE(keys.all());
+    EXPECT_TRUE(keys.contains(metadata::SIZE_IN_BYTES));
+    EXPECT_TRUE(keys.contains(metadata::WRITABLE));
+    EXPECT_FALSE(keys.contains(metadata::CONTENT_TYPE));
+
+    MetadataKeys no_defaults({}, {});
+    EXPECT_FALSE(no_defaults.all());
+    EXPECT_FALSE(no_defaults.contains(metadata::SIZE_IN_BYTES));
+}
+
+TEST(MetadataKeys, all)
+{
+    MetadataKeys keys({metadata::ALL}, {metadata::SIZE_IN_BYTES});
+    EXPECT_TRUE(keys.all());
+    EXPECT_TRUE(keys.contains(metadata::SIZE_IN_BYTES));
+    EXPECT_TRUE(keys.contains(metadata::CONTENT_TYPE));
+    EXPECT_TRUE(keys.contains("mcloud:something"));
+
+    // ALL wins even if other keys are present.
+    MetadataKeys mixed({metadata::WRITABLE, metadata::ALL}, {});
+    EXPECT_TRUE(mixed.all());
+    EXPECT_TRUE(mixed.contains(metadata::CONTENT_TYPE));
+
+    // ALL can be the default.
+    MetadataKeys dflt({}, {metadata::ALL});
+    EXPECT_TRUE(dflt.all());
+}
+
+int main(int argc, char** argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
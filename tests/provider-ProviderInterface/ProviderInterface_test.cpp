@@ -40,14 +40,18 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <exception>
+#include <chrono>
+#include <iostream>
 #include <memory>
 #include <mutex>
 #include <stdexcept>
+#include <thread>
 
 using namespace std;
 using unity::storage::ItemType;
 using unity::storage::provider::ProviderBase;
 using unity::storage::provider::Context;
+using unity::storage::provider::DispatchMode;
 using unity::storage::provider::Item;
 using unity::storage::provider::ItemList;
 using unity::storage::provider::PasswordCredentials;
@@ -876,6 +880,159 @@ TEST_F(ProviderInterfaceTest, always_unauthorized)
     EXPECT_EQ(PROVIDER_ERROR + "UnauthorizedException", reply.error().name());
 }
 
+TEST_F(ProviderInterfaceTest, thread_pool_dispatch)
+{
+    set_provider(unique_ptr<ProviderBase>(new ReauthenticateProvider), 10, DispatchMode::thread_pool);
+
+    auto roots_reply = client_->Roots(QList<QString>());
+    auto metadata_reply = client_->Metadata("item_id", QList<QString>());
+    auto lookup_reply = client_->Lookup("parent_id", "name", QList<QString>());
+    wait_for(roots_reply);
+    wait_for(metadata_reply);
+    wait_for(lookup_reply);
+
+    ASSERT_TRUE(roots_reply.isValid()) << roots_reply.error().message().toStdString();
+    EXPECT_EQ("interactive", roots_reply.value()[0].name);
+    // Retry after UnauthorizedException still works if the provider is called from a dispatch thread.
+    ASSERT_TRUE(metadata_reply.isValid()) << metadata_reply.error().message().toStdString();
+    EXPECT_EQ("refresh", metadata_reply.value().name);
+    ASSERT_FALSE(lookup_reply.isValid());
+    EXPECT_EQ(PROVIDER_ERROR + "UnauthorizedException", lookup_reply.error().name());
+}
+
+namespace
+{
+
+class FolderOrderProvider : public TestProvider
+{
+public:
+    boost::future<Item> create_folder(string const& parent_id,
+                                      string const& name,
+                                      vector<string> const& /*metadata_keys*/,
+                                      Context const& /*ctx*/) override
+    {
+        {
+            lock_guard<mutex> lock(mutex_);
+            names_.push_back(name);
+        }
+        Item item = {name + "_id", { parent_id }, name, "etag", ItemType::folder, {}};
+        return boost::make_ready_future(item);
+    }
+
+    vector<string> names() const
+    {
+        lock_guard<mutex> lock(mutex_);
+        return names_;
+    }
+
+private:
+    mutable mutex mutex_;
+    vector<string> names_;
+};
+
+}  // namespace
+
+TEST_F(ProviderInterfaceTest, thread_pool_dispatch_ordering)
+{
+    auto provider = new FolderOrderProvider;
+    set_provider(unique_ptr<ProviderBase>(provider), 2, DispatchMode::thread_pool);
+
+    // Mutating requests are dispatched from a single thread per account, so
+    // the provider methods are called in the order in which the requests were sent.
+    int const num_folders = 20;
+    vector<QDBusPendingReply<unity::storage::internal::ItemMetadata>> replies;
+    vector<string> expected;
+    for (int i = 0; i < num_folders; ++i)
+    {
+        auto name = "folder" + to_string(i);
+        replies.push_back(client_->CreateFolder("root_id", QString::fromStdString(name), QList<QString>()));
+        expected.push_back(name);
+    }
+    for (int i = 0; i < num_folders; ++i)
+    {
+        wait_for(replies[i]);
+        ASSERT_TRUE(replies[i].isValid()) << replies[i].error().message().toStdString();
+        EXPECT_EQ(QString::fromStdString(expected[i] + "_id"), replies[i].value().item_id);
+    }
+    EXPECT_EQ(expected, provider->names());
+
+    // Uploads stay on the main thread and still work.
+    auto upload_reply = client_->CreateFile("root_id", "File", file_contents.size(), "text/plain", false,
+                                            QList<QString>());
+    wait_for(upload_reply);
+    ASSERT_TRUE(upload_reply.isValid()) << upload_reply.error().message().toStdString();
+    auto cancel_reply = client_->CancelUpload(upload_reply.argumentAt<0>());
+    wait_for(cancel_reply);
+    ASSERT_TRUE(cancel_reply.isValid()) << cancel_reply.error().message().toStdString();
+}
+
+namespace
+{
+
+// Does a fixed amount of CPU work per request, synchronously, as a provider
+// that serves metadata from an in-memory cache would.
+
+class BusyProvider : public TestProvider
+{
+public:
+    boost::future<Item> metadata(string const& item_id,
+                                 vector<string> const& /*metadata_keys*/,
+                                 Context const& /*ctx*/) override
+    {
+        uint64_t h = 14695981039346656037u;
+        for (int i = 0; i < 200000; ++i)
+        {
+            h = (h ^ uint64_t(i)) * 1099511628211u;
+        }
+        Item item{item_id, {"root_id"}, "Child", to_string(h), ItemType::file, {}};
+        return boost::make_ready_future(item);
+    }
+};
+
+double run_load(ProviderInterfaceTest& test, ProviderClient& client, int num_requests)
+{
+    vector<QDBusPendingReply<unity::storage::internal::ItemMetadata>> replies;
+    replies.reserve(num_requests);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < num_requests; ++i)
+    {
+        replies.push_back(client.Metadata(QString("item%1").arg(i), QList<QString>()));
+    }
+    for (int i = 0; i < num_requests; ++i)
+    {
+        auto& r = replies[i];
+        if (!r.isFinished())
+        {
+            test.wait_for(r);
+        }
+        EXPECT_TRUE(r.isValid()) << r.error().message().toStdString();
+        EXPECT_EQ(QString("item%1").arg(i), r.value().item_id);
+    }
+    chrono::duration<double> secs = chrono::steady_clock::now() - start;
+    return num_requests / secs.count();
+}
+
+}  // namespace
+
+TEST_F(ProviderInterfaceTest, dispatch_load)
+{
+    int const num_requests = 400;
+
+    set_provider(unique_ptr<ProviderBase>(new BusyProvider), 2, DispatchMode::main_thread);
+    run_load(*this, *client_, 10);  // Warm up credentials and peer cache.
+    double main_rate = run_load(*this, *client_, num_requests);
+
+    test_server_.reset();
+    set_provider(unique_ptr<ProviderBase>(new BusyProvider), 2, DispatchMode::thread_pool);
+    run_load(*this, *client_, 10);
+    double pool_rate = run_load(*this, *client_, num_requests);
+
+    cout << "Metadata() with " << num_requests << " pipelined requests:" << endl;
+    cout << "    main thread: " << int(main_rate) << " requests/sec" << endl;
+    cout << "    thread pool: " << int(pool_rate) << " requests/sec ("
+         << thread::hardware_concurrency() << " cores)" << endl;
+}
+
 TEST_F(ProviderInterfaceTest, user_canceled_auth)
 {
     // Account #11 always returns a UserCanceled error when trying to
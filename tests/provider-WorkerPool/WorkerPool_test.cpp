@@ -0,0 +1,270 @@
+/*
+ * Copyright (C) 2017 Canonical Ltd
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Authors: Michi Henning <michi.henning@canonical.com>
+ */
+
+#include <unity/storage/provider/Exceptions.h>
+#include <unity/storage/provider/WorkerPool.h>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wctor-dtor-privacy"
+#include <gtest/gtest.h>
+#pragma GCC diagnostic pop
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace unity::storage::provider;
+using namespace std;
+
+namespace
+{
+
+WorkerPool::Options make_options(int metadata_threads, int bulk_threads, int max_queue_depth)
+{
+    WorkerPool::Options options;
+    options.metadata_threads = metadata_threads;
+    options.bulk_threads = bulk_threads;
+    options.max_queue_depth = max_queue_depth;
+    return options;
+}
+
+// Blocks the threads that call wait() until release() is called.
+
+class Gate
+{
+public:
+    void wait()
+    {
+        unique_lock<mutex> lock(mutex_);
+        cond_.wait(lock, [this]{ return open_; });
+    }
+
+    void release()
+    {
+        lock_guard<mutex> lock(mutex_);
+        open_ = true;
+        cond_.notify_all();
+    }
+
+private:
+    mutex mutex_;
+    condition_variable cond_;
+    bool open_ = false;
+};
+
+}  // namespace
+
+TEST(WorkerPool, basic)
+{
+    WorkerPool pool(make_options(2, 1, 0));
+
+    auto f = pool.submit(WorkerPool::Lane::metadata, []{ return 42; });
+    EXPECT_EQ(42, f.get());
+
+    auto v = pool.submit(WorkerPool::Lane::bulk, []{});
+    v.get();
+
+    auto stats = pool.stats(WorkerPool::Lane::metadata);
+    EXPECT_EQ(1, stats.executed);
+    EXPECT_EQ(0, stats.queued);
+    EXPECT_EQ(1, stats.max_queued);
+    EXPECT_EQ(0, stats.rejected);
+    EXPECT_GE(stats.max_wait_nsecs, 0);
+    EXPECT_GE(stats.total_wait_nsecs, stats.max_wait_nsecs);
+
+    EXPECT_EQ(1, pool.stats(WorkerPool::Lane::bulk).executed);
+}
+
+TEST(WorkerPool, exception)
+{
+    WorkerPool pool(make_options(1, 1, 0));
+
+    auto f = pool.submit(WorkerPool::Lane::metadata, []() -> int
+    {
+        throw boost::enable_current_exception(NotExistsException("no such item", "some_key"));
+    });
+    try
+    {
+        f.get();
+        FAIL();
+    }
+    catch (NotExistsException const& e)
+    {
+        EXPECT_EQ("some_key", e.key());
+    }
+}
+
+TEST(WorkerPool, thread_reuse)
+{
+    int const num_tasks = 1000;
+    WorkerPool pool(make_options(4, 1, 0));
+
+    mutex m;
+    set<thread::id> ids;
+    vector<boost::future<void>> futures;
+    for (int i = 0; i < num_tasks; ++i)
+    {
+        futures.emplace_back(pool.submit(WorkerPool::Lane::metadata, [&]
+        {
+            lock_guard<mutex> lock(m);
+            ids.insert(this_thread::get_id());
+        }));
+    }
+    for (auto& f : futures)
+    {
+        f.get();
+    }
+    EXPECT_LE(ids.size(), 4u);
+    EXPECT_EQ(num_tasks, pool.stats(WorkerPool::Lane::metadata).executed);
+}
+
+TEST(WorkerPool, lanes_are_independent)
+{
+    WorkerPool pool(make_options(1, 1, 0));
+
+    // Block the only bulk thread. Metadata operations must still complete.
+    Gate gate;
+    auto blocked = pool.submit(WorkerPool::Lane::bulk, [&]{ gate.wait(); });
+
+    auto f = pool.submit(WorkerPool::Lane::metadata, []{ return string("done"); });
+    EXPECT_EQ("done", f.get());
+
+    gate.release();
+    blocked.get();
+}
+
+TEST(WorkerPool, stealing)
+{
+    WorkerPool pool(make_options(2, 1, 0));
+
+    // Block one of the two threads. Work that is queued behind it is stolen by the other thread.
+    Gate gate;
+    atomic<bool> started(false);
+    auto blocked = pool.submit(WorkerPool::Lane::metadata, [&]{ started = true; gate.wait(); });
+    while (!started)
+    {
+        this_thread::yield();
+    }
+
+    vector<boost::future<void>> futures;
+    for (int i = 0; i < 10; ++i)
+    {
+        futures.emplace_back(pool.submit(WorkerPool::Lane::metadata, []{}));
+    }
+    for (auto& f : futures)
+    {
+        f.get();
+    }
+    EXPECT_GT(pool.stats(WorkerPool::Lane::metadata).stolen, 0);
+
+    gate.release();
+    blocked.get();
+}
+
+TEST(WorkerPool, queue_full)
+{
+    WorkerPool pool(make_options(1, 1, 2));
+
+    Gate gate;
+    atomic<bool> started(false);
+    auto blocked = pool.submit(WorkerPool::Lane::bulk, [&]{ started = true; gate.wait(); });
+    while (!started)
+    {
+        this_thread::yield();
+    }
+
+    auto f1 = pool.submit(WorkerPool::Lane::bulk, []{});
+    auto f2 = pool.submit(WorkerPool::Lane::bulk, []{});
+    try
+    {
+        pool.submit(WorkerPool::Lane::bulk, []{});
+        FAIL();
+    }
+    catch (ResourceException const& e)
+    {
+        EXPECT_STREQ("ResourceException: WorkerPool: bulk queue is full (max_queue_depth = 2)", e.what());
+        EXPECT_EQ(EAGAIN, e.error_code());
+    }
+
+    auto stats = pool.stats(WorkerPool::Lane::bulk);
+    EXPECT_EQ(2, stats.queued);
+    EXPECT_EQ(1, stats.rejected);
+
+    gate.release();
+    blocked.get();
+    f1.get();
+    f2.get();
+    EXPECT_EQ(3, pool.stats(WorkerPool::Lane::bulk).executed);
+}
+
+TEST(WorkerPool, abandoned_work)
+{
+    boost::future<void> f;
+    Gate gate;
+    boost::future<void> blocked;
+    thread releaser;
+    {
+        WorkerPool pool(make_options(1, 1, 0));
+
+        atomic<bool> started(false);
+        blocked = pool.submit(WorkerPool::Lane::metadata, [&]{ started = true; gate.wait(); });
+        while (!started)
+        {
+            this_thread::yield();
+        }
+        f = pool.submit(WorkerPool::Lane::metadata, []{});
+
+        // The pool destructor waits for the blocked operation, but does not run the queued one.
+        releaser = thread([&]{ this_thread::sleep_for(chrono::milliseconds(100)); gate.release(); });
+    }
+    releaser.join();
+    blocked.get();
+    EXPECT_THROW(f.get(), boost::broken_promise);
+}
+
+TEST(WorkerPool, invalid_options)
+{
+    try
+    {
+        WorkerPool pool(make_options(0, 1, 0));
+        FAIL();
+    }
+    catch (InvalidArgumentException const& e)
+    {
+        EXPECT_STREQ("InvalidArgumentException: WorkerPool(): number of threads must be > 0", e.what());
+    }
+
+    try
+    {
+        WorkerPool pool(make_options(1, 1, -1));
+        FAIL();
+    }
+    catch (InvalidArgumentException const& e)
+    {
+        EXPECT_STREQ("InvalidArgumentException: WorkerPool(): max_queue_depth must be >= 0", e.what());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
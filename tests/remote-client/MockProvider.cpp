@@ -176,6 +176,73 @@ boost::future<ItemList> MockProvider::lookup(
     return make_ready_future<ItemList>(children);
 }
 
+boost::future<tuple<ItemList,string>> MockProvider::search(
+    string const& parent_id, string const& query, string const& page_token, vector<string> const& keys,
+    Context const& ctx)
+{
+    if (cmd_ == "search_not_supported")
+    {
+        return ProviderBase::search(parent_id, query, page_token, keys, ctx);
+    }
+    if (parent_id != "root_id")
+    {
+        string msg = string("search(): no such item: \"") + parent_id + "\"";
+        return make_exceptional_future<tuple<ItemList,string>>(NotExistsException(msg, parent_id));
+    }
+    if (query != "child type:text/")
+    {
+        return make_ready_future(make_tuple(ItemList(), string()));
+    }
+    // One match per page, so the client has to follow the page token.
+    if (page_token.empty())
+    {
+        ItemList matches =
+        {
+            { "child_id", { "root_id" }, "Child", "etag", ItemType::file,
+              { { metadata::SIZE_IN_BYTES, 0 }, { metadata::LAST_MODIFIED_TIME, "2007-04-05T14:30Z" } } }
+        };
+        return make_ready_future(make_tuple(matches, string("next")));
+    }
+    if (page_token != "next")
+    {
+        string msg = string("search(): invalid page token: \"") + page_token + "\"";
+        return make_exceptional_future<tuple<ItemList,string>>(InvalidArgumentException(msg));
+    }
+    ItemList matches =
+    {
+        { "child2_id", { "child_id" }, "Child2", "etag", ItemType::file,
+          { { metadata::SIZE_IN_BYTES, 0 }, { metadata::LAST_MODIFIED_TIME, "2007-04-05T14:30Z" } } }
+    };
+    return make_ready_future(make_tuple(matches, string()));
+}
+
+boost::future<tuple<ItemList,string>> MockProvider::walk(
+    string const& parent_id, int32_t max_depth, string const& page_token, vector<string> const&, Context const&)
+{
+    if (parent_id != "root_id")
+    {
+        string msg = string("walk(): no such item: \"") + parent_id + "\"";
+        return make_exceptional_future<tuple<ItemList,string>>(NotExistsException(msg, parent_id));
+    }
+    // A folder on the first page, and its contents on the second (unless max_depth stops at the folder).
+    if (page_token.empty())
+    {
+        ItemList items =
+        {
+            { "child_folder_id", { "root_id" }, "Child_Folder", "etag", ItemType::folder,
+              { { metadata::PATH, "Child_Folder" } } }
+        };
+        return make_ready_future(make_tuple(items, string(max_depth == 1 ? "" : "next")));
+    }
+    ItemList items =
+    {
+        { "child_id", { "child_folder_id" }, "Child", "etag", ItemType::file,
+          { { metadata::SIZE_IN_BYTES, 0 }, { metadata::LAST_MODIFIED_TIME, "2007-04-05T14:30Z" },
+            { metadata::PATH, "Child_Folder/Child" } } }
+    };
+    return make_ready_future(make_tuple(items, string()));
+}
+
 boost::future<Item> MockProvider::metadata(string const& item_id, vector<string> const& /* keys */, Context const&)
 {
     static int num_calls = 0;
@@ -419,6 +486,27 @@ boost::future<unique_ptr<DownloadJob>> MockProvider::download(
     return make_ready_future(std::move(job));
 }
 
+boost::future<unique_ptr<DownloadJob>> MockProvider::download_range(
+    string const&, string const&, int64_t offset, int64_t length, Context const&)
+{
+    string const contents = "Hello world";
+    if (offset < 0 || offset > int64_t(contents.size()) || length < -1)
+    {
+        InvalidArgumentException e("download_range(): invalid range");
+        return make_exceptional_future<unique_ptr<DownloadJob>>(e);
+    }
+    auto const range = contents.substr(offset, length == -1 ? string::npos : size_t(length));
+    unique_ptr<DownloadJob> job(new MockDownloadJob(cmd_));
+    if (write(job->write_socket(), range.data(), range.size()) != ssize_t(range.size()))
+    {
+        ResourceException e("download_range(): write failed", errno);
+        job->report_error(make_exception_ptr(e));
+        return make_exceptional_future<unique_ptr<DownloadJob>>(e);
+    }
+    job->report_complete();
+    return make_ready_future(std::move(job));
+}
+
 boost::future<void> MockProvider::delete_item(
     string const& item_id, Context const&)
 {
@@ -529,6 +617,22 @@ boost::future<Item> MockUploadJob::finish()
     return make_ready_future(metadata);
 }
 
+// The provider has stored the first five bytes when the client goes away.
+
+boost::future<int64_t> MockUploadJob::suspend()
+{
+    if (cmd_ != "upload_resumable")
+    {
+        return UploadJob::suspend();
+    }
+    return make_ready_future<int64_t>(5);
+}
+
+boost::future<void> MockUploadJob::resume()
+{
+    return make_ready_future();
+}
+
 MockDownloadJob::MockDownloadJob()
     : DownloadJob("some_id")
 {
@@ -39,6 +39,12 @@ public:
     boost::future<unity::storage::provider::Item> metadata(
         std::string const& item_id, std::vector<std::string> const& keys,
         unity::storage::provider::Context const& ctx) override;
+    boost::future<std::tuple<unity::storage::provider::ItemList, std::string>> search(
+        std::string const& parent_id, std::string const& query, std::string const& page_token,
+        std::vector<std::string> const& keys, unity::storage::provider::Context const& ctx) override;
+    boost::future<std::tuple<unity::storage::provider::ItemList, std::string>> walk(
+        std::string const& parent_id, int32_t max_depth, std::string const& page_token,
+        std::vector<std::string> const& keys, unity::storage::provider::Context const& ctx) override;
     boost::future<unity::storage::provider::Item> create_folder(
         std::string const& parent_id,  std::string const& name, std::vector<std::string> const& keys,
         unity::storage::provider::Context const& ctx) override;
@@ -54,6 +60,9 @@ public:
     boost::future<std::unique_ptr<unity::storage::provider::DownloadJob>> download(
         std::string const& item_id, std::string const& match_etag,
         unity::storage::provider::Context const& ctx) override;
+    boost::future<std::unique_ptr<unity::storage::provider::DownloadJob>> download_range(
+        std::string const& item_id, std::string const& match_etag, int64_t offset, int64_t length,
+        unity::storage::provider::Context const& ctx) override;
 
     boost::future<void> delete_item(
         std::string const& item_id, unity::storage::provider::Context const& ctx) override;
@@ -80,6 +89,8 @@ public:
 
     boost::future<void> cancel() override;
     boost::future<unity::storage::provider::Item> finish() override;
+    boost::future<int64_t> suspend() override;
+    boost::future<void> resume() override;
 
 private:
     std::string cmd_;
@@ -27,8 +27,11 @@
 #include <gtest/gtest.h>
 #pragma GCC diagnostic pop
 
+#include <QDBusServiceWatcher>
 #include <QSignalSpy>
 
+#include <chrono>
+#include <thread>
 #include <unordered_set>
 
 using namespace unity::storage;
@@ -75,7 +78,9 @@ class MetadataTest : public RemoteClientTest {};
 class MoveTest : public RemoteClientTest {};
 class ParentsTest : public RemoteClientTest {};
 class RootsTest : public RemoteClientTest {};
+class SearchTest : public RemoteClientTest {};
 class UploadTest : public RemoteClientTest {};
+class WalkTest : public RemoteClientTest {};
 
 TEST(Runtime, lifecycle)
 {
@@ -2406,6 +2411,247 @@ TEST_F(ListTest, no_permission)
     EXPECT_EQ(StorageError::Type::PermissionDenied, j->error().type());
 }
 
+TEST_F(SearchTest, basic)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item root;
+    {
+        unique_ptr<ItemJob> j(acc_.get("root_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        root = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(root.search("child type:text/"));
+    EXPECT_TRUE(j->isValid());
+    EXPECT_EQ(ItemListJob::Status::Loading, j->status());
+    EXPECT_EQ(StorageError::Type::NoError, j->error().type());
+
+    QSignalSpy ready_spy(j.get(), &ItemListJob::itemsReady);
+    QSignalSpy status_spy(j.get(), &ItemListJob::statusChanged);
+
+    // The provider returns one match per page.
+    QList<Item> items;
+    ASSERT_TRUE(ready_spy.wait(SIGNAL_WAIT_TIME));
+    items.append(qvariant_cast<QList<Item>>(ready_spy.takeFirst().at(0)));
+    if (ready_spy.count() < 1)
+    {
+        ASSERT_TRUE(ready_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    items.append(qvariant_cast<QList<Item>>(ready_spy.takeFirst().at(0)));
+
+    if (status_spy.count() == 0)
+    {
+        status_spy.wait(SIGNAL_WAIT_TIME);
+    }
+    ASSERT_EQ(1, status_spy.count());
+    auto status_arg = status_spy.takeFirst();
+    EXPECT_EQ(ItemListJob::Status::Finished, qvariant_cast<ItemListJob::Status>(status_arg.at(0)));
+
+    ASSERT_EQ(2, items.size());
+    EXPECT_EQ("child_id", items[0].itemId());
+    EXPECT_EQ("Child", items[0].name());
+    EXPECT_EQ("child2_id", items[1].itemId());
+    EXPECT_EQ("Child2", items[1].name());
+    EXPECT_EQ(QStringList{ "child_id" }, items[1].parentIds());
+}
+
+TEST_F(SearchTest, no_matches)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item root;
+    {
+        unique_ptr<ItemJob> j(acc_.get("root_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        root = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(root.search("nothing"));
+    EXPECT_TRUE(j->isValid());
+
+    QSignalSpy ready_spy(j.get(), &ItemListJob::itemsReady);
+    QSignalSpy status_spy(j.get(), &ItemListJob::statusChanged);
+    status_spy.wait(SIGNAL_WAIT_TIME);
+    if (ready_spy.count() == 0)
+    {
+        ASSERT_TRUE(ready_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    EXPECT_TRUE(qvariant_cast<QList<Item>>(ready_spy.takeFirst().at(0)).isEmpty());
+
+    ASSERT_EQ(1, status_spy.count());
+    auto arg = status_spy.takeFirst();
+    EXPECT_EQ(ItemListJob::Status::Finished, qvariant_cast<ItemListJob::Status>(arg.at(0)));
+}
+
+TEST_F(SearchTest, wrong_type)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item child;
+    {
+        unique_ptr<ItemJob> j(acc_.get("child_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        child = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(child.search("child"));
+    EXPECT_FALSE(j->isValid());
+    EXPECT_EQ(ItemListJob::Status::Error, j->status());
+    EXPECT_EQ(StorageError::Type::LogicError, j->error().type());
+    EXPECT_EQ("LogicError: Item::search(): cannot perform search on a file", j->error().errorString());
+
+    // Signal must be received.
+    QSignalSpy spy(j.get(), &ItemListJob::statusChanged);
+    spy.wait(SIGNAL_WAIT_TIME);
+    ASSERT_EQ(1, spy.count());
+    auto arg = spy.takeFirst();
+    EXPECT_EQ(ItemListJob::Status::Error, qvariant_cast<ItemListJob::Status>(arg.at(0)));
+}
+
+TEST_F(SearchTest, not_supported)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider("search_not_supported")));
+
+    Item root;
+    {
+        unique_ptr<ItemJob> j(acc_.get("root_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        root = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(root.search("child"));
+    EXPECT_TRUE(j->isValid());
+
+    QSignalSpy spy(j.get(), &ItemListJob::statusChanged);
+    spy.wait(SIGNAL_WAIT_TIME);
+    ASSERT_EQ(1, spy.count());
+    auto arg = spy.takeFirst();
+    EXPECT_EQ(ItemListJob::Status::Error, qvariant_cast<ItemListJob::Status>(arg.at(0)));
+
+    EXPECT_EQ(StorageError::Type::LogicError, j->error().type());
+    EXPECT_EQ("search(): provider does not support searches", j->error().message());
+}
+
+TEST_F(WalkTest, basic)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item root;
+    {
+        unique_ptr<ItemJob> j(acc_.get("root_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        root = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(root.walk());
+    EXPECT_TRUE(j->isValid());
+    EXPECT_EQ(ItemListJob::Status::Loading, j->status());
+
+    QSignalSpy ready_spy(j.get(), &ItemListJob::itemsReady);
+    QSignalSpy status_spy(j.get(), &ItemListJob::statusChanged);
+
+    // The provider returns the folder on the first page and its contents on the second.
+    QList<Item> items;
+    ASSERT_TRUE(ready_spy.wait(SIGNAL_WAIT_TIME));
+    items.append(qvariant_cast<QList<Item>>(ready_spy.takeFirst().at(0)));
+    if (ready_spy.count() < 1)
+    {
+        ASSERT_TRUE(ready_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    items.append(qvariant_cast<QList<Item>>(ready_spy.takeFirst().at(0)));
+
+    if (status_spy.count() == 0)
+    {
+        status_spy.wait(SIGNAL_WAIT_TIME);
+    }
+    ASSERT_EQ(1, status_spy.count());
+    auto status_arg = status_spy.takeFirst();
+    EXPECT_EQ(ItemListJob::Status::Finished, qvariant_cast<ItemListJob::Status>(status_arg.at(0)));
+
+    ASSERT_EQ(2, items.size());
+    EXPECT_EQ("child_folder_id", items[0].itemId());
+    EXPECT_EQ(Item::Type::Folder, items[0].type());
+    EXPECT_EQ("Child_Folder", items[0].metadata().value("path").toString());
+    EXPECT_EQ("child_id", items[1].itemId());
+    EXPECT_EQ("Child_Folder/Child", items[1].metadata().value("path").toString());
+}
+
+TEST_F(WalkTest, max_depth)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item root;
+    {
+        unique_ptr<ItemJob> j(acc_.get("root_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        root = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(root.walk(1));
+    EXPECT_TRUE(j->isValid());
+
+    QSignalSpy ready_spy(j.get(), &ItemListJob::itemsReady);
+    QSignalSpy status_spy(j.get(), &ItemListJob::statusChanged);
+    status_spy.wait(SIGNAL_WAIT_TIME);
+    if (ready_spy.count() == 0)
+    {
+        ASSERT_TRUE(ready_spy.wait(SIGNAL_WAIT_TIME));
+    }
+    ASSERT_EQ(1, status_spy.count());
+    auto arg = status_spy.takeFirst();
+    EXPECT_EQ(ItemListJob::Status::Finished, qvariant_cast<ItemListJob::Status>(arg.at(0)));
+
+    ASSERT_EQ(1, ready_spy.count());
+    auto items = qvariant_cast<QList<Item>>(ready_spy.takeFirst().at(0));
+    ASSERT_EQ(1, items.size());
+    EXPECT_EQ("child_folder_id", items[0].itemId());
+}
+
+TEST_F(WalkTest, invalid_max_depth)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item root;
+    {
+        unique_ptr<ItemJob> j(acc_.get("root_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        root = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(root.walk(-1));
+    EXPECT_FALSE(j->isValid());
+    EXPECT_EQ(ItemListJob::Status::Error, j->status());
+    EXPECT_EQ(StorageError::Type::InvalidArgument, j->error().type());
+    EXPECT_EQ("Item::walk(): invalid maxDepth: -1", j->error().message());
+}
+
+TEST_F(WalkTest, wrong_type)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item child;
+    {
+        unique_ptr<ItemJob> j(acc_.get("child_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        child = j->item();
+    }
+
+    unique_ptr<ItemListJob> j(child.walk());
+    EXPECT_FALSE(j->isValid());
+    EXPECT_EQ(ItemListJob::Status::Error, j->status());
+    EXPECT_EQ(StorageError::Type::LogicError, j->error().type());
+    EXPECT_EQ("LogicError: Item::walk(): cannot perform walk on a file", j->error().errorString());
+}
+
 TEST_F(DownloadTest, basic)
 {
     set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
@@ -2452,6 +2698,52 @@ TEST_F(DownloadTest, basic)
     EXPECT_EQ(Downloader::Status::Finished, qvariant_cast<Downloader::Status>(arg.at(0)));
 }
 
+TEST_F(DownloadTest, range)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item child;
+    {
+        unique_ptr<ItemJob> j(acc_.get("child_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        child = j->item();
+    }
+
+    struct Range
+    {
+        qint64 offset;
+        qint64 length;
+        QByteArray expected;
+    };
+    for (auto const& r : { Range{ 6, 3, "wor" }, Range{ 6, -1, "world" }, Range{ 0, 100, "Hello world" } })
+    {
+        unique_ptr<Downloader> downloader(child.createDownloader(Item::ConflictPolicy::IgnoreConflict,
+                                                                 r.offset, r.length));
+        EXPECT_TRUE(downloader->isValid());
+
+        QSignalSpy status_spy(downloader.get(), &Downloader::statusChanged);
+        {
+            QSignalSpy read_spy(downloader.get(), &Downloader::readyRead);
+            ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+            auto arg = status_spy.takeFirst();
+            ASSERT_EQ(Downloader::Status::Ready, qvariant_cast<Downloader::Status>(arg.at(0)))
+                << downloader->error().errorString().toStdString();
+
+            if (read_spy.count() != 1)
+            {
+                read_spy.wait(SIGNAL_WAIT_TIME);
+            }
+        }
+        EXPECT_EQ(r.expected, downloader->readAll()) << r.offset << " " << r.length;
+
+        downloader->close();
+        ASSERT_TRUE(status_spy.wait(SIGNAL_WAIT_TIME));
+        auto arg = status_spy.takeFirst();
+        EXPECT_EQ(Downloader::Status::Finished, qvariant_cast<Downloader::Status>(arg.at(0)));
+    }
+}
+
 // TODO: This leaks:
 // ==4645== 1,369 (272 direct, 1,097 indirect) bytes in 1 blocks are definitely lost in loss record 193 of 203
 // ==4645==    at 0x4C2E0EF: operator new(unsigned long) (in /usr/lib/valgrind/vgpreload_memcheck-amd64-linux.so)
@@ -2957,6 +3249,116 @@ TEST_F(UploadTest, basic)
     EXPECT_EQ(child, uploader->item());
 }
 
+TEST_F(UploadTest, resume)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider("upload_resumable")));
+
+    Item child;
+    {
+        unique_ptr<ItemJob> j(acc_.get("child_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        child = j->item();
+    }
+
+    QByteArray contents("Hello world", -1);
+
+    // Start the upload on a second connection and drop that connection, so the provider suspends the upload.
+    static auto const connection_name = QStringLiteral("second-bus-connection");
+    QDBusServiceWatcher watcher;
+    watcher.setConnection(*service_connection_);
+    watcher.setWatchMode(QDBusServiceWatcher::WatchForUnregistration);
+    QSignalSpy unregistered_spy(&watcher, &QDBusServiceWatcher::serviceUnregistered);
+    QString upload_id;
+    {
+        QDBusConnection connection2 = QDBusConnection::connectToBus(dbus_->busAddress(), connection_name);
+        QDBusConnection::disconnectFromBus(connection_name);
+        watcher.addWatchedService(connection2.baseService());
+        ProviderClient client2(bus_name(), object_path(), connection2);
+        auto reply = client2.Update("child_id", contents.size(), "", QList<QString>());
+        wait_for(reply);
+        ASSERT_TRUE(reply.isValid()) << reply.error().message().toStdString();
+        upload_id = reply.argumentAt<0>();
+    }
+    if (unregistered_spy.count() == 0)
+    {
+        ASSERT_TRUE(unregistered_spy.wait(SIGNAL_WAIT_TIME));
+    }
+
+    // The upload is suspended asynchronously once the provider notices that the client went away.
+    ProviderClient client(bus_name(), object_path(), connection());
+    qlonglong offset = -1;
+    for (int i = 0; i < 100 && offset == -1; ++i)
+    {
+        auto reply = client.UploadOffset(upload_id);
+        wait_for(reply);
+        if (reply.isValid())
+        {
+            offset = reply.value();
+        }
+        else
+        {
+            this_thread::sleep_for(chrono::milliseconds(20));
+        }
+    }
+    ASSERT_EQ(5, offset);
+
+    unique_ptr<Uploader> uploader(child.resumeUpload(upload_id, contents.size()));
+    EXPECT_TRUE(uploader->isValid());
+    EXPECT_EQ(Uploader::Status::Loading, uploader->status());
+    {
+        QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+        ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+        auto arg = spy.takeFirst();
+        ASSERT_EQ(Uploader::Status::Ready, qvariant_cast<Uploader::Status>(arg.at(0)))
+            << uploader->error().errorString().toStdString();
+    }
+    EXPECT_EQ(upload_id, uploader->uploadId());
+    EXPECT_EQ(5, uploader->offset());
+    EXPECT_EQ(contents.size(), uploader->sizeInBytes());
+
+    auto const rest = contents.mid(uploader->offset());
+    EXPECT_EQ(rest.size(), uploader->write(rest));
+    EXPECT_TRUE(uploader->waitForBytesWritten(rest.size()));
+
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    uploader->close();
+    ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    auto arg = spy.takeFirst();
+    EXPECT_EQ(Uploader::Status::Finished, qvariant_cast<Uploader::Status>(arg.at(0)));
+    EXPECT_EQ(child, uploader->item());
+
+    // The upload was finished, so it cannot be resumed again.
+    auto reply = client.UploadOffset(upload_id);
+    wait_for(reply);
+    ASSERT_TRUE(reply.isError());
+    EXPECT_EQ("No such upload: " + upload_id, reply.error().message());
+}
+
+TEST_F(UploadTest, resume_no_such_upload)
+{
+    set_provider(unique_ptr<provider::ProviderBase>(new MockProvider()));
+
+    Item child;
+    {
+        unique_ptr<ItemJob> j(acc_.get("child_id"));
+        QSignalSpy spy(j.get(), &ItemJob::statusChanged);
+        spy.wait(SIGNAL_WAIT_TIME);
+        child = j->item();
+    }
+
+    unique_ptr<Uploader> uploader(child.resumeUpload("no_such_upload", 11));
+    EXPECT_TRUE(uploader->isValid());
+
+    QSignalSpy spy(uploader.get(), &Uploader::statusChanged);
+    ASSERT_TRUE(spy.wait(SIGNAL_WAIT_TIME));
+    auto arg = spy.takeFirst();
+    EXPECT_EQ(Uploader::Status::Error, qvariant_cast<Uploader::Status>(arg.at(0)));
+    EXPECT_EQ(StorageError::LogicError, uploader->error().type());
+    EXPECT_EQ("No such upload: no_such_upload", uploader->error().message());
+    EXPECT_EQ(0, uploader->offset());
+}
+
 #if 0
 // TODO: This test is currently disabled because a synchronous wait in the client
 //       blocks the single event loop that is shared by the client and the mock provider.
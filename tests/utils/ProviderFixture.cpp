@@ -58,7 +58,8 @@ QDBusConnection const& ProviderFixture::connection() const
 }
 
 void ProviderFixture::set_provider(unique_ptr<ProviderBase>&& provider,
-                                   unsigned int account_id)
+                                   unsigned int account_id,
+                                   DispatchMode mode)
 {
     account_manager_->waitForReady();
     OnlineAccounts::Account* account = account_manager_->account(account_id);
@@ -66,7 +67,8 @@ void ProviderFixture::set_provider(unique_ptr<ProviderBase>&& provider,
 
     test_server_.reset(
         new unity::storage::provider::testing::TestServer(move(provider), account,
-                                                          *service_connection_, OBJECT_PATH.toStdString()));
+                                                          *service_connection_, OBJECT_PATH.toStdString(),
+                                                          mode));
 }
 
 void ProviderFixture::wait_for(QDBusPendingCall const& call)
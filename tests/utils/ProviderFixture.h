@@ -42,7 +42,9 @@ public:
 
     QDBusConnection const& connection() const;
     void set_provider(std::unique_ptr<unity::storage::provider::ProviderBase>&& provider,
-                      unsigned int account_id = 2);
+                      unsigned int account_id = 2,
+                      unity::storage::provider::DispatchMode mode
+                          = unity::storage::provider::DispatchMode::main_thread);
     void wait_for(QDBusPendingCall const& call);
     QString bus_name() const;
     QString object_path() const;
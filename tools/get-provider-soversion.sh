@@ -17,25 +17,28 @@
 
 set -eu
 
+# Each series gets a new SOVERSION whenever the provider ABI changes.
+# 0.4: ProviderBase gained a data member and new virtual methods.
+
 [ -n "${SERIES:-}" ] || SERIES=$(lsb_release -c -s)
 
 case "$SERIES" in
     trusty)
         # TODO: the CI systems are running Trusty, so don't bomb out
         # when they try to build the source package.
-        echo 3
+        echo 4
         ;;
     vivid)
         # Old C++11 ABI, Boost 1.55
-        echo 3
+        echo 4
         ;;
     xenial)
         # New C++11 ABI, Boost 1.58
-        echo 4
+        echo 5
         ;;
     yakkety|zesty)
         # New C++11 ABI, Boost 1.61
-        echo 5
+        echo 6
         ;;
     *)
         echo "Unknown distro series $SERIES" >&2